@@ -5,30 +5,109 @@
 
 /**
  * @file JBash.c
- * @brief Core header files for shell implementation
- * 
+ * @brief The JBash program: a thin front-end over libjbash
+ *
+ * The interactive loop, the line editor and terminal modes live here; the
+ * tokenizer, expander and executor are in the library (see libjbash.h).
  */
 #include "JBash.h"
 
+static struct termios original_tio; // Original terminal settings
+
+/**
+  @brief line_source callback for the terminal: draws the prompt and reads a line with the editor
+  In the middle of a compound command the prompt is CONTINUATION_PROMPT instead.
+ */
+static int terminal_read(struct line_source *source)
+{
+    static int prompted = 0; // the first prompt was drawn
+    TRACE_BEGIN("render");
+    if (source->continuation) {
+        print_continuation_prompt();
+    } else {
+        if (xtrace_enabled) xtrace_flush(); // the batch ends where the user gets control back
+        print_prompt();
+    }
+    fflush(stdout); // Forces immediate display of prompt
+    TRACE_END("render");
+    if (startup_tracing && !prompted) startup_mark("first prompt"); // lazy steps keep printing after it
+    prompted = 1;
+    size_t length;
+    char *line = parse(&length, source->continuation);
+    source->number++;
+    line_source_split(source, line, length);
+    return 1;
+}
+
 /**
    @brief Main function should run infinitely until terminated manually using CTRL+C or typing in the exit command
-   It should call the parse() and execute() functions
+   Lines come from parse() through a line source, so a compound command can span several lines.
+   "JBash FILE" runs a script instead, and so does a stdin that is not a terminal.
+   "JBash -c COMMANDS" runs the given commands and exits.
+   "JBash --server" serves commands over a Unix socket, "JBash --client COMMANDS" sends them there.
    @param argc Argument count.
    @param argv Argument vector.
    @return status code
  */
 int main(int argc, char **argv)
 {   
+    if (argc > 1 && strcmp(argv[1], "--startup-trace") == 0) { // timeline of init steps on stderr
+        startup_trace_init();
+        argc--;
+        argv++;
+    }
+    if (argc > 2 && strcmp(argv[1], "--client") == 0) { // before any setup, the server has done it
+        int forwarded = client_main(argv[2]);
+        if (forwarded != -1) return forwarded;
+    }
+    // everything else initializes itself on first use, see startup.c
+    uint64_t begun = startup_begin();
     signal(SIGINT, handle_sigint); // Set up signal handler for Ctrl+C (SIGINT)
+    startup_end("signals", begun);
+    begun = startup_begin();
+    trace_init(); // JBASH_TRACE=FILE turns the event tracer on
+    profile_init(); // JBASH_PROFILE=FILE turns the script profiler on
+    startup_end("trace and profile", begun);
     int status; // status to check return of execute
-    // retrieve current owrking directory
-    cwd = getcwd(NULL, 0);
+    // the shell's state: working directory, variables, last status
+    begun = startup_begin();
+    struct jb_session *shell = jb_session_new();
+    session_enter(shell);
+    startup_end("session", begun);
+
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) { // warm shell for many short requests
+        return server_main();
+    }
+    if (argc > 2 && strcmp(argv[1], "--client") == 0) { // the server was not there, run here
+        return jb_eval(shell, argv[2], strlen(argv[2]));
+    }
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) { // command string
+        status = jb_eval(shell, argv[2], strlen(argv[2]));
+        startup_mark("-c done");
+        return status;
+    }
+    if (argc > 1) { // script file
+        FILE *script = fopen(argv[1], "r");
+        if (script == NULL) {
+            perror(argv[1]);
+            return 127;
+        }
+        status = run_script(script, argv[1]);
+        fclose(script);
+        return status;
+    }
+    if (!isatty(STDIN_FILENO)) { // commands piped in, no line editing
+        return run_script(stdin, "stdin");
+    }
+
+    snapshot_init(); // warm caches from the last shell, saved again at exit
+    snapshot_front_end = segment_snapshot;
+    if (rc_load() == 0) return session->last_usage.status; // ~/.jbashrc ran exit
+    struct line_source terminal; // prompts and reads a line whenever the parser needs one
+    line_source_init(&terminal, terminal_read, NULL, NULL);
     while (1) {
-        print_prompt();
-        fflush(stdout); // Forces immediate display of prompt
-        args = parse();
-        status = execute(args);
-        free_args(args); // free **args for next use
+        status = session_run_command(shell, &terminal);
+        snapshot_tick();
         if (status == 0) { // exit
             fprintf(stdout, "exiting...\n");
             break;
@@ -39,99 +118,39 @@ int main(int argc, char **argv)
 }
 
 /**
-  @brief Fork a child to execute the command using execvp. The parent should wait for the child to terminate
-  @param args Null terminated list of arguments (including program).
-  @return returns 1, to continue execution and 0 to terminate the JBash prompt.
+  @brief gets a line of input from the prompt with the line editor
+  @param length Set to the length of the line
+  @param continuation The prompt is CONTINUATION_PROMPT, an empty line is returned like any other
+  @return The line without leading whitespace, a heap buffer the caller owns
  */
-int execute(char **args)
-{
-    // FOR DEBUGGING
-    #if DEBUG
-        int i = 0;
-        while (args[i] != NULL) {
-            printf("arg[%d]:  %s\n", i, args[i]);
-            i++;
-        }
-    #endif
-
-    int rv = 1; // return value, 1 by default, set to 0 for termination.
-
-    if (args[0] == NULL) {} // invalid input i.e. all whitespace, do nothing
-    else if (strcmp(args[0], "exit") == 0) { // command 'exit' check to terminate shell
-        rv = 0; // trigger termination
-    }
-    else if (strcmp(args[0], "cd") == 0) { // command 'cd' to change directory of current process
-        int status;
-        if (args[1] == NULL) { // try to default to home when given no argument for cd
-            status = chdir(getenv("HOME")); // chdir sys call to change path
-        } else {
-            status = chdir(args[1]);
-        }
-
-        if (status == 0) {
-            // FOR DEBUGGING
-            #if DEBUG
-                char *cwd = getcwd(NULL, 0);
-                fprintf(stdout, "Current Working Directory: %s\n", cwd);
-                free(cwd);
-            #endif
-        } else {
-            perror("Failure to Change Directory");
-        }
-    } else {
-        // for non-shell implemented system calls
-        int rc = fork();
-        if (rc == -1) {
-            perror("Fork failed");
-            rv = 0; // trigger termination
-        } else if (rc == 0) {
-            int status = execvp(args[0], args);
-            if (status == -1) {
-                perror("Failure to Execute Command");
-                // free allocated memory of child process heap
-                free_args(args);
-                exit(EXIT_FAILURE);
-            }
-        } else {
-            wait(NULL);
-        }
-    }
-    return rv;
-}
-
-/**
-  @brief gets the input from the prompt and splits it into tokens. Prepares the arguments for execvp
-  @return returns char** args to be used by execvp
- */
-char** parse(void)
+char *parse(size_t *length, int continuation)
 {
+    TRACE_BEGIN("parse");
     // character of each keystroke input
     char ch;
-    // Starting buffer sizes
-    size_t command_line_buffer_length = CMD_LINE_BUFFER;
+    // Starting buffer size
     size_t string_buffer_length = STR_BUFFER;
-    // allocate single string and array of tokens to heap.
-    args = safe_malloc(sizeof(char *) * command_line_buffer_length);
-    inputString = safe_malloc(sizeof(char) * string_buffer_length);
+    // allocate single string to heap.
+    char *inputString = safe_malloc(sizeof(char) * string_buffer_length);
     // Initialize the allocated memory with initial values with memset 
     // which is similar to calloc to make sure there are no garbage values
-    memset(args, 0, sizeof(char *) * command_line_buffer_length);
     memset(inputString, 0, sizeof(char) * string_buffer_length);
-    // Starting lengths
-    size_t string_length = 0, array_length = 0;
+    // Starting length
+    size_t string_length = 0;
     size_t cursor = 0; // cursor; where user is currently typing/editing
     enable_raw_mode(); // turn off canonical mode, take user input char by char
-    while (read(STDIN_FILENO, &ch, 1) == 1) { // read standard input
+    while (read_input(&ch, inputString, string_length, cursor) == 1) { // read standard input
         // buffer check, check if string length is close to buffer size
         if (string_length + 1 >= string_buffer_length) {
-            inputString = realloc_buffer(inputString, &string_buffer_length);
+            inputString = realloc_buffer(inputString, &string_buffer_length, sizeof(char));
         }
 
-        if (ch == NEWLINE && !inputString[0]) {     // reprint shell for empty input
+        if (ch == NEWLINE && !inputString[0] && !continuation) { // reprint shell for empty input
+            render_flush();                         // keep what was drawn so far ahead of the prompt
             print_prompt();
         } else if (ch == NEWLINE) {                 // finalize command line
             inputString[string_length] = NULLCHAR;  // null terminate string
-            fprintf(stdout, "\n");                  // Move to next line
+            render("\n");                           // Move to next line
             break;
         } else if (ch == '\t') { // Do nothing for tab; future autocomplete feature
             continue;
@@ -140,8 +159,8 @@ char** parse(void)
         else if (ch == '\033') { // terminal sends 3 bytes in sequence
             char seq[3]; // Ideally: seq[0] = '[', seq[1] = Letter code
             // capture next chars, if error then break
-            if (read(STDIN_FILENO, &seq[0], 1) != 1) break;
-            if (read(STDIN_FILENO, &seq[1], 1) != 1) break;
+            if (read_input(&seq[0], inputString, string_length, cursor) != 1) break;
+            if (read_input(&seq[1], inputString, string_length, cursor) != 1) break;
 
             // ANSI escape sequences, '[' is the Control Sequence Introducer (CSI)
             if (seq[0] == '[') {
@@ -154,7 +173,7 @@ char** parse(void)
                         // 1 is the number of units to move
                         // C is the command code for "Cursor Forward"
                         if (cursor < string_length) {
-                            fprintf(stdout, "\033[1C");  // Move cursor right
+                            render("\033[1C");           // Move cursor right
                             cursor++;
                         }
                         break;
@@ -162,7 +181,7 @@ char** parse(void)
                         // 1 is the number of units to move
                         // D is the command code for "Cursor Backward"
                         if (cursor > 0) {
-                            fprintf(stdout, "\033[1D");  // Move cursor left
+                            render("\033[1D");           // Move cursor left
                             cursor--;
                         }
                         break;
@@ -190,13 +209,13 @@ char** parse(void)
             cursor--;
 
             // Update display
-            fprintf(stdout, "\b"); // Move back
+            render("\b"); // Move back
             // Prints the remaining string after cursor
-            fprintf(stdout, "%.*s", (int)(string_length - cursor), &inputString[cursor]);
-            fprintf(stdout, " "); // Clear character
+            render("%.*s", (int)(string_length - cursor), &inputString[cursor]);
+            render(" "); // Clear character
             
             // Reset cursor position by moving cursor back
-            fprintf(stdout, "\033[%zuD", string_length - cursor + 1);
+            render("\033[%zuD", string_length - cursor + 1);
         } else {
             if (cursor < string_length) { // handle substring insertions
                 // Shift characters right
@@ -220,15 +239,15 @@ char** parse(void)
                 cursor++;
                 
                 // Update display
-                fprintf(stdout, "%c", ch);                   // Print new char
-                fprintf(stdout, "\033[K");                   // Clear line after cursor
-                fprintf(stdout, "%s", &inputString[cursor]); // Print rest of string after cursor
+                render("%c", ch);                            // Print new char
+                render("\033[K");                            // Clear line after cursor
+                render("%s", &inputString[cursor]);          // Print rest of string after cursor
 
                 // Reset cursor position by moving cursor back
-                fprintf(stdout, "\033[%zuD", string_length - cursor);
+                render("\033[%zuD", string_length - cursor);
 
             } else { // end of line insertions
-                fprintf(stdout, "%c", ch); // Print new char
+                render("%c", ch); // Print new char
 
                 // Insert new character
                 inputString[cursor] = ch;
@@ -237,137 +256,19 @@ char** parse(void)
                 string_length++;
             }
         }
-        fflush(stdout); // flushes character out, essentially prints what's queued up.
+        // output is queued with render() and written once per input batch (see editor.c)
     }
+    render_flush(); // the final batch, including the newline
 
     disable_raw_mode(); // return to normal terminal setting state
 
     // remove preceding whitespace and reallocate unused memory
     inputString = realloc_leftover_string(inputString, &string_length);
+    if (string_length > 0) history_add(inputString); // remember the line before it is split up
+    TRACE_END("parse");
 
-    int extra_whitespace = 0; // keep track of extra whitespace
-    char *word_start = inputString;  // Track start of current word
-    for (int i = 0; i < string_length; i++) { // go through the entire buffer
-        // buffer check, check if array length is close to buffer size
-        if (array_length + 1 >= command_line_buffer_length) {
-            args = realloc_buffer(args, &command_line_buffer_length);
-        }
-
-        if (i != 0 && (inputString[i] == '"' || inputString[i] == '\'')) { // Check for quotes to include whitespaces
-            char quote = inputString[i];                                   // Note which delimiter we track
-            i++;
-            word_start = &inputString[i];                                  // Ignore beginning quote
-            while (i < string_length && inputString[i] != quote) i++;      // Keep adding until closing quote
-            inputString[i] = NULLCHAR;                                     // Null terminate word excluding end quote
-            args[array_length] = word_start;                               // Add to args
-            array_length++;
-            word_start = &inputString[i + 1];                              // Start of next word
-
-        } else if (inputString[i] == ' ' && inputString[i + 1] != ' ') {   // End of word
-            inputString[i - extra_whitespace] = NULLCHAR;                  // Null terminate word accounting for multiple whitespace
-            args[array_length] = word_start;                               // Add token to args
-            array_length++;
-            word_start = &inputString[i + 1];                              // Start of next word
-            extra_whitespace = 0;                                          // Reset whitespace count
-
-        } else if (inputString[i] == ' ' && inputString[i + 1] == ' ') {   // Extra whitespace check
-            extra_whitespace++;
-        }
-    }
-
-    // Add final word if exists
-    if (word_start[0] != NULLCHAR) {
-        args[array_length] = word_start;
-        array_length++;
-    }
-    args[array_length] = NULL;  // Null terminate args array
-
-    return args;
-}
-
-void print_prompt() {
-    printf("\033[1;32m%s:\033[0m%s", cwd, SHELL_NAME);
-}
-
-/**
- * Frees memory allocated for command line arguments.
- * 
- * @param args Double pointer to array of command line argument strings to be freed
- *             Each individual argument string and the array itself will be freed
- *             Array must be NULL terminated
- *             
- * @note Assumes args is a valid pointer to a NULL-terminated array of strings
- *       Each string in the array must have been dynamically allocated
- */
-void free_args(char **args)
-{
-    // Free the first string (original Command Line buffer)
-    if (args[0] != NULL) free(args[0]);
-    // Free the cmd array
-    if (args != NULL) free(args);
-}
-
-
-/**
- * Reallocates the current buffer memory with error checking.
- * 
- * @param ptr The pointer buffer to resize
- * @param current_buffer The current size of the buffer
- * @note Exits with status 1 if memory reallocation fails
- */
-void* realloc_buffer(void *ptr, size_t *current_buffer) {
-    *current_buffer *= 2;
-    char *new_ptr = realloc(ptr, sizeof(ptr) * *current_buffer); // increase
-    if (new_ptr == NULL) {
-        fprintf(stderr, "Memory allocation failed for size %zu\n", *current_buffer);
-        free(ptr); // Free original buffer if realloc fails
-        exit(EXIT_FAILURE);
-    }
-    return new_ptr;
-}
-
-/**
- * Reallocates the string with with error checking.
- * 
- * @param inputString The inputString buffer to resize
- * @param string_length The length of the current string
- * @note Exits with status 1 if memory reallocation fails
- */
-void* realloc_leftover_string(char *inputString, size_t *string_length) {
-    size_t i = 0;
-    while (inputString[i] == ' ') { // count preceding whitespaces
-        i++;
-    }
-    // shift left by the amount of whitespaces, removing them.
-    if (i != 0) {
-        memmove(inputString, inputString + i, *string_length - i + 1); // + 1 to account for null char
-        *string_length -= i;
-    }
-
-    // realloc and reduce size to length of string
-    char *resized_string = realloc(inputString, sizeof(inputString) * (*string_length + 1)); // manage unused memory
-    if (resized_string == NULL) {
-        fprintf(stderr, "Memory allocation failed for size %zu\n", *string_length + 1);
-        free(inputString); // Free original buffer if realloc fails
-        exit(EXIT_FAILURE);
-    }
-    return resized_string;
-}
-
-/**
- * Allocate SIZE bytes of memory with error checking.
- * 
- * @param size The number of bytes to allocate
- * @return A generic pointer to the allocated memory if successful
- * @note Exits with status 1 if memory allocation fails
- */
-void* safe_malloc(size_t size) {
-    void *ptr = malloc(size);
-    if (ptr == NULL) {
-        fprintf(stderr, "Memory allocation failed for size %zu\n", size);
-        exit(EXIT_FAILURE);
-    }
-    return ptr;
+    *length = string_length;
+    return inputString;
 }
 
 /**
@@ -376,9 +277,9 @@ void* safe_malloc(size_t size) {
  */
 void disable_raw_mode() {
     // Attempt to restore original terminal settings
-    // TCSAFLUSH will wait for all output to be transmitted
-    // and discards any unread input before applying the changes
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_tio) == -1) {
+    // TCSADRAIN will wait for all output to be transmitted before applying the changes;
+    // unread input is kept, so keys typed (or pasted) ahead reach the next prompt
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &original_tio) == -1) {
         perror("tcsetattr: Failed to restore terminal settings");
     }
 }
@@ -389,6 +290,8 @@ void disable_raw_mode() {
  * and without showing typed characters (no echo)
  */
 void enable_raw_mode() {
+    static int restore_registered = 0; // parse() calls this for every line, register the handler once
+
     // Save the original terminal settings so we can restore them later
     if (tcgetattr(STDIN_FILENO, &original_tio) == -1) {
         perror("tcgetattr: Failed to save terminal settings");
@@ -396,7 +299,10 @@ void enable_raw_mode() {
     }
     
     // Register disable_raw_mode to be called automatically when program exits
-    atexit(disable_raw_mode);
+    if (!restore_registered) {
+        atexit(disable_raw_mode);
+        restore_registered = 1;
+    }
 
     // Create new terminal settings based on original ones
     struct termios raw = original_tio;
@@ -408,7 +314,7 @@ void enable_raw_mode() {
     raw.c_lflag &= ~(ICANON | ECHO);
 
     // Apply the new settings
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) { // keep type-ahead, see disable_raw_mode
         perror("tcsetattr: Failed to apply new terminal settings");
         exit(EXIT_FAILURE);
     }
@@ -422,7 +328,6 @@ void enable_raw_mode() {
  */
 void handle_sigint(int sig) {
     printf("^C\n");
-    if (args != NULL) free_args(args);
-    if (inputString != NULL) free(inputString);
+    if (session != NULL) jb_session_free(session);
     exit(EXIT_FAILURE);
 }
\ No newline at end of file
@@ -7,26 +7,531 @@
 #include <errno.h> // access the errno variable
 #include <termios.h> // to read character by character, tcgetattr, tcsetattr, TCSAFLUSH
 #include <signal.h> // to handle Ctrl+C
+#include <poll.h> // poll, to wait on keystrokes and prompt workers at once
+#include <fcntl.h> // open, fcntl, O_NONBLOCK
+#include <sys/stat.h> // stat, S_ISREG
+#include <stdarg.h> // va_list, for render()
+#include <time.h> // clock_gettime, CLOCK_MONOTONIC
+#include <sys/resource.h> // wait4, getrusage, struct rusage
+#include <sys/mman.h> // mmap, memory shared with children
+#include <stdint.h> // uint64_t, uint32_t
+#include <ctype.h> // isalpha, isdigit, ..., for [[:alpha:]] in glob patterns
+#include <limits.h> // PATH_MAX
+#include <sys/socket.h> // socket, sendmsg, recvmsg, SCM_RIGHTS
+#include <sys/un.h> // struct sockaddr_un
+#include "libjbash.h" // the public API: jb_session_new, jb_eval, jb_last_status
 
 #define STR_BUFFER 16 // starting buffer for input string
 #define CMD_LINE_BUFFER 16 // starting buffer for args array
 #define NEWLINE '\n'
 #define NULLCHAR '\0'
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t') // characters that separate words
 #define SHELL_NAME "\033[1;34mJBash> \033[0m" //  Style: Bold; Color mode: Blue;
+#define CONTINUATION_PROMPT "> " // prompt for the next line of an unfinished compound command
 #define DEBUG 0
+#ifndef TRACING
+#define TRACING 1 // event tracer (trace.c); build with -DTRACING=0 to remove it entirely
+#endif
 
-static struct termios original_tio; // Original terminal settings
-char **args; // pointer to pointers of null terminating strings
-char *inputString; // current string
-char *cwd;
+#define SEGMENT_DEFAULT_CMD "git symbolic-ref --short -q HEAD 2>/dev/null" // default async prompt segment
+#define SEGMENT_PLACEHOLDER "..." // shown while a segment has no cached value yet
+#define SEGMENT_MAX 128 // longest segment value kept, in bytes
+#define SEGMENT_CACHE_SIZE 16 // number of directories remembered by the segment cache
+#define SEGMENT_TTL 5 // default seconds a cached segment stays fresh
 
-int execute(char **args);
-char** parse(void);
+#define VAR_BUCKETS 64 // hash buckets of the shell variable table
+#define COMMAND_BUCKETS 64 // hash buckets of the command hash table
+#define FUNCTION_BUCKETS 64 // hash buckets of a session's function table
+#define FUNCTION_DEPTH_MAX 1000 // deepest nesting of function calls, recursion past it is an error
+#define ARITH_NESTING_MAX 1024 // deepest an arithmetic expression nests, parsing is recursive
+#define ARRAY_GAP_MAX 65536 // furthest past the end of an indexed array an element may be set
+#define ARRAY_SLOTS_MIN 16 // smallest slot table of an associative array
+#define ARRAY_NOT_FIELDS ((size_t)-1) // array_fields(): the word is not "${NAME[@]}"
+#define PATTERN_CACHE 64 // compiled glob patterns a session keeps for ${NAME#...}, ${NAME/...} and the like
+#define PATTERN_NO_MATCH ((size_t)-1) // pattern_prefix(), pattern_suffix(): nothing matched
+#define CASE_FAILED ((size_t)-1) // case_select(): the word had an expansion error
+#define EXPAND_NESTING_MAX 256 // deepest ${NAME#${...}} operands nest, expansion is recursive
+#define ARENA_BLOCK 1024 // smallest block the word arena allocates
+#define HISTORY_SIZE 1000 // commands remembered by the history store
+#define PROMPT_SLOW_MS 1000 // commands slower than this show their duration in the prompt
+
+#define HIST_SUB_BITS 4 // histogram precision: 2^HIST_SUB_BITS buckets per power of two (~6%)
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_SUB_BUCKETS) // enough for any uint64_t value
+#define STATS_COMMANDS 128 // command names with their own wall time histogram
+#define STATS_SPAWN_SLOTS 512 // exec timestamps shared with children, one per pipeline stage
+#define TRACE_EVENTS 32768 // events kept per thread by the tracer
+#define PROFILE_BUCKETS 1024 // hash buckets of distinct stacks kept by the profiler
+#define PROFILE_DEPTH 128 // deepest profiler stack that is timed
+#define PROFILE_PATH 4096 // longest folded stack, in bytes
+#define XTRACE_BUFFER 8192 // set -x lines are batched in a buffer this big
+#define XTRACE_FLUSH_MS 200 // buffered trace lines older than this are written; checked when a line is added
+#define INPUT_BATCH 256 // bytes the line editor reads from the terminal at once
+#define RENDER_BUFFER 4096 // line editor output is collected here and written once per input batch
+#define SNAPSHOT_INTERVAL 60 // seconds between snapshot saves while a shell runs
+#define SERVER_MAGIC 0x4a42534bu // "JBSK", first field of every server request
+#define SERVER_FDS 4 // descriptors sent with a request: stdin, stdout, stderr, working directory
+#define SERVER_MAX_REQUEST (1 << 20) // longest command text a server accepts, in bytes
+
+#if TRACING
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_event(name, 'B'); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_event(name, 'E'); } while (0)
+#define TRACE_COMPLETE(name, start_ns, end_ns) do { if (trace_enabled) trace_complete(name, start_ns, end_ns); } while (0)
+#else
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_COMPLETE(name, start_ns, end_ns) do {} while (0)
+#endif
+
+/**
+ * Resource usage of the last command, filled in from wait4 for external
+ * commands and from getrusage deltas for builtins.
+ */
+struct cmd_usage {
+    int status;         // exit status, 128 + signal number if killed by a signal
+    long long wall_us;  // wall clock time (CLOCK_MONOTONIC) in microseconds
+    long long user_us;  // user CPU time in microseconds
+    long long sys_us;   // system CPU time in microseconds
+    long maxrss_kb;     // maximum resident set size in kilobytes
+    long nvcsw;         // voluntary context switches
+    long nivcsw;        // involuntary context switches
+};
+
+/**
+ * HDR style latency histogram, values in nanoseconds.
+ */
+struct histogram {
+    const char *name;
+    uint64_t count;   // values recorded
+    uint64_t sum;     // for the mean
+    uint64_t min;
+    uint64_t max;
+    uint32_t counts[HIST_BUCKETS];
+};
+
+/**
+ * Bump allocator for words produced by expansion, reset after every command.
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;  // usable bytes in data
+    size_t used;  // bytes handed out so far
+    char data[];
+};
+
+struct arena {
+    struct arena_block *head; // block currently being filled
+};
+
+struct var; // a shell variable, see vars.c
+struct array; // the elements of an array variable, see arrays.c
+struct pattern; // a compiled glob pattern, see pattern.c
+struct chunk; // compiled bytecode, see compile.c
+struct function; // a shell function, see functions.c
+
+/**
+ * One shell instance: everything that used to be a global of the shell.
+ */
+struct jb_session {
+    char **args;                    // words of the command being run
+    char *input;                    // its command line buffer, split in place by tokenize()
+    char *cwd;                      // working directory for the prompt, NULL until session_cwd() needs it
+    int cwd_fd;                     // the same directory, entered with fchdir
+    struct cmd_usage last_usage;    // usage of the most recent command
+    struct arena word_arena;        // storage for expanded words of the current command
+    struct var *vars[VAR_BUCKETS];  // shell variables
+    int exited;                     // "exit" ran, jb_eval runs nothing more
+    int loop_depth;                 // loops being run, for break and continue
+    int breaking;                   // enclosing loops "break N" still has to leave
+    int continuing;                 // loop levels "continue N" still has to unwind
+    struct function *functions[FUNCTION_BUCKETS]; // shell functions
+    char **positional;              // $1, $2, ... of the function being run
+    size_t positional_count;
+    int function_depth;             // function calls being run
+    int returning;                  // "return" is unwinding the function being run
+    int argv_borrows;               // the last make_argv() pointed arguments at array elements
+    struct pattern *patterns[PATTERN_CACHE]; // glob patterns of parameter expansions, by their text
+    int expand_depth;               // ${NAME#...} operands being expanded
+};
+
+/**
+ * A word as split_words() produced it, before expansion.
+ */
+struct word {
+    char *text;
+    char quote;  // quote character it was enclosed in, or 0
+    struct arith *arith; // its $(( )) expressions compiled by the parser (arith.c), NULL for none
+};
+
+/**
+ * Where the parser gets its lines: a script, a command buffer, the image of a
+ * sourced file or the terminal. read() puts the words of the next line in
+ * words; the parser asks for a line only when it needs one, so the terminal
+ * prompts for a continuation line only in the middle of a command.
+ */
+struct line_source {
+    int (*read)(struct line_source *source); // reads the next line, returns 0 at the end
+    void *context;          // the reader's own state
+    const char *name;       // script or file name for profiler frames and errors, NULL for the terminal
+    struct word *words;     // words of the current line
+    size_t count;
+    size_t capacity;
+    size_t position;        // next word the parser looks at
+    char *line;             // buffer the words point into, released with the next line
+    uint32_t number;        // line number of the current line
+    int need_line;          // the current line is used up
+    int ended;              // read() returned 0
+    int continuation;       // the parser is in the middle of a command
+    int error;              // the last parse_command() hit a syntax error
+    struct chunk *chunk;    // bytecode of the current command, its buffers are reused for the next
+};
+
+/**
+ * Kinds of parsed commands.
+ */
+enum node_type {
+    NODE_COMMAND,  // a command list run by execute(): pipelines joined by ';', '&&' and '||'
+    NODE_IF,       // if condition; then body; [elif ... | else else_part;] fi
+    NODE_WHILE,    // while condition; do body; done
+    NODE_UNTIL,    // until condition; do body; done
+    NODE_FOR,      // for name [in words]; do body; done
+    NODE_FUNCTION, // name () { body; }
+    NODE_CASE,     // case word in pattern) list ;; ... esac
+};
+
+struct case_matcher; // the compiled patterns of a case, see case.c
+
+/**
+ * One arm of a case: its patterns are words of the node, the list runs when one matches.
+ */
+struct case_arm {
+    size_t first;       // index of its first pattern in the node's words
+    size_t count;       // number of patterns
+    struct node *body;  // NULL for an empty list
+};
+
+/**
+ * One parsed command; the commands of a list are chained through next.
+ */
+struct node {
+    enum node_type type;
+    struct node *next;       // next command of the same list
+    const char *file;        // where it was parsed, for profiler frames (NULL for the terminal)
+    uint32_t line;
+    struct word *words;      // NODE_COMMAND: its words; NODE_FOR: the words after "in", NULL without "in"
+    size_t count;
+    char *name;              // NODE_FOR: the loop variable; NODE_FUNCTION: the function's name
+    struct node *condition;  // NODE_IF, NODE_WHILE, NODE_UNTIL
+    struct node *body;       // NODE_IF: the then part; loops and functions: the body
+    struct node *else_part;  // NODE_IF: the else part, an elif is an if inside it
+    struct case_arm *arms;   // NODE_CASE: its arms; words[0] is the word, the patterns follow
+    size_t arm_count;
+    struct case_matcher *matcher; // NODE_CASE: built the first time the case runs
+};
+
+/**
+ * Bytecode instructions (compile.c, run by vm.c). Each is one code word
+ * followed by its operands; jump targets are code offsets, words are indexes
+ * into the chunk's word table.
+ */
+enum opcode {
+    BC_EXEC,          // first count line: run words as a command list with execute()
+    BC_CALL,          // site first count line: a simple command whose name the call site resolves
+    BC_ASSIGN,        // first count line: NAME=value words only, as name and value word pairs
+    BC_JUMP,          // target
+    BC_JUMP_IF_FAIL,  // target: jump when $? is not 0
+    BC_JUMP_IF_OK,    // target: jump when $? is 0
+    BC_SET_STATUS,    // status
+    BC_ARITH,         // word line: a (( )) command
+    BC_DEFINE,        // definition: define a function
+    BC_LOOP_BEGIN,    // break continue: enter a while or until loop
+    BC_FOR_BEGIN,     // first count break continue: expand the words (FOR_POSITIONAL: $1...) and enter a for loop
+    BC_FOR_NEXT,      // name end: set name to the next word, or jump to end after the last
+    BC_LOOP_STATUS,   // the body finished, its status becomes the loop's
+    BC_LOOP_END,      // leave the loop with its status
+    BC_CASE,          // case line target...: pick the arm of a case, jump to its target (one per arm, then no match)
+    BC_HALT,
+    BC_COUNT,
+};
+
+#define FOR_POSITIONAL UINT32_MAX // first word of a for loop without "in"
+
+/**
+ * What a command name meant the last time a call site looked it up.
+ */
+enum call_kind {
+    CALL_FUNCTION,  // function
+    CALL_BUILTIN,   // slot
+    CALL_EXTERNAL,  // path
+    CALL_SEARCH,    // not found, or found through a relative PATH entry: looked up on every call
+};
+
+/**
+ * A simple command in bytecode whose name is known when it is compiled. It
+ * remembers what the name resolved to until command_generation moves on.
+ */
+struct call_site {
+    uint64_t generation;        // command_generation when it was resolved, 0 for never
+    enum call_kind kind;
+    int slot;                   // CALL_BUILTIN
+    struct function *function;  // CALL_FUNCTION
+    char *path;                 // CALL_EXTERNAL, owned by the site
+};
+
+/**
+ * One parsed command compiled to bytecode. The word table and its text are
+ * copies, so the chunk outlives the nodes it was compiled from; only
+ * function definitions point back to their nodes, and are run while those
+ * still exist.
+ */
+struct chunk {
+    uint32_t *code;
+    size_t length;
+    size_t capacity;
+    struct word *words;   // operands of commands, their text lives in pool
+    size_t word_count;
+    size_t word_capacity;
+    char *pool;
+    size_t pool_length;
+    size_t pool_capacity;
+    struct call_site *sites;
+    size_t site_count;
+    size_t site_capacity;
+    const struct node **definitions; // NODE_FUNCTIONs, for BC_DEFINE
+    size_t definition_count;
+    size_t definition_capacity;
+    const struct node **cases; // NODE_CASEs, for BC_CASE; they keep their matchers
+    size_t case_count;
+    size_t case_capacity;
+    const char *file;     // where the command was parsed, for profiler frames (NULL for the terminal)
+    int loop_depth;       // deepest nesting of loops, the interpreter keeps a frame per level
+};
+
+/**
+ * Line editor totals since start (or "stats reset"), kept next to keystroke_histogram.
+ */
+struct editor_totals {
+    uint64_t batches;       // input batches whose frame was flushed
+    uint64_t keys;          // bytes read from the terminal
+    uint64_t render_bytes;  // bytes written by the editor
+    uint64_t writes;        // write calls
+};
+
+/**
+ * Header of a request to the server, followed by length bytes of commands.
+ */
+struct server_request {
+    uint32_t magic;   // SERVER_MAGIC
+    uint32_t length;  // bytes of commands that follow
+};
+
+/**
+ * Usage of one pipeline stage, as reported by the time keyword.
+ */
+struct stage_usage {
+    const char *command;     // the stage's words joined by spaces
+    int pipeline;            // 1-based index of the pipeline within the command list
+    int stage;               // 1-based position within the pipeline
+    struct cmd_usage usage;
+};
+
+/**
+ * Everything the time keyword collected while its command list ran, stored in word_arena.
+ */
+struct time_report {
+    struct stage_usage *stages;
+    size_t count;
+    size_t capacity;
+};
+
+extern struct jb_session *session; // the session running right now
+extern char OP_PIPE[], OP_SEMI[], OP_AND[], OP_OR[]; // operator words produced by parse()
+extern struct histogram spawn_histogram; // fork to exec latency
+extern struct histogram keystroke_histogram; // keystroke read to echo flushed latency
+extern struct editor_totals editor_totals; // line editor bytes and writes
+#if TRACING
+extern int trace_enabled; // recording events right now
+#endif
+extern int profiling; // script profiler is on (JBASH_PROFILE)
+extern int xtrace_enabled; // set -x is on
+extern int startup_tracing; // --startup-trace is on
+extern uint64_t command_generation; // moves on whenever a command name may mean something else
+extern uint64_t command_serial; // moves on with every top-level command, for checks done once per command
+extern uint64_t var_generation; // moves on whenever variable slots may have gone away
+extern int tree_walker; // run commands with the tree walker instead of bytecode (JBASH_INTERP=tree), -1 until known
+extern int snapshot_enabled; // this shell reads and writes the snapshot
+extern void (*snapshot_front_end)(void); // adds the front-end's caches to a snapshot being saved
+
+int execute(const struct word *words, size_t count);
+const char *check_syntax(const struct word *words, size_t count);
+char *parse(size_t *length, int continuation);
+char** tokenize(size_t string_length);
+void split_words(char *inputString, size_t string_length, void (*emit)(char *word, char quote, void *context),
+                 void *context);
+char *make_word(const struct word *word);
+char **make_argv(const struct word *words, size_t count, int assignments, size_t *argc);
+char **argv_owned(char **argv);
+char *word_operator(const char *word, char quote);
+int run_script(FILE *in, const char *name);
+void line_source_stream(struct line_source *source, FILE *in, const char *name);
+void session_enter(struct jb_session *s);
+void session_update_cwd(struct jb_session *s);
+const char *session_cwd(struct jb_session *s);
+int session_run_command(struct jb_session *s, struct line_source *source);
+int session_run_source(struct jb_session *s, struct line_source *source);
+void line_source_init(struct line_source *source, int (*read)(struct line_source *), void *context, const char *name);
+void line_source_add(struct line_source *source, char *text, char quote);
+void line_source_split(struct line_source *source, char *line, size_t length);
+void line_source_free(struct line_source *source);
+struct node *parse_command(struct line_source *source);
+struct node *node_copy(const struct node *node);
+void node_free(struct node *node);
+int run_node(struct node *list);
+int loop_builtin(char **args);
+void set_status(int status);
+int loop_jumping(void);
+int loop_stops(void);
+char **loop_values(const struct word *words, size_t *count);
+struct chunk *chunk_new(void);
+void chunk_free(struct chunk *c);
+void compile(struct chunk *c, const struct node *list, const char *file, int nested);
+void chunk_print(const struct chunk *c, FILE *out);
+int disasm_builtin(char **args);
+int vm_run(const struct chunk *c);
+int builtin_slot(const char *name);
+int execute_call(struct call_site *site, const struct word *words, size_t count);
+void function_define(const struct node *definition);
+struct function *function_find(const char *name);
+int function_defined(const char *name);
+int function_call(struct function *f, char **argv, int *status);
+void functions_free(struct function **table);
+int return_builtin(char **args);
+void commands_changed(void);
 void print_prompt();
-void* realloc_buffer(void *ptr, size_t *current_buffer);
+void print_continuation_prompt(void);
+int read_input(char *ch, const char *line, size_t length, size_t cursor);
+void render(const char *format, ...);
+void render_flush(void);
+void segment_refresh(void);
+int segment_fd(void);
+void segment_update(const char *line, size_t length, size_t cursor);
+void segment_start(void);
+void usage_publish(const struct cmd_usage *usage);
+long long monotonic_us(void);
+long long timeval_us(struct timeval tv);
+int is_operator(const char *word);
+void time_report_add(struct time_report *report, char **argv, int pipeline, int stage, const struct cmd_usage *usage);
+void time_report_print(const struct time_report *report, const struct cmd_usage *total, int json);
+void var_set(const char *name, const char *value);
+struct var *var_find(const char *name);
+const char *var_value(const struct var *v);
+void var_assign(struct var *v, const char *value);
+void var_set_number(const char *name, long long value);
+size_t var_name_length(const char *text);
+size_t var_assignment(const char *word);
+int var_set_word(char *word);
+void var_set_array(const char *name, struct array *a);
+struct array *var_array(const struct var *v);
+const char *var_get(const char *name);
+void vars_free(struct var **table);
+void array_free(struct array *a);
+const char *array_scalar(const struct array *a);
+void array_assign_scalar(struct array *a, const char *value);
+int array_set_element(const char *name, const char *subscript, const char *value, int append);
+const char *array_expand(const char *name, size_t name_length, const char *subscript, size_t subscript_length,
+                         char prefix);
+size_t array_fields(const char *text, char quote, char **fields);
+int is_array_list(const struct word *w);
+void array_assign_list(const char *name, const char *list, size_t length, int append, int expand);
+void array_assign_word(const struct word *w);
+int declare_builtin(char **args);
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+char *expand_word(char *word, char quote, const struct arith *arith);
+struct arith *arith_compile_word(const char *text, char quote);
+void arith_free(struct arith *a);
+const char *arith_expand(const struct arith **next, const char *word, const char *at, size_t *length);
+int is_arith_command(const struct word *w);
+int arith_command(const struct word *w);
+int arith_evaluate(const char *text, int64_t *value);
+struct pattern *pattern_compile(const char *text, size_t length);
+void pattern_free(struct pattern *p);
+struct pattern *pattern_get(const char *text, size_t length);
+void patterns_free(struct pattern **cache);
+int pattern_match(const struct pattern *p, const char *s, size_t n);
+size_t pattern_prefix(const struct pattern *p, const char *s, size_t n, int longest);
+size_t pattern_suffix(const struct pattern *p, const char *s, size_t n, int longest);
+int pattern_find(const struct pattern *p, const char *s, size_t n, size_t *start, size_t *end);
+const char *pattern_literal(const struct pattern *p, size_t *length);
+size_t case_select(struct node *n);
+void case_matcher_free(struct case_matcher *m);
+void history_add(const char *line);
+void history_record_usage(const struct cmd_usage *usage);
+int history_builtin(char **args);
+uint64_t monotonic_ns(void);
+void hist_record(struct histogram *h, uint64_t value);
+void stats_record_command(const char *name, uint64_t ns);
+void stats_init(void);
+void stats_spawn_begin(size_t stage);
+void stats_spawn_exec(size_t stage);
+uint64_t stats_spawn_end(size_t stage, uint64_t forked_ns);
+int stats_builtin(char **args);
+#if TRACING
+void trace_event(const char *name, char phase);
+void trace_complete(const char *name, uint64_t start_ns, uint64_t end_ns);
+int trace_dump(const char *path);
+#endif
+void trace_init(void);
+void startup_trace_init(void);
+uint64_t startup_begin(void);
+void startup_end(const char *step, uint64_t begun);
+void startup_mark(const char *step);
+int trace_builtin(char **args);
+char *resolve_command(const char *name);
+const char *hash_find(const char *name, const char *path);
+void hash_add(const char *name, const char *found);
+int hash_builtin(char **args);
+int source_file(const char *path, int *status);
+int source_builtin(char **args, int *status);
+int rc_load(void);
+uint64_t cache_build_id(void);
+int cache_path(const char *key, const char *suffix, char *path, size_t size, int make_dirs);
+void cache_store(const char *path, const char *data, size_t size);
+struct function *autoload_find(const char *name);
+void autoload_forget(void);
+int autoload_builtin(char **args);
+void hash_snapshot(const char *path);
+void history_snapshot(void);
+void segment_snapshot(void);
+void snapshot_init(void);
+void snapshot_tick(void);
+int snapshot_save(void);
+int snapshot_builtin(char **args);
+const char *snapshot_command(const char *name, const char *path_var);
+size_t snapshot_command_count(const char *path_var);
+void snapshot_command_at(size_t i, const char **name, const char **path, uint64_t *hits);
+size_t snapshot_history_count(void);
+const char *snapshot_history_at(size_t i, time_t *started, struct cmd_usage *usage, int *finished);
+size_t snapshot_segment_count(void);
+void snapshot_segment_at(size_t i, const char **dir, const char **value);
+const char *snapshot_segment(const char *dir);
+void snapshot_add_command(const char *name, const char *path, uint64_t hits);
+void snapshot_add_history(const char *line, time_t started, const struct cmd_usage *usage, int finished);
+void snapshot_add_segment(const char *dir, const char *value);
+int server_main(void);
+int client_main(const char *commands);
+void profile_init(void);
+void profile_push(const char *frame);
+void profile_pop(void);
+void profile_add_cpu(long long us);
+void xtrace_command(char **argv);
+void xtrace_flush(void);
+int set_builtin(char **args);
+void* realloc_buffer(void *ptr, size_t *current_buffer, size_t element_size);
 void* realloc_leftover_string(char *inputString, size_t *string_length);
 void *safe_malloc(size_t size);
 void free_args(char **args);
 void disable_raw_mode();
 void enable_raw_mode();
-void handle_sigint(int sig);
\ No newline at end of file
+void handle_sigint(int sig);
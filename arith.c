@@ -0,0 +1,812 @@
+/*******************************************************************************
+  @file         arith.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file arith.c
+ * @brief Arithmetic: $(( )) expansion and the (( )) command
+ *
+ * Expressions use 64-bit signed integers that wrap on overflow, with the C
+ * operators of bash: ++ -- (prefix and postfix), unary + - ! ~, **, * / %,
+ * + -, << >>, < <= > >=, == !=, &, ^, |, &&, ||, ?:, the assignments
+ * = *= /= %= += -= <<= >>= &= ^= |= and the comma. Operands are numbers
+ * (decimal, 0x hex, 0 octal), variable names (also as $NAME or ${NAME}),
+ * $1...$9, ${N}, $# and $?, and array elements NAME[SUBSCRIPT] and the
+ * other braced forms of expand.c (${#NAME[@]}...), which are expanded when
+ * the expression is evaluated. A variable's value is read as a number; one
+ * that is unset or not a number is 0.
+ *
+ * The parser compiles every expression of a word once, when the word is put
+ * into a node (arith_compile_word), to postfix code with jumps for && || and
+ * ?:. Each variable of an expression remembers its slot in the variable
+ * table (vars.c) until var_generation moves on, so "i=$((i+1))" looks up
+ * nothing by name and, once the value's buffer is big enough, allocates
+ * nothing. A word the parser did not see is compiled when it is expanded.
+ *
+ * Errors (a syntax error, division by zero) are reported when the
+ * expression is evaluated. A $(( )) with an error makes expand_word() fail,
+ * so its command does not run and $? is 1; (( )) fails with status 1.
+ */
+#include "JBash.h"
+
+/**
+ * Postfix instructions of an expression.
+ */
+enum arith_code {
+    A_NUMBER,       // push value
+    A_VAR,          // push variable operand
+    A_POSITIONAL,   // push $operand
+    A_ARGC,         // push $#
+    A_STATUS,       // push $?
+    A_EXPAND,       // push the expansion of reference operand (its text is the variable's name)
+    A_STORE,        // variable operand = top, which stays
+    A_DUP,
+    A_POP,
+    A_NEGATE, A_NOT, A_COMPLEMENT,
+    A_POWER, A_MULTIPLY, A_DIVIDE, A_REMAINDER, A_ADD, A_SUBTRACT, A_SHIFT_LEFT, A_SHIFT_RIGHT,
+    A_LESS, A_LESS_EQUAL, A_GREATER, A_GREATER_EQUAL, A_EQUAL, A_NOT_EQUAL,
+    A_BIT_AND, A_BIT_XOR, A_BIT_OR,
+    A_BOOL,         // top = top != 0
+    A_AND_JUMP,     // top is 0: leave it and jump to operand, else pop it
+    A_OR_JUMP,      // top is not 0: make it 1 and jump to operand, else pop it
+    A_JUMP_IF_ZERO, // pop, jump to operand when it was 0
+    A_JUMP,
+};
+
+/**
+ * One postfix instruction.
+ */
+struct arith_op {
+    int64_t value;      // A_NUMBER
+    uint32_t code;
+    uint32_t operand;   // variable index, positional number or jump target
+};
+
+/**
+ * A variable an expression reads or assigns, with its slot once found.
+ */
+struct arith_var {
+    char *name;
+    struct var *slot;       // valid while generation == var_generation
+    uint64_t generation;
+};
+
+/**
+ * One compiled expression; the expressions of a word are chained in order.
+ */
+struct arith {
+    size_t offset;          // where its "$((" or "((" starts in the word
+    char *text;             // the expression, for error messages
+    const char *error;      // syntax error, reported when it is evaluated
+    struct arith_op *code;
+    size_t length, capacity;
+    struct arith_var *vars;
+    size_t var_count, var_capacity;
+    int depth;              // deepest the stack gets
+    struct arith *next;
+};
+
+/**
+ * Parser state while compiling one expression.
+ */
+struct arith_parser {
+    struct arith *a;
+    const char *p, *end;
+    int depth;              // stack depth after the code emitted so far
+    int nesting;            // recursive calls being parsed, bounded by ARITH_NESTING_MAX
+};
+
+/**
+ * @brief Appends an instruction, keeping track of the stack depth
+ * @param effect How many values it adds to the stack (negative: removes)
+ * @return Its index, for patching jump targets
+ */
+static size_t arith_emit(struct arith_parser *ap, enum arith_code code, uint32_t operand, int64_t value, int effect) {
+    struct arith *a = ap->a;
+    if (a->length == a->capacity) {
+        if (a->capacity == 0) a->capacity = CMD_LINE_BUFFER / 2; // realloc_buffer doubles it
+        a->code = realloc_buffer(a->code, &a->capacity, sizeof(struct arith_op));
+    }
+    a->code[a->length] = (struct arith_op){ value, code, operand };
+    ap->depth += effect;
+    if (ap->depth > a->depth) a->depth = ap->depth;
+    return a->length++;
+}
+
+/**
+ * @brief The index of a variable of the expression, added on first use
+ */
+static uint32_t arith_var(struct arith_parser *ap, const char *name, size_t length) {
+    struct arith *a = ap->a;
+    for (size_t i = 0; i < a->var_count; i++) {
+        if (strncmp(a->vars[i].name, name, length) == 0 && a->vars[i].name[length] == NULLCHAR) return (uint32_t)i;
+    }
+    if (a->var_count == a->var_capacity) {
+        if (a->var_capacity == 0) a->var_capacity = 2; // realloc_buffer doubles it
+        a->vars = realloc_buffer(a->vars, &a->var_capacity, sizeof(struct arith_var));
+    }
+    a->vars[a->var_count] = (struct arith_var){ strndup(name, length), NULL, 0 };
+    return (uint32_t)a->var_count++;
+}
+
+/**
+ * @brief Skips blanks and newlines
+ * @return The next character, or NULLCHAR at the end of the expression
+ */
+static char arith_peek(struct arith_parser *ap) {
+    while (ap->p < ap->end && (IS_BLANK(*ap->p) || *ap->p == NEWLINE)) ap->p++;
+    return ap->p < ap->end ? *ap->p : NULLCHAR;
+}
+
+/**
+ * @brief Consumes an operator if it comes next
+ * @param op The operator; it must not be followed by any character of not_before
+ */
+static int arith_accept(struct arith_parser *ap, const char *op, const char *not_before) {
+    arith_peek(ap);
+    size_t length = strlen(op);
+    if ((size_t)(ap->end - ap->p) < length || strncmp(ap->p, op, length) != 0) return 0;
+    if (ap->p + length < ap->end && not_before != NULL && strchr(not_before, ap->p[length]) != NULL) return 0;
+    ap->p += length;
+    return 1;
+}
+
+/**
+ * @brief Records the first syntax error
+ */
+static void arith_fail(struct arith_parser *ap, const char *error) {
+    if (ap->a->error == NULL) ap->a->error = error;
+    ap->p = ap->end; // nothing more is parsed
+}
+
+/**
+ * @brief Goes one recursive call deeper, unless the expression nests too deep for the C stack
+ * @return 1 to go on, 0 after recording the error (the caller then returns at once)
+ */
+static int arith_enter(struct arith_parser *ap) {
+    if (ap->nesting >= ARITH_NESTING_MAX) {
+        arith_fail(ap, "expression recursion level exceeded");
+        return 0;
+    }
+    ap->nesting++;
+    return 1;
+}
+
+/**
+ * @brief Length of the variable name at the parser's position, 0 when there is none
+ */
+static size_t arith_name(struct arith_parser *ap) {
+    arith_peek(ap);
+    const char *p = ap->p;
+    if (p == ap->end || !(*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))) return 0;
+    while (p < ap->end && (*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9'))) {
+        p++;
+    }
+    return (size_t)(p - ap->p);
+}
+
+static void arith_comma(struct arith_parser *ap);
+static void arith_assign(struct arith_parser *ap);
+static void arith_primary(struct arith_parser *ap);
+
+/**
+ * @brief Parses a number: decimal, 0x hex or 0 octal
+ */
+static void arith_number(struct arith_parser *ap) {
+    const char *p = ap->p;
+    int base = 10;
+    if (*p == '0' && p + 1 < ap->end && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (*p == '0') {
+        base = 8;
+    }
+    uint64_t value = 0;
+    const char *digits = p;
+    for (; p < ap->end; p++) {
+        int digit;
+        if (*p >= '0' && *p <= '9') digit = *p - '0';
+        else if (*p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+        else if (*p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+        else if (*p == '_' || (*p >= 'g' && *p <= 'z') || (*p >= 'G' && *p <= 'Z')) digit = 99;
+        else break;
+        if (digit >= base) {
+            arith_fail(ap, "value too great for base");
+            return;
+        }
+        value = value * (uint64_t)base + (uint64_t)digit; // wraps like the rest of the arithmetic
+    }
+    if (base == 16 && p == digits) {
+        arith_fail(ap, "invalid number");
+        return;
+    }
+    ap->p = p;
+    arith_emit(ap, A_NUMBER, 0, (int64_t)value, 1);
+}
+
+/**
+ * @brief Compiles a braced reference arith_dollar() does not read itself, to be expanded when evaluated
+ * That is ${#NAME...}, ${!NAME...} and ${NAME[SUBSCRIPT]}.
+ * @param dollar The '$', the parser is at the '{'
+ * @return 1 when it was one, 0 to parse it as a plain ${NAME}
+ */
+static int arith_reference(struct arith_parser *ap, const char *dollar) {
+    const char *name = ap->p + 1;
+    if (name < ap->end && (*name == '#' || *name == '!')) name++;
+    size_t length = var_name_length(name);
+    if (length == 0 || (name == ap->p + 1 && name[length] != '[')) return 0;
+    const char *close = memchr(name, '}', (size_t)(ap->end - name));
+    if (close == NULL) {
+        arith_fail(ap, "missing '}'");
+        return 1;
+    }
+    arith_emit(ap, A_EXPAND, arith_var(ap, dollar, (size_t)(close + 1 - dollar)), 0, 1);
+    ap->p = close + 1;
+    return 1;
+}
+
+/**
+ * @brief Parses a '$' operand: $NAME, ${NAME}, $N, ${N}, $#, $? or $(( )) (the '$' is ignored)
+ */
+static void arith_dollar(struct arith_parser *ap) {
+    ap->p++; // the '$'
+    if (ap->p < ap->end && *ap->p == '(') { // $(( )) inside an expression is only parentheses
+        arith_primary(ap);
+        return;
+    }
+    int braced = ap->p < ap->end && *ap->p == '{';
+    if (braced && arith_reference(ap, ap->p - 1)) return;
+    if (braced) ap->p++;
+    if (ap->p < ap->end && (*ap->p == '#' || *ap->p == '?')) {
+        arith_emit(ap, *ap->p == '#' ? A_ARGC : A_STATUS, 0, 0, 1);
+        ap->p++;
+    } else if (ap->p < ap->end && *ap->p >= '1' && *ap->p <= '9') {
+        uint32_t n = 0;
+        do n = n * 10 + (uint32_t)(*ap->p++ - '0');
+        while (braced && ap->p < ap->end && *ap->p >= '0' && *ap->p <= '9' && n < 100000000);
+        arith_emit(ap, A_POSITIONAL, n, 0, 1);
+    } else {
+        size_t length = arith_name(ap);
+        if (length == 0) {
+            arith_fail(ap, "operand expected");
+            return;
+        }
+        arith_emit(ap, A_VAR, arith_var(ap, ap->p, length), 0, 1);
+        ap->p += length;
+    }
+    if (braced && !arith_accept(ap, "}", NULL)) arith_fail(ap, "missing '}'");
+}
+
+/**
+ * @brief Parses an operand, a parenthesized expression, or a variable with ++ or -- after it
+ */
+static void arith_primary(struct arith_parser *ap) {
+    char c = arith_peek(ap);
+    if (c == '(') {
+        ap->p++;
+        arith_comma(ap);
+        if (!arith_accept(ap, ")", NULL)) arith_fail(ap, "missing ')'");
+    } else if (c >= '0' && c <= '9') {
+        arith_number(ap);
+    } else if (c == '$') {
+        arith_dollar(ap);
+    } else {
+        size_t length = arith_name(ap);
+        if (length == 0) {
+            arith_fail(ap, c == NULLCHAR ? "operand expected" : "syntax error in expression");
+            return;
+        }
+        if (ap->p + length < ap->end && ap->p[length] == '[') { // NAME[SUBSCRIPT] reads as ${NAME[SUBSCRIPT]}
+            const char *close = memchr(ap->p, ']', (size_t)(ap->end - ap->p));
+            if (close == NULL) {
+                arith_fail(ap, "missing ']'");
+                return;
+            }
+            size_t span = (size_t)(close + 1 - ap->p);
+            char reference[span + 4];
+            snprintf(reference, sizeof(reference), "${%.*s}", (int)span, ap->p);
+            arith_emit(ap, A_EXPAND, arith_var(ap, reference, span + 3), 0, 1);
+            ap->p = close + 1;
+            return;
+        }
+        uint32_t var = arith_var(ap, ap->p, length);
+        ap->p += length;
+        arith_emit(ap, A_VAR, var, 0, 1);
+        int increment = arith_accept(ap, "++", NULL), decrement = !increment && arith_accept(ap, "--", NULL);
+        if (increment || decrement) { // the old value is the result
+            arith_emit(ap, A_DUP, 0, 0, 1);
+            arith_emit(ap, A_NUMBER, 0, 1, 1);
+            arith_emit(ap, increment ? A_ADD : A_SUBTRACT, 0, 0, -1);
+            arith_emit(ap, A_STORE, var, 0, 0);
+            arith_emit(ap, A_POP, 0, 0, -1);
+        }
+    }
+}
+
+/**
+ * @brief Parses the unary operators, ++NAME and --NAME
+ */
+static void arith_unary(struct arith_parser *ap) {
+    if (!arith_enter(ap)) return;
+    int increment = arith_accept(ap, "++", NULL), decrement = !increment && arith_accept(ap, "--", NULL);
+    if (increment || decrement) {
+        size_t length = arith_name(ap);
+        if (length == 0) {
+            arith_fail(ap, "variable expected after ++ or --");
+            ap->nesting--;
+            return;
+        }
+        uint32_t var = arith_var(ap, ap->p, length);
+        ap->p += length;
+        arith_emit(ap, A_VAR, var, 0, 1);
+        arith_emit(ap, A_NUMBER, 0, 1, 1);
+        arith_emit(ap, increment ? A_ADD : A_SUBTRACT, 0, 0, -1);
+        arith_emit(ap, A_STORE, var, 0, 0);
+    } else if (arith_accept(ap, "-", NULL)) {
+        arith_unary(ap);
+        arith_emit(ap, A_NEGATE, 0, 0, 0);
+    } else if (arith_accept(ap, "+", NULL)) {
+        arith_unary(ap);
+    } else if (arith_accept(ap, "!", "=")) {
+        arith_unary(ap);
+        arith_emit(ap, A_NOT, 0, 0, 0);
+    } else if (arith_accept(ap, "~", NULL)) {
+        arith_unary(ap);
+        arith_emit(ap, A_COMPLEMENT, 0, 0, 0);
+    } else {
+        arith_primary(ap);
+    }
+    ap->nesting--;
+}
+
+/**
+ * @brief Parses ** (right associative, below the unary operators like in bash)
+ */
+static void arith_power(struct arith_parser *ap) {
+    if (!arith_enter(ap)) return;
+    arith_unary(ap);
+    if (arith_accept(ap, "**", "=")) {
+        arith_power(ap);
+        arith_emit(ap, A_POWER, 0, 0, -1);
+    }
+    ap->nesting--;
+}
+
+/**
+ * A level of left associative binary operators.
+ */
+struct arith_level {
+    const char *op;
+    const char *not_before;  // "+" must not take the first character of "++" or "+="
+    enum arith_code code;
+};
+
+static const struct arith_level multiplicative[] = {
+    { "*", "*=", A_MULTIPLY }, { "/", "=", A_DIVIDE }, { "%", "=", A_REMAINDER }, { NULL, NULL, 0 } };
+static const struct arith_level additive[] = { { "+", "+=", A_ADD }, { "-", "-=", A_SUBTRACT }, { NULL, NULL, 0 } };
+static const struct arith_level shifts[] = {
+    { "<<", "=", A_SHIFT_LEFT }, { ">>", "=", A_SHIFT_RIGHT }, { NULL, NULL, 0 } };
+static const struct arith_level relational[] = {
+    { "<=", NULL, A_LESS_EQUAL }, { ">=", NULL, A_GREATER_EQUAL }, { "<", "<", A_LESS }, { ">", ">", A_GREATER },
+    { NULL, NULL, 0 } };
+static const struct arith_level equality[] = { { "==", NULL, A_EQUAL }, { "!=", NULL, A_NOT_EQUAL }, { NULL, NULL, 0 } };
+static const struct arith_level bit_and[] = { { "&", "&=", A_BIT_AND }, { NULL, NULL, 0 } };
+static const struct arith_level bit_xor[] = { { "^", "=", A_BIT_XOR }, { NULL, NULL, 0 } };
+static const struct arith_level bit_or[] = { { "|", "|=", A_BIT_OR }, { NULL, NULL, 0 } };
+
+// from the tightest binding binary operators to the loosest; ** is below them
+static const struct arith_level *const levels[] = {
+    multiplicative, additive, shifts, relational, equality, bit_and, bit_xor, bit_or };
+
+/**
+ * @brief Parses a level of binary operators and everything that binds tighter
+ * @param level Index into levels, -1 for **
+ */
+static void arith_binary(struct arith_parser *ap, int level) {
+    if (level < 0) {
+        arith_power(ap);
+        return;
+    }
+    arith_binary(ap, level - 1);
+    for (;;) {
+        const struct arith_level *op = levels[level];
+        while (op->op != NULL && !arith_accept(ap, op->op, op->not_before)) op++;
+        if (op->op == NULL) return;
+        arith_binary(ap, level - 1);
+        arith_emit(ap, op->code, 0, 0, -1);
+    }
+}
+
+/**
+ * @brief Parses && and ||: the right side only runs when the left one did not decide
+ * @param or 1 for ||, whose operands are && expressions
+ */
+static void arith_logical(struct arith_parser *ap, int or) {
+    if (or) arith_logical(ap, 0);
+    else arith_binary(ap, (int)(sizeof(levels) / sizeof(levels[0])) - 1);
+    while (arith_accept(ap, or ? "||" : "&&", NULL)) {
+        size_t jump = arith_emit(ap, or ? A_OR_JUMP : A_AND_JUMP, 0, 0, -1);
+        if (or) arith_logical(ap, 0);
+        else arith_binary(ap, (int)(sizeof(levels) / sizeof(levels[0])) - 1);
+        arith_emit(ap, A_BOOL, 0, 0, 0);
+        ap->a->code[jump].operand = (uint32_t)ap->a->length;
+    }
+}
+
+/**
+ * @brief Parses CONDITION ? EXPRESSION : EXPRESSION
+ */
+static void arith_ternary(struct arith_parser *ap) {
+    arith_logical(ap, 1);
+    if (!arith_accept(ap, "?", NULL) || !arith_enter(ap)) return;
+    size_t to_else = arith_emit(ap, A_JUMP_IF_ZERO, 0, 0, -1);
+    arith_assign(ap);
+    size_t to_end = arith_emit(ap, A_JUMP, 0, 0, 0);
+    ap->depth--; // only one of the branches leaves its value
+    if (!arith_accept(ap, ":", NULL)) {
+        arith_fail(ap, "':' expected for conditional expression");
+        ap->nesting--;
+        return;
+    }
+    ap->a->code[to_else].operand = (uint32_t)ap->a->length;
+    arith_ternary(ap);
+    ap->a->code[to_end].operand = (uint32_t)ap->a->length;
+    ap->nesting--;
+}
+
+/**
+ * Assignment operators, with the operator they apply first.
+ */
+static const struct {
+    const char *op;
+    enum arith_code code;   // A_STORE for plain '='
+} assignments[] = {
+    { "=", A_STORE }, { "*=", A_MULTIPLY }, { "/=", A_DIVIDE }, { "%=", A_REMAINDER }, { "+=", A_ADD },
+    { "-=", A_SUBTRACT }, { "<<=", A_SHIFT_LEFT }, { ">>=", A_SHIFT_RIGHT }, { "&=", A_BIT_AND },
+    { "^=", A_BIT_XOR }, { "|=", A_BIT_OR },
+};
+
+/**
+ * @brief Parses NAME = EXPRESSION and the other assignments (right associative), or a conditional
+ */
+static void arith_assign(struct arith_parser *ap) {
+    size_t length = arith_name(ap);
+    if (length > 0 && arith_enter(ap)) {
+        const char *name = ap->p, *after = ap->p + length;
+        ap->p = after;
+        for (size_t i = 0; i < sizeof(assignments) / sizeof(assignments[0]); i++) {
+            if (!arith_accept(ap, assignments[i].op, "=")) continue;
+            uint32_t var = arith_var(ap, name, length);
+            if (assignments[i].code != A_STORE) arith_emit(ap, A_VAR, var, 0, 1);
+            arith_assign(ap);
+            if (assignments[i].code != A_STORE) arith_emit(ap, assignments[i].code, 0, 0, -1);
+            arith_emit(ap, A_STORE, var, 0, 0);
+            ap->nesting--;
+            return;
+        }
+        ap->p = name; // not an assignment, the name is an operand
+        ap->nesting--;
+    }
+    arith_ternary(ap);
+}
+
+/**
+ * @brief Parses EXPRESSION, EXPRESSION...: every value but the last is dropped
+ */
+static void arith_comma(struct arith_parser *ap) {
+    arith_assign(ap);
+    while (arith_accept(ap, ",", NULL)) {
+        arith_emit(ap, A_POP, 0, 0, -1);
+        arith_assign(ap);
+    }
+}
+
+/**
+ * @brief Compiles an expression
+ * @param text The expression, without the parentheses of $(( )) or (( ))
+ * @param length Its length
+ * @return The compiled expression; a syntax error is kept for when it is evaluated
+ */
+static struct arith *arith_compile(const char *text, size_t length) {
+    struct arith *a = safe_malloc(sizeof(struct arith));
+    memset(a, 0, sizeof(struct arith));
+    a->text = strndup(text, length);
+    struct arith_parser ap = { a, text, text + length, 0, 0 };
+    arith_comma(&ap);
+    if (arith_peek(&ap) != NULLCHAR) arith_fail(&ap, "syntax error in expression");
+    return a;
+}
+
+/**
+ * @brief Length of "((...))" or "$((...))" up to its matching closing parentheses
+ * @param at The "((" or "$(("
+ * @return The length, 0 when the parentheses are not balanced
+ */
+static size_t arith_span(const char *at) {
+    const char *p = at + (*at == '$');
+    int depth = 0;
+    for (const char *q = p; *q; q++) {
+        if (*q == '(') depth++;
+        else if (*q == ')' && --depth == 0) return q[-1] == ')' ? (size_t)(q + 1 - at) : 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compiles every $(( )) of a word, or the expression of a (( )) command
+ * Called when a word is put into a node.
+ * @return The chain of expressions, NULL when the word has none
+ */
+struct arith *arith_compile_word(const char *text, char quote) {
+    if (quote == '\'') return NULL;
+    struct arith *chain = NULL, **tail = &chain;
+    size_t length = strlen(text);
+    if (quote == 0 && length >= 4 && strncmp(text, "((", 2) == 0 && arith_span(text) == length) {
+        return arith_compile(text + 2, length - 4);
+    }
+    for (const char *at = strstr(text, "$(("); at != NULL; at = strstr(at + 1, "$((")) {
+        size_t span = arith_span(at);
+        if (span == 0) break; // unbalanced, expand_word() leaves the rest literal
+        struct arith *a = arith_compile(at + 3, span - 5);
+        a->offset = (size_t)(at - text);
+        *tail = a;
+        tail = &a->next;
+        at += span - 1;
+    }
+    return chain;
+}
+
+/**
+ * @brief Frees a chain of compiled expressions
+ */
+void arith_free(struct arith *a) {
+    while (a != NULL) {
+        struct arith *next = a->next;
+        for (size_t i = 0; i < a->var_count; i++) free(a->vars[i].name);
+        free(a->vars);
+        free(a->code);
+        free(a->text);
+        free(a);
+        a = next;
+    }
+}
+
+/**
+ * @brief Reads a variable's value as a number: decimal, 0x hex or 0 octal; anything else is 0
+ */
+static int64_t arith_value(const char *value) {
+    if (value == NULL) return 0;
+    while (IS_BLANK(*value)) value++;
+    int negative = *value == '-';
+    if (*value == '-' || *value == '+') value++;
+    int base = 10;
+    if (value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) {
+        base = 16;
+        value += 2;
+    } else if (value[0] == '0') {
+        base = 8;
+    }
+    uint64_t number = 0;
+    for (; *value; value++) {
+        int digit;
+        if (*value >= '0' && *value <= '9') digit = *value - '0';
+        else if (*value >= 'a' && *value <= 'f') digit = *value - 'a' + 10;
+        else if (*value >= 'A' && *value <= 'F') digit = *value - 'A' + 10;
+        else break;
+        if (digit >= base) return 0;
+        number = number * (uint64_t)base + (uint64_t)digit;
+    }
+    while (IS_BLANK(*value)) value++;
+    if (*value != NULLCHAR) return 0;
+    return negative ? (int64_t)(0 - number) : (int64_t)number;
+}
+
+/**
+ * @brief Finds a variable's slot again when the one remembered may be gone
+ */
+static struct var *arith_slot(struct arith_var *v) {
+    if (v->generation != var_generation) {
+        v->slot = var_find(v->name);
+        v->generation = var_generation;
+    }
+    return v->slot;
+}
+
+/**
+ * @brief Assigns a number to a variable through its slot, or by name the first time
+ */
+static void arith_store(struct arith_var *v, int64_t value) {
+    char number[24];
+    snprintf(number, sizeof(number), "%lld", (long long)value);
+    struct var *slot = arith_slot(v);
+    if (slot != NULL) {
+        var_assign(slot, number);
+        return;
+    }
+    var_set(v->name, number);
+    v->slot = var_find(v->name); // NULL for PATH, which lives in the environment
+}
+
+/**
+ * @brief Evaluates a compiled expression
+ * @param result Set to its value
+ * @return 0, or -1 after reporting an error
+ */
+static int arith_run(struct arith *a, int64_t *result) {
+    if (a->error != NULL) {
+        fprintf(stderr, "JBash: %s: %s\n", a->text, a->error);
+        return -1;
+    }
+    int64_t stack[a->depth + 1];
+    int top = -1;
+    for (size_t pc = 0; pc < a->length; pc++) {
+        const struct arith_op *op = &a->code[pc];
+        int64_t x, y;
+        switch ((enum arith_code)op->code) {
+        case A_NUMBER: stack[++top] = op->value; break;
+        case A_VAR: {
+            struct arith_var *v = &a->vars[op->operand];
+            struct var *slot = arith_slot(v);
+            stack[++top] = arith_value(slot != NULL ? var_value(slot) : var_get(v->name));
+            break;
+        }
+        case A_POSITIONAL:
+            stack[++top] = op->operand <= session->positional_count ? arith_value(session->positional[op->operand - 1]) : 0;
+            break;
+        case A_EXPAND: {
+            const char *expanded = expand_word(a->vars[op->operand].name, 0, NULL);
+            if (expanded == NULL) return -1; // its own error is already printed
+            stack[++top] = arith_value(expanded);
+            break;
+        }
+        case A_ARGC: stack[++top] = (int64_t)session->positional_count; break;
+        case A_STATUS: stack[++top] = session->last_usage.status; break;
+        case A_STORE: arith_store(&a->vars[op->operand], stack[top]); break;
+        case A_DUP: stack[top + 1] = stack[top]; top++; break;
+        case A_POP: top--; break;
+        case A_NEGATE: stack[top] = (int64_t)(0 - (uint64_t)stack[top]); break;
+        case A_NOT: stack[top] = !stack[top]; break;
+        case A_COMPLEMENT: stack[top] = ~stack[top]; break;
+        case A_BOOL: stack[top] = stack[top] != 0; break;
+        case A_AND_JUMP:
+            if (stack[top] == 0) pc = op->operand - 1;
+            else top--;
+            break;
+        case A_OR_JUMP:
+            if (stack[top] != 0) {
+                stack[top] = 1;
+                pc = op->operand - 1;
+            } else {
+                top--;
+            }
+            break;
+        case A_JUMP_IF_ZERO:
+            if (stack[top--] == 0) pc = op->operand - 1;
+            break;
+        case A_JUMP: pc = op->operand - 1; break;
+        default: // binary operators
+            y = stack[top--];
+            x = stack[top];
+            switch ((enum arith_code)op->code) {
+            case A_POWER:
+                if (y < 0) {
+                    fprintf(stderr, "JBash: %s: exponent less than 0\n", a->text);
+                    return -1;
+                }
+                for (uint64_t base = (uint64_t)x, power = 1; ; base *= base) { // square and multiply, wrapping
+                    if (y & 1) power *= base;
+                    y >>= 1;
+                    if (y == 0) {
+                        x = (int64_t)power;
+                        break;
+                    }
+                }
+                break;
+            case A_MULTIPLY: x = (int64_t)((uint64_t)x * (uint64_t)y); break;
+            case A_DIVIDE:
+            case A_REMAINDER:
+                if (y == 0) {
+                    fprintf(stderr, "JBash: %s: division by 0\n", a->text);
+                    return -1;
+                }
+                if (y == -1) x = op->code == A_DIVIDE ? (int64_t)(0 - (uint64_t)x) : 0; // INT64_MIN / -1 wraps
+                else x = op->code == A_DIVIDE ? x / y : x % y;
+                break;
+            case A_ADD: x = (int64_t)((uint64_t)x + (uint64_t)y); break;
+            case A_SUBTRACT: x = (int64_t)((uint64_t)x - (uint64_t)y); break;
+            case A_SHIFT_LEFT: x = (int64_t)((uint64_t)x << (y & 63)); break;
+            case A_SHIFT_RIGHT: x >>= (y & 63); break;
+            case A_LESS: x = x < y; break;
+            case A_LESS_EQUAL: x = x <= y; break;
+            case A_GREATER: x = x > y; break;
+            case A_GREATER_EQUAL: x = x >= y; break;
+            case A_EQUAL: x = x == y; break;
+            case A_NOT_EQUAL: x = x != y; break;
+            case A_BIT_AND: x &= y; break;
+            case A_BIT_XOR: x ^= y; break;
+            case A_BIT_OR: x |= y; break;
+            default: break;
+            }
+            stack[top] = x;
+            break;
+        }
+    }
+    *result = top >= 0 ? stack[top] : 0;
+    return 0;
+}
+
+/**
+ * @brief Expands a $(( )) of a word
+ * @param next The word's next compiled expression, advanced past this one; one that is missing is compiled now, and freed
+ * @param word The word
+ * @param at The "$((" in the word
+ * @param length Set to the length of the $(( )), 0 when its parentheses are not balanced
+ * @return The value in decimal, in word_arena; NULL when unbalanced, or after an error (*length is not 0 then)
+ */
+const char *arith_expand(const struct arith **next, const char *word, const char *at, size_t *length) {
+    *length = arith_span(at);
+    if (*length == 0) return NULL;
+    // the expressions are in the order of the word, so expand_word() passes over the chain once
+    size_t offset = (size_t)(at - word);
+    while (*next != NULL && (*next)->offset < offset) *next = (*next)->next;
+    struct arith *a = (struct arith *)*next, *compiled = NULL;
+    if (a != NULL && a->offset == offset) *next = a->next;
+    else a = compiled = arith_compile(at + 3, *length - 5);
+    int64_t value;
+    int failed = arith_run(a, &value) == -1;
+    arith_free(compiled);
+    if (failed) return NULL;
+    char *number = arena_alloc(&session->word_arena, 24);
+    snprintf(number, 24, "%lld", (long long)value);
+    return number;
+}
+
+/**
+ * @brief Whether a word is a (( )) command
+ */
+int is_arith_command(const struct word *w) {
+    size_t length = strlen(w->text);
+    return w->quote == 0 && length >= 4 && strncmp(w->text, "((", 2) == 0 && arith_span(w->text) == length;
+}
+
+/**
+ * @brief Runs a (( )) command
+ * @param w The word, is_arith_command() said it is one
+ * @return Exit status: 0 when the expression is not 0, 1 when it is 0 or has an error
+ */
+int arith_command(const struct word *w) {
+    if (xtrace_enabled) {
+        char *argv[] = { w->text, NULL };
+        xtrace_command(argv);
+    }
+    struct arith *a = w->arith, *compiled = NULL;
+    if (a == NULL || a->offset != 0) a = compiled = arith_compile(w->text + 2, strlen(w->text) - 4);
+    int64_t value;
+    int failed = arith_run(a, &value) == -1;
+    arith_free(compiled);
+    return failed || value == 0;
+}
+
+/**
+ * @brief Evaluates an expression nobody compiled ahead, such as an array subscript
+ * A number or a lone variable name is read directly; anything else is
+ * compiled for this one evaluation.
+ * @param value Set to its value
+ * @return 0, or -1 after reporting an error
+ */
+int arith_evaluate(const char *text, int64_t *value) {
+    size_t length = strlen(text);
+    if (length > 0 && var_name_length(text) == length) {
+        *value = arith_value(var_get(text));
+        return 0;
+    }
+    if (length > 0 && strspn(text, "0123456789") == length) {
+        *value = arith_value(text);
+        return 0;
+    }
+    struct arith *a = arith_compile(text, length);
+    int rv = arith_run(a, value);
+    arith_free(a);
+    return rv;
+}
@@ -0,0 +1,642 @@
+/*******************************************************************************
+  @file         arrays.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file arrays.c
+ * @brief Indexed and associative arrays, and the declare builtin
+ *
+ * An indexed array is a vector of element strings, one pointer per index,
+ * with NULL for indexes never set. Appending is amortized constant time; an
+ * index more than ARRAY_GAP_MAX past the end is refused rather than filling
+ * the gap. An associative array keeps its entries in a vector in the order
+ * they were added and finds them through an open addressing table of entry
+ * numbers (linear probing, at most half full), so ${!NAME[@]} lists keys in
+ * insertion order and walking the entries touches contiguous memory.
+ *
+ * "${NAME[@]}" as a whole word becomes one argument per element, and the
+ * argument vector points at the elements themselves (make_argv). Commands
+ * that may assign arrays while they run, functions and declare, copy them
+ * first (argv_owned).
+ *
+ * NAME=(...) and NAME+=(...) assign lists whose elements are words or
+ * [SUBSCRIPT]=word. Subscripts of indexed arrays are arithmetic, negative
+ * ones counting back from the end; keys of associative arrays are strings.
+ */
+#include "JBash.h"
+
+/**
+ * One key and value of an associative array.
+ */
+struct assoc_entry {
+    char *key;
+    char *value;
+    uint64_t hash;
+};
+
+/**
+ * An array variable's elements.
+ */
+struct array {
+    int associative;
+    char **items;                 // indexed: element i, NULL when it was never set
+    size_t length;                // indexed: highest index set + 1
+    size_t count;                 // elements set
+    size_t capacity;              // of items, or of entries
+    struct assoc_entry *entries;  // associative: in the order they were added
+    uint32_t *slots;              // associative: entry number + 1, 0 for an empty slot
+    size_t slot_mask;             // slot table size - 1, a power of two
+};
+
+/**
+ * An element of a NAME=(...) list, expanded.
+ */
+struct list_item {
+    const char *subscript;        // from [SUBSCRIPT]=word, NULL for a plain word
+    const char *value;
+};
+
+/**
+ * @brief Allocates an empty array
+ */
+static struct array *array_new(int associative) {
+    struct array *a = safe_malloc(sizeof(struct array));
+    memset(a, 0, sizeof(struct array));
+    a->associative = associative;
+    return a;
+}
+
+/**
+ * @brief Frees an array and its elements
+ */
+void array_free(struct array *a) {
+    if (a == NULL) return;
+    if (a->associative) {
+        for (size_t i = 0; i < a->count; i++) {
+            free(a->entries[i].key);
+            free(a->entries[i].value);
+        }
+    } else {
+        for (size_t i = 0; i < a->length; i++) free(a->items[i]);
+    }
+    free(a->items);
+    free(a->entries);
+    free(a->slots);
+    free(a);
+}
+
+/**
+ * @brief A new element value: a copy of value, or old with value added for +=
+ */
+static char *element_value(const char *old, const char *value, int append) {
+    if (!append || old == NULL) return strdup(value);
+    size_t old_length = strlen(old), length = strlen(value);
+    char *joined = safe_malloc(old_length + length + 1);
+    memcpy(joined, old, old_length);
+    memcpy(&joined[old_length], value, length + 1);
+    return joined;
+}
+
+/**
+ * @brief Sets element index of an indexed array, growing the vector as needed
+ */
+static void indexed_set(struct array *a, size_t index, const char *value, int append) {
+    if (index >= a->capacity) {
+        size_t old = a->capacity;
+        if (a->capacity == 0) a->capacity = STR_BUFFER;
+        while (index >= a->capacity) a->capacity *= 2;
+        a->items = realloc(a->items, a->capacity * sizeof(char *));
+        if (a->items == NULL) {
+            fprintf(stderr, "Memory allocation failed for size %zu\n", a->capacity);
+            exit(EXIT_FAILURE);
+        }
+        memset(&a->items[old], 0, (a->capacity - old) * sizeof(char *));
+    }
+    char *old = a->items[index];
+    a->items[index] = element_value(old, value, append); // before the free: value may be the old element
+    free(old);
+    if (old == NULL) a->count++;
+    if (index >= a->length) a->length = index + 1;
+}
+
+/**
+ * @brief djb2 string hash, like the variable table's but kept at 64 bits
+ */
+static uint64_t key_hash(const char *key) {
+    uint64_t hash = 5381;
+    while (*key) hash = hash * 33 + (unsigned char)*key++;
+    return hash;
+}
+
+/**
+ * @brief Slot of a key in an associative array's table: the one holding it, or the empty one it would go in
+ * The hash is multiplied by 2^64 / phi first, so keys that differ in their last character spread out.
+ */
+static size_t assoc_slot(const struct array *a, const char *key, uint64_t hash) {
+    size_t i = (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> 32) & a->slot_mask;
+    for (;; i = (i + 1) & a->slot_mask) {
+        uint32_t slot = a->slots[i];
+        if (slot == 0) return i;
+        const struct assoc_entry *e = &a->entries[slot - 1];
+        if (e->hash == hash && strcmp(e->key, key) == 0) return i;
+    }
+}
+
+/**
+ * @brief Doubles an associative array's slot table and puts every entry back
+ */
+static void assoc_grow(struct array *a) {
+    size_t size = a->slots == NULL ? ARRAY_SLOTS_MIN : (a->slot_mask + 1) * 2;
+    free(a->slots);
+    a->slots = safe_malloc(size * sizeof(uint32_t));
+    memset(a->slots, 0, size * sizeof(uint32_t));
+    a->slot_mask = size - 1;
+    for (size_t i = 0; i < a->count; i++) {
+        a->slots[assoc_slot(a, a->entries[i].key, a->entries[i].hash)] = (uint32_t)(i + 1);
+    }
+}
+
+/**
+ * @brief Sets a key of an associative array, adding an entry for a new one
+ */
+static void assoc_set(struct array *a, const char *key, const char *value, int append) {
+    if (a->slots == NULL || (a->count + 1) * 2 > a->slot_mask + 1) assoc_grow(a);
+    uint64_t hash = key_hash(key);
+    size_t slot = assoc_slot(a, key, hash);
+    if (a->slots[slot] != 0) {
+        struct assoc_entry *e = &a->entries[a->slots[slot] - 1];
+        char *old = e->value;
+        e->value = element_value(old, value, append);
+        free(old);
+        return;
+    }
+    if (a->count == a->capacity) {
+        if (a->capacity == 0) a->capacity = STR_BUFFER / 2; // realloc_buffer doubles it
+        a->entries = realloc_buffer(a->entries, &a->capacity, sizeof(struct assoc_entry));
+    }
+    a->entries[a->count] = (struct assoc_entry){ strdup(key), strdup(value), hash };
+    a->slots[slot] = (uint32_t)++a->count;
+}
+
+/**
+ * @brief The value of a key of an associative array, NULL when it is not set
+ */
+static const char *assoc_get(const struct array *a, const char *key) {
+    if (a->slots == NULL) return NULL;
+    size_t slot = assoc_slot(a, key, key_hash(key));
+    return a->slots[slot] != 0 ? a->entries[a->slots[slot] - 1].value : NULL;
+}
+
+/**
+ * @brief The value an array has as a scalar: element 0, or key "0"
+ */
+const char *array_scalar(const struct array *a) {
+    if (a->associative) return assoc_get(a, "0");
+    return a->length > 0 ? a->items[0] : NULL;
+}
+
+/**
+ * @brief Assigns an array as a scalar, which sets element 0 (key "0")
+ */
+void array_assign_scalar(struct array *a, const char *value) {
+    if (a->associative) assoc_set(a, "0", value, 0);
+    else indexed_set(a, 0, value, 0);
+}
+
+/**
+ * @brief The array of a variable, making it one when it is not
+ * A variable that has a value (or an environment variable of that name) keeps it as element 0.
+ */
+static struct array *array_of(const char *name, int associative) {
+    struct var *v = var_find(name);
+    if (v != NULL && var_array(v) != NULL) return var_array(v);
+    struct array *a = array_new(associative);
+    const char *value = var_get(name);
+    if (value != NULL) array_assign_scalar(a, value);
+    var_set_array(name, a);
+    return a;
+}
+
+/**
+ * @brief The array of a variable, NULL when it is a scalar or not set
+ */
+static struct array *array_find(const char *name) {
+    struct var *v = var_find(name);
+    return v != NULL ? var_array(v) : NULL;
+}
+
+/**
+ * @brief The index an indexed array's subscript stands for; negative subscripts count back from the end
+ * @return 0, or -1 after reporting a bad subscript
+ */
+static int array_index(const struct array *a, const char *name, const char *subscript, size_t *index) {
+    int64_t value;
+    if (arith_evaluate(subscript, &value) == -1) return -1;
+    if (value < 0) value += (int64_t)a->length;
+    if (value < 0) {
+        fprintf(stderr, "JBash: %s[%s]: bad array subscript\n", name, subscript);
+        return -1;
+    }
+    *index = (size_t)value;
+    return 0;
+}
+
+/**
+ * @brief Sets one element: NAME[SUBSCRIPT]=value, or NAME[SUBSCRIPT]+=value
+ * A variable that is not an array becomes an indexed one.
+ * @return 0, or -1 after reporting an error
+ */
+int array_set_element(const char *name, const char *subscript, const char *value, int append) {
+    struct array *a = array_of(name, 0);
+    if (a->associative) {
+        assoc_set(a, subscript, value, append);
+        return 0;
+    }
+    size_t index;
+    if (array_index(a, name, subscript, &index) == -1) return -1;
+    if (index > a->length + ARRAY_GAP_MAX) {
+        fprintf(stderr, "JBash: %s[%s]: index too far past the end of the array\n", name, subscript);
+        return -1;
+    }
+    indexed_set(a, index, value, append);
+    return 0;
+}
+
+/**
+ * @brief A decimal index in word_arena
+ */
+static char *index_text(size_t index) {
+    char *number = arena_alloc(&session->word_arena, 24);
+    snprintf(number, 24, "%zu", index);
+    return number;
+}
+
+/**
+ * @brief Puts an array's values, or its keys (indexes), in fields, in order
+ * @param a The array, NULL for a scalar variable (one field when it is set)
+ */
+static void array_fields_of(const struct array *a, const char *name, int keys, char **fields) {
+    if (a == NULL) {
+        const char *value = var_get(name);
+        if (value != NULL) fields[0] = keys ? "0" : (char *)value;
+        return;
+    }
+    size_t n = 0;
+    if (a->associative) {
+        for (size_t i = 0; i < a->count; i++) fields[n++] = keys ? a->entries[i].key : a->entries[i].value;
+        return;
+    }
+    for (size_t i = 0; i < a->length; i++) {
+        if (a->items[i] != NULL) fields[n++] = keys ? index_text(i) : a->items[i];
+    }
+}
+
+/**
+ * @brief Expands ${NAME[SUBSCRIPT]}, ${NAME[@]}, ${NAME[*]}, ${#NAME[...]} and ${!NAME[@]}
+ * @ and * join the values (or keys, or indexes) with spaces; # counts the
+ * elements, or gives the length of one. A variable that is not an array
+ * is element 0.
+ * @param name The name, not null terminated
+ * @param subscript What is between the brackets, not null terminated; it is expanded first
+ * @param prefix '#', '!' or 0
+ * @return The value (empty for unset elements), or NULL when the reference is not a valid one
+ */
+const char *array_expand(const char *name, size_t name_length, const char *subscript, size_t subscript_length,
+                         char prefix) {
+    char *key = arena_alloc(&session->word_arena, name_length + subscript_length + 2);
+    memcpy(key, name, name_length);
+    key[name_length] = NULLCHAR;
+    char *sub = &key[name_length + 1];
+    memcpy(sub, subscript, subscript_length);
+    sub[subscript_length] = NULLCHAR;
+    int all = strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0;
+    if (prefix == '!' && !all) return NULL;
+    if (!all && strchr(sub, '$') != NULL && (sub = expand_word(sub, 0, NULL)) == NULL) return ""; // like a bad subscript
+
+    struct array *a = array_find(key);
+    if (all) {
+        size_t count = a != NULL ? a->count : var_get(key) != NULL;
+        if (prefix == '#') return index_text(count);
+        if (count == 0) return "";
+        char **fields = arena_alloc(&session->word_arena, count * sizeof(char *));
+        array_fields_of(a, key, prefix == '!', fields);
+        size_t total = count;
+        for (size_t i = 0; i < count; i++) total += strlen(fields[i]);
+        char *joined = arena_alloc(&session->word_arena, total), *out = joined;
+        for (size_t i = 0; i < count; i++) {
+            size_t length = strlen(fields[i]);
+            memcpy(out, fields[i], length);
+            out += length;
+            *out++ = ' ';
+        }
+        out[-1] = NULLCHAR;
+        return joined;
+    }
+
+    const char *value = NULL;
+    if (a != NULL && a->associative) {
+        value = assoc_get(a, sub);
+    } else {
+        size_t index;
+        struct array scalar = { 0 }; // a scalar is an array of one
+        scalar.length = var_get(key) != NULL;
+        const struct array *indexed = a != NULL ? a : &scalar;
+        if (array_index(indexed, key, sub, &index) == -1) return "";
+        if (a != NULL) value = index < a->length ? a->items[index] : NULL;
+        else if (index == 0) value = var_get(key);
+    }
+    if (prefix == '#') return index_text(value != NULL ? strlen(value) : 0);
+    return value != NULL ? value : "";
+}
+
+/**
+ * @brief Whether a word is "${NAME[@]}" or "${!NAME[@]}" alone, and its fields
+ * Such a word expands to one argument per element (or key) instead of one argument.
+ * @param fields Filled with pointers to the elements themselves (keys of indexed arrays are
+ *        in word_arena); NULL to only count them
+ * @return The number of fields, ARRAY_NOT_FIELDS when the word is not one of these
+ */
+size_t array_fields(const char *text, char quote, char **fields) {
+    if (quote == '\'' || text[0] != '$' || text[1] != '{') return ARRAY_NOT_FIELDS;
+    const char *name = &text[2];
+    int keys = *name == '!';
+    name += keys;
+    size_t name_length = var_name_length(name);
+    if (name_length == 0 || strcmp(&name[name_length], "[@]}") != 0) return ARRAY_NOT_FIELDS;
+    char key[name_length + 1];
+    memcpy(key, name, name_length);
+    key[name_length] = NULLCHAR;
+    struct array *a = array_find(key);
+    size_t count = a != NULL ? a->count : var_get(key) != NULL;
+    if (fields != NULL) array_fields_of(a, key, keys, fields);
+    return count;
+}
+
+/**
+ * @brief Whether a word assigns a list: NAME=(...) or NAME+=(...)
+ */
+int is_array_list(const struct word *w) {
+    if (w->quote != 0) return 0;
+    size_t name_length = var_name_length(w->text);
+    if (name_length == 0) return 0;
+    const char *list = &w->text[name_length];
+    if (*list == '+') list++;
+    size_t length = strlen(list);
+    return length >= 3 && list[0] == '=' && list[1] == '(' && list[length - 1] == ')';
+}
+
+/**
+ * @brief Appends text to a growing buffer
+ */
+static void buffer_add(char **buffer, size_t *length, size_t *capacity, const char *text, size_t size) {
+    while (*length + size + 1 > *capacity) *buffer = realloc_buffer(*buffer, capacity, sizeof(char));
+    memcpy(&(*buffer)[*length], text, size);
+    *length += size;
+    (*buffer)[*length] = NULLCHAR;
+}
+
+/**
+ * @brief Appends an item to the list being collected
+ */
+static void list_add(struct list_item **items, size_t *count, size_t *capacity, const char *subscript,
+                     const char *value) {
+    if (*count == *capacity) *items = realloc_buffer(*items, capacity, sizeof(struct list_item));
+    (*items)[(*count)++] = (struct list_item){ subscript, value };
+}
+
+/**
+ * @brief Assigns a list to an array: the elements of NAME=(...), NAME+=(...) or declare's NAME=(...)
+ * Words are separated by blanks and may be quoted in parts; an unquoted
+ * [SUBSCRIPT]= in front gives the element's index or key. The list is
+ * expanded completely before the array changes, so it may use the array.
+ * @param list The text between the parentheses, not null terminated
+ * @param append Non-zero for +=: indexed elements go after the last one
+ * @param expand Zero when the list was expanded already (declare's arguments)
+ */
+void array_assign_list(const char *name, const char *list, size_t length, int append, int expand) {
+    size_t count = 0, capacity = STR_BUFFER, word_length = 0, word_capacity = STR_BUFFER;
+    struct list_item *items = safe_malloc(capacity * sizeof(struct list_item));
+    char *word = safe_malloc(word_capacity);
+    const char *p = list, *end = list + length;
+    while (p < end) {
+        while (p < end && (IS_BLANK(*p) || *p == NEWLINE)) p++;
+        if (p == end) break;
+        const char *subscript = NULL;
+        int failed = 0; // an expansion of the word had an error, the element is left out
+        if (*p == '[') { // [SUBSCRIPT]=word
+            const char *close = p;
+            while (close < end && *close != ']' && !IS_BLANK(*close)) close++;
+            if (close + 1 < end && *close == ']' && close[1] == '=') {
+                char *sub = arena_alloc(&session->word_arena, (size_t)(close - p));
+                memcpy(sub, p + 1, (size_t)(close - p - 1));
+                sub[close - p - 1] = NULLCHAR;
+                subscript = expand ? expand_word(sub, 0, NULL) : sub;
+                failed = subscript == NULL;
+                p = close + 2;
+            }
+        }
+        // the word's parts: unquoted runs, "..." and '...', each expanded on its own
+        const char *start = p;
+        word_length = 0;
+        word[0] = NULLCHAR;
+        int parts = 0;
+        char last_quote = 0;
+        while (p < end && !IS_BLANK(*p) && *p != NEWLINE) {
+            char quote = (*p == '"' || *p == '\'') ? *p : 0;
+            const char *part = p + (quote != 0);
+            const char *stop = part;
+            if (quote) {
+                while (stop < end && *stop != quote) stop++;
+            } else {
+                while (stop < end && !IS_BLANK(*stop) && *stop != NEWLINE && *stop != '"' && *stop != '\'') stop++;
+            }
+            char *text = arena_alloc(&session->word_arena, (size_t)(stop - part) + 1);
+            memcpy(text, part, (size_t)(stop - part));
+            text[stop - part] = NULLCHAR;
+            const char *expanded = expand ? expand_word(text, quote, NULL) : text;
+            if (expanded == NULL) failed = 1;
+            else buffer_add(&word, &word_length, &word_capacity, expanded, strlen(expanded));
+            parts++;
+            last_quote = quote;
+            p = stop + (quote != 0 && stop < end);
+        }
+        if (failed) continue;
+        size_t fields = ARRAY_NOT_FIELDS;
+        if (expand && subscript == NULL && parts == 1) { // "${NAME[@]}" becomes its elements
+            char *text = arena_alloc(&session->word_arena, (size_t)(p - start) + 1);
+            size_t skip = last_quote != 0;
+            memcpy(text, start + skip, (size_t)(p - start) - 2 * skip);
+            text[p - start - 2 * skip] = NULLCHAR;
+            fields = array_fields(text, last_quote, NULL);
+            if (fields != ARRAY_NOT_FIELDS && fields > 0) {
+                char **values = arena_alloc(&session->word_arena, fields * sizeof(char *));
+                array_fields(text, last_quote, values);
+                for (size_t i = 0; i < fields; i++) list_add(&items, &count, &capacity, NULL, values[i]);
+            }
+        }
+        if (fields == ARRAY_NOT_FIELDS) {
+            char *value = arena_alloc(&session->word_arena, word_length + 1);
+            memcpy(value, word, word_length + 1);
+            list_add(&items, &count, &capacity, subscript, value);
+        }
+    }
+    free(word);
+
+    struct array *old = array_find(name);
+    int associative = old != NULL && old->associative;
+    struct array *a = append ? array_of(name, associative) : array_new(associative);
+    size_t next = a->length; // indexed: where the next plain word goes
+    for (size_t i = 0; i < count; i++) {
+        if (associative) {
+            if (items[i].subscript == NULL) {
+                fprintf(stderr, "JBash: %s: %s: must use a subscript when assigning an associative array\n",
+                        name, items[i].value);
+                continue;
+            }
+            assoc_set(a, items[i].subscript, items[i].value, 0);
+            continue;
+        }
+        size_t index = next;
+        if (items[i].subscript != NULL && array_index(a, name, items[i].subscript, &index) == -1) continue;
+        if (index > a->length + ARRAY_GAP_MAX) {
+            fprintf(stderr, "JBash: %s[%zu]: index too far past the end of the array\n", name, index);
+            continue;
+        }
+        indexed_set(a, index, items[i].value, 0);
+        next = index + 1;
+    }
+    free(items);
+    if (!append) var_set_array(name, a); // frees the old array, which the list may have used
+}
+
+/**
+ * @brief Runs a NAME=(...) or NAME+=(...) word that is_array_list() accepted
+ */
+void array_assign_word(const struct word *w) {
+    size_t name_length = var_name_length(w->text);
+    char name[name_length + 1];
+    memcpy(name, w->text, name_length);
+    name[name_length] = NULLCHAR;
+    int append = w->text[name_length] == '+';
+    const char *list = &w->text[name_length + append + 2]; // after "=("
+    array_assign_list(name, list, strlen(list) - 1, append, 1);
+}
+
+/**
+ * @brief Prints a value in double quotes, escaped so the shell reads it back
+ */
+static void print_quoted(const char *value) {
+    putchar('"');
+    for (; *value; value++) {
+        if (*value == '"' || *value == '\\' || *value == '$' || *value == '`') putchar('\\');
+        putchar(*value);
+    }
+    putchar('"');
+}
+
+/**
+ * @brief declare -p NAME: prints the variable as a declare command
+ * @return 0, or 1 when it is not set
+ */
+static int declare_print(const char *name) {
+    struct array *a = array_find(name);
+    if (a == NULL) {
+        const char *value = var_get(name);
+        if (value == NULL) {
+            fprintf(stderr, "declare: %s: not found\n", name);
+            return 1;
+        }
+        printf("declare %s %s=", var_find(name) != NULL ? "--" : "-x", name);
+        print_quoted(value);
+        putchar('\n');
+        return 0;
+    }
+    printf("declare -%c %s=(", a->associative ? 'A' : 'a', name);
+    size_t printed = 0;
+    size_t end = a->associative ? a->count : a->length;
+    for (size_t i = 0; i < end; i++) {
+        if (!a->associative && a->items[i] == NULL) continue;
+        if (printed++ > 0) putchar(' ');
+        if (a->associative) printf("[%s]=", a->entries[i].key);
+        else printf("[%zu]=", i);
+        print_quoted(a->associative ? a->entries[i].value : a->items[i]);
+    }
+    printf(")\n");
+    return 0;
+}
+
+/**
+ * @brief declare -a NAME / declare -A NAME: makes the variable an indexed or associative array
+ * @return 0, or -1 after reporting that its elements do not fit the other kind
+ */
+static int declare_type(const char *name, int associative) {
+    struct array *a = array_find(name);
+    if (a == NULL) {
+        array_of(name, associative);
+        return 0;
+    }
+    if (a->associative == associative) return 0;
+    if (a->count > 0) {
+        fprintf(stderr, "declare: %s: cannot convert %s array to %s array\n", name,
+                a->associative ? "associative" : "indexed", associative ? "associative" : "indexed");
+        return -1;
+    }
+    var_set_array(name, array_new(associative));
+    return 0;
+}
+
+/**
+ * @brief The declare builtin: "declare [-a|-A|-p] NAME[=VALUE]..."
+ * -a and -A make each NAME an indexed or an associative array; -p prints
+ * them as declare commands. A VALUE in parentheses assigns a list.
+ * @return 0, 1 when a name was not valid, 2 for a bad option
+ */
+int declare_builtin(char **args) {
+    args = argv_owned(args); // NAME=(...) may replace an array the other arguments point into
+    int type = 0, print = 0;
+    size_t i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != NULLCHAR; i++) {
+        for (const char *flag = &args[i][1]; *flag; flag++) {
+            if (*flag == 'a' || *flag == 'A') type = *flag;
+            else if (*flag == 'p') print = 1;
+            else {
+                fprintf(stderr, "declare: -%c: invalid option\nusage: declare [-a|-A|-p] NAME[=VALUE]...\n", *flag);
+                return 2;
+            }
+        }
+    }
+    if (args[i] == NULL) {
+        fprintf(stderr, "usage: declare [-a|-A|-p] NAME[=VALUE]...\n");
+        return 2;
+    }
+    int status = 0;
+    for (; args[i] != NULL; i++) {
+        if (print) {
+            status |= declare_print(args[i]);
+            continue;
+        }
+        size_t name_length = var_name_length(args[i]), equals = var_assignment(args[i]);
+        if (name_length == 0 || (args[i][name_length] != NULLCHAR && equals == 0)) {
+            fprintf(stderr, "declare: '%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        char name[name_length + 1];
+        memcpy(name, args[i], name_length);
+        name[name_length] = NULLCHAR;
+        if (type != 0 && declare_type(name, type == 'A') == -1) {
+            status = 1;
+            continue;
+        }
+        if (equals == 0) continue;
+        const char *value = &args[i][equals + 1];
+        size_t length = strlen(value);
+        if (args[i][name_length] != '[' && length >= 2 && value[0] == '(' && value[length - 1] == ')') {
+            array_assign_list(name, value + 1, length - 2, args[i][equals - 1] == '+', 0);
+        } else if (var_set_word(args[i]) == -1) {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,547 @@
+/*******************************************************************************
+  @file         autoload.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file autoload.c
+ * @brief Autoloaded function libraries and their on-disk index
+ *
+ * JBASH_AUTOLOAD is a colon separated list of directories of function
+ * libraries. Each regular file in them may define any number of functions;
+ * its other commands are never run. Nothing is sourced at startup: the first
+ * command name that is not a defined function maps each directory's index,
+ * and a name found there is parsed from its file (from the line it starts on)
+ * and defined the first time it is called. The first directory that has a
+ * name wins, and within a directory the last definition, like sourcing the
+ * files in name order would leave it.
+ *
+ * The index of a directory lives in the cache directory next to the parse
+ * images (rc.c), keyed by the directory's path, its mtime and the mtime and
+ * size of every file. When any of them changed (a file was edited, added,
+ * removed or renamed) the directory is scanned again and the index rewritten.
+ * A loaded index is checked again once per top-level command (command_serial),
+ * and a file is checked against its index before a definition is read from it,
+ * so a library edited while the shell runs is picked up by the next command.
+ *
+ * Index layout: header, files, entries sorted by name, then the string pool.
+ */
+#include "JBash.h"
+#include <dirent.h> // opendir, readdir
+
+#define AUTOLOAD_INDEX_MAGIC 0x4a424149u // "JBAI"
+
+/**
+ * Start of an index.
+ */
+struct index_header {
+    uint32_t magic;        // AUTOLOAD_INDEX_MAGIC
+    uint32_t file_count;
+    uint64_t build_id;     // shell that wrote it; another build may parse differently
+    uint64_t size;         // index size
+    int64_t mtime_sec;     // the directory when it was scanned
+    int64_t mtime_nsec;
+    uint32_t directory;    // string offset of the directory path, guards against hash collisions
+    uint32_t entry_count;
+};
+
+/**
+ * One library file of the directory.
+ */
+struct index_file {
+    uint32_t name;         // string offset of the file name within the directory
+    uint32_t unused;
+    int64_t mtime_sec;     // the file when it was scanned
+    int64_t mtime_nsec;
+    uint64_t size;
+};
+
+/**
+ * One function: where its definition starts.
+ */
+struct index_entry {
+    uint64_t offset;       // byte offset of the line the definition starts on
+    uint32_t name;         // string offset of the function name
+    uint32_t file;         // index into the files
+    uint32_t line;         // line number of that line
+    uint32_t unused;
+};
+
+/**
+ * An index being built by scanning a directory.
+ */
+struct index_builder {
+    struct index_file *files;
+    size_t file_count, file_capacity;
+    struct index_entry *entries;
+    size_t entry_count, entry_capacity;
+    char *pool;
+    size_t pool_length, pool_capacity;
+};
+
+/**
+ * The index of one JBASH_AUTOLOAD directory.
+ */
+struct autoload_dir {
+    char *path;
+    const char *index;     // mapped from the cache, or built in memory
+    size_t size;
+    int mapped;
+    struct autoload_dir *next;
+};
+
+static struct autoload_dir *autoload_dirs = NULL;
+static char *loaded_for = NULL; // JBASH_AUTOLOAD the indexes were loaded for
+static uint64_t checked_serial = 0; // command_serial when the indexes were last checked against their directories
+
+/**
+ * A library file being scanned: the byte offset of every line read.
+ */
+struct scan_reader {
+    FILE *in;
+    uint64_t *offsets;
+    size_t count, capacity;
+};
+
+/**
+ * @brief line_source callback while scanning: reads the next line and remembers where it started
+ */
+static int scan_read(struct line_source *source) {
+    struct scan_reader *reader = source->context;
+    off_t offset = ftello(reader->in);
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length = getline(&line, &capacity, reader->in);
+    if (length == -1) {
+        free(line);
+        return 0;
+    }
+    if (reader->count == reader->capacity) {
+        if (reader->capacity == 0) reader->capacity = CMD_LINE_BUFFER / 2; // realloc_buffer doubles it
+        reader->offsets = realloc_buffer(reader->offsets, &reader->capacity, sizeof(uint64_t));
+    }
+    reader->offsets[reader->count++] = (uint64_t)offset;
+    if (length > 0 && line[length - 1] == NEWLINE) line[--length] = NULLCHAR;
+    source->number++;
+    line_source_split(source, line, (size_t)length);
+    return 1;
+}
+
+/**
+ * @brief Appends a string to the index's pool
+ * @return Its offset within the pool
+ */
+static uint32_t builder_string(struct index_builder *b, const char *s) {
+    size_t length = strlen(s) + 1;
+    while (b->pool_length + length > b->pool_capacity) b->pool = realloc_buffer(b->pool, &b->pool_capacity, sizeof(char));
+    memcpy(&b->pool[b->pool_length], s, length);
+    b->pool_length += length;
+    return (uint32_t)(b->pool_length - length);
+}
+
+/**
+ * @brief Adds the functions a library file defines at its top level to the index
+ * @param in The file, read from the start
+ * @param path Its path, for syntax errors
+ * @param file Its index in the builder's files
+ */
+static void scan_file(struct index_builder *b, FILE *in, const char *path, uint32_t file) {
+    struct scan_reader reader = { in, NULL, 0, 0 };
+    struct line_source source;
+    line_source_init(&source, scan_read, &reader, path);
+    struct node *command;
+    while ((command = parse_command(&source)) != NULL || !source.ended) {
+        for (struct node *n = command; n != NULL; n = n->next) {
+            if (n->type != NODE_FUNCTION || n->line == 0 || n->line > reader.count) continue;
+            if (b->entry_count == b->entry_capacity) {
+                b->entries = realloc_buffer(b->entries, &b->entry_capacity, sizeof(struct index_entry));
+            }
+            b->entries[b->entry_count++] = (struct index_entry){ reader.offsets[n->line - 1], builder_string(b, n->name),
+                                                                 file, n->line, 0 };
+        }
+        node_free(command);
+    }
+    line_source_free(&source);
+    free(reader.offsets);
+}
+
+static const char *sort_pool; // the pool entries are sorted against
+
+/**
+ * @brief qsort comparator of entries: by name, then by where they are defined
+ */
+static int entry_order(const void *a, const void *b) {
+    const struct index_entry *x = a, *y = b;
+    int names = strcmp(&sort_pool[x->name], &sort_pool[y->name]);
+    if (names != 0) return names;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/**
+ * @brief qsort comparator of file names
+ */
+static int name_order(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Scans a directory's library files into an index
+ * @param dir Absolute path of the directory
+ * @param dir_st Its stat, for the key
+ * @param size Set to the index size
+ * @return The index, to be freed by the caller
+ */
+static char *index_build(const char *dir, const struct stat *dir_st, size_t *size) {
+    struct index_builder b = { NULL, 0, CMD_LINE_BUFFER, NULL, 0, CMD_LINE_BUFFER, NULL, 0, STR_BUFFER };
+    b.files = safe_malloc(b.file_capacity * sizeof(struct index_file));
+    b.entries = safe_malloc(b.entry_capacity * sizeof(struct index_entry));
+    b.pool = safe_malloc(b.pool_capacity);
+    uint32_t dir_offset = builder_string(&b, dir);
+
+    // file names in order, so a later file's definition wins like it would when sourcing them all
+    char **names = NULL;
+    size_t name_count = 0, name_capacity = 0;
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d != NULL && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        if (name_count == name_capacity) {
+            if (name_capacity == 0) name_capacity = CMD_LINE_BUFFER / 2; // realloc_buffer doubles it
+            names = realloc_buffer(names, &name_capacity, sizeof(char *));
+        }
+        names[name_count++] = strdup(e->d_name);
+    }
+    if (d != NULL) closedir(d);
+    if (name_count > 0) qsort(names, name_count, sizeof(char *), name_order);
+
+    for (size_t i = 0; i < name_count; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        FILE *in = fopen(path, "r");
+        struct stat st;
+        if (in != NULL && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)) {
+            if (b.file_count == b.file_capacity) b.files = realloc_buffer(b.files, &b.file_capacity, sizeof(struct index_file));
+            uint32_t file = (uint32_t)b.file_count++;
+            b.files[file] = (struct index_file){ builder_string(&b, names[i]), 0, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+                                                 (uint64_t)st.st_size };
+            scan_file(&b, in, path, file);
+        }
+        if (in != NULL) fclose(in);
+        free(names[i]);
+    }
+    free(names);
+
+    // sorted by name for binary search; of several definitions of a name only the last is kept
+    sort_pool = b.pool;
+    if (b.entry_count > 0) qsort(b.entries, b.entry_count, sizeof(struct index_entry), entry_order);
+    size_t kept = 0;
+    for (size_t i = 0; i < b.entry_count; i++) {
+        if (kept > 0 && strcmp(&b.pool[b.entries[kept - 1].name], &b.pool[b.entries[i].name]) == 0) kept--;
+        b.entries[kept++] = b.entries[i];
+    }
+    b.entry_count = kept;
+
+    size_t files_at = sizeof(struct index_header);
+    size_t entries_at = files_at + b.file_count * sizeof(struct index_file);
+    size_t strings = entries_at + b.entry_count * sizeof(struct index_entry);
+    *size = strings + b.pool_length + 1;
+    char *index = safe_malloc(*size);
+    struct index_header header = { AUTOLOAD_INDEX_MAGIC, (uint32_t)b.file_count, cache_build_id(), *size,
+                                   dir_st->st_mtim.tv_sec, dir_st->st_mtim.tv_nsec, (uint32_t)(dir_offset + strings),
+                                   (uint32_t)b.entry_count };
+    for (size_t i = 0; i < b.file_count; i++) b.files[i].name += (uint32_t)strings;
+    for (size_t i = 0; i < b.entry_count; i++) b.entries[i].name += (uint32_t)strings;
+    memcpy(index, &header, sizeof(header));
+    memcpy(&index[files_at], b.files, b.file_count * sizeof(struct index_file));
+    memcpy(&index[entries_at], b.entries, b.entry_count * sizeof(struct index_entry));
+    memcpy(&index[strings], b.pool, b.pool_length);
+    index[*size - 1] = NULLCHAR;
+    free(b.files);
+    free(b.entries);
+    free(b.pool);
+    return index;
+}
+
+/**
+ * @brief The files of an index
+ */
+static const struct index_file *index_files(const char *index) {
+    return (const struct index_file *)&index[sizeof(struct index_header)];
+}
+
+/**
+ * @brief The entries of an index
+ */
+static const struct index_entry *index_entries(const char *index) {
+    const struct index_header *header = (const struct index_header *)index;
+    return (const struct index_entry *)&index_files(index)[header->file_count];
+}
+
+/**
+ * @brief Checks an index against its directory, bounds included
+ * Every file is stat'ed: an edit changes the file's mtime, anything else the directory's.
+ */
+static int index_valid(const char *index, size_t size, const char *dir, const struct stat *dir_st) {
+    const struct index_header *header = (const struct index_header *)index;
+    if (size < sizeof(struct index_header) || header->magic != AUTOLOAD_INDEX_MAGIC || header->size != size ||
+        header->build_id != cache_build_id() || header->mtime_sec != dir_st->st_mtim.tv_sec ||
+        header->mtime_nsec != dir_st->st_mtim.tv_nsec || index[size - 1] != NULLCHAR) {
+        return 0;
+    }
+    if (header->file_count > size / sizeof(struct index_file) || header->entry_count > size / sizeof(struct index_entry) ||
+        sizeof(struct index_header) + header->file_count * sizeof(struct index_file) +
+        header->entry_count * sizeof(struct index_entry) > size || header->directory >= size ||
+        strcmp(&index[header->directory], dir) != 0) {
+        return 0;
+    }
+    const struct index_file *files = index_files(index);
+    const struct index_entry *entries = index_entries(index);
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        if (entries[i].name >= size || entries[i].file >= header->file_count) return 0;
+    }
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) return 0;
+    int valid = 1;
+    for (uint32_t i = 0; valid && i < header->file_count; i++) {
+        struct stat st;
+        valid = files[i].name < size && fstatat(dir_fd, &index[files[i].name], &st, 0) == 0 &&
+                files[i].mtime_sec == st.st_mtim.tv_sec && files[i].mtime_nsec == st.st_mtim.tv_nsec &&
+                files[i].size == (uint64_t)st.st_size;
+    }
+    close(dir_fd);
+    return valid;
+}
+
+/**
+ * @brief Maps a directory's index from the cache, or scans the directory and caches a new one
+ * @param dir Directory named by JBASH_AUTOLOAD
+ * @return The directory's index, or NULL when it is not a directory
+ */
+static struct autoload_dir *index_load(const char *dir) {
+    uint64_t begun = startup_begin();
+    char *path = realpath(dir, NULL);
+    struct stat dir_st;
+    if (path == NULL || stat(path, &dir_st) == -1 || !S_ISDIR(dir_st.st_mode)) {
+        free(path);
+        return NULL;
+    }
+    struct autoload_dir *loaded = safe_malloc(sizeof(struct autoload_dir));
+    *loaded = (struct autoload_dir){ path, NULL, 0, 0, NULL };
+
+    char cached[PATH_MAX];
+    if (cache_path(path, "jbi", cached, sizeof(cached), 0) == 0) {
+        int fd = open(cached, O_RDONLY | O_CLOEXEC);
+        struct stat cst;
+        if (fd != -1 && fstat(fd, &cst) == 0 && cst.st_size > 0) {
+            size_t size = (size_t)cst.st_size;
+            void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED && index_valid(mapped, size, path, &dir_st)) {
+                loaded->index = mapped;
+                loaded->size = size;
+                loaded->mapped = 1;
+            } else if (mapped != MAP_FAILED) {
+                munmap(mapped, size);
+            }
+        }
+        if (fd != -1) close(fd);
+    }
+    if (loaded->index == NULL) {
+        TRACE_BEGIN("autoload_index");
+        loaded->index = index_build(path, &dir_st, &loaded->size);
+        TRACE_END("autoload_index");
+        if (cache_path(path, "jbi", cached, sizeof(cached), 1) == 0) cache_store(cached, loaded->index, loaded->size);
+    }
+    startup_end(path, begun);
+    return loaded;
+}
+
+/**
+ * @brief Frees a loaded index
+ */
+static void dir_free(struct autoload_dir *dir) {
+    if (dir->mapped) munmap((void *)dir->index, dir->size);
+    else free((void *)dir->index);
+    free(dir->path);
+    free(dir);
+}
+
+/**
+ * @brief Forgets the indexes; the next lookup checks the directories again
+ * Called by "hash -r", and when JBASH_AUTOLOAD changes.
+ */
+void autoload_forget(void) {
+    while (autoload_dirs != NULL) {
+        struct autoload_dir *next = autoload_dirs->next;
+        dir_free(autoload_dirs);
+        autoload_dirs = next;
+    }
+    free(loaded_for);
+    loaded_for = NULL;
+}
+
+/**
+ * @brief Loads again the index of every directory whose files changed since it was loaded
+ * A directory that is gone is dropped.
+ */
+static void autoload_refresh(void) {
+    struct autoload_dir **link = &autoload_dirs;
+    while (*link != NULL) {
+        struct autoload_dir *dir = *link;
+        struct stat st;
+        if (stat(dir->path, &st) == 0 && S_ISDIR(st.st_mode) && index_valid(dir->index, dir->size, dir->path, &st)) {
+            link = &dir->next;
+            continue;
+        }
+        struct autoload_dir *reloaded = index_load(dir->path);
+        if (reloaded != NULL) {
+            reloaded->next = dir->next;
+            *link = reloaded;
+            link = &reloaded->next;
+        } else {
+            *link = dir->next;
+        }
+        dir_free(dir);
+    }
+    checked_serial = command_serial;
+}
+
+/**
+ * @brief Loads the index of every JBASH_AUTOLOAD directory, unless they are loaded for its current value
+ * Indexes that are loaded already are checked against their directories once per top-level command.
+ * @return 0 when JBASH_AUTOLOAD is unset or empty
+ */
+static int autoload_ready(void) {
+    const char *setting = var_get("JBASH_AUTOLOAD");
+    if (setting == NULL || setting[0] == NULLCHAR) {
+        if (loaded_for != NULL) autoload_forget();
+        return 0;
+    }
+    if (loaded_for != NULL && strcmp(loaded_for, setting) == 0) {
+        if (checked_serial != command_serial) autoload_refresh();
+        return 1;
+    }
+    autoload_forget();
+    loaded_for = strdup(setting);
+    checked_serial = command_serial;
+    struct autoload_dir **tail = &autoload_dirs;
+    char dirs[strlen(setting) + 1];
+    strcpy(dirs, setting);
+    for (char *dir = strtok(dirs, ":"); dir != NULL; dir = strtok(NULL, ":")) {
+        struct autoload_dir *loaded = index_load(dir);
+        if (loaded == NULL) continue;
+        *tail = loaded;
+        tail = &loaded->next;
+    }
+    return 1;
+}
+
+/**
+ * @brief Binary search of an index for a function name
+ * @return The entry, or NULL when the directory does not define the function
+ */
+static const struct index_entry *index_find(const char *index, const char *name) {
+    const struct index_header *header = (const struct index_header *)index;
+    const struct index_entry *entries = index_entries(index);
+    size_t low = 0, high = header->entry_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(name, &index[entries[middle].name]);
+        if (order == 0) return &entries[middle];
+        if (order < 0) high = middle;
+        else low = middle + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Parses a function from its library file, starting at the line the index recorded
+ * Commands around the definition are parsed past, never run.
+ * @return 1 when the function was defined, -1 when the file changed since it was indexed
+ */
+static int autoload_define(const struct autoload_dir *dir, const struct index_entry *entry, const char *name) {
+    const struct index_file *file = &index_files(dir->index)[entry->file];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir->path, &dir->index[file->name]);
+    FILE *in = fopen(path, "r");
+    struct stat st;
+    if (in != NULL && fstat(fileno(in), &st) == 0 && (file->mtime_sec != st.st_mtim.tv_sec ||
+        file->mtime_nsec != st.st_mtim.tv_nsec || file->size != (uint64_t)st.st_size)) {
+        fclose(in); // edited during this command: the offset may point anywhere now
+        return -1;
+    }
+    if (in == NULL || fseeko(in, (off_t)entry->offset, SEEK_SET) == -1) {
+        fprintf(stderr, "JBash: autoload: %s: %s\n", path, strerror(errno));
+        if (in != NULL) fclose(in);
+        return 0;
+    }
+    TRACE_BEGIN("autoload");
+    struct line_source source;
+    line_source_stream(&source, in, path);
+    source.number = entry->line - 1; // so profiler frames and errors have the file's line numbers
+    int defined = 0;
+    struct node *command;
+    while (!defined && ((command = parse_command(&source)) != NULL || !source.ended)) {
+        for (struct node *n = command; n != NULL && !defined; n = n->next) {
+            if (n->type == NODE_FUNCTION && strcmp(n->name, name) == 0) {
+                function_define(n);
+                defined = 1;
+            }
+        }
+        node_free(command);
+    }
+    line_source_free(&source);
+    fclose(in);
+    TRACE_END("autoload");
+    return defined;
+}
+
+/**
+ * @brief Defines a function from the autoload directories the first time its name is looked up
+ * @param name Command name that is not a defined function
+ * @return The function, or NULL when no directory defines it
+ */
+struct function *autoload_find(const char *name) {
+    if (!autoload_ready()) return NULL;
+    for (struct autoload_dir *dir = autoload_dirs; dir != NULL; dir = dir->next) {
+        const struct index_entry *entry = index_find(dir->index, name);
+        if (entry == NULL) continue;
+        int defined = autoload_define(dir, entry, name);
+        if (defined == -1) { // the index is out of date: load it again and look the name up once more
+            autoload_refresh();
+            dir = autoload_dirs;
+            while (dir != NULL && (entry = index_find(dir->index, name)) == NULL) dir = dir->next;
+            defined = dir != NULL && autoload_define(dir, entry, name) == 1;
+        }
+        if (!defined) return NULL;
+        return function_find(name);
+    }
+    return NULL;
+}
+
+/**
+ * @brief The autoload builtin: lists the functions of the autoload directories and where they are defined
+ * A function that is already defined is marked with '*'.
+ * @return Exit status: 1 when JBASH_AUTOLOAD is not set
+ */
+int autoload_builtin(char **args) {
+    if (args[1] != NULL) {
+        fprintf(stderr, "usage: autoload\n");
+        return 2;
+    }
+    if (!autoload_ready()) {
+        fprintf(stderr, "autoload: JBASH_AUTOLOAD is not set\n");
+        return 1;
+    }
+    for (struct autoload_dir *dir = autoload_dirs; dir != NULL; dir = dir->next) {
+        const struct index_header *header = (const struct index_header *)dir->index;
+        const struct index_file *files = index_files(dir->index);
+        const struct index_entry *entries = index_entries(dir->index);
+        for (uint32_t i = 0; i < header->entry_count; i++) {
+            const char *name = &dir->index[entries[i].name];
+            printf("%c %s\t%s/%s:%u\n", function_defined(name) ? '*' : ' ', name, dir->path,
+                   &dir->index[files[entries[i].file].name], entries[i].line);
+        }
+    }
+    return 0;
+}
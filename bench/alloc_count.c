@@ -0,0 +1,138 @@
+/*******************************************************************************
+  @file         alloc_count.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file alloc_count.c
+ * @brief Counting allocator, loaded into the shell with LD_PRELOAD by the soak test
+ *
+ * malloc, calloc, realloc, free and the aligned variants are interposed and
+ * forwarded to glibc's own implementations (__libc_malloc and friends, which
+ * avoids the dlsym bootstrapping problem). Calls and live bytes are counted in
+ * a shared mapping of the file named by JBASH_ALLOC_COUNTERS, so the soak
+ * harness can read them at any point without the shell's help.
+ *
+ * Only the first process to open the file counts: forked children stop
+ * counting at fork, and programs they exec find the file already claimed.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>     // malloc_usable_size
+#include <pthread.h>    // pthread_atfork
+#include <sys/mman.h>
+
+#include "alloc_count.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static struct alloc_counters *counters = NULL; // NULL while not counting
+
+/**
+ * @brief Counts a new block
+ */
+static void count_alloc(void *ptr) {
+    if (counters == NULL || ptr == NULL) return;
+    __atomic_add_fetch(&counters->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->live_bytes, (int64_t)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts a block about to be released
+ */
+static void count_free(void *ptr) {
+    if (counters == NULL || ptr == NULL) return;
+    __atomic_add_fetch(&counters->frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&counters->live, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&counters->live_bytes, (int64_t)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) {
+    void *ptr = __libc_calloc(count, size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    size_t old_size = malloc_usable_size(ptr);
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (counters != NULL && new_ptr != NULL) {
+        __atomic_add_fetch(&counters->reallocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&counters->live_bytes, (int64_t)malloc_usable_size(new_ptr) - (int64_t)old_size,
+                           __ATOMIC_RELAXED);
+    }
+    return new_ptr;
+}
+
+void free(void *ptr) {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) {
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL) return ENOMEM;
+    *result = ptr;
+    return 0;
+}
+
+/**
+ * @brief A forked child is not the process being measured
+ */
+static void stop_counting(void) {
+    counters = NULL;
+}
+
+/**
+ * @brief Maps the counters file and claims it for this process
+ */
+__attribute__((constructor))
+static void alloc_count_init(void) {
+    const char *path = getenv("JBASH_ALLOC_COUNTERS");
+    if (path == NULL || path[0] == '\0') return;
+    int fd = open(path, O_RDWR);
+    if (fd == -1) return;
+    struct alloc_counters *map = mmap(NULL, sizeof(struct alloc_counters), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+    int32_t unclaimed = 0;
+    if (!__atomic_compare_exchange_n(&map->owner, &unclaimed, (int32_t)getpid(), 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(map, sizeof(struct alloc_counters)); // a command the shell ran
+        return;
+    }
+    pthread_atfork(NULL, NULL, stop_counting);
+    counters = map;
+}
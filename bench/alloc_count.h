@@ -0,0 +1,28 @@
+/*******************************************************************************
+  @file         alloc_count.h
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file alloc_count.h
+ * @brief Layout of the counters file shared by alloc_count.so and the soak harness
+ */
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stdint.h>
+
+/**
+ * Allocation counters of the measured process, in a MAP_SHARED file mapping.
+ */
+struct alloc_counters {
+    int32_t owner;        // pid of the counting process, 0 until one claims the file
+    int32_t padding;
+    uint64_t allocs;      // malloc, calloc and aligned allocations
+    uint64_t reallocs;
+    uint64_t frees;
+    int64_t live;         // blocks not yet freed
+    int64_t live_bytes;   // usable bytes of those blocks
+};
+
+#endif
@@ -0,0 +1,708 @@
+/*******************************************************************************
+  @file         bench.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file bench.c
+ * @brief JBash benchmark suite, run with "make bench"
+ *
+ * Links libjbash for the in-process benchmarks and runs the JBash binary for
+ * the end-to-end ones.
+ *
+ * Every result is one line of tab separated fields, so runs can be diffed or
+ * loaded into a spreadsheet:
+ *   bench <TAB> metric <TAB> value <TAB> unit
+ * Names and units never change between runs; add new lines rather than
+ * changing existing ones. Some results have a budget; when one is missed jbench
+ * says so on stderr and exits with a failure ("make startup-check").
+ *
+ * Usage: jbench [path to JBash] [benchmark name ...]
+ */
+#define _GNU_SOURCE // posix_openpt, ptsname
+#include "../JBash.h"
+#include <spawn.h> // posix_spawn
+#include <dirent.h> // opendir, to clean up temporary directories
+
+#define STARTUP_BUDGET_MS 10.0 // p50 of "JBash -c true" and of time to first prompt must stay under this
+
+extern char **environ;
+
+static const char *jbash = "./JBash"; // binary under test
+static int budget_failures = 0; // checks that went over budget, jbench then exits with 1
+
+/**
+ * @brief Prints one result line
+ */
+static void result(const char *bench, const char *metric, double value, const char *unit) {
+    printf("%s\t%s\t%.3f\t%s\n", bench, metric, value, unit);
+    fflush(stdout);
+}
+
+/**
+ * @brief qsort comparator for uint64_t samples
+ */
+static int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Prints mean, p50, p99 and max of latency samples in microseconds
+ * @return The p50, in nanoseconds
+ */
+static uint64_t latency_results(const char *bench, uint64_t *samples, size_t count) {
+    qsort(samples, count, sizeof(uint64_t), compare_samples);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) sum += samples[i];
+    result(bench, "mean", sum / (double)count / 1e3, "us");
+    result(bench, "p50", samples[count / 2] / 1e3, "us");
+    result(bench, "p99", samples[count * 99 / 100] / 1e3, "us");
+    result(bench, "max", samples[count - 1] / 1e3, "us");
+    return samples[count / 2];
+}
+
+/**
+ * @brief Checks a p50 against its budget, printing it as a result line
+ * A miss is reported on stderr and makes jbench exit with a failure.
+ */
+static void check_budget(const char *bench, uint64_t p50_ns, double budget_ms) {
+    result(bench, "budget", budget_ms, "ms");
+    if (p50_ns / 1e6 > budget_ms) {
+        fprintf(stderr, "jbench: %s p50 %.3f ms is over its %.0f ms budget\n", bench, p50_ns / 1e6, budget_ms);
+        budget_failures++;
+    }
+}
+
+/**
+ * @brief Runs the JBash binary with arguments, stdout and stderr sent to /dev/null
+ * @return Nanoseconds from spawn to reaping it
+ */
+static uint64_t run_jbash(char *const argv[]) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    uint64_t start = monotonic_ns();
+    pid_t pid;
+    if (posix_spawn(&pid, jbash, &actions, NULL, argv, environ) != 0) {
+        perror(jbash);
+        exit(EXIT_FAILURE);
+    }
+    waitpid(pid, NULL, 0);
+    uint64_t elapsed = monotonic_ns() - start;
+    posix_spawn_file_actions_destroy(&actions);
+    return elapsed;
+}
+
+/**
+ * @brief Tokenizer throughput: tokenize() over a mix of synthetic command lines
+ */
+static void bench_tokenize(void) {
+    static const char *lines[] = {
+        "ls -la /usr/local/bin",
+        "grep -rn \"some pattern\" src include   docs",
+        "echo $HOME ${PATH} $? 'not $expanded' plain words here",
+        "cat file.txt | sort -n | uniq -c | sort -rn | head -20",
+        "make      -j8     CFLAGS=-O2     all      ;      true",
+        "git commit -m 'a longer message with several words in it' && git push || echo failed",
+    };
+    size_t kinds = sizeof(lines) / sizeof(lines[0]);
+    size_t iterations = 200000, bytes = 0, words = 0;
+
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        const char *line = lines[i % kinds];
+        size_t length = strlen(line);
+        session->input = safe_malloc(length + 1);
+        memcpy(session->input, line, length + 1);
+        session->args = tokenize(length);
+        for (char **arg = session->args; *arg != NULL; arg++) words++;
+        free_args(session->args);
+        session->args = NULL;
+        bytes += length;
+    }
+    double seconds = (monotonic_ns() - start) / 1e9;
+    result("tokenize", "throughput", bytes / seconds / 1e6, "MB/s");
+    result("tokenize", "lines", iterations / seconds, "lines/s");
+    result("tokenize", "words", words / seconds, "words/s");
+}
+
+/**
+ * @brief Allocation behaviour: realloc_buffer growth and the word arena against malloc/free
+ */
+static void bench_alloc(void) {
+    // grow a line buffer the way parse() does, one character at a time, up to 1 MiB
+    size_t target = 1 << 20, reallocs = 0, rounds = 20;
+    uint64_t start = monotonic_ns();
+    for (size_t round = 0; round < rounds; round++) {
+        size_t capacity = STR_BUFFER;
+        char *buffer = safe_malloc(capacity);
+        for (size_t length = 0; length < target; length++) {
+            if (length + 1 >= capacity) {
+                buffer = realloc_buffer(buffer, &capacity, sizeof(char));
+                reallocs++;
+            }
+            buffer[length] = 'x';
+        }
+        free(buffer);
+    }
+    double seconds = (monotonic_ns() - start) / 1e9;
+    result("realloc_buffer", "growth", (double)target * rounds / seconds / 1e6, "MB/s");
+    result("realloc_buffer", "reallocs", (double)reallocs / rounds, "per_MiB");
+
+    // small allocations that live until the end of a command
+    size_t allocations = 2000000, per_command = 64;
+    start = monotonic_ns();
+    for (size_t i = 0; i < allocations; i++) {
+        char *word = arena_alloc(&session->word_arena, 16 + i % 48);
+        word[0] = 'x';
+        if (i % per_command == per_command - 1) arena_reset(&session->word_arena);
+    }
+    arena_reset(&session->word_arena);
+    result("arena", "alloc", (monotonic_ns() - start) / (double)allocations, "ns/alloc");
+
+    char *words[64];
+    start = monotonic_ns();
+    for (size_t i = 0; i < allocations; i++) {
+        words[i % per_command] = safe_malloc(16 + i % 48);
+        words[i % per_command][0] = 'x';
+        if (i % per_command == per_command - 1) {
+            for (size_t k = 0; k < per_command; k++) free(words[k]);
+        }
+    }
+    result("malloc", "alloc", (monotonic_ns() - start) / (double)allocations, "ns/alloc");
+}
+
+/**
+ * @brief Spawn latency of /bin/true with fork, vfork and posix_spawn, spawn to reaped
+ */
+static void bench_spawn(void) {
+    size_t iterations = 500;
+    uint64_t *samples = safe_malloc(iterations * sizeof(uint64_t));
+    char *argv[] = { "true", NULL };
+
+    for (size_t i = 0; i < iterations; i++) {
+        uint64_t start = monotonic_ns();
+        pid_t pid = fork();
+        if (pid == 0) {
+            execv("/bin/true", argv);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+        samples[i] = monotonic_ns() - start;
+    }
+    latency_results("spawn_fork", samples, iterations);
+
+    for (size_t i = 0; i < iterations; i++) {
+        uint64_t start = monotonic_ns();
+        pid_t pid = vfork();
+        if (pid == 0) {
+            execv("/bin/true", argv);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+        samples[i] = monotonic_ns() - start;
+    }
+    latency_results("spawn_vfork", samples, iterations);
+
+    for (size_t i = 0; i < iterations; i++) {
+        uint64_t start = monotonic_ns();
+        pid_t pid;
+        posix_spawn(&pid, "/bin/true", NULL, NULL, argv, environ);
+        waitpid(pid, NULL, 0);
+        samples[i] = monotonic_ns() - start;
+    }
+    latency_results("spawn_posix_spawn", samples, iterations);
+    free(samples);
+}
+
+/**
+ * @brief Pipeline throughput: 256 MiB through a three stage pipeline set up by JBash
+ */
+static void bench_pipeline(void) {
+    double megabytes = 256;
+    char *argv[] = { "JBash", "-c", "head -c 268435456 /dev/zero | cat | wc -c", NULL };
+    uint64_t elapsed = run_jbash(argv);
+    result("pipeline", "throughput", megabytes / (elapsed / 1e9), "MiB/s");
+}
+
+/**
+ * @brief Builtin loop throughput: a script of builtins, run by the JBash binary and in process
+ */
+static void bench_builtins(void) {
+    size_t commands = 100000;
+    char path[] = "/tmp/jbench-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *script = fdopen(fd, "w");
+    for (size_t i = 0; i < commands; i++) fputs(i % 2 ? "cd .\n" : "set +x\n", script);
+    fclose(script);
+
+    char *argv[] = { "JBash", path, NULL };
+    uint64_t elapsed = run_jbash(argv);
+    result("builtin_loop", "script", commands / (elapsed / 1e9), "commands/s");
+    unlink(path);
+
+    // the same loop without process startup and file reading
+    static const char line[] = "cd .";
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < commands; i++) jb_eval(session, line, sizeof(line) - 1);
+    result("builtin_loop", "in_process", commands / ((monotonic_ns() - start) / 1e9), "commands/s");
+}
+
+/**
+ * @brief Loop overhead in process: 100k iterations of ':' in nested for loops, next to 100k lines of ':'
+ * The loop body is parsed once, so an iteration should cost no more than a line.
+ */
+static void bench_loop(void) {
+    static const char loop[] =
+        "for a in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        " for b in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "  for c in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "   for d in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "    for e in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "     :\n"
+        "    done\n"
+        "   done\n"
+        "  done\n"
+        " done\n"
+        "done\n";
+    size_t iterations = 100000;
+    uint64_t start = monotonic_ns();
+    jb_eval(session, loop, sizeof(loop) - 1);
+    result("loop", "per_iteration", (monotonic_ns() - start) / (double)iterations, "ns");
+
+    char *lines = safe_malloc(iterations * 2);
+    for (size_t i = 0; i < iterations; i++) memcpy(&lines[i * 2], ":\n", 2);
+    start = monotonic_ns();
+    jb_eval(session, lines, iterations * 2);
+    result("loop", "unrolled_line", (monotonic_ns() - start) / (double)iterations, "ns");
+    free(lines);
+}
+
+/**
+ * @brief Runs commands in process with one engine: the tree walker or the bytecode interpreter
+ * @return Nanoseconds per iteration, the best of three runs
+ */
+static double run_engine(int tree, const char *script, size_t iterations) {
+    uint64_t best = UINT64_MAX;
+    tree_walker = tree;
+    for (int run = 0; run < 3; run++) {
+        uint64_t start = monotonic_ns();
+        jb_eval(session, script, strlen(script));
+        uint64_t elapsed = monotonic_ns() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    tree_walker = -1;
+    return best / (double)iterations;
+}
+
+/**
+ * @brief The tree walker next to the bytecode interpreter on loop heavy scripts of builtins:
+ * the nested ':' loop of the loop benchmark, and 10k iterations with assignments, an if and an inner while
+ */
+static void bench_interp(void) {
+    static const char nested[] =
+        "for a in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        " for b in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "  for c in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "   for d in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "    for e in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "     :\n"
+        "    done\n"
+        "   done\n"
+        "  done\n"
+        " done\n"
+        "done\n";
+    static const char branchy[] =
+        "for a in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        " for b in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "  for c in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "   for d in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "    x=$a$b$c$d\n"
+        "    if : ; then y=$x ; else : ; fi\n"
+        "    while : ; do break ; done\n"
+        "   done\n"
+        "  done\n"
+        " done\n"
+        "done\n";
+    double tree = run_engine(1, nested, 100000), bytecode = run_engine(0, nested, 100000);
+    result("interp", "tree_loop", tree, "ns");
+    result("interp", "bytecode_loop", bytecode, "ns");
+    result("interp", "loop_speedup", tree / bytecode, "x");
+    tree = run_engine(1, branchy, 10000);
+    bytecode = run_engine(0, branchy, 10000);
+    result("interp", "tree_branchy", tree, "ns");
+    result("interp", "bytecode_branchy", bytecode, "ns");
+    result("interp", "branchy_speedup", tree / bytecode, "x");
+}
+
+/**
+ * @brief Calls of a small helper function in a loop, 10k of them, with the tree walker and with bytecode
+ * Bytecode call sites remember that the name is a function, and the builtins in its body their slots.
+ */
+static void bench_function(void) {
+    static const char calls[] =
+        "helper() { x=$1 ; : $x ; }\n"
+        "for a in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        " for b in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "  for c in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "   for d in 0 1 2 3 4 5 6 7 8 9 ; do\n"
+        "    helper $a$b$c$d\n"
+        "   done\n"
+        "  done\n"
+        " done\n"
+        "done\n";
+    double tree = run_engine(1, calls, 10000), bytecode = run_engine(0, calls, 10000);
+    result("function", "call_tree", tree, "ns");
+    result("function", "call_bytecode", bytecode, "ns");
+    result("function", "call_speedup", tree / bytecode, "x");
+}
+
+/**
+ * @brief A counter loop, 100k iterations of "i=$((i+1))" with each engine, next to running expr for it
+ * The expression is compiled once with the loop; only the expr loop forks.
+ */
+static void bench_arith(void) {
+    static const char counter[] = "i=0 ; while (( i < 100000 )) ; do i=$((i + 1)) ; done\n";
+    double tree = run_engine(1, counter, 100000), bytecode = run_engine(0, counter, 100000);
+    result("arith", "counter_tree", tree, "ns");
+    result("arith", "counter_bytecode", bytecode, "ns");
+
+    size_t iterations = 1000;
+    char *argv[] = { "JBash", "-c", "i=0 ; while (( i < 1000 )) ; do expr $i + 1 ; i=$((i + 1)) ; done", NULL };
+    double expr = run_jbash(argv) / (double)iterations;
+    result("arith", "counter_expr", expr, "ns");
+    result("arith", "expr_speedup", expr / bytecode, "x");
+}
+
+/**
+ * @brief Arrays: 1M indexed and 1M associative inserts, less the bare counter loop around them,
+ * and "${a[@]}" over the 1M elements as fields of one ':'
+ */
+static void bench_arrays(void) {
+    static const char counter[] = "i=0 ; while (( i < 1000000 )) ; do i=$((i + 1)) ; done\n";
+    static const char indexed[] = "a=() ; i=0 ; while (( i < 1000000 )) ; do a[i]=$i ; i=$((i + 1)) ; done\n";
+    static const char associative[] =
+        "declare -A m ; m=() ; i=0 ; while (( i < 1000000 )) ; do m[k$i]=$i ; i=$((i + 1)) ; done\n";
+    double loop = run_engine(0, counter, 1000000);
+    result("arrays", "indexed_insert", run_engine(0, indexed, 1000000) - loop, "ns");
+    result("arrays", "assoc_insert", run_engine(0, associative, 1000000) - loop, "ns");
+    result("arrays", "expand_element", run_engine(0, ": \"${a[@]}\"\n", 1000000), "ns");
+}
+
+/**
+ * @brief Parameter expansion on a 1.5 MB value: literal and glob replacement of every match,
+ * removing the longest suffix and prefix, and a substring, in MB of value per second
+ */
+static void bench_strings(void) {
+    static const char build[] = "s=abcdef ; i=0 ; while (( i < 18 )) ; do s+=$s ; i=$((i + 1)) ; done\n";
+    static const struct {
+        const char *metric, *script;
+    } operations[] = {
+        { "replace_literal", "t=${s//cd/X}\n" },
+        { "replace_glob", "t=${s//c?e/X}\n" },
+        { "remove_suffix", "t=${s%%c*}\n" },
+        { "remove_prefix", "t=${s##*e}\n" },
+        { "substring", "t=${s:1000:1000000}\n" },
+    };
+    jb_eval(session, build, strlen(build));
+    double megabytes = 6.0 * (1 << 18) / 1e6;
+    for (size_t i = 0; i < sizeof(operations) / sizeof(operations[0]); i++) {
+        double ns = run_engine(0, operations[i].script, 1);
+        result("strings", operations[i].metric, megabytes / (ns / 1e9), "MB/s");
+    }
+}
+
+/**
+ * @brief Builds a loop that runs one case 100k times: 40 empty arms "wN SUFFIX)" and a "*)" fallback
+ */
+static void case_script(char *script, size_t size, const char *word, const char *suffix) {
+    int length = snprintf(script, size, "i=0 ; while (( i < 100000 )) ; do case %s in", word);
+    for (int arm = 0; arm < 40; arm++) length += snprintf(script + length, size - length, " w%d%s) ;;", arm, suffix);
+    snprintf(script + length, size - length, " *) ;; esac ; i=$((i + 1)) ; done\n");
+}
+
+/**
+ * @brief case dispatch, less the bare counter loop around it: a word matching the last of 40 literal
+ * arms, one that falls through to "*)", and the last of 40 glob arms
+ */
+static void bench_case(void) {
+    static const char counter[] = "i=0 ; while (( i < 100000 )) ; do i=$((i + 1)) ; done\n";
+    char script[2048];
+    double loop = run_engine(0, counter, 100000);
+    case_script(script, sizeof(script), "w39", "");
+    result("case", "literal_last_arm", run_engine(0, script, 100000) - loop, "ns");
+    case_script(script, sizeof(script), "nomatch", "");
+    result("case", "literal_fallback", run_engine(0, script, 100000) - loop, "ns");
+    case_script(script, sizeof(script), "w39x", "*");
+    result("case", "glob_last_arm", run_engine(0, script, 100000) - loop, "ns");
+}
+
+/**
+ * @brief Time to first prompt: JBash started on a pseudo-terminal, spawn to the prompt's "JBash> "
+ * @return Nanoseconds, or 0 when no prompt showed up
+ */
+static uint64_t first_prompt(void) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("jbench: pty");
+        exit(EXIT_FAILURE);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (int fd = 0; fd < 3; fd++) posix_spawn_file_actions_addopen(&actions, fd, ptsname(master), O_RDWR, 0);
+    posix_spawn_file_actions_addclose(&actions, master);
+    char *argv[] = { "JBash", NULL };
+    uint64_t start = monotonic_ns();
+    pid_t pid;
+    if (posix_spawn(&pid, jbash, &actions, NULL, argv, environ) != 0) {
+        perror(jbash);
+        exit(EXIT_FAILURE);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    char screen[4096];
+    size_t length = 0;
+    uint64_t elapsed = 0;
+    struct pollfd pfd = { master, POLLIN, 0 };
+    while (elapsed == 0 && length < sizeof(screen) - 1 && poll(&pfd, 1, 2000) > 0) {
+        ssize_t n = read(master, &screen[length], sizeof(screen) - 1 - length);
+        if (n <= 0) break;
+        length += (size_t)n;
+        screen[length] = NULLCHAR;
+        if (strstr(screen, "JBash> ") != NULL) elapsed = monotonic_ns() - start;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(master);
+    return elapsed;
+}
+
+/**
+ * @brief Removes a temporary directory and the files in it
+ */
+static void remove_dir(const char *path) {
+    char file[PATH_MAX];
+    DIR *dir = opendir(path);
+    for (struct dirent *entry; dir != NULL && (entry = readdir(dir)) != NULL; ) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        unlink(file);
+    }
+    if (dir != NULL) closedir(dir);
+    rmdir(path);
+}
+
+/**
+ * @brief Sourcing a long rc-style file in process: parsed every time, and from the parse cache
+ */
+static void bench_source(void) {
+    size_t lines = 20000, iterations = 20;
+    char path[] = "/tmp/jbench-XXXXXX";
+    char cache[] = "/tmp/jbench-cache-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1 || mkdtemp(cache) == NULL) {
+        perror("jbench: source");
+        return;
+    }
+    FILE *script = fdopen(fd, "w");
+    for (size_t i = 0; i < lines; i++) {
+        fprintf(script, i % 2 ? "# comment %zu\n" : "cd .    'a quoted word'  \"$HOME and more\" plain words %zu\n", i);
+    }
+    fclose(script);
+    char command[64];
+    snprintf(command, sizeof(command), "source %s", path);
+
+    setenv("JBASH_CACHE_DIR", "", 1); // no cache: read and split every time
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < iterations; i++) jb_eval(session, command, strlen(command));
+    result("source", "uncached", lines * iterations / ((monotonic_ns() - start) / 1e9), "lines/s");
+
+    setenv("JBASH_CACHE_DIR", cache, 1);
+    jb_eval(session, command, strlen(command)); // writes the image
+    start = monotonic_ns();
+    for (size_t i = 0; i < iterations; i++) jb_eval(session, command, strlen(command));
+    result("source", "cached", lines * iterations / ((monotonic_ns() - start) / 1e9), "lines/s");
+    unsetenv("JBASH_CACHE_DIR");
+
+    unlink(path);
+    remove_dir(cache);
+}
+
+/**
+ * @brief A library of 2000 functions in 40 files: JBash -c calling one of them after sourcing every
+ * file (from warm parse images), against the same call autoloaded through the directory's index.
+ * Then, in this process, a library file is rewritten between two commands: the second must see it.
+ */
+static void bench_autoload(void) {
+    size_t files = 40, functions = 50, iterations = 100;
+    char lib[] = "/tmp/jbench-lib-XXXXXX";
+    char cache[] = "/tmp/jbench-cache-XXXXXX";
+    if (mkdtemp(lib) == NULL || mkdtemp(cache) == NULL) {
+        perror("jbench: autoload");
+        return;
+    }
+    size_t length = files * (sizeof(lib) + 24);
+    char *sourced = safe_malloc(length);
+    sourced[0] = NULLCHAR;
+    for (size_t f = 0; f < files; f++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/lib%02zu.jb", lib, f);
+        FILE *out = fopen(path, "w");
+        if (out == NULL) {
+            perror(path);
+            return;
+        }
+        for (size_t i = 0; i < functions; i++) {
+            fprintf(out, "fn_%zu_%zu() {\n  x=$1\n  if true ; then : $x ; fi\n}\n", f, i);
+        }
+        fclose(out);
+        snprintf(&sourced[strlen(sourced)], length - strlen(sourced), "source %s ; ", path);
+    }
+    strcat(sourced, "fn_39_49 done");
+
+    setenv("JBASH_CACHE_DIR", cache, 1);
+    uint64_t *samples = safe_malloc(iterations * sizeof(uint64_t));
+    char *source_argv[] = { "JBash", "-c", sourced, NULL };
+    run_jbash(source_argv); // writes the parse images
+    for (size_t i = 0; i < iterations; i++) samples[i] = run_jbash(source_argv);
+    uint64_t source_p50 = latency_results("autoload_source_all", samples, iterations);
+
+    setenv("JBASH_AUTOLOAD", lib, 1);
+    char *autoload_argv[] = { "JBash", "-c", "fn_39_49 done", NULL };
+    uint64_t start = monotonic_ns();
+    run_jbash(autoload_argv); // scans the directory and writes the index
+    result("autoload", "index_build", (monotonic_ns() - start) / 1e3, "us");
+    for (size_t i = 0; i < iterations; i++) samples[i] = run_jbash(autoload_argv);
+    uint64_t autoload_p50 = latency_results("autoload_indexed", samples, iterations);
+    result("autoload", "speedup", source_p50 / (double)autoload_p50, "x");
+
+    char first[] = "fn_0_0 x";
+    jb_eval(session, first, sizeof(first) - 1); // maps the index in this process
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/lib00.jb", lib);
+    FILE *out = fopen(path, "w");
+    if (out != NULL) { // a new function first, so every old definition moves
+        fprintf(out, "fn_new() {\n  edited=1\n}\n");
+        for (size_t i = 0; i < functions; i++) {
+            fprintf(out, "fn_0_%zu() {\n  edited=$((edited + %zu))\n}\n", i, i);
+        }
+        fclose(out);
+    }
+    char edited[] = "fn_new ; fn_0_10";
+    start = monotonic_ns();
+    jb_eval(session, edited, sizeof(edited) - 1);
+    result("autoload", "edit_reload", (monotonic_ns() - start) / 1e3, "us");
+    const char *value = var_get("edited");
+    if (jb_last_status(session) != 0 || value == NULL || strcmp(value, "11") != 0) {
+        fprintf(stderr, "jbench: autoload: a library edited mid-session was not reloaded (edited=%s)\n",
+                value != NULL ? value : "");
+        budget_failures++;
+    }
+    unsetenv("JBASH_AUTOLOAD");
+    unsetenv("JBASH_CACHE_DIR");
+
+    free(samples);
+    free(sourced);
+    remove_dir(lib);
+    remove_dir(cache);
+}
+
+/**
+ * @brief Startup time: JBash -c true, spawn to reaped, and time to the first interactive prompt
+ * Both p50s must stay within STARTUP_BUDGET_MS.
+ */
+static void bench_startup(void) {
+    size_t iterations = 200;
+    uint64_t *samples = safe_malloc(iterations * sizeof(uint64_t));
+    char *argv[] = { "JBash", "-c", "true", NULL };
+    for (size_t i = 0; i < iterations; i++) samples[i] = run_jbash(argv);
+    check_budget("startup_c_true", latency_results("startup_c_true", samples, iterations), STARTUP_BUDGET_MS);
+
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = first_prompt();
+        if (samples[i] == 0) {
+            fprintf(stderr, "jbench: %s printed no prompt\n", jbash);
+            exit(EXIT_FAILURE);
+        }
+    }
+    check_budget("startup_first_prompt", latency_results("startup_first_prompt", samples, iterations),
+                 STARTUP_BUDGET_MS);
+
+    char *exit_argv[] = { "JBash", "-c", "exit", NULL };
+    for (size_t i = 0; i < iterations; i++) samples[i] = run_jbash(exit_argv);
+    latency_results("startup_c_exit", samples, iterations);
+    free(samples);
+}
+
+/**
+ * @brief Server mode: JBash --client true against a warm JBash --server, next to JBash -c true
+ */
+static void bench_server(void) {
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/jbench-%d.sock", (int)getpid());
+    setenv("JBASH_SOCKET", socket_path, 1);
+    char *server_argv[] = { "JBash", "--server", NULL };
+    pid_t server;
+    if (posix_spawn(&server, jbash, NULL, NULL, server_argv, environ) != 0) {
+        perror(jbash);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < 200 && access(socket_path, F_OK) != 0; i++) usleep(5000); // wait for it to listen
+
+    size_t iterations = 200;
+    uint64_t *samples = safe_malloc(iterations * sizeof(uint64_t));
+    char *argv[] = { "JBash", "--client", "true", NULL };
+    for (size_t i = 0; i < iterations; i++) samples[i] = run_jbash(argv);
+    latency_results("server_client_true", samples, iterations);
+    char *local_argv[] = { "JBash", "-c", "true", NULL };
+    for (size_t i = 0; i < iterations; i++) samples[i] = run_jbash(local_argv);
+    latency_results("server_local_true", samples, iterations);
+    free(samples);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unsetenv("JBASH_SOCKET");
+}
+
+/**
+ * One benchmark the suite can run.
+ */
+struct benchmark {
+    const char *name;
+    void (*run)(void);
+};
+
+static const struct benchmark benchmarks[] = {
+    { "tokenize", bench_tokenize },
+    { "alloc", bench_alloc },
+    { "spawn", bench_spawn },
+    { "pipeline", bench_pipeline },
+    { "builtins", bench_builtins },
+    { "loop", bench_loop },
+    { "interp", bench_interp },
+    { "function", bench_function },
+    { "arith", bench_arith },
+    { "arrays", bench_arrays },
+    { "strings", bench_strings },
+    { "case", bench_case },
+    { "source", bench_source },
+    { "autoload", bench_autoload },
+    { "startup", bench_startup },
+    { "server", bench_server },
+};
+
+int main(int argc, char **argv) {
+    if (argc > 1) jbash = argv[1];
+    session_enter(jb_session_new()); // in-process benchmarks run in a session of their own
+    size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    for (size_t i = 0; i < count; i++) {
+        int selected = argc <= 2;
+        for (int k = 2; k < argc; k++) {
+            if (strcmp(argv[k], benchmarks[i].name) == 0) selected = 1;
+        }
+        if (selected) benchmarks[i].run();
+    }
+    return budget_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
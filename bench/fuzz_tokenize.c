@@ -0,0 +1,247 @@
+/*******************************************************************************
+  @file         fuzz_tokenize.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file fuzz_tokenize.c
+ * @brief Fuzz target for tokenize() and expand_word(), including their worst-case complexity
+ *
+ * Every input goes through the tokenizer (as a command line) and the expander
+ * (as an unquoted and a double quoted word), with a few sanity checks on the
+ * result. Then the input is grown to FUZZ_BASE_LENGTH bytes, and to
+ * FUZZ_GROWTH times that, in two ways: repeating the whole input, and
+ * repeating its last byte (long runs of spaces, of quotes, of "${"). If the
+ * longer input takes more than FUZZ_MAX_RATIO times as long, processing is
+ * superlinear: the input is printed and the target aborts, so the fuzzer keeps it.
+ *
+ * Drivers:
+ *   libFuzzer  clang -fsanitize=fuzzer -DLIBFUZZER (provides main);
+ *              run with -close_fd_mask=2 to drop the shell's error messages
+ *   AFL        afl-fuzz -i bench/fuzz_seeds -o out -- ./fuzz_tokenize @@
+ *   plain      fuzz_tokenize [-r RUNS] [-s SEED] [FILE...]
+ *              runs the given files (stdin without any), then RUNS random
+ *              inputs built from shell syntax fragments
+ *
+ * Inputs such as "$((1/0))" make the shell print errors by the thousand. The
+ * plain driver sends them to /dev/null and keeps the real stderr for its own
+ * failure reports.
+ */
+#include "../JBash.h"
+
+#define FUZZ_BASE_LENGTH 16384 // inputs are grown to at least this many bytes before timing
+#define FUZZ_GROWTH 4          // the long input is this many times the base length
+#define FUZZ_MAX_RATIO 10.0    // linear is FUZZ_GROWTH, quadratic FUZZ_GROWTH squared
+#define FUZZ_TIMINGS 3         // best of this many runs, to keep scheduler noise out
+#define FUZZ_MAX_INPUT 4096    // longer inputs are cut, the growth does the rest
+
+static FILE *report = NULL; // where failures are reported, stderr when NULL
+
+/**
+ * @brief Tokenizes a copy of the input like parse() would and checks the words
+ * @param data Input bytes, NUL bytes included (a terminal can send them)
+ * @param size Length of the input
+ */
+static void run_tokenizer(const char *data, size_t size) {
+    size_t length = size;
+    char *line = safe_malloc(size + 1);
+    memcpy(line, data, size);
+    line[size] = NULLCHAR;
+    session->input = realloc_leftover_string(line, &length);
+    int quoted = memchr(data, '"', size) != NULL || memchr(data, '\'', size) != NULL;
+    char **args = session->args = tokenize(length);
+
+    size_t count = 0;
+    for (; args[count] != NULL; count++) {
+        // only quotes ("" or '') or an expansion to nothing ($UNSET) may produce an empty word
+        if (args[count][0] == NULLCHAR && !quoted && memchr(data, '$', size) == NULL) {
+            fprintf(report, "fuzz: empty word %zu from unquoted input\n", count);
+            abort();
+        }
+    }
+    if (count > size + 1) {
+        fprintf(report, "fuzz: %zu words from %zu bytes\n", count, size);
+        abort();
+    }
+    free_args(args);
+    session->args = NULL;
+}
+
+/**
+ * @brief Expands the input as an unquoted and as a double quoted word
+ */
+static void run_expander(const char *data, size_t size) {
+    char *word = safe_malloc(size + 1);
+    memcpy(word, data, size);
+    word[size] = NULLCHAR;
+    struct arith *arith = arith_compile_word(word, 0);
+    expand_word(word, 0, arith);
+    arith_free(arith);
+    expand_word(word, '"', NULL); // compiles each $(( )) as it goes
+    if (expand_word(word, '\'', NULL) != word) { // single quotes never expand
+        fprintf(report, "fuzz: single quoted word was expanded\n");
+        abort();
+    }
+    arena_reset(&session->word_arena);
+    free(word);
+}
+
+/**
+ * @brief Best time of FUZZ_TIMINGS runs of the tokenizer and expander, in nanoseconds
+ */
+static uint64_t time_input(const char *data, size_t size) {
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < FUZZ_TIMINGS; run++) {
+        uint64_t start = monotonic_ns();
+        run_tokenizer(data, size);
+        run_expander(data, size);
+        uint64_t elapsed = monotonic_ns() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+/**
+ * @brief Grows the input to at least length bytes
+ * @param whole Non-zero to repeat the whole input, otherwise its last byte
+ * @return Heap buffer of exactly length bytes
+ */
+static char *grow(const char *data, size_t size, size_t length, int whole) {
+    char *grown = safe_malloc(length);
+    if (whole) {
+        for (size_t i = 0; i < length; i++) grown[i] = data[i % size];
+    } else {
+        size_t keep = size < length ? size : length;
+        memcpy(grown, data, keep);
+        memset(&grown[keep], data[size - 1], length - keep);
+    }
+    return grown;
+}
+
+/**
+ * @brief Prints the start of an input with escapes
+ */
+static void print_input(const char *data, size_t size) {
+    fprintf(report, "\"");
+    for (size_t i = 0; i < size && i < 80; i++) {
+        unsigned char c = (unsigned char)data[i];
+        if (c == '"' || c == '\\') fprintf(report, "\\%c", c);
+        else if (c < 0x20 || c >= 0x7f) fprintf(report, "\\x%02x", c);
+        else fputc(c, report);
+    }
+    fprintf(report, "\"%s (%zu bytes)", size > 80 ? "..." : "", size);
+}
+
+/**
+ * @brief Fails when processing time grows faster than the input
+ */
+static void check_scaling(const char *data, size_t size, int whole) {
+    size_t base = FUZZ_BASE_LENGTH;
+    char *small = grow(data, size, base, whole);
+    char *large = grow(data, size, base * FUZZ_GROWTH, whole);
+    double ratio = 0;
+    for (int attempt = 0; attempt < 2; attempt++) { // a second measurement rules out a hiccup
+        uint64_t small_ns = time_input(small, base);
+        uint64_t large_ns = time_input(large, base * FUZZ_GROWTH);
+        ratio = (double)large_ns / (double)(small_ns > 0 ? small_ns : 1);
+        if (ratio <= FUZZ_MAX_RATIO) break;
+    }
+    if (ratio > FUZZ_MAX_RATIO) {
+        fprintf(report, "fuzz: superlinear: %dx the input took %.1fx the time when %s ",
+                FUZZ_GROWTH, ratio, whole ? "repeating" : "extending the last byte of");
+        print_input(data, size);
+        fprintf(report, "\n");
+        abort();
+    }
+    free(small);
+    free(large);
+}
+
+/**
+ * @brief The fuzz target
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *bytes, size_t size) {
+    if (size == 0) return 0;
+    if (size > FUZZ_MAX_INPUT) size = FUZZ_MAX_INPUT;
+    const char *data = (const char *)bytes;
+    if (report == NULL) report = stderr;
+    if (session == NULL) session_enter(jb_session_new()); // the first input sets up the shell
+    run_tokenizer(data, size);
+    run_expander(data, size);
+    check_scaling(data, size, 1);
+    check_scaling(data, size, 0);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+/**
+ * @brief Runs one input file (or stdin for "-")
+ */
+static void run_file(const char *path) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == NULL) {
+        fprintf(report, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char data[FUZZ_MAX_INPUT];
+    size_t size = fread(data, 1, sizeof(data), in);
+    if (in != stdin) fclose(in);
+    LLVMFuzzerTestOneInput((const uint8_t *)data, size);
+}
+
+/**
+ * @brief Builds a random input out of shell syntax fragments
+ * @return Length of the input
+ */
+static size_t random_input(char *data, size_t capacity) {
+    static const char *fragments[] = {
+        " ", "  ", "\t", "'", "\"", "$", "${", "}", "$?", "${?}", "|", ";", "&&", "||",
+        "a", "echo", "HOME", "_x1", "PATH", "\\", "#", "=", "-", "\x01", "\xff",
+        "$((", "((", "))", "(", ")", "+", "++", "*", "?", ":", "1",
+    };
+    size_t kinds = sizeof(fragments) / sizeof(fragments[0]);
+    size_t count = 1 + (size_t)rand() % 32, size = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *fragment = fragments[(size_t)rand() % kinds];
+        size_t length = strlen(fragment);
+        if (size + length > capacity) break;
+        memcpy(&data[size], fragment, length);
+        size += length;
+    }
+    return size;
+}
+
+int main(int argc, char **argv) {
+    long runs = 0;
+    unsigned seed = (unsigned)time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+        if (opt == 'r') runs = atol(optarg);
+        else if (opt == 's') seed = (unsigned)strtoul(optarg, NULL, 10);
+        else {
+            fprintf(stderr, "usage: fuzz_tokenize [-r RUNS] [-s SEED] [FILE...]\n");
+            return 2;
+        }
+    }
+    int saved = dup(STDERR_FILENO), null = open("/dev/null", O_WRONLY);
+    if (saved != -1 && null != -1 && (report = fdopen(saved, "w")) != NULL) {
+        setvbuf(report, NULL, _IONBF, 0);
+        dup2(null, STDERR_FILENO); // the shell's own error messages
+    }
+    if (null != -1) close(null);
+    if (report == NULL) report = stderr;
+    for (int i = optind; i < argc; i++) run_file(argv[i]);
+    if (optind == argc && runs == 0) run_file("-"); // AFL feeding stdin
+
+    srand(seed);
+    char data[256];
+    for (long i = 0; i < runs; i++) {
+        size_t size = random_input(data, sizeof(data));
+        LLVMFuzzerTestOneInput((const uint8_t *)data, size);
+    }
+    if (runs > 0) printf("fuzz: %ld random inputs (seed %u) and %d files, no failures\n", runs, seed, argc - optind);
+    return EXIT_SUCCESS;
+}
+
+#endif
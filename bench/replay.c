@@ -0,0 +1,618 @@
+/*******************************************************************************
+  @file         replay.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file replay.c
+ * @brief Replays keystroke scripts into JBash under a pseudo-terminal
+ *
+ * The shell is started on a fresh pty, the script's keys are written to it at
+ * the configured rates and everything it prints is fed through a small
+ * terminal model. At the end the harness prints, in the same
+ * "bench<TAB>metric<TAB>value<TAB>unit" lines as jbench:
+ *   - echo latency (key written to first byte of output) per kind of input,
+ *   - bytes and reads of shell output,
+ * and then the final screen, so runs can be compared with diff.
+ *
+ * A keystroke script has one command per line ('#' starts a comment):
+ *   type TEXT      types TEXT one key at a time, "rate" ms apart
+ *   paste TEXT     writes TEXT with a single write, like a terminal paste
+ *   repeat N TEXT  N copies of TEXT, "repeat-rate" ms apart (held key)
+ *   key NAME...    enter, tab, backspace, left, right, up, down, ctrl-c, ctrl-d, escape
+ *   wait MS        sleeps, reading output meanwhile
+ *   quiet          waits until the shell has printed nothing for QUIET_MS
+ *   rate MS        delay between typed keys (default 10)
+ *   repeat-rate MS delay between repeated keys (default 33, a typical autorepeat)
+ * TEXT may use \n, \r, \t, \e, \\ and \xHH escapes.
+ *
+ * "replay -c JBASH SCRIPT" records instead: the shell runs on the pty with
+ * this terminal's keys passed through, and the keys and pauses are written
+ * to SCRIPT in the format above.
+ *
+ * Usage: replay [-s SCREEN] JBASH SCRIPT
+ *        replay -c JBASH SCRIPT
+ */
+#define _GNU_SOURCE // posix_openpt, ptsname
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#define SCREEN_ROWS 24
+#define SCREEN_COLS 80
+#define QUIET_MS 200 // "quiet" and the end of a script wait for this much silence
+#define MAX_SAMPLES 65536 // latency samples kept per kind of input
+#define LINE_BUFFER 4096 // longest script line
+
+/**
+ * The terminal model: enough of a VT100 for what the shell prints.
+ */
+struct screen {
+    char cells[SCREEN_ROWS][SCREEN_COLS];
+    int row, col;
+    int saved_row, saved_col; // ESC 7 / ESC 8
+    int state;                // 0 text, 1 after ESC, 2 inside CSI
+    char csi[32];             // parameters of the CSI sequence being read
+    size_t csi_length;
+};
+
+/**
+ * Echo latencies of one kind of input.
+ */
+struct samples {
+    const char *name;
+    uint64_t values[MAX_SAMPLES];
+    size_t count;
+};
+
+static struct screen screen;
+static struct samples typed = { .name = "type" };
+static struct samples pasted = { .name = "paste" };
+static struct samples repeated = { .name = "repeat" };
+static struct samples keyed = { .name = "key" };
+
+static int master = -1;          // our side of the pty
+static pid_t child = -1;
+static uint64_t output_bytes = 0, output_reads = 0;
+static uint64_t written_bytes = 0, written_keys = 0;
+static uint64_t pending_ns = 0;  // when the key awaiting its echo was written, 0 when none
+static struct samples *pending_kind = NULL;
+static uint64_t last_output_ns = 0;
+
+/**
+ * @brief Current time from CLOCK_MONOTONIC in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Clears the screen model and homes the cursor
+ */
+static void screen_clear(void) {
+    memset(screen.cells, ' ', sizeof(screen.cells));
+    screen.row = 0;
+    screen.col = 0;
+}
+
+/**
+ * @brief Moves everything up one line, making room at the bottom
+ */
+static void screen_scroll(void) {
+    memmove(screen.cells[0], screen.cells[1], (SCREEN_ROWS - 1) * SCREEN_COLS);
+    memset(screen.cells[SCREEN_ROWS - 1], ' ', SCREEN_COLS);
+}
+
+/**
+ * @brief Moves the cursor down a line, scrolling at the bottom
+ */
+static void screen_linefeed(void) {
+    if (screen.row == SCREEN_ROWS - 1) screen_scroll();
+    else screen.row++;
+}
+
+/**
+ * @brief Keeps the cursor on the screen
+ */
+static void screen_clamp(void) {
+    if (screen.row < 0) screen.row = 0;
+    if (screen.row >= SCREEN_ROWS) screen.row = SCREEN_ROWS - 1;
+    if (screen.col < 0) screen.col = 0;
+    if (screen.col >= SCREEN_COLS) screen.col = SCREEN_COLS - 1;
+}
+
+/**
+ * @brief Runs a complete CSI sequence (ESC [ params final)
+ */
+static void screen_csi(char final) {
+    screen.csi[screen.csi_length] = '\0';
+    int n = atoi(screen.csi);
+    int count = n > 0 ? n : 1;
+    switch (final) {
+        case 'A': screen.row -= count; break;
+        case 'B': screen.row += count; break;
+        case 'C': screen.col += count; break;
+        case 'D': screen.col -= count; break;
+        case 'G': screen.col = count - 1; break;
+        case 'H': case 'f': { // row;col, both 1 based
+            char *semicolon = strchr(screen.csi, ';');
+            screen.row = count - 1;
+            screen.col = semicolon != NULL && atoi(semicolon + 1) > 0 ? atoi(semicolon + 1) - 1 : 0;
+            break;
+        }
+        case 'K': // erase in line: 0 to the end, 1 from the start, 2 all of it
+            if (n == 0) memset(&screen.cells[screen.row][screen.col], ' ', SCREEN_COLS - screen.col);
+            else if (n == 1) memset(screen.cells[screen.row], ' ', screen.col + 1);
+            else memset(screen.cells[screen.row], ' ', SCREEN_COLS);
+            break;
+        case 'J': // erase in display
+            if (n == 2 || n == 3) {
+                memset(screen.cells, ' ', sizeof(screen.cells));
+            } else if (n == 0) {
+                memset(&screen.cells[screen.row][screen.col], ' ', SCREEN_COLS - screen.col);
+                for (int r = screen.row + 1; r < SCREEN_ROWS; r++) memset(screen.cells[r], ' ', SCREEN_COLS);
+            }
+            break;
+        default: // colours (m) and anything else do not change the text
+            break;
+    }
+    screen_clamp();
+}
+
+/**
+ * @brief Feeds shell output through the terminal model
+ */
+static void screen_feed(const char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (screen.state == 1) { // after ESC
+            screen.state = 0;
+            if (c == '[') {
+                screen.state = 2;
+                screen.csi_length = 0;
+            } else if (c == '7') {
+                screen.saved_row = screen.row;
+                screen.saved_col = screen.col;
+            } else if (c == '8') {
+                screen.row = screen.saved_row;
+                screen.col = screen.saved_col;
+            }
+            continue;
+        }
+        if (screen.state == 2) { // inside CSI: parameters until a final byte
+            if (c >= 0x40 && c <= 0x7e) {
+                screen.state = 0;
+                screen_csi(c);
+            } else if (screen.csi_length + 1 < sizeof(screen.csi)) {
+                screen.csi[screen.csi_length++] = c;
+            }
+            continue;
+        }
+        switch (c) {
+            case '\033': screen.state = 1; break;
+            case '\r': screen.col = 0; break;
+            case '\n': screen_linefeed(); break;
+            case '\b': if (screen.col > 0) screen.col--; break;
+            case '\t': screen.col = (screen.col / 8 + 1) * 8; screen_clamp(); break;
+            case '\a': break;
+            default:
+                if ((unsigned char)c < 0x20) break;
+                if (screen.col >= SCREEN_COLS) { // wrap
+                    screen.col = 0;
+                    screen_linefeed();
+                }
+                screen.cells[screen.row][screen.col++] = c;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Writes the screen, one line per row without trailing blanks, stopping after the last used row
+ */
+static void screen_print(FILE *out) {
+    int last = SCREEN_ROWS - 1;
+    while (last > 0) {
+        int blank = 1;
+        for (int c = 0; c < SCREEN_COLS && blank; c++) blank = screen.cells[last][c] == ' ';
+        if (!blank) break;
+        last--;
+    }
+    for (int r = 0; r <= last; r++) {
+        int length = SCREEN_COLS;
+        while (length > 0 && screen.cells[r][length - 1] == ' ') length--;
+        fprintf(out, "%.*s\n", length, screen.cells[r]);
+    }
+}
+
+/**
+ * @brief Reads whatever the shell printed, for at most timeout_ms
+ * @return 0 when the shell is still there, -1 once its side of the pty is closed
+ */
+static int pump(int timeout_ms) {
+    struct pollfd fd = { .fd = master, .events = POLLIN };
+    int ready = poll(&fd, 1, timeout_ms);
+    if (ready == -1) return errno == EINTR ? 0 : -1;
+    if (ready == 0) return 0;
+
+    char data[4096];
+    ssize_t n = read(master, data, sizeof(data));
+    if (n <= 0) return n == -1 && errno == EINTR ? 0 : -1;
+    uint64_t now = now_ns();
+    last_output_ns = now;
+    if (pending_ns != 0) { // first output since the key was written: its echo
+        if (pending_kind->count < MAX_SAMPLES) pending_kind->values[pending_kind->count++] = now - pending_ns;
+        pending_ns = 0;
+    }
+    output_bytes += (uint64_t)n;
+    output_reads++;
+    screen_feed(data, (size_t)n);
+    return 0;
+}
+
+/**
+ * @brief Reads output for the given time
+ */
+static void pump_for(uint64_t ms) {
+    uint64_t end = now_ns() + ms * 1000000ull;
+    for (uint64_t now = now_ns(); now < end; now = now_ns()) {
+        if (pump((int)((end - now + 999999) / 1000000)) == -1) return;
+    }
+}
+
+/**
+ * @brief Reads output until the shell has been silent for QUIET_MS (or has gone away)
+ */
+static void pump_until_quiet(void) {
+    last_output_ns = now_ns();
+    while (now_ns() - last_output_ns < QUIET_MS * 1000000ull) {
+        if (pump(QUIET_MS / 4) == -1) return;
+    }
+}
+
+/**
+ * @brief Writes keys to the shell and starts timing their echo
+ */
+static void send(const char *keys, size_t length, struct samples *kind) {
+    size_t written = 0;
+    uint64_t start = now_ns();
+    while (written < length) {
+        ssize_t n = write(master, &keys[written], length - written);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        written += (size_t)n;
+    }
+    if (pending_ns == 0) {
+        pending_ns = start;
+        pending_kind = kind;
+    }
+    written_bytes += length;
+    written_keys++;
+}
+
+/**
+ * @brief Decodes \n, \r, \t, \e, \\ and \xHH escapes in place
+ * @return Length of the decoded text
+ */
+static size_t unescape(char *text) {
+    size_t out = 0;
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        if (text[i] != '\\' || text[i + 1] == '\0') {
+            text[out++] = text[i];
+            continue;
+        }
+        char c = text[++i];
+        if (c == 'n') text[out++] = '\n';
+        else if (c == 'r') text[out++] = '\r';
+        else if (c == 't') text[out++] = '\t';
+        else if (c == 'e') text[out++] = '\033';
+        else if (c == 'x' && text[i + 1] != '\0' && text[i + 2] != '\0') {
+            char hex[3] = { text[i + 1], text[i + 2], '\0' };
+            text[out++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else text[out++] = c;
+    }
+    text[out] = '\0';
+    return out;
+}
+
+/**
+ * @brief Looks up the bytes a named key sends
+ * @return The key's bytes, or NULL for an unknown name
+ */
+static const char *key_bytes(const char *name) {
+    static const char *keys[][2] = {
+        { "enter", "\n" }, { "tab", "\t" }, { "backspace", "\177" }, { "escape", "\033" },
+        { "left", "\033[D" }, { "right", "\033[C" }, { "up", "\033[A" }, { "down", "\033[B" },
+        { "ctrl-c", "\003" }, { "ctrl-d", "\004" },
+    };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strcmp(keys[i][0], name) == 0) return keys[i][1];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the shell on a new pty
+ * @param argv argv of the shell, argv[0] is the path
+ */
+static void spawn_shell(char **argv) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("posix_openpt");
+        exit(EXIT_FAILURE);
+    }
+    struct winsize size = { .ws_row = SCREEN_ROWS, .ws_col = SCREEN_COLS };
+    ioctl(master, TIOCSWINSZ, &size);
+    const char *slave_name = ptsname(master);
+
+    child = fork();
+    if (child == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (child == 0) {
+        setsid(); // new session, so the pty becomes our controlling terminal
+        int slave = open(slave_name, O_RDWR);
+        if (slave == -1) _exit(127);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        if (slave > STDERR_FILENO) close(slave);
+        close(master);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+}
+
+/**
+ * @brief Waits for the shell to exit, hanging up on it if it does not
+ * @return Its exit status, or 128 + signal
+ */
+static int reap_shell(void) {
+    int status;
+    for (int i = 0; i < 50; i++) { // give a script ending in "exit" half a second
+        if (waitpid(child, &status, WNOHANG) == child) goto reaped;
+        pump(10);
+    }
+    kill(child, SIGHUP);
+    pump_for(50);
+    kill(child, SIGKILL);
+    waitpid(child, &status, 0);
+reaped:
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * @brief Runs a keystroke script against the shell
+ * @return 0 on success, 1 on a bad script line
+ */
+static int replay(FILE *script, const char *name) {
+    uint64_t rate_ms = 10, repeat_ms = 33;
+    char line[LINE_BUFFER];
+    size_t number = 0;
+
+    pump_until_quiet(); // let the first prompt appear
+    while (fgets(line, sizeof(line), script) != NULL) {
+        number++;
+        line[strcspn(line, "\n")] = '\0';
+        char *command = line + strspn(line, " \t");
+        if (command[0] == '\0' || command[0] == '#') continue;
+        char *rest = command + strcspn(command, " \t");
+        if (*rest != '\0') *rest++ = '\0';
+
+        if (strcmp(command, "type") == 0) {
+            size_t length = unescape(rest);
+            for (size_t i = 0; i < length; i++) {
+                send(&rest[i], 1, &typed);
+                pump_for(rate_ms);
+            }
+        } else if (strcmp(command, "paste") == 0) {
+            size_t length = unescape(rest);
+            send(rest, length, &pasted);
+            pump_for(rate_ms);
+        } else if (strcmp(command, "repeat") == 0) {
+            char *text;
+            long count = strtol(rest, &text, 10);
+            if (*text == ' ') text++;
+            size_t length = unescape(text);
+            for (long i = 0; i < count; i++) {
+                send(text, length, &repeated);
+                pump_for(repeat_ms);
+            }
+        } else if (strcmp(command, "key") == 0) {
+            for (char *key = strtok(rest, " \t"); key != NULL; key = strtok(NULL, " \t")) {
+                const char *bytes = key_bytes(key);
+                if (bytes == NULL) {
+                    fprintf(stderr, "%s:%zu: unknown key \"%s\"\n", name, number, key);
+                    return 1;
+                }
+                send(bytes, strlen(bytes), &keyed);
+                pump_for(rate_ms);
+            }
+        } else if (strcmp(command, "wait") == 0) {
+            pump_for(strtoull(rest, NULL, 10));
+        } else if (strcmp(command, "quiet") == 0) {
+            pump_until_quiet();
+        } else if (strcmp(command, "rate") == 0) {
+            rate_ms = strtoull(rest, NULL, 10);
+        } else if (strcmp(command, "repeat-rate") == 0) {
+            repeat_ms = strtoull(rest, NULL, 10);
+        } else {
+            fprintf(stderr, "%s:%zu: unknown command \"%s\"\n", name, number, command);
+            return 1;
+        }
+    }
+    pump_until_quiet();
+    return 0;
+}
+
+/**
+ * @brief Prints one result line
+ */
+static void result(const char *bench, const char *metric, double value, const char *unit) {
+    printf("%s\t%s\t%.3f\t%s\n", bench, metric, value, unit);
+}
+
+/**
+ * @brief qsort comparator for uint64_t samples
+ */
+static int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Prints count, p50, p99 and max echo latency of one kind of input
+ */
+static void latency_results(struct samples *samples) {
+    if (samples->count == 0) return;
+    char bench[32];
+    snprintf(bench, sizeof(bench), "echo_%s", samples->name);
+    qsort(samples->values, samples->count, sizeof(uint64_t), compare_samples);
+    result(bench, "count", samples->count, "events");
+    result(bench, "p50", samples->values[samples->count / 2] / 1e3, "us");
+    result(bench, "p99", samples->values[samples->count * 99 / 100] / 1e3, "us");
+    result(bench, "max", samples->values[samples->count - 1] / 1e3, "us");
+}
+
+/**
+ * @brief Passes this terminal's keys to the shell and writes them to a script, with the pauses between them
+ * @return 0 on success
+ */
+static int record(FILE *script) {
+    struct termios original, raw;
+    int interactive = tcgetattr(STDIN_FILENO, &original) == 0;
+    if (interactive) {
+        raw = original;
+        cfmakeraw(&raw);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    }
+    fprintf(script, "# recorded by replay -c\nquiet\n");
+
+    uint64_t last_key_ns = now_ns();
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = master, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        char data[4096];
+        if (fds[1].revents != 0) {
+            ssize_t n = read(master, data, sizeof(data));
+            if (n <= 0) break; // the shell is gone
+            write(STDOUT_FILENO, data, (size_t)n);
+        }
+        if (fds[0].revents != 0) {
+            ssize_t n = read(STDIN_FILENO, data, sizeof(data));
+            if (n <= 0) break;
+            uint64_t now = now_ns();
+            fprintf(script, "wait %llu\n", (unsigned long long)((now - last_key_ns) / 1000000));
+            last_key_ns = now;
+            // one key becomes "type", several keys in one read arrived as a paste
+            fprintf(script, "%s ", n == 1 ? "type" : "paste");
+            for (ssize_t i = 0; i < n; i++) {
+                unsigned char c = (unsigned char)data[i];
+                if (c == '\\') fputs("\\\\", script);
+                else if (c < 0x20 || c >= 0x7f) fprintf(script, "\\x%02x", c);
+                else fputc(c, script);
+            }
+            fputc('\n', script);
+            write(master, data, (size_t)n);
+        }
+    }
+    if (interactive) tcsetattr(STDIN_FILENO, TCSAFLUSH, &original);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *screen_path = NULL;
+    int recording = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "cs:")) != -1) {
+        if (opt == 'c') recording = 1;
+        else if (opt == 's') screen_path = optarg;
+        else break;
+    }
+    if (argc - optind != 2 || opt == '?') {
+        fprintf(stderr, "usage: replay [-s SCREEN] JBASH SCRIPT\n       replay -c JBASH SCRIPT\n");
+        return 2;
+    }
+    const char *script_path = argv[optind + 1];
+    char *shell_argv[] = { argv[optind], NULL };
+    signal(SIGPIPE, SIG_IGN);
+
+    if (recording) {
+        FILE *script = fopen(script_path, "w");
+        if (script == NULL) {
+            perror(script_path);
+            return 1;
+        }
+        spawn_shell(shell_argv);
+        record(script);
+        fclose(script);
+        reap_shell();
+        return 0;
+    }
+
+    FILE *script = fopen(script_path, "r");
+    if (script == NULL) {
+        perror(script_path);
+        return 1;
+    }
+    screen_clear();
+    spawn_shell(shell_argv);
+    uint64_t start = now_ns();
+    int rv = replay(script, script_path);
+    fclose(script);
+    int status = reap_shell();
+    double seconds = (now_ns() - start) / 1e9;
+
+    // Results are named after the script so several runs can be concatenated
+    const char *base = strrchr(script_path, '/');
+    base = base != NULL ? base + 1 : script_path;
+    printf("# %s\n", base);
+    latency_results(&typed);
+    latency_results(&pasted);
+    latency_results(&repeated);
+    latency_results(&keyed);
+    result("input", "keys", written_keys, "writes");
+    result("input", "bytes", written_bytes, "bytes");
+    result("output", "bytes", output_bytes, "bytes");
+    result("output", "bytes_per_input_byte", written_bytes ? (double)output_bytes / written_bytes : 0, "ratio");
+    result("output", "reads", output_reads, "reads");
+    result("session", "wall", seconds, "s");
+    result("session", "exit_status", status, "status");
+
+    if (screen_path != NULL) {
+        FILE *out = fopen(screen_path, "w");
+        if (out == NULL) {
+            perror(screen_path);
+            return 1;
+        }
+        screen_print(out);
+        fclose(out);
+    } else {
+        printf("# screen\n");
+        screen_print(stdout);
+    }
+    return rv;
+}
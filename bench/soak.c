@@ -0,0 +1,336 @@
+/*******************************************************************************
+  @file         soak.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file soak.c
+ * @brief Long running soak test: a million commands through one shell, watching for growth
+ *
+ * The shell runs in batch mode with its stdin on a pipe and alloc_count.so
+ * preloaded. Commands are fed in checkpoints; each checkpoint ends with an
+ * "echo" marker. Once the marker comes back and the shell is blocked reading
+ * stdin (/proc/PID/syscall), it is idle between commands, so its resident set
+ * (/proc/PID/statm), open descriptors (/proc/PID/fd) and live allocations are
+ * sampled at the same point every time.
+ *
+ * The first checkpoints are warm-up (buffers reaching their working size,
+ * stats tables filling). Live allocations may still step up after it and
+ * level off, when a value gains a digit or a table grows once; the first half
+ * of the checkpoints after warm-up sets their plateau, and live blocks or live
+ * bytes above it in the second half are a leak. Any growth of open
+ * descriptors, or resident set growth beyond RSS_SLACK_KB, fails as well. A
+ * failure makes the exit status 1.
+ *
+ * Usage: soak [-n COMMANDS] [-i INTERVAL] JBASH ALLOC_COUNT_SO
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h> // SYS_read
+
+#include "alloc_count.h"
+
+#define RSS_SLACK_KB 512 // resident set growth allowed after warm-up (allocator and page cache noise)
+#define WARMUP_SHARE 10  // percent of the commands treated as warm-up
+
+extern char **environ;
+
+/**
+ * What is sampled at each checkpoint.
+ */
+struct sample {
+    uint64_t commands;
+    long rss_kb;
+    long fds;
+    int64_t live;
+    int64_t live_bytes;
+    uint64_t allocs;
+};
+
+/**
+ * The command mix: builtins, expansion, arithmetic, quoting, lists, set -x and the odd external command.
+ * Nothing writes to stdout, which is kept for the checkpoint markers.
+ */
+static const char *mix[] = {
+    "cd .",
+    "cd '.' ; cd \".\"",
+    "cd / && cd \"$SOAK_DIR\"",
+    "set -x ; cd $SOAK_DIR ; set +x",
+    "false || cd ${SOAK_DIR}",
+    "time -j cd .",
+    "set +o xtrace",
+    "cd /nonexistent-soak-dir || cd .",
+    "i=$(( i + 1 )) ; (( i % 2 )) || cd .",
+    "arr=(a b) ; arr[i % 4]=$i ; declare -A m ; m[k$(( i % 8 ))]=x ; : \"${arr[@]}\" \"${!m[@]}\"",
+    "f=/soak/dir/file$i.tar.gz ; : ${f##*/} ${f%%.*} \"${f//[a-z]/x}\" ${#f} ${f:1:4} ${f/#\\/soak/~}",
+    "case $i in 1|2) : ;; *[05]) cd . ;; *) : ;; esac",
+};
+static const char *external[] = {
+    "true",
+    "true | true",
+    "soak-no-such-command",
+};
+
+/**
+ * @brief Resident set of a process in KiB
+ */
+static long rss_kb(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE *statm = fopen(path, "r");
+    if (statm == NULL) return -1;
+    long size, resident;
+    int n = fscanf(statm, "%ld %ld", &size, &resident);
+    fclose(statm);
+    return n == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+/**
+ * @brief Number of open file descriptors of a process
+ */
+static long open_fds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return -1;
+    long count = 0;
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+/**
+ * @brief Reads the shell's stdout until the marker line comes back
+ * @return 0 when the marker was seen, -1 if the shell went away
+ */
+static int wait_for_marker(FILE *out, const char *marker) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int rv = -1;
+    while ((length = getline(&line, &capacity, out)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+        if (strcmp(line, marker) == 0) {
+            rv = 0;
+            break;
+        }
+    }
+    free(line);
+    return rv;
+}
+
+/**
+ * @brief Waits until the shell is blocked reading its stdin
+ * The marker's output arrives while the shell may still be reaping the echo,
+ * so that alone is not an idle point.
+ * @return 0 once idle, -1 if /proc/PID/syscall cannot tell
+ */
+static int wait_until_idle(pid_t pid) {
+    char path[64], wanted[32];
+    snprintf(path, sizeof(path), "/proc/%d/syscall", (int)pid);
+    snprintf(wanted, sizeof(wanted), "%d 0x0 ", SYS_read); // read(STDIN_FILENO, ...)
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+    for (int tries = 0; tries < 100000; tries++) {
+        char state[256] = "";
+        FILE *syscall_file = fopen(path, "r");
+        if (syscall_file == NULL) return -1;
+        char *line = fgets(state, sizeof(state), syscall_file);
+        fclose(syscall_file);
+        if (line == NULL) return -1;
+        if (strncmp(state, wanted, strlen(wanted)) == 0) return 0;
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+/**
+ * @brief Prints one result line, like jbench
+ */
+static void result(const char *bench, const char *metric, double value, const char *unit) {
+    printf("%s\t%s\t%.3f\t%s\n", bench, metric, value, unit);
+}
+
+int main(int argc, char **argv) {
+    uint64_t total = 1000000, interval = 20000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+        if (opt == 'n') total = strtoull(optarg, NULL, 10);
+        else if (opt == 'i') interval = strtoull(optarg, NULL, 10);
+        else break;
+    }
+    if (argc - optind != 2 || opt == '?' || interval == 0 || total < interval * 3) {
+        fprintf(stderr, "usage: soak [-n COMMANDS] [-i INTERVAL] JBASH ALLOC_COUNT_SO\n"
+                        "       COMMANDS must cover at least three intervals\n");
+        return 2;
+    }
+    const char *jbash = argv[optind];
+    char preload[4096];
+    if (realpath(argv[optind + 1], preload) == NULL) {
+        perror(argv[optind + 1]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // the counters file the preloaded allocator maps
+    char counters_path[] = "/tmp/jbash-soak-XXXXXX";
+    int counters_fd = mkstemp(counters_path);
+    if (counters_fd == -1 || ftruncate(counters_fd, sizeof(struct alloc_counters)) == -1) {
+        perror("counters");
+        return 2;
+    }
+    struct alloc_counters *counters = mmap(NULL, sizeof(struct alloc_counters), PROT_READ | PROT_WRITE,
+                                           MAP_SHARED, counters_fd, 0);
+    close(counters_fd);
+    if (counters == MAP_FAILED) {
+        perror("mmap");
+        return 2;
+    }
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return 2;
+    setenv("SOAK_DIR", cwd, 1);
+    setenv("JBASH_SEGMENT", "", 1);
+
+    int to_shell[2], from_shell[2];
+    if (pipe(to_shell) == -1 || pipe(from_shell) == -1) {
+        perror("pipe");
+        return 2;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return 2;
+    }
+    if (pid == 0) {
+        dup2(to_shell[0], STDIN_FILENO);
+        dup2(from_shell[1], STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO); // error messages and set -x lines
+        close(null);
+        close(to_shell[0]);
+        close(to_shell[1]);
+        close(from_shell[0]);
+        close(from_shell[1]);
+        setenv("LD_PRELOAD", preload, 1);
+        setenv("JBASH_ALLOC_COUNTERS", counters_path, 1);
+        char *shell_argv[] = { (char *)jbash, NULL };
+        execv(jbash, shell_argv);
+        _exit(127);
+    }
+    close(to_shell[0]);
+    close(from_shell[1]);
+    FILE *in = fdopen(to_shell[1], "w");
+    FILE *out = fdopen(from_shell[0], "r");
+
+    size_t checkpoints = total / interval;
+    struct sample *samples = calloc(checkpoints, sizeof(struct sample));
+    size_t warmup = checkpoints * WARMUP_SHARE / 100;
+    if (warmup < 1) warmup = 1;
+    size_t mix_count = sizeof(mix) / sizeof(mix[0]);
+    size_t external_count = sizeof(external) / sizeof(external[0]);
+    uint64_t sent = 0, externals = 0;
+
+    printf("# checkpoint\tcommands\trss_kb\tfds\tlive\tlive_bytes\tallocs\n");
+    for (size_t k = 0; k < checkpoints; k++) {
+        for (uint64_t i = 0; i < interval; i++, sent++) {
+            if (sent % 100 == 99) fprintf(in, "%s\n", external[externals++ % external_count]);
+            else fprintf(in, "%s\n", mix[sent % mix_count]);
+        }
+        char marker[32];
+        snprintf(marker, sizeof(marker), "soak-%zu", k);
+        fprintf(in, "echo %s\n", marker);
+        fflush(in);
+        if (wait_for_marker(out, marker) == -1) {
+            fprintf(stderr, "soak: the shell exited after %llu commands\n", (unsigned long long)sent);
+            return 1;
+        }
+        if (wait_until_idle(pid) == -1 && k == 0) {
+            fprintf(stderr, "soak: cannot read /proc/%d/syscall, sampling right after the marker\n", (int)pid);
+        }
+
+        struct sample *s = &samples[k];
+        s->commands = sent;
+        s->rss_kb = rss_kb(pid);
+        s->fds = open_fds(pid);
+        s->live = __atomic_load_n(&counters->live, __ATOMIC_ACQUIRE);
+        s->live_bytes = __atomic_load_n(&counters->live_bytes, __ATOMIC_ACQUIRE);
+        s->allocs = __atomic_load_n(&counters->allocs, __ATOMIC_ACQUIRE);
+        printf("# %zu\t%llu\t%ld\t%ld\t%lld\t%lld\t%llu\n", k, (unsigned long long)s->commands, s->rss_kb,
+               s->fds, (long long)s->live, (long long)s->live_bytes, (unsigned long long)s->allocs);
+        fflush(stdout);
+    }
+    fclose(in);
+    int status;
+    waitpid(pid, &status, 0);
+    fclose(out);
+    int owner = counters->owner;
+    unlink(counters_path);
+
+    // descriptors and the resident set are compared with the last warm-up checkpoint, live
+    // allocations in the second half after warm-up with their plateau in the first half
+    const struct sample *base = &samples[warmup - 1], *last = &samples[checkpoints - 1];
+    size_t middle = warmup + (checkpoints - warmup) / 2;
+    int64_t plateau_live = base->live, plateau_live_bytes = base->live_bytes;
+    int64_t max_live = 0, max_live_bytes = 0;
+    long max_rss = base->rss_kb, max_fds = base->fds;
+    for (size_t k = warmup; k < checkpoints; k++) {
+        int64_t *live = k < middle ? &plateau_live : &max_live;
+        int64_t *live_bytes = k < middle ? &plateau_live_bytes : &max_live_bytes;
+        if (samples[k].live > *live) *live = samples[k].live;
+        if (samples[k].live_bytes > *live_bytes) *live_bytes = samples[k].live_bytes;
+        if (samples[k].rss_kb > max_rss) max_rss = samples[k].rss_kb;
+        if (samples[k].fds > max_fds) max_fds = samples[k].fds;
+    }
+    double measured = (double)(last->commands - base->commands);
+    result("soak", "commands", (double)sent, "commands");
+    result("soak", "allocs_per_command", (last->allocs - base->allocs) / measured, "allocs");
+    result("soak", "rss_start", base->rss_kb, "KiB");
+    result("soak", "rss_max", max_rss, "KiB");
+    result("soak", "live_start", base->live, "blocks");
+    result("soak", "live_plateau", plateau_live, "blocks");
+    result("soak", "live_max", max_live, "blocks");
+    result("soak", "live_bytes_start", base->live_bytes, "bytes");
+    result("soak", "live_bytes_plateau", plateau_live_bytes, "bytes");
+    result("soak", "live_bytes_max", max_live_bytes, "bytes");
+    result("soak", "fds_start", base->fds, "fds");
+    result("soak", "fds_max", max_fds, "fds");
+
+    int failed = 0;
+    if (owner != pid) {
+        fprintf(stderr, "soak: the allocator was not loaded into the shell\n");
+        failed = 1;
+    }
+    if (max_live > plateau_live || max_live_bytes > plateau_live_bytes) {
+        fprintf(stderr, "soak: FAIL live allocations grew past their plateau by %lld blocks, %lld bytes\n",
+                (long long)(max_live - plateau_live), (long long)(max_live_bytes - plateau_live_bytes));
+        failed = 1;
+    }
+    if (max_fds > base->fds) {
+        fprintf(stderr, "soak: FAIL open descriptors grew from %ld to %ld\n", base->fds, max_fds);
+        failed = 1;
+    }
+    if (max_rss > base->rss_kb + RSS_SLACK_KB) {
+        fprintf(stderr, "soak: FAIL resident set grew from %ld KiB to %ld KiB\n", base->rss_kb, max_rss);
+        failed = 1;
+    }
+    if (!WIFEXITED(status)) {
+        fprintf(stderr, "soak: FAIL the shell was killed by signal %d\n", WTERMSIG(status));
+        failed = 1;
+    }
+    if (!failed) fprintf(stderr, "soak: PASS, no growth over %llu commands\n", (unsigned long long)sent);
+    free(samples);
+    return failed;
+}
@@ -0,0 +1,172 @@
+/*******************************************************************************
+  @file         case.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file case.c
+ * @brief Picking the arm of a case statement
+ *
+ * The first time a case runs, its patterns are compiled into a matcher that
+ * stays on the node (case_select). A pattern that can only match its own
+ * text (quoted, or without '*', '?' and classes) goes into a hash table from
+ * that text to the first arm that has it. The other patterns stay a list of
+ * compiled globs (pattern.c) in arm order. A word is looked up in the table
+ * once, then only the globs of earlier arms are tried: a case of literal arms
+ * costs one lookup however many arms it has, and a trailing "*)" one match.
+ *
+ * Patterns with a '$' are expanded each time they are tried, and compiled
+ * through the session's pattern cache.
+ */
+#include "JBash.h"
+
+#define NO_ARM UINT32_MAX // no pattern matched
+
+/**
+ * A pattern that only matches its own text.
+ */
+struct case_literal {
+    char *text;
+    size_t length;
+    uint32_t hash;
+    uint32_t arm;
+};
+
+/**
+ * A pattern tried in order: a compiled glob, or a word with a '$' that is expanded first.
+ */
+struct case_glob {
+    uint32_t arm;
+    struct pattern *pattern;  // NULL when word has to be expanded
+    const struct word *word;
+};
+
+struct case_matcher {
+    struct case_literal *literals;
+    size_t literal_count;
+    uint32_t *slots;          // index + 1 into literals, 0 for an empty slot; at most half full
+    size_t slot_mask;
+    struct case_glob *globs;  // in arm order
+    size_t glob_count;
+};
+
+/**
+ * @brief djb2 hash of a literal
+ */
+static uint32_t literal_hash(const char *text, size_t length) {
+    uint32_t hash = 5381;
+    for (size_t i = 0; i < length; i++) hash = hash * 33 + (unsigned char)text[i];
+    return hash;
+}
+
+/**
+ * @brief The table slot holding a literal, or the empty slot it would go in
+ */
+static uint32_t *literal_slot(const struct case_matcher *m, const char *text, size_t length, uint32_t hash) {
+    size_t slot = hash & m->slot_mask;
+    while (m->slots[slot] != 0) {
+        const struct case_literal *l = &m->literals[m->slots[slot] - 1];
+        if (l->hash == hash && l->length == length && memcmp(l->text, text, length) == 0) break;
+        slot = (slot + 1) & m->slot_mask;
+    }
+    return &m->slots[slot];
+}
+
+/**
+ * @brief Adds a literal pattern, unless an earlier arm already has it
+ */
+static void literal_add(struct case_matcher *m, const char *text, size_t length, uint32_t arm) {
+    uint32_t hash = literal_hash(text, length);
+    uint32_t *slot = literal_slot(m, text, length, hash);
+    if (*slot != 0) return;
+    struct case_literal *l = &m->literals[m->literal_count++];
+    l->text = safe_malloc(length + 1);
+    memcpy(l->text, text, length);
+    l->text[length] = NULLCHAR;
+    l->length = length;
+    l->hash = hash;
+    l->arm = arm;
+    *slot = (uint32_t)m->literal_count;
+}
+
+/**
+ * @brief Compiles the patterns of a case
+ */
+static struct case_matcher *matcher_build(const struct node *n) {
+    size_t patterns = n->count > 1 ? n->count - 1 : 1, slots = 8;
+    while (slots < 2 * patterns) slots *= 2;
+    struct case_matcher *m = safe_malloc(sizeof(struct case_matcher));
+    memset(m, 0, sizeof(struct case_matcher));
+    m->literals = safe_malloc(patterns * sizeof(struct case_literal));
+    m->globs = safe_malloc(patterns * sizeof(struct case_glob));
+    m->slots = safe_malloc(slots * sizeof(uint32_t));
+    memset(m->slots, 0, slots * sizeof(uint32_t));
+    m->slot_mask = slots - 1;
+    for (uint32_t arm = 0; arm < n->arm_count; arm++) {
+        for (size_t i = n->arms[arm].first; i < n->arms[arm].first + n->arms[arm].count; i++) {
+            const struct word *w = &n->words[i];
+            int expands = w->quote != '\'' && strchr(w->text, '$') != NULL;
+            if (w->quote != 0 && !expands) {
+                literal_add(m, w->text, strlen(w->text), arm);
+                continue;
+            }
+            struct pattern *p = expands ? NULL : pattern_compile(w->text, strlen(w->text));
+            size_t length;
+            const char *literal = p != NULL ? pattern_literal(p, &length) : NULL;
+            if (literal != NULL) {
+                literal_add(m, literal, length, arm);
+                pattern_free(p);
+            } else {
+                m->globs[m->glob_count++] = (struct case_glob){ .arm = arm, .pattern = p, .word = w };
+            }
+        }
+    }
+    return m;
+}
+
+/**
+ * @brief Releases the matcher of a case
+ */
+void case_matcher_free(struct case_matcher *m) {
+    if (m == NULL) return;
+    for (size_t i = 0; i < m->literal_count; i++) free(m->literals[i].text);
+    for (size_t i = 0; i < m->glob_count; i++) pattern_free(m->globs[i].pattern);
+    free(m->literals);
+    free(m->slots);
+    free(m->globs);
+    free(m);
+}
+
+/**
+ * @brief Matches a pattern with a '$': quoted it is compared as it expands, otherwise it is a glob
+ */
+static int expanded_match(const struct word *w, const char *word, size_t length) {
+    const char *text = expand_word(w->text, w->quote, w->arith);
+    if (text == NULL) return 0; // an expansion error, reported; the pattern matches nothing
+    if (w->quote != 0) return strlen(text) == length && memcmp(text, word, length) == 0;
+    return pattern_match(pattern_get(text, strlen(text)), word, length);
+}
+
+/**
+ * @brief Expands the word of a case and finds the first arm with a pattern that matches it
+ * The expansions are left in word_arena for the caller to reset.
+ * @param n A NODE_CASE; its matcher is built on the first call
+ * @return Index of the arm, n->arm_count when none matched, CASE_FAILED when the word had an expansion error
+ */
+size_t case_select(struct node *n) {
+    if (n->matcher == NULL) n->matcher = matcher_build(n);
+    const struct case_matcher *m = n->matcher;
+    const char *word = expand_word(n->words[0].text, n->words[0].quote, n->words[0].arith);
+    if (word == NULL) return CASE_FAILED;
+    size_t length = strlen(word);
+    uint32_t *slot = literal_slot(m, word, length, literal_hash(word, length));
+    uint32_t arm = *slot != 0 ? m->literals[*slot - 1].arm : NO_ARM;
+    for (size_t i = 0; i < m->glob_count && m->globs[i].arm < arm; i++) { // a glob only wins in an earlier arm
+        const struct case_glob *g = &m->globs[i];
+        if (g->pattern != NULL ? pattern_match(g->pattern, word, length) : expanded_match(g->word, word, length)) {
+            arm = g->arm;
+            break;
+        }
+    }
+    return arm == NO_ARM ? n->arm_count : arm;
+}
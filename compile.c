@@ -0,0 +1,484 @@
+/*******************************************************************************
+  @file         compile.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file compile.c
+ * @brief Compiles parsed commands to bytecode, and the disasm builtin
+ *
+ * compile() turns the node list of one parsed command (parser.c) into a
+ * chunk that vm_run() (vm.c) runs. Control flow becomes jumps, so running a
+ * loop is a walk over a flat array of code words instead of a recursion
+ * over nodes. Simple commands are resolved as far as the text allows: a
+ * command whose name is literal becomes a call site that remembers what
+ * the name means (execute_call() in exec.c), and a command of only
+ * NAME=value words sets its variables without going through execute().
+ *
+ * A chunk owns copies of its words, and its buffers are kept when it is
+ * compiled again, so a line source compiles every command into the same
+ * memory.
+ */
+#include "JBash.h"
+
+/**
+ * @brief Creates an empty chunk
+ */
+struct chunk *chunk_new(void) {
+    struct chunk *c = safe_malloc(sizeof(struct chunk));
+    memset(c, 0, sizeof(struct chunk));
+    return c;
+}
+
+/**
+ * @brief Releases a chunk and its buffers
+ */
+void chunk_free(struct chunk *c) {
+    if (c == NULL) return;
+    for (size_t i = 0; i < c->site_count; i++) free(c->sites[i].path);
+    free(c->code);
+    free(c->words);
+    free(c->pool);
+    free(c->sites);
+    free(c->definitions);
+    free(c->cases);
+    free(c);
+}
+
+/**
+ * @brief Appends a code word
+ * @return Its offset, for patching jump targets
+ */
+static size_t emit(struct chunk *c, uint32_t value) {
+    if (c->length == c->capacity) {
+        if (c->capacity == 0) c->capacity = CMD_LINE_BUFFER / 2; // realloc_buffer doubles it
+        c->code = realloc_buffer(c->code, &c->capacity, sizeof(uint32_t));
+    }
+    c->code[c->length] = value;
+    return c->length++;
+}
+
+/**
+ * @brief Copies a word into the chunk
+ * Its text goes into the pool, which may still move: text holds the offset until compile() is done.
+ * @param arith The node word's compiled arithmetic, borrowed like the definitions
+ * @return Index of the word in the word table
+ */
+static uint32_t add_word(struct chunk *c, const char *text, char quote, struct arith *arith) {
+    size_t length = strlen(text) + 1;
+    while (c->pool_length + length > c->pool_capacity) {
+        if (c->pool_capacity == 0) c->pool_capacity = STR_BUFFER / 2;
+        c->pool = realloc_buffer(c->pool, &c->pool_capacity, 1);
+    }
+    memcpy(&c->pool[c->pool_length], text, length);
+
+    if (c->word_count == c->word_capacity) {
+        if (c->word_capacity == 0) c->word_capacity = CMD_LINE_BUFFER / 2;
+        c->words = realloc_buffer(c->words, &c->word_capacity, sizeof(struct word));
+    }
+    c->words[c->word_count].text = (char *)(uintptr_t)c->pool_length;
+    c->words[c->word_count].quote = quote;
+    c->words[c->word_count].arith = arith;
+    c->pool_length += length;
+    return (uint32_t)c->word_count++;
+}
+
+/**
+ * @brief Copies a node's words into the chunk
+ * @return Index of the first one
+ */
+static uint32_t add_words(struct chunk *c, const struct word *words, size_t count) {
+    uint32_t first = (uint32_t)c->word_count;
+    for (size_t i = 0; i < count; i++) add_word(c, words[i].text, words[i].quote, words[i].arith);
+    return first;
+}
+
+/**
+ * @brief Adds an unresolved call site
+ * @return Its index
+ */
+static uint32_t add_site(struct chunk *c) {
+    if (c->site_count == c->site_capacity) {
+        if (c->site_capacity == 0) c->site_capacity = CMD_LINE_BUFFER / 2;
+        c->sites = realloc_buffer(c->sites, &c->site_capacity, sizeof(struct call_site));
+    }
+    memset(&c->sites[c->site_count], 0, sizeof(struct call_site));
+    return (uint32_t)c->site_count++;
+}
+
+/**
+ * @brief A word the executor would take as NAME=value, whatever it expands to
+ */
+static int is_assignment_word(const struct word *word) {
+    if (word->quote != 0 || word_operator(word->text, word->quote) != NULL) return 0;
+    return var_assignment(word->text) != 0;
+}
+
+/**
+ * @brief Compiles one pipeline, or a whole command list that has to stay one command
+ * Words with operators run through execute(); assignments only, (( ))
+ * commands and simple commands with a literal name get instructions of their own.
+ */
+static void compile_pipeline(struct chunk *c, const struct word *words, size_t count, uint32_t line) {
+    int assigns = 1, operators = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (word_operator(words[i].text, words[i].quote) != NULL) operators = 1;
+        if (!is_assignment_word(&words[i])) assigns = 0;
+    }
+    int call = !operators && !is_assignment_word(&words[0]) && strchr(words[0].text, '$') == NULL &&
+               !(words[0].quote == 0 && strcmp(words[0].text, "time") == 0);
+
+    if (count == 1 && is_arith_command(&words[0])) {
+        emit(c, BC_ARITH);
+        emit(c, add_words(c, words, 1));
+        emit(c, line);
+        return;
+    }
+    if (assigns) {
+        emit(c, BC_ASSIGN);
+    } else if (call) {
+        emit(c, BC_CALL);
+        emit(c, add_site(c));
+    } else {
+        emit(c, BC_EXEC);
+    }
+    emit(c, add_words(c, words, count));
+    emit(c, (uint32_t)count);
+    emit(c, line);
+}
+
+/**
+ * @brief Compiles a NODE_COMMAND
+ * Inside compound commands and functions its pipelines become instructions
+ * of their own, '&&' and '||' conditional jumps. A command line of its own
+ * stays one instruction, so its usage, history entry and time keyword
+ * cover the whole line; so does a list execute() has to report a syntax error for.
+ * @param nested The command is part of a compound command or a function body
+ */
+static void compile_command(struct chunk *c, const struct node *n, int nested) {
+    if (n->count == 0) return;
+    const struct word *words = n->words;
+    if (!nested || (words[0].quote == 0 && strcmp(words[0].text, "time") == 0) || check_syntax(words, n->count) != NULL) {
+        compile_pipeline(c, words, n->count, n->line);
+        return;
+    }
+    char *previous = NULL; // operator before the pipeline
+    size_t start = 0;
+    for (size_t i = 0; i <= n->count; i++) {
+        char *op = i < n->count ? word_operator(words[i].text, words[i].quote) : NULL;
+        if (i < n->count && op != OP_SEMI && op != OP_AND && op != OP_OR) continue;
+        if (i > start) { // nothing after a trailing ';'
+            size_t skip = 0;
+            if (previous == OP_AND || previous == OP_OR) { // skipped, the status stays the one that decided it
+                emit(c, previous == OP_AND ? BC_JUMP_IF_FAIL : BC_JUMP_IF_OK);
+                skip = emit(c, 0);
+            }
+            compile_pipeline(c, &words[start], i - start, n->line);
+            if (skip != 0) c->code[skip] = (uint32_t)c->length;
+        }
+        previous = op;
+        start = i + 1;
+    }
+}
+
+static void compile_list(struct chunk *c, const struct node *list, int depth, int nested);
+
+/**
+ * @brief Compiles an if: the condition, then a jump over the then part when it failed
+ */
+static void compile_if(struct chunk *c, const struct node *n, int depth) {
+    compile_list(c, n->condition, depth, 1);
+    emit(c, BC_JUMP_IF_FAIL);
+    size_t to_else = emit(c, 0);
+    compile_list(c, n->body, depth, 1);
+    emit(c, BC_JUMP);
+    size_t to_end = emit(c, 0);
+    c->code[to_else] = (uint32_t)c->length;
+    if (n->else_part != NULL) {
+        compile_list(c, n->else_part, depth, 1);
+    } else { // no branch ran
+        emit(c, BC_SET_STATUS);
+        emit(c, 0);
+    }
+    c->code[to_end] = (uint32_t)c->length;
+}
+
+/**
+ * @brief Compiles a while or until loop
+ *   LOOP_BEGIN; condition; JUMP_IF_FAIL (or JUMP_IF_OK) end; body; LOOP_STATUS; JUMP condition; end: LOOP_END
+ */
+static void compile_while(struct chunk *c, const struct node *n, int depth) {
+    emit(c, BC_LOOP_BEGIN);
+    size_t to_break = emit(c, 0);
+    size_t to_continue = emit(c, 0);
+    size_t condition = c->length;
+    compile_list(c, n->condition, depth, 1);
+    emit(c, n->type == NODE_UNTIL ? BC_JUMP_IF_OK : BC_JUMP_IF_FAIL);
+    size_t to_end = emit(c, 0);
+    compile_list(c, n->body, depth, 1);
+    emit(c, BC_LOOP_STATUS);
+    emit(c, BC_JUMP);
+    emit(c, (uint32_t)condition);
+    c->code[to_end] = c->code[to_break] = (uint32_t)c->length;
+    c->code[to_continue] = (uint32_t)condition;
+    emit(c, BC_LOOP_END);
+}
+
+/**
+ * @brief Compiles a for loop
+ *   FOR_BEGIN; next: FOR_NEXT end; body; LOOP_STATUS; JUMP next; end: LOOP_END
+ */
+static void compile_for(struct chunk *c, const struct node *n, int depth) {
+    emit(c, BC_FOR_BEGIN);
+    emit(c, n->words != NULL ? add_words(c, n->words, n->count) : FOR_POSITIONAL);
+    emit(c, (uint32_t)n->count);
+    size_t to_break = emit(c, 0);
+    size_t to_continue = emit(c, 0);
+    size_t next = emit(c, BC_FOR_NEXT);
+    emit(c, add_word(c, n->name, 0, NULL));
+    size_t to_end = emit(c, 0);
+    compile_list(c, n->body, depth, 1);
+    emit(c, BC_LOOP_STATUS);
+    emit(c, BC_JUMP);
+    emit(c, (uint32_t)next);
+    c->code[to_end] = c->code[to_break] = (uint32_t)c->length;
+    c->code[to_continue] = (uint32_t)next;
+    emit(c, BC_LOOP_END);
+}
+
+/**
+ * @brief Compiles a case: a CASE with a jump target per arm and one for no match
+ *   CASE case line targets; arm: list; JUMP end; ...; none: SET_STATUS 0; end:
+ */
+static void compile_case(struct chunk *c, const struct node *n, int depth) {
+    if (c->case_count == c->case_capacity) {
+        if (c->case_capacity == 0) c->case_capacity = 2;
+        c->cases = realloc_buffer(c->cases, &c->case_capacity, sizeof(struct node *));
+    }
+    emit(c, BC_CASE);
+    emit(c, (uint32_t)c->case_count);
+    c->cases[c->case_count++] = n;
+    emit(c, n->line);
+    size_t table = c->length;
+    for (size_t i = 0; i <= n->arm_count; i++) emit(c, 0);
+    size_t *to_end = safe_malloc((n->arm_count + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n->arm_count; i++) {
+        c->code[table + i] = (uint32_t)c->length;
+        if (n->arms[i].body != NULL) {
+            compile_list(c, n->arms[i].body, depth, 1);
+        } else {
+            emit(c, BC_SET_STATUS);
+            emit(c, 0);
+        }
+        emit(c, BC_JUMP);
+        to_end[i] = emit(c, 0);
+    }
+    c->code[table + n->arm_count] = (uint32_t)c->length;
+    emit(c, BC_SET_STATUS);
+    emit(c, 0);
+    for (size_t i = 0; i < n->arm_count; i++) c->code[to_end[i]] = (uint32_t)c->length;
+    free(to_end);
+}
+
+/**
+ * @brief Compiles a list of nodes
+ * @param depth Loops around the list
+ * @param nested The list is part of a compound command or a function body
+ */
+static void compile_list(struct chunk *c, const struct node *list, int depth, int nested) {
+    for (const struct node *n = list; n != NULL; n = n->next) {
+        switch (n->type) {
+        case NODE_COMMAND: compile_command(c, n, nested); break;
+        case NODE_IF: compile_if(c, n, depth); break;
+        case NODE_CASE: compile_case(c, n, depth); break;
+        case NODE_FUNCTION:
+            if (c->definition_count == c->definition_capacity) {
+                if (c->definition_capacity == 0) c->definition_capacity = 2;
+                c->definitions = realloc_buffer(c->definitions, &c->definition_capacity, sizeof(struct node *));
+            }
+            emit(c, BC_DEFINE);
+            emit(c, (uint32_t)c->definition_count);
+            c->definitions[c->definition_count++] = n;
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+        case NODE_FOR:
+            if (depth + 1 > c->loop_depth) c->loop_depth = depth + 1;
+            if (n->type == NODE_FOR) compile_for(c, n, depth + 1);
+            else compile_while(c, n, depth + 1);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Compiles one parsed command, replacing whatever the chunk held
+ * @param list The command's nodes, as parse_command() returned them; the chunk keeps only its function definitions
+ * @param file Where it was parsed (an interned name that lives as long as the process), or NULL
+ * @param nested The list is a function body, its command lists are split like inside compound commands
+ */
+void compile(struct chunk *c, const struct node *list, const char *file, int nested) {
+    TRACE_BEGIN("compile");
+    for (size_t i = 0; i < c->site_count; i++) free(c->sites[i].path);
+    c->length = c->word_count = c->pool_length = c->site_count = c->definition_count = c->case_count = 0;
+    c->loop_depth = 0;
+    c->file = file;
+    compile_list(c, list, 0, nested);
+    emit(c, BC_HALT);
+    for (size_t i = 0; i < c->word_count; i++) c->words[i].text = &c->pool[(uintptr_t)c->words[i].text];
+    TRACE_END("compile");
+}
+
+/**
+ * Instruction names and operand counts, for the disassembler.
+ */
+static const struct {
+    const char *name;
+    int operands;
+} instructions[BC_COUNT] = {
+    [BC_EXEC] = { "EXEC", 3 },
+    [BC_CALL] = { "CALL", 4 },
+    [BC_ASSIGN] = { "ASSIGN", 3 },
+    [BC_JUMP] = { "JUMP", 1 },
+    [BC_JUMP_IF_FAIL] = { "JUMP_IF_FAIL", 1 },
+    [BC_JUMP_IF_OK] = { "JUMP_IF_OK", 1 },
+    [BC_SET_STATUS] = { "SET_STATUS", 1 },
+    [BC_ARITH] = { "ARITH", 2 },
+    [BC_DEFINE] = { "DEFINE", 1 },
+    [BC_LOOP_BEGIN] = { "LOOP_BEGIN", 2 },
+    [BC_FOR_BEGIN] = { "FOR_BEGIN", 4 },
+    [BC_FOR_NEXT] = { "FOR_NEXT", 2 },
+    [BC_LOOP_STATUS] = { "LOOP_STATUS", 0 },
+    [BC_LOOP_END] = { "LOOP_END", 0 },
+    [BC_CASE] = { "CASE", 2 }, // and a target per arm, then the one for no match
+    [BC_HALT] = { "HALT", 0 },
+};
+
+/**
+ * @brief Prints words the way they were written, quoted words with their quotes
+ */
+static void print_words(const struct chunk *c, uint32_t first, uint32_t count, FILE *out) {
+    for (uint32_t i = first; i < first + count; i++) {
+        const struct word *w = &c->words[i];
+        if (w->quote != 0) fprintf(out, " %c%s%c", w->quote, w->text, w->quote);
+        else fprintf(out, " %s", w->text);
+    }
+}
+
+/**
+ * @brief Prints a chunk one instruction per line: offset, name, operands
+ */
+void chunk_print(const struct chunk *c, FILE *out) {
+    fprintf(out, "; %zu code words, %zu words, loop depth %d\n", c->length, c->word_count, c->loop_depth);
+    for (size_t pc = 0; pc < c->length; ) {
+        uint32_t op = c->code[pc];
+        const uint32_t *a = &c->code[pc + 1];
+        size_t targets = 0; // CASE's jump table
+        if (instructions[op].operands == 0) fprintf(out, "%04zu  %s", pc, instructions[op].name);
+        else fprintf(out, "%04zu  %-13s", pc, instructions[op].name);
+        switch (op) {
+        case BC_EXEC:
+        case BC_ASSIGN:
+            fprintf(out, "line %u:", a[2]);
+            print_words(c, a[0], a[1], out);
+            break;
+        case BC_ARITH:
+            fprintf(out, "line %u:", a[1]);
+            print_words(c, a[0], 1, out);
+            break;
+        case BC_CALL:
+            fprintf(out, "site %u line %u:", a[0], a[3]);
+            print_words(c, a[1], a[2], out);
+            break;
+        case BC_DEFINE:
+            fprintf(out, "%s", c->definitions[a[0]]->name);
+            break;
+        case BC_JUMP:
+        case BC_JUMP_IF_FAIL:
+        case BC_JUMP_IF_OK:
+            fprintf(out, "%04u", a[0]);
+            break;
+        case BC_SET_STATUS:
+            fprintf(out, "%u", a[0]);
+            break;
+        case BC_LOOP_BEGIN:
+            fprintf(out, "break %04u continue %04u", a[0], a[1]);
+            break;
+        case BC_FOR_BEGIN:
+            fprintf(out, "break %04u continue %04u in", a[2], a[3]);
+            if (a[0] == FOR_POSITIONAL) fprintf(out, " $1...");
+            else print_words(c, a[0], a[1], out);
+            break;
+        case BC_FOR_NEXT:
+            fprintf(out, "%s end %04u", c->words[a[0]].text, a[1]);
+            break;
+        case BC_CASE: {
+            const struct node *n = c->cases[a[0]];
+            fprintf(out, "line %u: %s in", a[1], n->words[0].text);
+            for (size_t i = 0; i < n->arm_count; i++) {
+                for (size_t k = n->arms[i].first; k < n->arms[i].first + n->arms[i].count; k++) {
+                    const struct word *w = &n->words[k];
+                    if (w->quote != 0) fprintf(out, "%s%c%s%c", k > n->arms[i].first ? "|" : " ", w->quote, w->text, w->quote);
+                    else fprintf(out, "%s%s", k > n->arms[i].first ? "|" : " ", w->text);
+                }
+                fprintf(out, ") %04u", a[2 + i]);
+            }
+            fprintf(out, " none %04u", a[2 + n->arm_count]);
+            targets = n->arm_count + 1;
+            break;
+        }
+        }
+        fputc(NEWLINE, out);
+        pc += 1 + (size_t)instructions[op].operands + targets;
+    }
+}
+
+/**
+ * @brief The disasm builtin: prints the bytecode commands compile to, without running them
+ *   disasm 'COMMANDS'  compile the commands given as one argument
+ *   disasm -f FILE     compile every command of a script
+ * @return Exit status: 2 for a syntax error, 1 for a usage or file error
+ */
+int disasm_builtin(char **args) {
+    FILE *in;
+    const char *name = NULL;
+    if (args[1] != NULL && strcmp(args[1], "-f") == 0 && args[2] != NULL) {
+        name = args[2];
+        in = fopen(name, "r");
+    } else if (args[1] != NULL && args[2] == NULL) {
+        in = fmemopen(args[1], strlen(args[1]), "r");
+    } else {
+        fprintf(stderr, "usage: disasm 'COMMANDS' | disasm -f FILE\n");
+        return 1;
+    }
+    if (in == NULL) {
+        perror(name != NULL ? name : "disasm");
+        return 1;
+    }
+
+    struct line_source source;
+    line_source_stream(&source, in, name);
+    struct chunk *c = chunk_new();
+    int status = 0;
+    struct node *command;
+    while ((command = parse_command(&source)) != NULL || source.error) {
+        if (command == NULL) { // the parser reported it
+            status = 2;
+            continue;
+        }
+        compile(c, command, source.name, 0);
+        chunk_print(c, stdout);
+        struct chunk *body = chunk_new();
+        for (size_t i = 0; i < c->definition_count; i++) { // functions defined at the top level of the command
+            compile(body, c->definitions[i]->body, source.name, 1);
+            printf("; function %s\n", c->definitions[i]->name);
+            chunk_print(body, stdout);
+        }
+        chunk_free(body);
+        node_free(command);
+    }
+    chunk_free(c);
+    line_source_free(&source);
+    fclose(in);
+    return status;
+}
@@ -0,0 +1,183 @@
+/*******************************************************************************
+  @file         editor.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file editor.c
+ * @brief Terminal input batching, render buffering and latency instrumentation for parse()
+ *
+ * The line editor in parse() asks for one character at a time, but the
+ * terminal is read INPUT_BATCH bytes at a time, so a paste or a burst of key
+ * repeats arrives as a single batch. Everything the editor draws goes into a
+ * render buffer that is written with one system call right before the editor
+ * blocks for more input, i.e. once per batch.
+ *
+ * For every batch the time from its arrival to its frame being written is
+ * recorded in keystroke_histogram, and the bytes and write calls it took are
+ * counted in editor_totals. "stats" prints the totals; JBASH_KEYLOG=FILE additionally logs one
+ * line per batch: arrival (us), bytes read, bytes rendered, writes, latency (ns).
+ */
+#include "JBash.h"
+
+static char input_batch[INPUT_BATCH];
+static size_t batch_position = 0, batch_length = 0;
+static uint64_t batch_arrived_ns = 0; // 0 once the batch's frame has been flushed
+
+static char render_buffer[RENDER_BUFFER];
+static size_t render_length = 0;
+static uint64_t batch_render_bytes = 0, batch_writes = 0; // output of the current batch
+
+static FILE *keylog = NULL;
+static int keylog_checked = 0; // JBASH_KEYLOG is looked at once
+
+/**
+ * @brief Writes editor output to the terminal, counting the bytes and the system calls
+ */
+static void terminal_write(const char *bytes, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(STDOUT_FILENO, &bytes[written], length - written);
+        batch_writes++;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += (size_t)n;
+    }
+    batch_render_bytes += length;
+}
+
+/**
+ * @brief Writes the render buffer to the terminal
+ */
+static void render_write(void) {
+    terminal_write(render_buffer, render_length);
+    render_length = 0;
+}
+
+/**
+ * @brief Queues editor output, formatted like printf
+ * Output larger than the whole buffer (redrawing a very long line) is written on its own.
+ */
+void render(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(&render_buffer[render_length], RENDER_BUFFER - render_length, format, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < RENDER_BUFFER - render_length) {
+        render_length += (size_t)n;
+        return;
+    }
+    render_write(); // did not fit: make room, then format again
+    if ((size_t)n < RENDER_BUFFER) {
+        va_start(ap, format);
+        render_length = (size_t)vsnprintf(render_buffer, RENDER_BUFFER, format, ap);
+        va_end(ap);
+        return;
+    }
+    char *large = safe_malloc((size_t)n + 1);
+    va_start(ap, format);
+    vsnprintf(large, (size_t)n + 1, format, ap);
+    va_end(ap);
+    terminal_write(large, (size_t)n);
+    free(large);
+}
+
+/**
+ * @brief Writes the current batch's frame and records its latency
+ * Anything printed through stdio (the prompt) is flushed first so output stays in order.
+ */
+void render_flush(void) {
+    fflush(stdout);
+    if (render_length > 0) render_write();
+    if (batch_arrived_ns == 0) return; // nothing arrived since the last flush
+
+    uint64_t rendered_ns = monotonic_ns();
+    hist_record(&keystroke_histogram, rendered_ns - batch_arrived_ns);
+    TRACE_COMPLETE("render", batch_arrived_ns, rendered_ns);
+    editor_totals.batches++;
+    editor_totals.render_bytes += batch_render_bytes;
+    editor_totals.writes += batch_writes;
+    if (keylog != NULL) {
+        fprintf(keylog, "%llu %zu %llu %llu %llu\n", (unsigned long long)(batch_arrived_ns / 1000),
+                batch_length, (unsigned long long)batch_render_bytes, (unsigned long long)batch_writes,
+                (unsigned long long)(rendered_ns - batch_arrived_ns));
+    }
+    batch_arrived_ns = 0;
+    batch_render_bytes = 0;
+    batch_writes = 0;
+}
+
+/**
+ * @brief Closes the keystroke log at exit
+ */
+static void keylog_close(void) {
+    if (keylog != NULL) fclose(keylog);
+    keylog = NULL;
+}
+
+/**
+ * @brief Opens JBASH_KEYLOG the first time input is read
+ */
+static void keylog_open(void) {
+    keylog_checked = 1;
+    const char *path = getenv("JBASH_KEYLOG");
+    if (path == NULL || path[0] == NULLCHAR) return;
+    keylog = fopen(path, "w");
+    if (keylog == NULL) {
+        perror("JBASH_KEYLOG");
+        return;
+    }
+    atexit(keylog_close);
+}
+
+/**
+ * @brief Reads the next batch from the terminal while servicing the prompt segment worker
+ * @return Bytes read, 0 or -1 on end of input or error (like read)
+ */
+static ssize_t read_batch(const char *line, size_t length, size_t cursor) {
+    int worker = segment_fd();
+    while (worker != -1) {
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = worker, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents != 0) segment_update(line, length, cursor);
+        if (fds[0].revents != 0) break; // keyboard is ready
+        worker = segment_fd();
+    }
+    return read(STDIN_FILENO, input_batch, sizeof(input_batch));
+}
+
+/**
+ * @brief Wait for the next keystroke while servicing the prompt segment worker
+ * Characters come from the current batch; when it is used up the pending frame is
+ * flushed and the next batch is read.
+ *
+ * @param ch Where to store the character read
+ * @param line The text typed so far, used to redraw after a segment update
+ * @param length Length of the typed text
+ * @param cursor Cursor position within the typed text
+ * @return 1 when a character was read, 0 or -1 on end of input or error (like read)
+ */
+int read_input(char *ch, const char *line, size_t length, size_t cursor) {
+    if (batch_position == batch_length) {
+        render_flush(); // the editor is about to wait: this batch's frame is complete
+        segment_start(); // the prompt is on screen, now the segment worker may fork
+        if (!keylog_checked) keylog_open();
+        ssize_t n = read_batch(line, length, cursor);
+        if (n <= 0) return (int)n;
+        batch_arrived_ns = monotonic_ns();
+        batch_position = 0;
+        batch_length = (size_t)n;
+        editor_totals.keys += (uint64_t)n;
+    }
+    *ch = input_batch[batch_position++];
+    return 1;
+}
@@ -0,0 +1,589 @@
+/*******************************************************************************
+  @file         exec.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file exec.c
+ * @brief Command execution: command lists, pipelines, builtins and PATH lookup
+ *
+ * execute() runs the words of one parsed command list of the current
+ * session: pipelines joined by ';', '&&' and '||', each stage forked and
+ * reaped with wait4, builtins run in the shell itself.
+ */
+#include "JBash.h"
+
+/**
+  @brief Microseconds on the monotonic clock
+ */
+long long monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+  @brief Converts a struct timeval to microseconds
+ */
+long long timeval_us(struct timeval tv)
+{
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+  @brief Makes the usage of the command that just finished visible to the shell
+  Sets $? and the JB_* variables, and attaches the usage to the history entry.
+  @param usage Usage of the finished command
+ */
+void usage_publish(const struct cmd_usage *usage)
+{
+    var_set_number("JB_STATUS", usage->status);
+    var_set_number("JB_WALL_US", usage->wall_us);
+    var_set_number("JB_USER_US", usage->user_us);
+    var_set_number("JB_SYS_US", usage->sys_us);
+    var_set_number("JB_MAXRSS_KB", usage->maxrss_kb);
+    var_set_number("JB_NVCSW", usage->nvcsw);
+    var_set_number("JB_NIVCSW", usage->nivcsw);
+    history_record_usage(usage);
+}
+
+/**
+  @brief The exit builtin: "exit [N]", N defaults to the last status
+ */
+static int builtin_exit(char **argv, int *status)
+{
+    *status = argv[1] != NULL ? atoi(argv[1]) : session->last_usage.status; // "exit N" for scripts
+    return 0; // trigger termination
+}
+
+/**
+  @brief The cd builtin: "cd [DIR]", DIR defaults to HOME
+ */
+static int builtin_cd(char **argv, int *status)
+{
+    int rc;
+    if (argv[1] == NULL) { // try to default to home when given no argument for cd
+        rc = chdir(getenv("HOME")); // chdir sys call to change path
+    } else {
+        rc = chdir(argv[1]);
+    }
+
+    if (rc == 0) {
+        // keep the prompt (and the per directory segment cache) and the session's directory in sync
+        session_update_cwd(session);
+        // FOR DEBUGGING
+        #if DEBUG
+            char *cwd = getcwd(NULL, 0);
+            fprintf(stdout, "Current Working Directory: %s\n", cwd);
+            free(cwd);
+        #endif
+    } else {
+        perror("Failure to Change Directory");
+        *status = 1;
+    }
+    return 1;
+}
+
+/**
+  @brief The ':' builtin: does nothing and succeeds
+ */
+static int builtin_null(char **argv, int *status)
+{
+    (void)argv;
+    (void)status;
+    return 1;
+}
+
+/**
+ * A command implemented by the shell itself. Builtins that may end the shell
+ * use run; the others only return their status, through command.
+ */
+struct builtin {
+    const char *name;
+    int (*run)(char **argv, int *status); // returns 1 to continue and 0 to terminate
+    int (*command)(char **argv);          // returns the exit status
+};
+
+// The index into this table is a builtin's slot; call sites (compile.c) remember it
+static const struct builtin builtins[] = {
+    { "exit", builtin_exit, NULL },         // terminate the shell
+    { "cd", builtin_cd, NULL },             // change directory of current process
+    { "history", NULL, history_builtin },   // list previous commands
+    { "stats", NULL, stats_builtin },       // print latency histograms
+    { "trace", NULL, trace_builtin },       // control the event tracer
+    { "set", NULL, set_builtin },           // shell options such as -x
+    { "hash", NULL, hash_builtin },         // list or forget remembered PATH lookups
+    { "source", source_builtin, NULL },     // run a file in this shell
+    { ".", source_builtin, NULL },
+    { "snapshot", NULL, snapshot_builtin }, // show or save the cache snapshot
+    { "break", NULL, loop_builtin },        // leave or restart loops
+    { "continue", NULL, loop_builtin },
+    { ":", builtin_null, NULL },
+    { "return", NULL, return_builtin },     // leave the function being run
+    { "autoload", NULL, autoload_builtin }, // list the functions of the autoload directories
+    { "disasm", NULL, disasm_builtin },     // show the bytecode of commands
+    { "declare", NULL, declare_builtin },   // make variables arrays, or print them
+};
+
+/**
+  @brief Finds the builtin a command name refers to
+  @param name Command name
+  @return Its slot, or -1 when the command is not a builtin
+ */
+int builtin_slot(const char *name)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(name, builtins[i].name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+/**
+  @brief Runs a builtin command in the current process
+  @param slot The builtin, as builtin_slot() found it
+  @param argv Null terminated list of arguments, argv[0] names the builtin
+  @param status Set to the builtin's exit status
+  @return returns 1, to continue execution and 0 to terminate the JBash prompt.
+ */
+static int run_builtin(int slot, char **argv, int *status)
+{
+    *status = 0;
+    if (builtins[slot].run != NULL) return builtins[slot].run(argv, status);
+    *status = builtins[slot].command(argv);
+    return 1;
+}
+
+/**
+  @brief Checks for a NAME=value word (or NAME+=value, NAME[SUBSCRIPT]=value)
+ */
+static int is_assignment(const char *word)
+{
+    return var_assignment(word) != 0;
+}
+
+/**
+  @brief Fills a usage record from what wait4 returned for a child
+ */
+static void usage_from_rusage(struct cmd_usage *usage, int wstatus, const struct rusage *ru)
+{
+    usage->status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+    usage->user_us = timeval_us(ru->ru_utime);
+    usage->sys_us = timeval_us(ru->ru_stime);
+    usage->maxrss_kb = ru->ru_maxrss;
+    usage->nvcsw = ru->ru_nvcsw;
+    usage->nivcsw = ru->ru_nivcsw;
+}
+
+/**
+  @brief Runs a function or a builtin in the shell itself, measured with getrusage deltas of the shell
+  @param slot The builtin, when function is NULL
+  @param function The function, or NULL
+  @param argv Its words, expanded
+  @param usage Set to its usage
+  @return returns 1, to continue execution and 0 to terminate the JBash prompt.
+ */
+static int run_in_shell(int slot, struct function *function, char **argv, struct cmd_usage *usage)
+{
+    long long started = monotonic_us();
+    struct rusage before, after;
+    int status = 0, rv;
+    getrusage(RUSAGE_SELF, &before);
+    if (function != NULL) {
+        TRACE_BEGIN("function");
+        rv = function_call(function, argv, &status);
+        TRACE_END("function");
+    } else {
+        TRACE_BEGIN("builtin");
+        rv = run_builtin(slot, argv, &status);
+        TRACE_END("builtin");
+    }
+    getrusage(RUSAGE_SELF, &after);
+    memset(usage, 0, sizeof(*usage));
+    usage->status = status;
+    usage->wall_us = monotonic_us() - started;
+    usage->user_us = timeval_us(after.ru_utime) - timeval_us(before.ru_utime);
+    usage->sys_us = timeval_us(after.ru_stime) - timeval_us(before.ru_stime);
+    usage->maxrss_kb = after.ru_maxrss;
+    usage->nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+    usage->nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    stats_record_command(argv[0], (uint64_t)usage->wall_us * 1000);
+    return rv;
+}
+
+/**
+  @brief Runs one pipeline: stages separated by OP_PIPE, each stage forked with its stdout piped to the next
+  A lone function or builtin runs in the shell itself so cd and exit keep working; inside a
+  longer pipeline they run in the forked child. Leading NAME=value words set shell variables
+  when they are all a stage has, otherwise they go into the environment of its command. Every stage is reaped with wait4 so the
+  pipeline's usage (and the per stage usage, when a report is given) is accurate.
+
+  @param argv Null terminated list of words of the pipeline, split in place at OP_PIPE
+  @param usage Set to the pipeline's usage: last stage's status, summed CPU and context switches, peak RSS
+  @param report Where per stage usage is appended for the time keyword, or NULL
+  @param pipeline 1-based index of the pipeline within the command list, for the report
+  @param resolved Path of the first stage's command when a call site already found it, or NULL
+  @return returns 1, to continue execution and 0 to terminate the JBash prompt.
+ */
+static int run_pipeline(char **argv, struct cmd_usage *usage, struct time_report *report, int pipeline,
+                        const char *resolved)
+{
+    int rv = 1;
+    long long started = monotonic_us();
+    memset(usage, 0, sizeof(*usage));
+
+    // split the pipeline into stages in place
+    size_t count = 1;
+    for (size_t i = 0; argv[i] != NULL; i++) {
+        if (argv[i] == OP_PIPE) count++;
+    }
+    char **stages[count];
+    stages[0] = argv;
+    for (size_t i = 0, k = 1; argv[i] != NULL; i++) {
+        if (argv[i] == OP_PIPE) {
+            argv[i] = NULL;
+            stages[k++] = &argv[i + 1];
+        }
+    }
+
+    char **assignments[count]; // each stage's NAME=value words, the stage itself starts after them
+    for (size_t k = 0; k < count; k++) {
+        assignments[k] = stages[k];
+        while (stages[k][0] != NULL && is_assignment(stages[k][0])) stages[k]++;
+    }
+    argv = stages[0];
+
+    struct function *function = argv[0] != NULL && resolved == NULL ? function_find(argv[0]) : NULL;
+    int slot = argv[0] != NULL && resolved == NULL && function == NULL ? builtin_slot(argv[0]) : -1;
+    if (count == 1 && (argv[0] == NULL || function != NULL || slot != -1)) {
+        if (argv[0] == NULL) { // assignments only
+            for (char **a = assignments[0]; a < argv; a++) {
+                if (var_set_word(*a) == -1) usage->status = 1;
+            }
+            usage->wall_us = monotonic_us() - started;
+        } else {
+            rv = run_in_shell(slot, function, argv, usage);
+        }
+        if (report != NULL) time_report_add(report, assignments[0], pipeline, 1, usage);
+        return rv;
+    }
+
+    pid_t pids[count];
+    uint64_t forked[count]; // monotonic_ns() just before each fork
+    size_t spawned = 0;
+    int in = -1; // read end of the previous stage's pipe
+    fflush(stdout); // children must not inherit (and repeat) buffered output
+    for (size_t k = 0; k < count; k++) {
+        int fds[2] = { -1, -1 };
+        if (k + 1 < count && pipe(fds) == -1) {
+            perror("Pipe failed");
+            break;
+        }
+        // resolved here so the lookup shows up in traces and children only exec
+        const char *path = k == 0 ? resolved : NULL;
+        struct function *stage_function = NULL;
+        int stage_slot = -1;
+        if (stages[k][0] != NULL && path == NULL) {
+            stage_function = function_find(stages[k][0]);
+            if (stage_function == NULL) stage_slot = builtin_slot(stages[k][0]);
+            if (stage_function == NULL && stage_slot == -1) {
+                TRACE_BEGIN("path_lookup");
+                path = resolve_command(stages[k][0]);
+                TRACE_END("path_lookup");
+            }
+        }
+        stats_spawn_begin(k);
+        TRACE_BEGIN("fork");
+        forked[k] = monotonic_ns();
+        pid_t rc = fork();
+        if (rc == -1) {
+            perror("Fork failed");
+            rv = 0; // trigger termination
+            if (fds[0] != -1) { close(fds[0]); close(fds[1]); }
+            break;
+        } else if (rc == 0) {
+            if (in != -1) { dup2(in, STDIN_FILENO); close(in); }
+            if (fds[1] != -1) { dup2(fds[1], STDOUT_FILENO); close(fds[0]); close(fds[1]); }
+            for (char **a = assignments[k]; a < stages[k]; a++) { // the child execs before the words go away
+                if (var_assignment(*a) == var_name_length(*a)) putenv(*a); // not NAME+= or NAME[SUBSCRIPT]=
+            }
+            if (stages[k][0] == NULL) _exit(EXIT_SUCCESS);
+            if (stage_function != NULL || stage_slot != -1) {
+                int status;
+                if (stage_function != NULL) function_call(stage_function, stages[k], &status);
+                else run_builtin(stage_slot, stages[k], &status);
+                fflush(stdout);
+                _exit(status);
+            }
+            stats_spawn_exec(k);
+            int status = execvp(path != NULL ? path : stages[k][0], stages[k]);
+            if (status == -1) {
+                perror("Failure to Execute Command");
+                // free allocated memory of child process heap
+                free_args(session->args);
+                _exit(EXIT_FAILURE); // skip atexit handlers, they belong to the shell (trace, profile, set -x)
+            }
+        }
+        TRACE_END("fork");
+        pids[spawned++] = rc;
+        if (in != -1) close(in);
+        if (fds[1] != -1) close(fds[1]);
+        in = fds[0];
+    }
+    if (in != -1) close(in);
+
+    // reap the stages in whatever order they finish; a prompt worker reaped here is harmless,
+    // prompt.c only uses waitpid to avoid leaving zombies behind
+    size_t remaining = spawned;
+    TRACE_BEGIN("wait");
+    while (remaining > 0) {
+        int wstatus = 0;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &wstatus, 0, &ru);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        size_t k = 0;
+        while (k < spawned && pids[k] != pid) k++;
+        if (k == spawned) continue; // not one of ours
+
+        struct cmd_usage stage = {0};
+        usage_from_rusage(&stage, wstatus, &ru);
+        uint64_t elapsed = monotonic_ns() - forked[k];
+        stage.wall_us = (long long)(elapsed / 1000);
+        uint64_t exec_ns = stats_spawn_end(k, forked[k]);
+        if (exec_ns != 0) TRACE_COMPLETE("spawn", forked[k], exec_ns);
+        if (stages[k][0] != NULL) stats_record_command(stages[k][0], elapsed);
+        if (k == count - 1) usage->status = stage.status; // pipeline status is the last stage's
+        usage->user_us += stage.user_us;
+        usage->sys_us += stage.sys_us;
+        if (stage.maxrss_kb > usage->maxrss_kb) usage->maxrss_kb = stage.maxrss_kb;
+        usage->nvcsw += stage.nvcsw;
+        usage->nivcsw += stage.nivcsw;
+        if (report != NULL) time_report_add(report, assignments[k], pipeline, (int)k + 1, &stage);
+        remaining--;
+    }
+    TRACE_END("wait");
+    usage->wall_us = monotonic_us() - started;
+    return rv;
+}
+
+/**
+  @brief Searches PATH for a command the way execvp would, remembering it in the command hash table
+  @param name Command name; names containing a '/' are used as they are
+  @return Path to the executable (name itself or a copy in word_arena), or NULL if not found
+ */
+char *resolve_command(const char *name)
+{
+    if (strchr(name, '/') != NULL) return (char *)name;
+    const char *path = getenv("PATH");
+    if (path == NULL) path = "/bin:/usr/bin";
+
+    const char *hashed = hash_find(name, path);
+    if (hashed != NULL) {
+        char *found = arena_alloc(&session->word_arena, strlen(hashed) + 1);
+        return strcpy(found, hashed);
+    }
+
+    size_t name_length = strlen(name);
+    for (const char *dir = path; ; ) {
+        const char *end = strchr(dir, ':');
+        size_t dir_length = end != NULL ? (size_t)(end - dir) : strlen(dir);
+        char candidate[dir_length + name_length + 3];
+        if (dir_length == 0) { // empty entry means the current directory
+            snprintf(candidate, sizeof(candidate), "./%s", name);
+        } else {
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)dir_length, dir, name);
+        }
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            if (candidate[0] == '/') hash_add(name, candidate); // relative entries depend on the directory
+            char *found = arena_alloc(&session->word_arena, strlen(candidate) + 1);
+            return strcpy(found, candidate);
+        }
+        if (end == NULL) break;
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+/**
+  @brief Checks that every operator separates two commands (a trailing ';' is allowed)
+  @param words Words of the command list, not expanded
+  @param count Number of words
+  @return The offending operator, or NULL when the list is well formed
+ */
+const char *check_syntax(const struct word *words, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        char *op = word_operator(words[i].text, words[i].quote);
+        if (op == NULL) continue;
+        if (i == 0 || word_operator(words[i - 1].text, words[i - 1].quote) != NULL) return op; // nothing before it
+        if (i + 1 == count && op != OP_SEMI) return op; // nothing after it
+    }
+    return NULL;
+}
+
+/**
+  @brief Execute a command list: pipelines joined by ';', '&&' and '||'
+  Each pipeline's words are expanded just before it runs, so "X=1 ; echo $X" sees the new value.
+  Each pipeline's stages are forked and reaped with wait4 so exit statuses and resource
+  usage end up in the session's last_usage; builtins are measured with getrusage deltas of the shell itself.
+  A leading "time" (optionally "time -j" for JSON) reports the whole list with per stage usage.
+  The expanded words live in word_arena, the caller resets it.
+  @param words Words of the command list as parsed, not expanded
+  @param count Number of words
+  @return returns 1, to continue execution and 0 to terminate the JBash prompt.
+ */
+int execute(const struct word *words, size_t count)
+{
+    // FOR DEBUGGING
+    #if DEBUG
+        for (size_t i = 0; i < count; i++) {
+            printf("arg[%zu]:  %s\n", i, words[i].text);
+        }
+    #endif
+
+    int rv = 1; // return value, 1 by default, set to 0 for termination.
+
+    if (count == 0) return rv; // invalid input i.e. all whitespace, do nothing, $? is kept
+
+    TRACE_BEGIN("execute");
+    struct time_report report = {0};
+    int timed = 0, json = 0;
+    if (words[0].quote == 0 && strcmp(words[0].text, "time") == 0) { // 'time' keyword, measures the rest of the line
+        timed = 1;
+        words++;
+        count--;
+        if (count > 0 && strcmp(words[0].text, "-j") == 0) {
+            json = 1;
+            words++;
+            count--;
+        }
+    }
+
+    const char *bad = check_syntax(words, count);
+    if (bad != NULL) {
+        fprintf(stderr, "JBash: syntax error near '%s'\n", bad);
+        session->last_usage = (struct cmd_usage){ .status = 2 };
+        usage_publish(&session->last_usage);
+        TRACE_END("execute");
+        return rv;
+    }
+
+    struct cmd_usage total = {0}, usage = {0};
+    long long started = monotonic_us();
+    int pipeline = 0;
+    char *previous = NULL; // operator that ended the previous pipeline
+    size_t i = 0;
+    while (rv && i < count && !loop_jumping()) { // break and return end the list too
+        size_t start = i;
+        char *op = NULL;
+        while (i < count) {
+            op = word_operator(words[i].text, words[i].quote);
+            if (op == OP_SEMI || op == OP_AND || op == OP_OR) break;
+            op = NULL;
+            i++;
+        }
+        size_t end = i;
+        if (op != NULL) i++;
+
+        int run = previous == NULL || previous == OP_SEMI ||
+                  (previous == OP_AND && total.status == 0) || (previous == OP_OR && total.status != 0);
+        if (run && end - start == 1 && is_arith_command(&words[start])) { // (( )) runs in the shell, unmeasured
+            usage = (struct cmd_usage){ .status = arith_command(&words[start]) };
+            total.status = usage.status;
+            session->last_usage.status = usage.status;
+        } else if (run) {
+            char **argv = make_argv(&words[start], end - start, 1, NULL);
+            if (argv == NULL) { // an expansion error, reported; the pipeline does not run
+                usage = (struct cmd_usage){ .status = 1 };
+            } else {
+                if (xtrace_enabled && argv[0] != NULL) xtrace_command(argv);
+                TRACE_BEGIN("pipeline");
+                rv = run_pipeline(argv, &usage, timed ? &report : NULL, ++pipeline, NULL);
+                TRACE_END("pipeline");
+            }
+            total.status = usage.status;
+            session->last_usage.status = usage.status; // $? of the next pipeline
+            total.user_us += usage.user_us;
+            total.sys_us += usage.sys_us;
+            if (usage.maxrss_kb > total.maxrss_kb) total.maxrss_kb = usage.maxrss_kb;
+            total.nvcsw += usage.nvcsw;
+            total.nivcsw += usage.nivcsw;
+        }
+        previous = op;
+    }
+    total.wall_us = monotonic_us() - started;
+
+    if (timed) time_report_print(&report, &total, json);
+    if (profiling) profile_add_cpu(total.user_us + total.sys_us);
+    session->last_usage = total;
+    usage_publish(&session->last_usage);
+    TRACE_END("execute");
+    return rv;
+}
+
+/**
+  @brief Looks up what a call site's command name means now
+ */
+static void resolve_site(struct call_site *site, const char *name)
+{
+    free(site->path);
+    site->path = NULL;
+    if ((site->function = function_find(name)) != NULL) {
+        site->kind = CALL_FUNCTION;
+    } else if ((site->slot = builtin_slot(name)) != -1) {
+        site->kind = CALL_BUILTIN;
+    } else {
+        TRACE_BEGIN("path_lookup");
+        char *path = resolve_command(name);
+        TRACE_END("path_lookup");
+        // a command found through a relative PATH entry depends on the directory, like in the hash table
+        if (path != NULL && (path[0] == '/' || strchr(name, '/') != NULL)) site->path = strdup(path);
+        site->kind = site->path != NULL ? CALL_EXTERNAL : CALL_SEARCH;
+    }
+    site->generation = command_generation; // after the lookup, which may have autoloaded a function
+}
+
+/**
+  @brief Runs a simple command compiled to a call site (compile.c)
+  The same as execute() on a list of one simple command, without looking for
+  operators or "time". The site remembers whether the name is a function, a
+  builtin or an external command until command_generation moves on, so
+  repeated calls skip the function table, the builtin table and PATH.
+  @param site The call site, updated when it has to look the name up
+  @param words Words of the command as parsed, not expanded; the first is the name
+  @param count Number of words
+  @return returns 1, to continue execution and 0 to terminate the JBash prompt.
+ */
+int execute_call(struct call_site *site, const struct word *words, size_t count)
+{
+    TRACE_BEGIN("execute");
+    char **argv = make_argv(words, count, 1, NULL);
+    if (argv == NULL) { // an expansion error, the command does not run
+        session->last_usage = (struct cmd_usage){ .status = 1 };
+        usage_publish(&session->last_usage);
+        TRACE_END("execute");
+        return 1;
+    }
+    if (xtrace_enabled) xtrace_command(argv);
+    if (site->generation != command_generation ||
+        (site->kind == CALL_EXTERNAL && access(site->path, X_OK) != 0)) { // moved or deleted
+        resolve_site(site, argv[0]);
+    }
+
+    struct cmd_usage usage;
+    int rv;
+    switch (site->kind) {
+    case CALL_FUNCTION: rv = run_in_shell(-1, site->function, argv, &usage); break;
+    case CALL_BUILTIN: rv = run_in_shell(site->slot, NULL, argv, &usage); break;
+    default: rv = run_pipeline(argv, &usage, NULL, 1, site->path); break;
+    }
+    if (profiling) profile_add_cpu(usage.user_us + usage.sys_us);
+    session->last_usage = usage;
+    usage_publish(&session->last_usage);
+    TRACE_END("execute");
+    return rv;
+}
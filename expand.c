@@ -0,0 +1,423 @@
+/*******************************************************************************
+  @file         expand.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file expand.c
+ * @brief Parameter expansion of words and the arena that holds the results
+ *
+ * Supported forms are $NAME, ${NAME}, the special parameters $? and $#, the
+ * positional parameters $1...$9, ${N}, $@ and $* (joined by spaces),
+ * arithmetic $(( )) (arith.c) and array elements ${NAME[SUBSCRIPT]}, with
+ * ${NAME[@]}, ${#NAME[@]} and ${!NAME[@]} (arrays.c). Words in single quotes are left alone. Words
+ * without a '$' are returned as they are, so the common case allocates nothing.
+ *
+ * ${#NAME} is the length of a value, ${NAME:OFFSET:LENGTH} a part of it, and
+ * ${NAME#PATTERN}, ${NAME%PATTERN} and ${NAME/PATTERN/REPLACEMENT} remove or
+ * replace what a glob pattern (pattern.c) matches. Every result is written
+ * once into a buffer of its exact size, and a replacement searches on from
+ * the end of the previous match, so mangling a long value stays linear.
+ */
+#include "JBash.h"
+
+/**
+ * What lookup_reference() returns when a reference has an error that is
+ * already reported, such as a failed $(( )) in an operand.
+ */
+static const char expand_error[] = "";
+
+/**
+ * @brief Hands out SIZE bytes from the arena, adding a block when the current one is full
+ * @param arena Arena to allocate from
+ * @param size Number of bytes needed
+ * @return Pointer valid until the next arena_reset()
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1); // keeps every block aligned for pointers and sizes
+    struct arena_block *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        block = safe_malloc(sizeof(struct arena_block) + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *ptr = &block->data[block->used];
+    block->used += size;
+    return ptr;
+}
+
+/**
+ * @brief Releases everything handed out by the arena
+ * The newest block is kept for the next command so steady use does not call malloc.
+ */
+void arena_reset(struct arena *arena) {
+    struct arena_block *block = arena->head;
+    if (block == NULL) return;
+    struct arena_block *older = block->next;
+    while (older != NULL) {
+        struct arena_block *next = older->next;
+        free(older);
+        older = next;
+    }
+    block->next = NULL;
+    block->used = 0;
+}
+
+/**
+ * @brief Releases every block of an arena, for a session that goes away
+ */
+void arena_free(struct arena *arena) {
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+/**
+ * @brief The positional parameters joined by spaces, for $@ and $*
+ * @return A string in word_arena
+ */
+static const char *positional_joined(void) {
+    size_t total = 1;
+    for (size_t i = 0; i < session->positional_count; i++) total += strlen(session->positional[i]) + 1;
+    char *joined = arena_alloc(&session->word_arena, total);
+    char *out = joined;
+    for (size_t i = 0; i < session->positional_count; i++) {
+        if (i > 0) *out++ = ' ';
+        size_t length = strlen(session->positional[i]);
+        memcpy(out, session->positional[i], length);
+        out += length;
+    }
+    *out = NULLCHAR;
+    return joined;
+}
+
+/**
+ * @brief The value of a parameter: a variable, $?, $#, $@, $* or a positional parameter
+ * @param name The parameter's name, need not be null terminated
+ * @return The value (empty string when unset)
+ */
+static const char *parameter_value(const char *name, size_t name_length) {
+    if (*name == '?' || *name == '#') { // a word may hold both, each needs its own buffer
+        char *number = arena_alloc(&session->word_arena, 24);
+        if (*name == '?') snprintf(number, 24, "%d", session->last_usage.status);
+        else snprintf(number, 24, "%zu", session->positional_count);
+        return number;
+    }
+    if (*name == '@' || *name == '*') return positional_joined();
+    if (*name >= '1' && *name <= '9') {
+        size_t n = strtoul(name, NULL, 10);
+        return n <= session->positional_count ? session->positional[n - 1] : "";
+    }
+    char small_key[64]; // a name of any length fits the arena, not the stack
+    char *key = name_length < sizeof(small_key) ? small_key : arena_alloc(&session->word_arena, name_length + 1);
+    memcpy(key, name, name_length);
+    key[name_length] = NULLCHAR;
+    const char *value = var_get(key);
+    return value != NULL ? value : "";
+}
+
+/**
+ * @brief Finds where an operand of ${NAME#...}, ${NAME/.../...} or ${NAME:...:...} ends
+ * Nested ${...} are skipped, and a backslash quotes the next character.
+ * @param stop Character that ends the operand besides the closing '}'
+ * @return The stop character or the closing '}', NULL when the word ends first
+ */
+static const char *operand_end(const char *p, char stop) {
+    int depth = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && p[1] != NULLCHAR) p++;
+        else if (*p == '$' && p[1] == '{') depth++, p++;
+        else if (*p == '}' && depth > 0) depth--;
+        else if (*p == '}' || (*p == stop && depth == 0)) return p;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Expands an operand of an operation, such as the pattern of ${NAME#PATTERN}
+ * @return A null terminated copy in word_arena, expanded; NULL after an error
+ */
+static char *operand(const char *start, const char *end) {
+    size_t length = (size_t)(end - start);
+    char *text = arena_alloc(&session->word_arena, length + 1);
+    memcpy(text, start, length);
+    text[length] = NULLCHAR;
+    return expand_word(text, 0, NULL);
+}
+
+/**
+ * @brief ${NAME/PATTERN/REPLACEMENT} and ${NAME//PATTERN/REPLACEMENT}
+ * The matches are found first, then the result is written into one buffer
+ * of the exact size; a search goes on from the end of the previous match.
+ * @param all Non-zero to replace every match, otherwise only the first
+ */
+static const char *replace(const char *value, size_t value_length, const struct pattern *p, const char *replacement,
+                           int all) {
+    struct span {
+        size_t start, end;
+    } *spans = NULL;
+    size_t count = 0, capacity = 0, from = 0, kept = value_length, start, end;
+    while (pattern_find(p, value + from, value_length - from, &start, &end)) {
+        if (count == capacity) { // doubles, so the copies add up to less than the final size
+            capacity = capacity == 0 ? 8 : 2 * capacity;
+            struct span *grown = arena_alloc(&session->word_arena, capacity * sizeof(struct span));
+            if (count > 0) memcpy(grown, spans, count * sizeof(struct span));
+            spans = grown;
+        }
+        spans[count++] = (struct span){ from + start, from + end };
+        kept -= end - start;
+        from += end;
+        if (!all) break;
+    }
+    if (count == 0) return value;
+
+    size_t replacement_length = strlen(replacement);
+    char *result = arena_alloc(&session->word_arena, kept + count * replacement_length + 1);
+    char *out = result;
+    from = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(out, value + from, spans[i].start - from);
+        out += spans[i].start - from;
+        memcpy(out, replacement, replacement_length);
+        out += replacement_length;
+        from = spans[i].end;
+    }
+    memcpy(out, value + from, value_length - from);
+    out[value_length - from] = NULLCHAR;
+    return result;
+}
+
+/**
+ * @brief ${NAME:OFFSET} and ${NAME:OFFSET:LENGTH}, both arithmetic
+ * A negative offset counts back from the end, a negative length leaves that
+ * many bytes off the end.
+ * @param length_text The LENGTH operand, NULL without one
+ * @return The part, or expand_error after reporting an error in an operand
+ */
+static const char *substring(const char *value, size_t value_length, const char *offset_text, const char *length_text) {
+    int64_t offset = 0, count = (int64_t)value_length, n = (int64_t)value_length;
+    if (*offset_text != NULLCHAR && arith_evaluate(offset_text, &offset) == -1) return expand_error;
+    if (length_text != NULL && *length_text != NULLCHAR && arith_evaluate(length_text, &count) == -1) {
+        return expand_error;
+    }
+    if (length_text != NULL && *length_text == NULLCHAR) count = 0;
+    if (offset < 0) offset += n;
+    if (offset < 0 || offset > n) return "";
+    if (count < 0) {
+        count += n - offset;
+        if (count < 0) {
+            fprintf(stderr, "JBash: %s: substring expression < 0\n", length_text);
+            return expand_error;
+        }
+    }
+    if (count > n - offset) count = n - offset;
+    char *result = arena_alloc(&session->word_arena, (size_t)count + 1);
+    memcpy(result, value + offset, (size_t)count);
+    result[count] = NULLCHAR;
+    return result;
+}
+
+/**
+ * @brief Runs the operation of ${NAME#PATTERN}, ${NAME##PATTERN}, ${NAME%PATTERN},
+ * ${NAME%%PATTERN}, ${NAME/PATTERN/REPLACEMENT} (also // for every match, /# and
+ * /% anchored at the start or end) or ${NAME:OFFSET:LENGTH}
+ * Operands are expanded first, then the value is read.
+ * @param name The parameter's name, the operator follows it
+ * @param unbalanced Set when an operand runs to the end of the word, later operations then stay literal
+ * @return As lookup_reference()
+ */
+static const char *lookup_operation(const char *dollar, const char *name, size_t name_length, size_t *length,
+                                    int *unbalanced) {
+    *length = 0;
+    const char *op = &name[name_length];
+    char kind = *op++;
+    if (kind == ':' && (*op == '-' || *op == '=' || *op == '+' || *op == '?')) return NULL; // ${NAME:-WORD} is not supported
+    if (*unbalanced || session->expand_depth >= EXPAND_NESTING_MAX) return NULL;
+    int longest = 0, all = 0;
+    char anchor = 0;
+    if ((kind == '#' || kind == '%') && *op == kind) longest = 1, op++;
+    else if (kind == '/' && *op == '/') all = 1, op++;
+    else if (kind == '/' && (*op == '#' || *op == '%')) anchor = *op++;
+    const char *first_end = operand_end(op, kind == '/' ? '/' : kind == ':' ? ':' : '}'), *second = NULL;
+    const char *close = first_end;
+    if (first_end != NULL && *first_end != '}') {
+        second = first_end + 1;
+        close = operand_end(second, '}');
+    }
+    if (close == NULL) {
+        *unbalanced = 1; // scanning again from every later '$' would be quadratic
+        return NULL;
+    }
+    session->expand_depth++;
+    char *first = operand(op, first_end);
+    char *rest = second != NULL ? operand(second, close) : NULL;
+    session->expand_depth--;
+    *length = (size_t)(close + 1 - dollar);
+    if (first == NULL || (second != NULL && rest == NULL)) return expand_error;
+
+    const char *value = parameter_value(name, name_length);
+    size_t value_length = strlen(value);
+    if (kind == ':') return substring(value, value_length, first, rest);
+    struct pattern *p = pattern_get(first, strlen(first));
+    if (kind == '#') {
+        size_t cut = pattern_prefix(p, value, value_length, longest);
+        return cut == PATTERN_NO_MATCH ? value : value + cut;
+    }
+    if (kind == '%' || anchor != 0) {
+        size_t cut = kind == '%' || anchor == '%' ? pattern_suffix(p, value, value_length, kind == '/' || longest)
+                                                  : pattern_prefix(p, value, value_length, 1);
+        if (cut == PATTERN_NO_MATCH) return value;
+        const char *replacement = anchor != 0 && rest != NULL ? rest : "";
+        size_t replacement_length = strlen(replacement);
+        char *result = arena_alloc(&session->word_arena, value_length - cut + replacement_length + 1);
+        if (anchor == '#') {
+            memcpy(result, replacement, replacement_length);
+            memcpy(result + replacement_length, value + cut, value_length - cut + 1);
+        } else {
+            memcpy(result, value, value_length - cut);
+            memcpy(result + value_length - cut, replacement, replacement_length + 1);
+        }
+        return result;
+    }
+    if (*first == NULLCHAR) return value;
+    return replace(value, value_length, p, rest != NULL ? rest : "", all);
+}
+
+/**
+ * @brief Finds the array element a ${NAME[SUBSCRIPT]}, ${#NAME[...]} or ${!NAME[@]} refers to
+ * @param name The name, after the '#' or '!'
+ * @param prefix '#', '!' or 0
+ * @return As lookup_reference()
+ */
+static const char *lookup_element(const char *dollar, const char *name, char prefix, size_t *length) {
+    size_t name_length = var_name_length(name);
+    const char *subscript = &name[name_length + 1];
+    const char *close = name[name_length] == '[' ? strchr(subscript, ']') : NULL;
+    const char *value = NULL;
+    if (close != NULL && close[1] == '}') {
+        value = array_expand(name, name_length, subscript, (size_t)(close - subscript), prefix);
+    }
+    *length = value != NULL ? (size_t)(close + 2 - dollar) : 0;
+    return value;
+}
+
+/**
+ * @brief Finds the variable a '$' refers to
+ * @param dollar Points at the '$'
+ * @param length Set to the number of characters the reference spans, 0 if it is not one
+ * @param unbalanced See lookup_operation()
+ * @return The value (empty string for unset variables), or NULL if the '$' is literal
+ */
+static const char *lookup_reference(const char *dollar, size_t *length, int *unbalanced) {
+    const char *name = dollar + 1;
+    int braced = (*name == '{');
+    if (braced) name++;
+    if (braced && *name == '#' && name[1] != '}') { // ${#NAME} or ${#N}: the length of the value, in bytes
+        size_t n = var_name_length(name + 1);
+        while (n == 0 && name[1] >= '1' && name[1] <= '9' && name[1 + n] >= '0' && name[1 + n] <= '9') n++;
+        if (n > 0 && name[1 + n] == '}') {
+            char *number = arena_alloc(&session->word_arena, 24);
+            snprintf(number, 24, "%zu", strlen(parameter_value(name + 1, n)));
+            *length = n + 4;
+            return number;
+        }
+    }
+    if (braced && (*name == '#' || *name == '!') && var_name_length(name + 1) > 0) {
+        return lookup_element(dollar, name + 1, *name, length);
+    }
+
+    size_t name_length = 0;
+    if (*name == '?' || *name == '#' || *name == '@' || *name == '*' || (*name >= '1' && *name <= '9')) {
+        name_length = 1;
+        while (braced && name[name_length] >= '0' && name[name_length] <= '9' && *name >= '1') name_length++; // ${10}
+    } else if (*name == '_' || (*name >= 'A' && *name <= 'Z') || (*name >= 'a' && *name <= 'z')) {
+        while (name[name_length] == '_' || (name[name_length] >= 'A' && name[name_length] <= 'Z') ||
+               (name[name_length] >= 'a' && name[name_length] <= 'z') ||
+               (name[name_length] >= '0' && name[name_length] <= '9')) {
+            name_length++;
+        }
+    }
+    if (braced && var_name_length(name) > 0 && name[name_length] == '[') return lookup_element(dollar, name, 0, length);
+    if (braced && name_length > 0 && *name != '?' && *name != '#' && *name != '@' && *name != '*' &&
+        name[name_length] != NULLCHAR && strchr("#%/:", name[name_length]) != NULL) {
+        return lookup_operation(dollar, name, name_length, length, unbalanced);
+    }
+    if (name_length == 0 || (braced && name[name_length] != '}')) {
+        *length = 0;
+        return NULL;
+    }
+    *length = 1 + name_length + (braced ? 2 : 0);
+    return parameter_value(name, name_length);
+}
+
+/**
+ * A piece of an expanded word: a reference's value, or a run of the word's own text.
+ */
+struct piece {
+    const char *text;
+    size_t length;
+};
+
+/**
+ * @brief Expands variable references and $(( )) in a word
+ * Every reference is looked up (and every expression evaluated) once, left to right.
+ * @param word Null terminated word, as split by split_words()
+ * @param quote The quote character the word was enclosed in, or 0
+ * @param arith The word's compiled $(( )) expressions, NULL when the parser did not compile them
+ * @return The word itself when there is nothing to expand, otherwise a copy in word_arena;
+ *         NULL after an expansion error, which is already reported
+ */
+char *expand_word(char *word, char quote, const struct arith *arith) {
+    if (quote == '\'' || strchr(word, '$') == NULL) return word;
+    TRACE_BEGIN("expand");
+
+    // the pieces are collected first and copied once the total is known, so the result is allocated once
+    size_t dollars = 0;
+    for (const char *p = strchr(word, '$'); p != NULL; p = strchr(p + 1, '$')) dollars++;
+    size_t most = 2 * dollars + 1;
+    struct piece small[32];
+    struct piece *pieces = most <= 32 ? small : arena_alloc(&session->word_arena, most * sizeof(struct piece));
+    size_t count = 0, total = 0, length;
+    const char *literal = word;
+    int unbalanced = 0; // an unclosed "$((" ran to the end, later ones stay literal so the word is scanned once
+    int operand_unbalanced = 0; // the same for an unclosed ${NAME#...}
+    for (const char *p = word; *p; ) {
+        const char *value = NULL;
+        if (*p == '$' && p[1] == '(' && p[2] == '(') {
+            if (!unbalanced) value = arith_expand(&arith, word, p, &length);
+            if (value == NULL && !unbalanced && length > 0) value = expand_error;
+            unbalanced = value == NULL;
+        } else if (*p == '$') {
+            value = lookup_reference(p, &length, &operand_unbalanced);
+        }
+        if (value == expand_error) {
+            TRACE_END("expand");
+            return NULL;
+        }
+        if (value == NULL) {
+            p++;
+            continue;
+        }
+        if (p > literal) pieces[count++] = (struct piece){ literal, (size_t)(p - literal) };
+        pieces[count++] = (struct piece){ value, strlen(value) };
+        total += (size_t)(p - literal) + pieces[count - 1].length;
+        p += length;
+        literal = p;
+    }
+    size_t rest = strlen(literal);
+    pieces[count++] = (struct piece){ literal, rest };
+    total += rest;
+
+    char *result = arena_alloc(&session->word_arena, total + 1);
+    char *out = result;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(out, pieces[i].text, pieces[i].length);
+        out += pieces[i].length;
+    }
+    *out = NULLCHAR;
+    TRACE_END("expand");
+    return result;
+}
@@ -0,0 +1,200 @@
+/*******************************************************************************
+  @file         functions.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file functions.c
+ * @brief Shell functions and the return builtin
+ *
+ * "NAME () { list; }" stores a copy of the parsed body in a chained hash
+ * table of the session; the copy is compiled to bytecode the first time the
+ * function is called, once. A call sets $1, $2, ... to its arguments and runs
+ * the body in the caller's session, with a word arena of its own so the
+ * body's commands do not release the caller's words.
+ *
+ * Defining a function moves command_generation on (hash.c), so call sites
+ * that remembered what the name meant look it up again. A function that is
+ * redefined while it runs is freed when its last call returns. A name that
+ * is not defined yet may be in an autoload directory (autoload.c).
+ */
+#include "JBash.h"
+
+/**
+ * One function in a hash bucket chain.
+ */
+struct function {
+    char *name;
+    struct node *body;       // a copy, owned by the function
+    struct chunk *chunk;     // the body as bytecode, NULL until the first call
+    unsigned refs;           // the table's reference and one per call being run
+    struct function *next;
+};
+
+static struct arena spare_arena; // word arena of the last call that returned, for the next one
+
+/**
+ * @brief djb2 string hash, the same as for variables
+ */
+static unsigned long function_hash(const char *name) {
+    unsigned long hash = 5381;
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash % FUNCTION_BUCKETS;
+}
+
+/**
+ * @brief Drops a reference, freeing the function with the last one
+ */
+static void function_release(struct function *f) {
+    if (--f->refs > 0) return;
+    free(f->name);
+    node_free(f->body);
+    chunk_free(f->chunk);
+    free(f);
+}
+
+/**
+ * @brief Defines (or redefines) a function in the current session
+ * @param definition A NODE_FUNCTION; its body is copied
+ */
+void function_define(const struct node *definition) {
+    struct function *f = safe_malloc(sizeof(struct function));
+    f->name = strdup(definition->name);
+    f->body = node_copy(definition->body);
+    f->chunk = NULL;
+    f->refs = 1;
+    struct function **link = &session->functions[function_hash(definition->name)];
+    for (struct function *old = *link; old != NULL; link = &old->next, old = old->next) {
+        if (strcmp(old->name, definition->name) == 0) {
+            f->next = old->next;
+            *link = f;
+            function_release(old);
+            commands_changed();
+            return;
+        }
+    }
+    f->next = *link;
+    *link = f;
+    commands_changed();
+}
+
+/**
+ * @brief Looks up a function the current session has defined
+ */
+static struct function *function_lookup(const char *name) {
+    for (struct function *f = session->functions[function_hash(name)]; f != NULL; f = f->next) {
+        if (strcmp(f->name, name) == 0) return f;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Looks up a function of the current session, defining it from the autoload directories if needed
+ * @return The function, or NULL when no function has that name
+ */
+struct function *function_find(const char *name) {
+    struct function *f = function_lookup(name);
+    return f != NULL ? f : autoload_find(name);
+}
+
+/**
+ * @brief Whether the current session has defined a function, without autoloading it
+ */
+int function_defined(const char *name) {
+    return function_lookup(name) != NULL;
+}
+
+/**
+ * @brief Runs a function with the interpreter in use
+ * @param f The function
+ * @param argv Null terminated list of arguments, argv[0] names the function; kept until the call returns
+ * @param status Set to the status of the body's last command, or to return's N
+ * @return returns 1, to continue execution and 0 after exit.
+ */
+int function_call(struct function *f, char **argv, int *status) {
+    if (session->function_depth >= FUNCTION_DEPTH_MAX) {
+        fprintf(stderr, "JBash: %s: maximum function nesting level exceeded (%d)\n", argv[0], FUNCTION_DEPTH_MAX);
+        *status = 1;
+        return 1;
+    }
+    argv = argv_owned(argv); // the body may assign an array the arguments point into
+    char **positional = session->positional;
+    size_t positional_count = session->positional_count;
+    int loop_depth = session->loop_depth;
+    struct arena words = session->word_arena; // argv lives here
+    session->word_arena = spare_arena;
+    spare_arena.head = NULL;
+    size_t count = 0;
+    while (argv[count + 1] != NULL) count++;
+    session->positional = &argv[1];
+    session->positional_count = count;
+    session->loop_depth = 0; // break and continue only see the function's own loops
+    session->function_depth++;
+    f->refs++;
+    if (profiling) profile_push(f->name);
+
+    int rv;
+    if (tree_walker) {
+        rv = run_node(f->body);
+    } else {
+        if (f->chunk == NULL) {
+            f->chunk = chunk_new();
+            compile(f->chunk, f->body, f->body != NULL ? f->body->file : NULL, 1);
+        }
+        rv = vm_run(f->chunk);
+    }
+    *status = session->last_usage.status;
+
+    if (profiling) profile_pop();
+    function_release(f);
+    session->returning = 0;
+    session->function_depth--;
+    session->loop_depth = loop_depth;
+    session->positional = positional;
+    session->positional_count = positional_count;
+    arena_reset(&session->word_arena);
+    if (spare_arena.head == NULL) spare_arena = session->word_arena;
+    else arena_free(&session->word_arena);
+    session->word_arena = words;
+    return rv;
+}
+
+/**
+ * @brief Frees every function of a session's table
+ * @param table The session's FUNCTION_BUCKETS buckets
+ */
+void functions_free(struct function **table) {
+    for (size_t i = 0; i < FUNCTION_BUCKETS; i++) {
+        struct function *f = table[i];
+        while (f != NULL) {
+            struct function *next = f->next;
+            function_release(f);
+            f = next;
+        }
+        table[i] = NULL;
+    }
+    commands_changed();
+}
+
+/**
+ * @brief The return builtin: "return [N]" leaves the function being run
+ * @return N, or the last command's status without one
+ */
+int return_builtin(char **args) {
+    if (session->function_depth == 0) {
+        fprintf(stderr, "return: can only be used in a function\n");
+        return 1;
+    }
+    int status = session->last_usage.status;
+    if (args[1] != NULL) {
+        char *end;
+        long n = strtol(args[1], &end, 10);
+        if (*end != NULLCHAR || end == args[1]) {
+            fprintf(stderr, "return: %s: numeric argument required\n", args[1]);
+            n = 2;
+        }
+        status = (int)(n & 0xff);
+    }
+    session->returning = 1;
+    return status;
+}
@@ -0,0 +1,203 @@
+/*******************************************************************************
+  @file         hash.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file hash.c
+ * @brief Command hash table: remembered PATH lookups
+ *
+ * resolve_command() stats every PATH directory until it finds a command; the
+ * table remembers where each command was found so the next lookup is a single
+ * access() check. It is shared by the whole process (a server keeps it warm
+ * across requests) and emptied whenever PATH changes or by "hash -r".
+ * Commands found through a relative PATH entry depend on the working
+ * directory and are not remembered. A miss consults the snapshot (snapshot.c)
+ * before PATH is searched.
+ *
+ * Call sites in bytecode remember what a name meant (a function, a builtin or
+ * a path) without asking the table. command_generation moves on whenever
+ * that may have changed: the table is emptied (PATH changed, "hash -r"), a
+ * function is defined or the session changes.
+ */
+#include "JBash.h"
+
+/**
+ * One remembered command in a hash bucket chain.
+ */
+struct hashed_command {
+    char *name;
+    char *path;                   // where PATH lookup found it
+    unsigned long hits;           // lookups answered from the table
+    struct hashed_command *next;
+};
+
+static struct hashed_command *command_table[COMMAND_BUCKETS];
+static char *hashed_for_path = NULL; // PATH the table was filled with
+static int snapshot_forgotten = 0;   // "hash -r" forgets the snapshot's commands too
+uint64_t command_generation = 1;     // call sites resolved in an older generation look their name up again
+
+/**
+ * @brief djb2 string hash, the same as for variables
+ */
+static unsigned long command_hash(const char *name) {
+    unsigned long hash = 5381;
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash % COMMAND_BUCKETS;
+}
+
+/**
+ * @brief Makes every call site look its command name up again
+ */
+void commands_changed(void) {
+    command_generation++;
+}
+
+/**
+ * @brief Forgets every remembered command
+ */
+static void hash_clear(void) {
+    commands_changed();
+    for (size_t i = 0; i < COMMAND_BUCKETS; i++) {
+        struct hashed_command *c = command_table[i];
+        while (c != NULL) {
+            struct hashed_command *next = c->next;
+            free(c->name);
+            free(c->path);
+            free(c);
+            c = next;
+        }
+        command_table[i] = NULL;
+    }
+}
+
+/**
+ * @brief Empties the table when PATH is not the one it was filled with
+ */
+static void hash_check_path(const char *path) {
+    if (hashed_for_path != NULL && strcmp(hashed_for_path, path) == 0) return;
+    hash_clear();
+    free(hashed_for_path);
+    hashed_for_path = strdup(path);
+}
+
+/**
+ * @brief Finds a remembered command without counting a hit
+ */
+static struct hashed_command *hash_lookup(const char *name) {
+    for (struct hashed_command *c = command_table[command_hash(name)]; c != NULL; c = c->next) {
+        if (strcmp(c->name, name) == 0) return c;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Looks up a remembered command that is still executable
+ * @param name Command name without a '/'
+ * @param path Current value of PATH
+ * @return Its path, or NULL when it has to be searched for
+ */
+const char *hash_find(const char *name, const char *path) {
+    hash_check_path(path);
+    struct hashed_command **link = &command_table[command_hash(name)];
+    for (struct hashed_command *c = *link; c != NULL; link = &c->next, c = c->next) {
+        if (strcmp(c->name, name) != 0) continue;
+        if (access(c->path, X_OK) == 0) {
+            c->hits++;
+            return c->path;
+        }
+        *link = c->next; // moved or deleted, search PATH again
+        free(c->name);
+        free(c->path);
+        free(c);
+        return NULL;
+    }
+    const char *saved = snapshot_forgotten ? NULL : snapshot_command(name, path); // remembered by an earlier shell
+    if (saved != NULL && access(saved, X_OK) == 0) {
+        hash_add(name, saved);
+        return saved;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Remembers where a command was found
+ * @param name Command name
+ * @param found Path PATH lookup returned for it
+ */
+void hash_add(const char *name, const char *found) {
+    struct hashed_command *c = safe_malloc(sizeof(struct hashed_command));
+    unsigned long bucket = command_hash(name);
+    c->name = strdup(name);
+    c->path = strdup(found);
+    if (c->name == NULL || c->path == NULL) { // not remembering it is fine
+        free(c->name);
+        free(c->path);
+        free(c);
+        return;
+    }
+    c->hits = 0;
+    c->next = command_table[bucket];
+    command_table[bucket] = c;
+}
+
+/**
+ * @brief Adds the table, and the snapshot's commands it does not have, to the snapshot being saved
+ * @param path Current value of PATH
+ */
+void hash_snapshot(const char *path) {
+    if (hashed_for_path != NULL && strcmp(hashed_for_path, path) == 0) {
+        for (size_t i = 0; i < COMMAND_BUCKETS; i++) {
+            for (struct hashed_command *c = command_table[i]; c != NULL; c = c->next) {
+                snapshot_add_command(c->name, c->path, c->hits);
+            }
+        }
+    }
+    size_t count = snapshot_forgotten ? 0 : snapshot_command_count(path);
+    for (size_t i = 0; i < count; i++) {
+        const char *name, *found;
+        uint64_t hits;
+        snapshot_command_at(i, &name, &found, &hits);
+        if (hash_lookup(name) == NULL) snapshot_add_command(name, found, hits);
+    }
+}
+
+/**
+ * @brief The hash builtin
+ *   hash          list remembered commands with their hit counts
+ *   hash -r       forget all of them, and the autoload indexes
+ *   hash NAME...  look the commands up now and remember them
+ * @return Exit status: 1 if a NAME was not found, 2 on bad usage
+ */
+int hash_builtin(char **args) {
+    if (args[1] == NULL) {
+        int any = 0;
+        for (size_t i = 0; i < COMMAND_BUCKETS; i++) {
+            for (struct hashed_command *c = command_table[i]; c != NULL; c = c->next) {
+                if (!any) printf("hits\tcommand\n");
+                printf("%4lu\t%s\n", c->hits, c->path);
+                any = 1;
+            }
+        }
+        if (!any) printf("hash: hash table empty\n");
+        return 0;
+    }
+    if (strcmp(args[1], "-r") == 0) {
+        hash_clear();
+        snapshot_forgotten = 1;
+        autoload_forget(); // the autoload indexes are checked against their directories again
+        return 0;
+    }
+    if (args[1][0] == '-') {
+        fprintf(stderr, "usage: hash [-r] [NAME...]\n");
+        return 2;
+    }
+    int status = 0;
+    for (char **name = &args[1]; *name != NULL; name++) {
+        if (resolve_command(*name) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", *name);
+            status = 1;
+        }
+    }
+    return status;
+}
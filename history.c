@@ -0,0 +1,121 @@
+/*******************************************************************************
+  @file         history.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file history.c
+ * @brief Command history with per command metadata
+ *
+ * Every command line is kept together with when it started and the resource
+ * usage it ended with, in a ring of HISTORY_SIZE entries. The history of
+ * earlier shells is read from the snapshot (snapshot.c) in place, and comes
+ * before this shell's own.
+ */
+#include "JBash.h"
+
+/**
+ * One remembered command.
+ */
+struct history_entry {
+    char *line;              // command line as typed
+    time_t started;          // wall clock time the command was entered
+    struct cmd_usage usage;  // how it ended and what it cost
+    int finished;            // usage is filled in
+};
+
+static struct history_entry history[HISTORY_SIZE];
+static size_t history_count = 0; // total commands ever added, the ring holds the last HISTORY_SIZE
+
+/**
+ * @brief Adds a command line to the history, overwriting the oldest entry when full
+ * @param line Command line (copied)
+ */
+void history_add(const char *line) {
+    struct history_entry *entry = &history[history_count % HISTORY_SIZE];
+    free(entry->line);
+    entry->line = strdup(line);
+    entry->started = time(NULL);
+    entry->finished = 0;
+    history_count++;
+}
+
+/**
+ * @brief Attaches the usage of the command that just finished to the newest entry
+ */
+void history_record_usage(const struct cmd_usage *usage) {
+    if (history_count == 0) return;
+    struct history_entry *entry = &history[(history_count - 1) % HISTORY_SIZE];
+    if (entry->finished) return; // already recorded, never overwrite an earlier command
+    entry->usage = *usage;
+    entry->finished = 1;
+}
+
+/**
+ * @brief Prints one history line, with its metadata when verbose
+ */
+static void history_print(size_t number, const struct history_entry *entry, int verbose) {
+    if (verbose && entry->finished) {
+        char when[20];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&entry->started));
+        printf("%5zu  %s  status=%d wall=%.3fms user=%.3fms sys=%.3fms rss=%ldkB csw=%ld/%ld  %s\n",
+               number, when, entry->usage.status, entry->usage.wall_us / 1000.0,
+               entry->usage.user_us / 1000.0, entry->usage.sys_us / 1000.0,
+               entry->usage.maxrss_kb, entry->usage.nvcsw, entry->usage.nivcsw, entry->line);
+    } else {
+        printf("%5zu  %s\n", number, entry->line);
+    }
+}
+
+/**
+ * @brief The history builtin: lists remembered commands
+ * "history" prints numbered command lines, "history -v" adds the metadata
+ * (status, wall/user/sys milliseconds, max RSS and context switches).
+ *
+ * @param args Null terminated list of arguments, args[0] is "history"
+ * @return 0 on success, 1 on bad usage
+ */
+int history_builtin(char **args) {
+    int verbose = 0;
+    if (args[1] != NULL) {
+        if (strcmp(args[1], "-v") != 0) {
+            fprintf(stderr, "history: usage: history [-v]\n");
+            return 1;
+        }
+        verbose = 1;
+    }
+
+    size_t saved = snapshot_history_count(); // numbered first, they are older
+    for (size_t n = 0; n < saved; n++) {
+        struct history_entry entry;
+        entry.line = (char *)snapshot_history_at(n, &entry.started, &entry.usage, &entry.finished);
+        history_print(n + 1, &entry, verbose);
+    }
+    size_t first = history_count > HISTORY_SIZE ? history_count - HISTORY_SIZE : 0;
+    for (size_t n = first; n < history_count; n++) {
+        history_print(saved + n + 1, &history[n % HISTORY_SIZE], verbose);
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the last HISTORY_SIZE commands, the snapshot's and this shell's, to the snapshot being saved
+ */
+void history_snapshot(void) {
+    size_t saved = snapshot_history_count();
+    size_t first = history_count > HISTORY_SIZE ? history_count - HISTORY_SIZE : 0;
+    size_t total = saved + history_count - first;
+    size_t skip = total > HISTORY_SIZE ? total - HISTORY_SIZE : 0;
+    for (size_t n = skip; n < saved; n++) {
+        struct cmd_usage usage;
+        time_t started;
+        int finished;
+        const char *line = snapshot_history_at(n, &started, &usage, &finished);
+        snapshot_add_history(line, started, &usage, finished);
+    }
+    if (skip > saved) first += skip - saved;
+    for (size_t n = first; n < history_count; n++) {
+        struct history_entry *entry = &history[n % HISTORY_SIZE];
+        snapshot_add_history(entry->line, entry->started, &entry->usage, entry->finished);
+    }
+}
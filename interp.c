@@ -0,0 +1,222 @@
+/*******************************************************************************
+  @file         interp.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file interp.c
+ * @brief The tree-walking interpreter for parsed commands, and break and continue
+ *
+ * run_node() runs a list of nodes built by parse_command() (parser.c). A
+ * NODE_COMMAND's words go to execute(), which expands them into the word
+ * arena; compound commands only decide which lists to run. Nothing is
+ * read or split again when a loop body runs another time. Commands are
+ * compiled to bytecode (compile.c, vm.c) unless JBASH_INTERP=tree selects
+ * this interpreter; both share the loop helpers below.
+ *
+ * "break N" and "continue N" set a counter in the session; every list stops
+ * while one is set, and each loop it reaches takes one level off.
+ */
+#include "JBash.h"
+
+/**
+ * @brief Sets $? without touching the rest of the last command's usage
+ */
+void set_status(int status) {
+    session->last_usage.status = status;
+    var_set_number("JB_STATUS", status);
+}
+
+/**
+ * @brief A break, continue or return is unwinding the lists it is in
+ */
+int loop_jumping(void) {
+    return session->breaking > 0 || session->continuing > 0 || session->returning;
+}
+
+/**
+ * @brief Handles a break or continue that reached a loop
+ * @return 1 when the loop has to stop, 0 to go on with its next iteration
+ */
+int loop_stops(void) {
+    if (session->returning) return 1; // every loop of the function stops
+    if (session->breaking > 0) {
+        session->breaking--;
+        return 1;
+    }
+    if (session->continuing > 0) return --session->continuing > 0; // "continue 2" stops this loop
+    return 0;
+}
+
+/**
+ * @brief Runs a command list with execute(), which expands each pipeline just before it runs
+ * @return returns 1, to continue execution and 0 after exit.
+ */
+static int run_command(struct node *n) {
+    if (profiling && n->file != NULL) {
+        char frame[strlen(n->file) + 24];
+        snprintf(frame, sizeof(frame), "%s:%u", n->file, n->line);
+        profile_push(frame);
+    }
+    int rv = execute(n->words, n->count);
+    arena_reset(&session->word_arena); // the expanded words are only needed by this command
+    if (profiling && n->file != NULL) profile_pop();
+    return rv;
+}
+
+/**
+ * @brief Runs the condition, then the first branch whose condition succeeded
+ * The status is the branch's, or 0 when no branch ran.
+ */
+static int run_if(struct node *n) {
+    int rv = run_node(n->condition);
+    if (!rv || loop_jumping()) return rv;
+    if (session->last_usage.status == 0) return run_node(n->body);
+    if (n->else_part != NULL) return run_node(n->else_part);
+    set_status(0);
+    return 1;
+}
+
+/**
+ * @brief Runs a while or until loop
+ * The status is the last body's, or 0 when the body never ran.
+ */
+static int run_while(struct node *n) {
+    int rv = 1, status = 0;
+    session->loop_depth++;
+    while (rv) {
+        rv = run_node(n->condition);
+        if (!rv || (loop_jumping() && loop_stops())) break;
+        if ((session->last_usage.status == 0) == (n->type == NODE_UNTIL)) break;
+        rv = run_node(n->body);
+        status = session->last_usage.status;
+        if (loop_stops()) break;
+    }
+    session->loop_depth--;
+    if (rv) set_status(status);
+    return rv;
+}
+
+/**
+ * @brief Expands the words of a for loop, once, before its first iteration
+ * The body's commands reset the word arena, so the values are copied into one block.
+ * @param words The words after "in", or NULL for the positional parameters
+ * @param count Number of words; set to the number of values
+ * @return The values, one heap block to free; NULL (and no values) after an expansion error
+ */
+char **loop_values(const struct word *words, size_t *count) {
+    char **expanded;
+    if (words == NULL) {
+        *count = session->positional_count;
+        expanded = session->positional;
+    } else if ((expanded = make_argv(words, *count, 0, count)) == NULL) { // "${NAME[@]}" gives a value per element
+        *count = 0;
+        arena_reset(&session->word_arena);
+        return NULL;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < *count; i++) total += strlen(expanded[i]) + 1;
+    char **values = safe_malloc(*count * sizeof(char *) + total + 1);
+    char *text = (char *)&values[*count];
+    for (size_t i = 0; i < *count; i++) {
+        size_t length = strlen(expanded[i]) + 1;
+        values[i] = memcpy(text, expanded[i], length);
+        text += length;
+    }
+    arena_reset(&session->word_arena);
+    return values;
+}
+
+/**
+ * @brief Runs a for loop: the words are expanded once, then the body runs with NAME set to each
+ * The status is the last body's, or 0 when the body never ran; 1 when the words had an error.
+ */
+static int run_for(struct node *n) {
+    size_t count = n->count;
+    char **values = loop_values(n->words, &count);
+    if (values == NULL) {
+        set_status(1);
+        return 1;
+    }
+    int rv = 1, status = 0;
+    session->loop_depth++;
+    for (size_t i = 0; rv && i < count; i++) {
+        var_set(n->name, values[i]);
+        rv = run_node(n->body);
+        status = session->last_usage.status;
+        if (loop_stops()) break;
+    }
+    session->loop_depth--;
+    free(values);
+    if (rv) set_status(status);
+    return rv;
+}
+
+/**
+ * @brief Runs a case: the word is expanded and matched once, then the list of the arm it picked runs
+ * The status is the list's, or 0 when no arm matched or its list is empty; 1 when the word had an error.
+ */
+static int run_case(struct node *n) {
+    size_t arm = case_select(n);
+    arena_reset(&session->word_arena);
+    if (arm == CASE_FAILED) {
+        set_status(1);
+        return 1;
+    }
+    if (arm == n->arm_count || n->arms[arm].body == NULL) {
+        set_status(0);
+        return 1;
+    }
+    return run_node(n->arms[arm].body);
+}
+
+/**
+ * @brief Runs a list of parsed commands in the current session
+ * A list stops early after exit, or while a break or continue unwinds it.
+ * @param list First node of the list
+ * @return returns 1, to continue execution and 0 after exit.
+ */
+int run_node(struct node *list) {
+    int rv = 1;
+    for (struct node *n = list; rv && n != NULL && !loop_jumping(); n = n->next) {
+        switch (n->type) {
+        case NODE_COMMAND: rv = run_command(n); break;
+        case NODE_IF: rv = run_if(n); break;
+        case NODE_WHILE:
+        case NODE_UNTIL: rv = run_while(n); break;
+        case NODE_FOR: rv = run_for(n); break;
+        case NODE_CASE: rv = run_case(n); break;
+        case NODE_FUNCTION:
+            function_define(n);
+            set_status(0);
+            break;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @brief The break and continue builtins
+ *   break [N]     leave N enclosing loops (default 1)
+ *   continue [N]  go on with the next iteration of the Nth enclosing loop
+ * @return Exit status: 1 for a bad N
+ */
+int loop_builtin(char **args) {
+    long levels = 1;
+    if (args[1] != NULL) {
+        char *end;
+        levels = strtol(args[1], &end, 10);
+        if (*end != NULLCHAR || levels < 1) {
+            fprintf(stderr, "%s: %s: loop count out of range\n", args[0], args[1]);
+            return 1;
+        }
+    }
+    if (session->loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", args[0]);
+        return 0;
+    }
+    if (levels > session->loop_depth) levels = session->loop_depth;
+    if (strcmp(args[0], "break") == 0) session->breaking = (int)levels;
+    else session->continuing = (int)levels;
+    return 0;
+}
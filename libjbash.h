@@ -0,0 +1,40 @@
+/*******************************************************************************
+  @file         libjbash.h
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file libjbash.h
+ * @brief Public C API of libjbash: the JBash tokenizer, expander and executor as a library
+ *
+ * A session is one shell: its own working directory, variables and last
+ * status. Sessions are independent, but run one at a time (not from several
+ * threads at once); running a command moves the process into the session's
+ * working directory.
+ *
+ *   struct jb_session *sh = jb_session_new();
+ *   jb_eval(sh, "cd /tmp && ls | wc -l", 21);
+ *   int status = jb_last_status(sh);
+ *   jb_session_free(sh);
+ */
+#ifndef LIBJBASH_H
+#define LIBJBASH_H
+
+#include <stddef.h> // size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct jb_session;
+
+struct jb_session *jb_session_new(void);
+void jb_session_free(struct jb_session *session);
+int jb_eval(struct jb_session *session, const char *buffer, size_t length);
+int jb_last_status(const struct jb_session *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,640 @@
+/*******************************************************************************
+  @file         parser.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file parser.c
+ * @brief Line sources and the parser: complete commands into trees of nodes
+ *
+ * A line source hands out the words of one line at a time (split_words, or a
+ * cached image of split words). parse_command() reads one complete command
+ * from it: a single line, or for if, while, until, for, case and function
+ * definitions every line up to the matching fi, done, esac or '}'. The result is a list of nodes (see JBash.h) that
+ * run_node() (interp.c) walks; a loop body is parsed once, however often it
+ * runs.
+ *
+ * Words between keywords stay a NODE_COMMAND run by execute(), so pipelines,
+ * '&&', '||' and the time keyword work as they do on a single line. Keywords
+ * are only recognized unquoted and where a command starts: first on a line,
+ * or after an operator. Like every operator, ';' has to be a word of its own:
+ * "while [ $n -lt 3 ] ; do", and so does the ";;" that ends an arm of a case.
+ */
+#include "JBash.h"
+
+static const char *const keywords[] = { "if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done",
+                                        "{", "}", "case", "esac", ";;", NULL };
+static const char *const then_words[] = { "then", NULL };
+static const char *const branch_ends[] = { "elif", "else", "fi", NULL };
+static const char *const fi_words[] = { "fi", NULL };
+static const char *const do_words[] = { "do", NULL };
+static const char *const done_words[] = { "done", NULL };
+static const char *const brace_words[] = { "}", NULL };
+static const char *const case_ends[] = { ";;", "esac", NULL };
+
+/**
+ * A source name nodes point to; names are kept for the life of the process
+ * because a parsed body may outlive the file it came from.
+ */
+struct source_name {
+    struct source_name *next;
+    char name[];
+};
+
+static struct source_name *source_names = NULL;
+
+/**
+ * @brief The one stored copy of a source name
+ */
+static const char *intern_name(const char *name) {
+    if (name == NULL) return NULL;
+    for (struct source_name *n = source_names; n != NULL; n = n->next) {
+        if (strcmp(n->name, name) == 0) return n->name;
+    }
+    size_t length = strlen(name) + 1;
+    struct source_name *n = safe_malloc(sizeof(struct source_name) + length);
+    memcpy(n->name, name, length);
+    n->next = source_names;
+    source_names = n;
+    return n->name;
+}
+
+/**
+ * @brief Sets up a line source; nothing is read until the parser asks
+ * @param read Reads the next line into the source, returns 0 at the end
+ * @param context The reader's own state
+ * @param name Script or file name, NULL for the terminal
+ */
+void line_source_init(struct line_source *source, int (*read)(struct line_source *), void *context, const char *name) {
+    memset(source, 0, sizeof(struct line_source));
+    source->read = read;
+    source->context = context;
+    source->name = intern_name(name);
+    source->need_line = 1;
+}
+
+/**
+ * @brief Appends a word to the current line of a source
+ * @param text The word, kept until the next line is read
+ * @param quote The quote character it was enclosed in, or 0
+ */
+void line_source_add(struct line_source *source, char *text, char quote) {
+    if (source->count == source->capacity) {
+        if (source->capacity == 0) source->capacity = CMD_LINE_BUFFER / 2; // realloc_buffer doubles it
+        source->words = realloc_buffer(source->words, &source->capacity, sizeof(struct word));
+    }
+    source->words[source->count].text = text;
+    source->words[source->count].quote = quote;
+    source->words[source->count].arith = NULL;
+    source->count++;
+}
+
+/**
+ * @brief split_words() callback of line_source_split()
+ */
+static void source_word(char *word, char quote, void *context) {
+    line_source_add(context, word, quote);
+}
+
+/**
+ * @brief Makes a line read by a text source its current line
+ * Blank lines and '#' comment lines have no words.
+ * @param line Heap buffer holding the line without its newline; the source takes it over
+ * @param length Length of the line
+ */
+void line_source_split(struct line_source *source, char *line, size_t length) {
+    free(source->line);
+    source->line = line;
+    size_t indent = 0;
+    while (indent < length && IS_BLANK(line[indent])) indent++;
+    if (indent == length || line[indent] == '#') return;
+    TRACE_BEGIN("tokenize");
+    split_words(&line[indent], length - indent, source_word, source);
+    TRACE_END("tokenize");
+}
+
+/**
+ * @brief Releases a source's words, line buffer and bytecode
+ */
+void line_source_free(struct line_source *source) {
+    free(source->words);
+    free(source->line);
+    chunk_free(source->chunk);
+    source->words = NULL;
+    source->line = NULL;
+    source->chunk = NULL;
+    source->count = source->capacity = 0;
+}
+
+/**
+ * @brief The word the parser looks at next, reading the next line when the current one is used up
+ * @return The word, or NULL at the end of the line (source->ended tells whether the source ended too)
+ */
+static struct word *peek(struct line_source *source) {
+    if (source->need_line) {
+        source->need_line = 0;
+        source->count = 0;
+        source->position = 0;
+        if (!source->ended && !source->read(source)) source->ended = 1;
+    }
+    return source->position < source->count ? &source->words[source->position] : NULL;
+}
+
+/**
+ * @brief Checks for an unquoted word
+ */
+static int is_word(const struct word *w, const char *text) {
+    return w != NULL && w->quote == 0 && strcmp(w->text, text) == 0;
+}
+
+/**
+ * @brief Checks for an unquoted word out of a NULL terminated list
+ */
+static int is_one_of(const struct word *w, const char *const *list) {
+    for (size_t i = 0; w != NULL && list[i] != NULL; i++) {
+        if (is_word(w, list[i])) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks for an operator word: "|", ";", "&&" or "||"
+ */
+static int is_operator_word(const struct word *w) {
+    return is_word(w, "|") || is_word(w, ";") || is_word(w, "&&") || is_word(w, "||");
+}
+
+/**
+ * @brief Reports a syntax error; the rest of the command is skipped
+ * @param near The offending word, or NULL for the end of a line or of the source
+ */
+static void syntax_error(struct line_source *source, const struct word *near) {
+    if (source->error) return; // the first error is the one that matters
+    source->error = 1;
+    if (source->name != NULL) fprintf(stderr, "JBash: %s:%u: ", source->name, source->number);
+    else fprintf(stderr, "JBash: ");
+    if (near != NULL) fprintf(stderr, "syntax error near '%s'\n", near->text);
+    else if (source->ended) fprintf(stderr, "syntax error: unexpected end of file\n");
+    else fprintf(stderr, "syntax error near newline\n");
+}
+
+/**
+ * @brief Allocates a node at the source's current line
+ */
+static struct node *new_node(struct line_source *source, enum node_type type) {
+    struct node *n = safe_malloc(sizeof(struct node));
+    memset(n, 0, sizeof(struct node));
+    n->type = type;
+    n->file = source->name;
+    n->line = source->number;
+    return n;
+}
+
+/**
+ * @brief Copies words of the current line into a node; the line goes away with the next read
+ * @param first Index of the first word
+ * @param count Number of words
+ */
+static void copy_words(struct line_source *source, struct node *n, size_t first, size_t count) {
+    n->words = safe_malloc((count > 0 ? count : 1) * sizeof(struct word));
+    for (size_t i = 0; i < count; i++) {
+        n->words[i].text = strdup(source->words[first + i].text);
+        if (n->words[i].text == NULL) {
+            fprintf(stderr, "Memory allocation failed for size %zu\n", strlen(source->words[first + i].text) + 1);
+            exit(EXIT_FAILURE);
+        }
+        n->words[i].quote = source->words[first + i].quote;
+        n->words[i].arith = arith_compile_word(n->words[i].text, n->words[i].quote);
+    }
+    n->count = count;
+}
+
+static struct node *parse_list(struct line_source *source, const char *const *terminators);
+
+/**
+ * @brief Checks for the start of a function definition: "NAME()" or "NAME ()"
+ * @param at Index of the word in the current line
+ * @return Number of words the name and its parentheses take, 0 when it is something else
+ */
+static size_t function_header(struct line_source *source, size_t at) {
+    struct word *w = &source->words[at];
+    size_t length = strlen(w->text), name_length = var_name_length(w->text);
+    if (w->quote != 0 || name_length == 0) return 0;
+    if (name_length + 2 == length && strcmp(&w->text[name_length], "()") == 0) return 1;
+    if (name_length == length && at + 1 < source->count && is_word(&source->words[at + 1], "()")) return 2;
+    return 0;
+}
+
+/**
+ * @brief Parses the words up to the next keyword in command position, or the end of the line
+ * @return A NODE_COMMAND, or NULL after a syntax error
+ */
+static struct node *parse_simple(struct line_source *source) {
+    size_t first = source->position, end = first;
+    int command_position = 1;
+    while (end < source->count) {
+        struct word *w = &source->words[end];
+        if (command_position && (is_one_of(w, keywords) || function_header(source, end) > 0)) break;
+        if (is_word(w, ";;")) break; // ends an arm of a case wherever it is
+        command_position = is_operator_word(w);
+        end++;
+    }
+    // a keyword or a function may only follow ';': "cmd && while ..." would need pipelines of compound commands
+    if (end < source->count && !is_word(&source->words[end - 1], ";") && !is_word(&source->words[end], ";;")) {
+        syntax_error(source, &source->words[end]);
+        return NULL;
+    }
+    size_t count = end - first;
+    if (count > 1 && is_word(&source->words[end - 1], ";")) count--; // "cmd ;" before a keyword
+    struct node *n = new_node(source, NODE_COMMAND);
+    copy_words(source, n, first, count);
+    source->position = end;
+    return n;
+}
+
+/**
+ * @brief Consumes a keyword the caller checked with peek()
+ */
+static void consume(struct line_source *source) {
+    source->position++;
+}
+
+/**
+ * @brief Parses "if list; then list; [elif list; then list;]... [else list;] fi", also the elif part
+ * @return A NODE_IF, or NULL after a syntax error
+ */
+static struct node *parse_if(struct line_source *source) {
+    struct node *n = new_node(source, NODE_IF);
+    consume(source); // "if" or "elif"
+    n->condition = parse_list(source, then_words);
+    if (source->error) goto fail;
+    consume(source);
+    n->body = parse_list(source, branch_ends);
+    if (source->error) goto fail;
+    struct word *w = peek(source);
+    if (is_word(w, "elif")) { // the rest is an if of its own, its fi ends this one too
+        n->else_part = parse_if(source);
+        if (source->error) goto fail;
+        return n;
+    }
+    if (is_word(w, "else")) {
+        consume(source);
+        n->else_part = parse_list(source, fi_words);
+        if (source->error) goto fail;
+    }
+    consume(source); // "fi"
+    return n;
+fail:
+    node_free(n);
+    return NULL;
+}
+
+/**
+ * @brief Parses "while list; do list; done" and "until list; do list; done"
+ * @return A NODE_WHILE or NODE_UNTIL, or NULL after a syntax error
+ */
+static struct node *parse_loop(struct line_source *source) {
+    struct node *n = new_node(source, is_word(peek(source), "while") ? NODE_WHILE : NODE_UNTIL);
+    consume(source);
+    n->condition = parse_list(source, do_words);
+    if (source->error) goto fail;
+    consume(source);
+    n->body = parse_list(source, done_words);
+    if (source->error) goto fail;
+    consume(source);
+    return n;
+fail:
+    node_free(n);
+    return NULL;
+}
+
+/**
+ * @brief Parses "for NAME [in WORD...] ; do list; done"; the words end at ';' or the end of the line
+ * @return A NODE_FOR, or NULL after a syntax error
+ */
+static struct node *parse_for(struct line_source *source) {
+    struct node *n = new_node(source, NODE_FOR);
+    consume(source);
+    struct word *w = peek(source);
+    if (w == NULL || w->quote != 0 || w->text[var_name_length(w->text)] != NULLCHAR || w->text[0] == NULLCHAR) {
+        syntax_error(source, w);
+        goto fail;
+    }
+    n->name = strdup(w->text);
+    consume(source);
+    w = peek(source);
+    if (is_word(w, "in")) {
+        consume(source);
+        size_t first = source->position, end = first;
+        while (end < source->count && !is_operator_word(&source->words[end])) end++;
+        copy_words(source, n, first, end - first);
+        source->position = end;
+        w = peek(source);
+    } // without "in" words stays NULL: the loop goes over the positional parameters
+    if (is_word(w, ";")) consume(source);
+    else if (w != NULL) {
+        syntax_error(source, w);
+        goto fail;
+    }
+    while ((w = peek(source)) == NULL) { // "do" may start the next line
+        if (source->ended) {
+            syntax_error(source, NULL);
+            goto fail;
+        }
+        source->need_line = 1;
+    }
+    if (!is_word(w, "do")) {
+        syntax_error(source, w);
+        goto fail;
+    }
+    consume(source);
+    n->body = parse_list(source, done_words);
+    if (source->error) goto fail;
+    consume(source);
+    return n;
+fail:
+    node_free(n);
+    return NULL;
+}
+
+/**
+ * @brief Parses "NAME () { list; }"; the '{' may start the next line
+ * @param header Words of the name and parentheses, from function_header()
+ * @return A NODE_FUNCTION, or NULL after a syntax error
+ */
+static struct node *parse_function(struct line_source *source, size_t header) {
+    struct node *n = new_node(source, NODE_FUNCTION);
+    const char *text = source->words[source->position].text;
+    n->name = strndup(text, var_name_length(text));
+    source->position += header;
+    struct word *w;
+    while ((w = peek(source)) == NULL) {
+        if (source->ended) {
+            syntax_error(source, NULL);
+            goto fail;
+        }
+        source->need_line = 1;
+    }
+    if (!is_word(w, "{")) {
+        syntax_error(source, w);
+        goto fail;
+    }
+    consume(source);
+    n->body = parse_list(source, brace_words);
+    if (source->error) goto fail;
+    consume(source);
+    return n;
+fail:
+    node_free(n);
+    return NULL;
+}
+
+/**
+ * @brief Adds a pattern of a case to the node's words
+ * @param capacity Words the node has room for
+ */
+static void add_pattern(struct node *n, size_t *capacity, const char *text, size_t length, char quote) {
+    if (n->count == *capacity) n->words = realloc_buffer(n->words, capacity, sizeof(struct word));
+    struct word *w = &n->words[n->count++];
+    w->text = safe_malloc(length + 1);
+    memcpy(w->text, text, length);
+    w->text[length] = NULLCHAR;
+    w->quote = quote;
+    w->arith = arith_compile_word(w->text, quote);
+}
+
+/**
+ * @brief Parses the patterns of an arm, "[(]PATTERN[|PATTERN]...)", up to the word that ends in ')'
+ * Unquoted words are split at '|'; a quoted word is one pattern that matches its own text.
+ * @return 1, or 0 after a syntax error
+ */
+static int parse_patterns(struct line_source *source, struct node *n, size_t *capacity) {
+    for (int first = 1, closed = 0; !closed; first = 0) {
+        struct word *w = peek(source);
+        if (w == NULL || is_one_of(w, case_ends)) { // the patterns stay on one line
+            syntax_error(source, w);
+            return 0;
+        }
+        consume(source);
+        if (w->quote != 0) {
+            add_pattern(n, capacity, w->text, strlen(w->text), w->quote);
+            continue;
+        }
+        const char *text = w->text;
+        size_t length = strlen(text);
+        if (first && *text == '(') text++, length--;
+        if (length > 0 && text[length - 1] == ')') closed = 1, length--;
+        size_t start = 0;
+        for (size_t i = 0; i <= length; i++) {
+            if (i + 1 < length && text[i] == '\\') i++;
+            else if (i == length || text[i] == '|') {
+                if (i > start) add_pattern(n, capacity, &text[start], i - start, 0);
+                start = i + 1;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Parses "case WORD in [(]PATTERN[|PATTERN]...) list ;; ... esac"
+ * The word, "in" and each arm's patterns stay on one line; an arm's list
+ * may be empty, and the last one needs no ";;".
+ * @return A NODE_CASE, or NULL after a syntax error
+ */
+static struct node *parse_case(struct line_source *source) {
+    struct node *n = new_node(source, NODE_CASE);
+    consume(source);
+    struct word *w = peek(source);
+    struct word *in = w != NULL && source->position + 1 < source->count ? w + 1 : NULL;
+    if (w == NULL || is_operator_word(w) || !is_word(in, "in")) {
+        syntax_error(source, w == NULL || is_operator_word(w) ? w : in);
+        goto fail;
+    }
+    copy_words(source, n, source->position, 1);
+    source->position += 2;
+    size_t capacity = 1, arm_capacity = 4;
+    n->arms = safe_malloc(arm_capacity * sizeof(struct case_arm));
+    for (;;) {
+        while ((w = peek(source)) == NULL) { // the arms go on over the next lines
+            if (source->ended) {
+                syntax_error(source, NULL);
+                goto fail;
+            }
+            source->need_line = 1;
+        }
+        if (is_word(w, "esac")) break;
+        if (n->arm_count == arm_capacity) n->arms = realloc_buffer(n->arms, &arm_capacity, sizeof(struct case_arm));
+        struct case_arm *arm = &n->arms[n->arm_count++];
+        *arm = (struct case_arm){ .first = n->count };
+        if (!parse_patterns(source, n, &capacity)) goto fail;
+        arm->count = n->count - arm->first;
+        if (arm->count == 0) { // "|)" or ")"
+            syntax_error(source, &source->words[source->position - 1]);
+            goto fail;
+        }
+        while ((w = peek(source)) == NULL) { // the list may start on the next line
+            if (source->ended) {
+                syntax_error(source, NULL);
+                goto fail;
+            }
+            source->need_line = 1;
+        }
+        if (!is_one_of(w, case_ends)) {
+            arm->body = parse_list(source, case_ends);
+            if (source->error) goto fail;
+        }
+        if (is_word(peek(source), ";;")) consume(source);
+    }
+    consume(source); // "esac"
+    return n;
+fail:
+    node_free(n);
+    return NULL;
+}
+
+/**
+ * @brief Parses one command: a compound command, or the words up to the next keyword
+ * @return The node, or NULL after a syntax error
+ */
+static struct node *parse_statement(struct line_source *source) {
+    struct word *w = peek(source);
+    struct node *n;
+    if (is_word(w, "if")) n = parse_if(source);
+    else if (is_word(w, "while") || is_word(w, "until")) n = parse_loop(source);
+    else if (is_word(w, "for")) n = parse_for(source);
+    else if (is_word(w, "case")) n = parse_case(source);
+    else if (is_one_of(w, keywords)) { // "fi" or "done" with nothing to end
+        syntax_error(source, w);
+        return NULL;
+    } else {
+        size_t header = function_header(source, source->position);
+        if (header == 0) return parse_simple(source);
+        n = parse_function(source, header);
+    }
+    if (n == NULL) return NULL;
+
+    // after fi, done or '}': ';', the end of the line or another keyword
+    w = peek(source);
+    if (is_word(w, ";")) consume(source);
+    else if (w != NULL && !is_one_of(w, keywords)) {
+        syntax_error(source, w);
+        node_free(n);
+        return NULL;
+    }
+    return n;
+}
+
+/**
+ * @brief Parses commands up to one of the terminators, which is left for the caller
+ * Inside a compound command newlines separate commands and more lines are
+ * read as needed; at the top level (no terminators) the list ends with the line.
+ * @param terminators Keywords that end the list, NULL at the top level
+ * @return The list, NULL when it is empty or after a syntax error
+ */
+static struct node *parse_list(struct line_source *source, const char *const *terminators) {
+    struct node *head = NULL, **tail = &head;
+    while (!source->error) {
+        struct word *w = peek(source);
+        if (w == NULL) {
+            if (terminators == NULL) break;
+            if (source->ended) {
+                syntax_error(source, NULL);
+                break;
+            }
+            source->need_line = 1;
+            continue;
+        }
+        if (terminators != NULL && is_one_of(w, terminators)) {
+            if (head == NULL) syntax_error(source, w); // "then fi", "do done"
+            break;
+        }
+        struct node *n = parse_statement(source);
+        if (n == NULL) break;
+        *tail = n;
+        tail = &n->next;
+    }
+    if (source->error) {
+        node_free(head);
+        return NULL;
+    }
+    return head;
+}
+
+/**
+ * @brief Reads and parses the next complete command of a source
+ * Blank lines before it are skipped. After a syntax error source->error is
+ * set and the rest of the line is dropped.
+ * @return The command's list of nodes, free it with node_free(); NULL at the end of the source or on error
+ */
+struct node *parse_command(struct line_source *source) {
+    source->error = 0;
+    source->continuation = 0;
+    while (peek(source) == NULL) { // blank and comment lines
+        if (source->ended) return NULL;
+        source->need_line = 1;
+    }
+    source->continuation = 1;
+    struct node *command = parse_list(source, NULL);
+    source->need_line = 1; // the line is done; the next one is read when the next command is parsed
+    return command;
+}
+
+/**
+ * @brief Copies a list of nodes and everything below them, for a function body that outlives its command
+ */
+struct node *node_copy(const struct node *node) {
+    struct node *head = NULL, **tail = &head;
+    for (; node != NULL; node = node->next) {
+        struct node *n = safe_malloc(sizeof(struct node));
+        *n = *node;
+        n->next = NULL;
+        if (node->words != NULL) {
+            n->words = safe_malloc((node->count > 0 ? node->count : 1) * sizeof(struct word));
+            for (size_t i = 0; i < node->count; i++) {
+                n->words[i].text = safe_malloc(strlen(node->words[i].text) + 1);
+                strcpy(n->words[i].text, node->words[i].text);
+                n->words[i].quote = node->words[i].quote;
+                n->words[i].arith = arith_compile_word(n->words[i].text, n->words[i].quote);
+            }
+        }
+        n->name = node->name != NULL ? strdup(node->name) : NULL;
+        n->condition = node_copy(node->condition);
+        n->body = node_copy(node->body);
+        n->else_part = node_copy(node->else_part);
+        if (node->arms != NULL) {
+            n->arms = safe_malloc((node->arm_count > 0 ? node->arm_count : 1) * sizeof(struct case_arm));
+            for (size_t i = 0; i < node->arm_count; i++) {
+                n->arms[i] = node->arms[i];
+                n->arms[i].body = node_copy(node->arms[i].body);
+            }
+        }
+        n->matcher = NULL; // built again the first time the copy runs
+        *tail = n;
+        tail = &n->next;
+    }
+    return head;
+}
+
+/**
+ * @brief Frees a list of nodes and everything below them
+ */
+void node_free(struct node *node) {
+    while (node != NULL) {
+        struct node *next = node->next;
+        for (size_t i = 0; i < node->count; i++) {
+            free(node->words[i].text);
+            arith_free(node->words[i].arith);
+        }
+        free(node->words);
+        free(node->name);
+        node_free(node->condition);
+        node_free(node->body);
+        node_free(node->else_part);
+        for (size_t i = 0; i < node->arm_count; i++) node_free(node->arms[i].body);
+        free(node->arms);
+        case_matcher_free(node->matcher);
+        free(node);
+        node = next;
+    }
+}
@@ -0,0 +1,364 @@
+/*******************************************************************************
+  @file         pattern.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file pattern.c
+ * @brief Glob patterns, compiled once and matched without backtracking
+ *
+ * A pattern ('*', '?', "[...]" classes and literal characters, a backslash
+ * quotes the next one) compiles to a list of items: each is either a star or
+ * the set of bytes it accepts, 256 bits. Matching runs every item that can be
+ * at the current byte at once, like a Thompson NFA, so it costs the string's
+ * length times the number of items whatever the pattern: "*a*a*b" against a
+ * long run of a's does not backtrack. Items are symmetric, so a suffix is
+ * matched by running the reversed item list from the end of the string.
+ *
+ * A pattern without '*', '?' or a class keeps its unquoted text and is
+ * matched with memcmp, and searched for with memmem (glibc's two-way search).
+ *
+ * Parameter expansion gets its patterns from pattern_get(), a small cache
+ * per session keyed by the pattern's text.
+ */
+#define _GNU_SOURCE // memmem
+#include "JBash.h"
+
+#define NO_STATE SIZE_MAX // an item no match in progress has reached
+
+/**
+ * One position of a compiled pattern.
+ */
+struct glob_item {
+    int star;         // matches any run of bytes, set is unused
+    uint64_t set[4];  // the bytes it matches, one bit each
+};
+
+struct pattern {
+    char *text;               // source text, the cache key
+    size_t length;
+    char *literal;            // unquoted text when nothing is special, otherwise NULL
+    size_t literal_length;
+    struct glob_item *items;  // the items, then the same items reversed
+    struct glob_item *reversed;
+    size_t count;
+};
+
+/**
+ * @brief Adds a byte to an item's set
+ */
+static void set_add(uint64_t set[4], unsigned char c) {
+    set[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+/**
+ * @brief Whether an item's set has a byte
+ */
+static int set_has(const uint64_t set[4], unsigned char c) {
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+/**
+ * @brief Adds a named class such as "alpha" of "[[:alpha:]]" to a set
+ * @return 1, or 0 when the name is not a class
+ */
+static int named_class(const char *name, size_t length, uint64_t set[4]) {
+    static const struct {
+        const char *name;
+        int (*is)(int);
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+        { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+        { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != length || memcmp(classes[i].name, name, length) != 0) continue;
+        for (int c = 0; c < 256; c++) {
+            if (classes[i].is(c)) set_add(set, (unsigned char)c);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compiles a bracket expression: "[abc]", "[a-z]", "[!x]" or "[^x]", "[[:digit:]]"
+ * A ']' right after the '[' (or after the '!') is a member.
+ * @param text Points at the '['
+ * @param set Filled with the bytes it matches
+ * @return Characters it spans, 0 when it is not closed (the '[' is then literal)
+ */
+static size_t bracket(const char *text, size_t length, uint64_t set[4]) {
+    size_t i = 1;
+    int negate = i < length && (text[i] == '!' || text[i] == '^');
+    if (negate) i++;
+    size_t first = i;
+    for (; i < length && (text[i] != ']' || i == first); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '[' && i + 1 < length && text[i + 1] == ':') {
+            const char *close = memmem(&text[i + 2], length - i - 2, ":]", 2);
+            if (close != NULL && named_class(&text[i + 2], (size_t)(close - &text[i + 2]), set)) {
+                i = (size_t)(close - text) + 1;
+                continue;
+            }
+        }
+        if (c == '\\' && i + 1 < length) c = (unsigned char)text[++i];
+        if (i + 2 < length && text[i + 1] == '-' && text[i + 2] != ']') {
+            unsigned char last = (unsigned char)text[i + 2];
+            i += 2;
+            for (unsigned c2 = c; c2 <= last; c2++) set_add(set, (unsigned char)c2);
+        } else {
+            set_add(set, c);
+        }
+    }
+    if (i >= length) return 0;
+    if (negate) {
+        for (int k = 0; k < 4; k++) set[k] = ~set[k];
+    }
+    return i + 1;
+}
+
+/**
+ * @brief Compiles a glob pattern
+ * @param text Pattern text, need not be null terminated
+ * @return The pattern, free it with pattern_free()
+ */
+struct pattern *pattern_compile(const char *text, size_t length) {
+    struct pattern *p = safe_malloc(sizeof(struct pattern));
+    p->text = safe_malloc(length + 1);
+    memcpy(p->text, text, length);
+    p->text[length] = NULLCHAR;
+    p->length = length;
+    p->items = safe_malloc(2 * (length + 1) * sizeof(struct glob_item)); // at most one item per character
+    char *literal = safe_malloc(length + 1);
+    size_t count = 0, literal_length = 0;
+    int special = 0;
+    for (size_t i = 0; i < length; ) {
+        struct glob_item *item = &p->items[count];
+        memset(item, 0, sizeof(struct glob_item));
+        unsigned char c = (unsigned char)text[i];
+        if (c == '*') {
+            special = 1;
+            if (count == 0 || !p->items[count - 1].star) { // "**" is one star
+                item->star = 1;
+                count++;
+            }
+            i++;
+            continue;
+        }
+        if (c == '?') {
+            special = 1;
+            memset(item->set, 0xff, sizeof(item->set));
+            count++;
+            i++;
+            continue;
+        }
+        if (c == '[') {
+            size_t used = bracket(&text[i], length - i, item->set);
+            if (used > 0) {
+                special = 1;
+                count++;
+                i += used;
+                continue;
+            }
+            memset(item->set, 0, sizeof(item->set));
+        }
+        if (c == '\\' && i + 1 < length) c = (unsigned char)text[++i];
+        set_add(item->set, c);
+        literal[literal_length++] = (char)c;
+        count++;
+        i++;
+    }
+    p->count = count;
+    p->reversed = &p->items[count];
+    for (size_t k = 0; k < count; k++) p->reversed[k] = p->items[count - 1 - k];
+    if (special) {
+        free(literal);
+        literal = NULL;
+    }
+    p->literal = literal;
+    p->literal_length = literal_length;
+    return p;
+}
+
+/**
+ * @brief Releases a compiled pattern
+ */
+void pattern_free(struct pattern *p) {
+    if (p == NULL) return;
+    free(p->text);
+    free(p->items);
+    free(p->literal);
+    free(p);
+}
+
+/**
+ * @brief The compiled pattern for a text, compiled on first use and cached in the session
+ * The cache is direct mapped: a pattern stays until another text lands in its slot.
+ * @return A pattern that stays valid until the next pattern_get()
+ */
+struct pattern *pattern_get(const char *text, size_t length) {
+    uint32_t hash = 5381;
+    for (size_t i = 0; i < length; i++) hash = hash * 33 + (unsigned char)text[i];
+    struct pattern **slot = &session->patterns[hash % PATTERN_CACHE];
+    if (*slot != NULL && (*slot)->length == length && memcmp((*slot)->text, text, length) == 0) return *slot;
+    pattern_free(*slot);
+    *slot = pattern_compile(text, length);
+    return *slot;
+}
+
+/**
+ * @brief Releases the patterns a session cached
+ */
+void patterns_free(struct pattern **cache) {
+    for (size_t i = 0; i < PATTERN_CACHE; i++) {
+        pattern_free(cache[i]);
+        cache[i] = NULL;
+    }
+}
+
+/**
+ * @brief The text a pattern without special characters matches, its backslashes taken out
+ * @param length Set to its length
+ * @return The text, NULL when the pattern has '*', '?' or a class
+ */
+const char *pattern_literal(const struct pattern *p, size_t *length) {
+    *length = p->literal_length;
+    return p->literal;
+}
+
+/**
+ * @brief Puts an item in a state set, with the stars it may skip
+ * Each item keeps the leftmost offset a match reaching it started at.
+ * @param states One start offset per item, the last entry is the accepting state
+ */
+static void state_add(size_t *states, const struct glob_item *items, size_t count, size_t item, size_t start) {
+    for (;;) {
+        if (states[item] <= start) return;
+        states[item] = start;
+        if (item == count || !items[item].star) return;
+        item++;
+    }
+}
+
+/**
+ * @brief Moves every match in progress over one byte
+ * @return 1 when some match is still in progress
+ */
+static int state_step(const size_t *from, size_t *to, const struct glob_item *items, size_t count, unsigned char c) {
+    int any = 0;
+    for (size_t k = 0; k <= count; k++) to[k] = NO_STATE;
+    for (size_t k = 0; k < count; k++) {
+        if (from[k] == NO_STATE) continue;
+        if (items[k].star) state_add(to, items, count, k, from[k]);
+        else if (set_has(items[k].set, c)) state_add(to, items, count, k + 1, from[k]);
+        else continue;
+        any = 1;
+    }
+    return any;
+}
+
+/**
+ * @brief Matches a pattern against the start, or with backward the end, of a string
+ * @param longest Non-zero for the longest match, otherwise the shortest
+ * @return Length of the match, PATTERN_NO_MATCH when there is none
+ */
+static size_t anchored(const struct pattern *p, const char *s, size_t n, int backward, int longest) {
+    const struct glob_item *items = backward ? p->reversed : p->items;
+    size_t count = p->count;
+    size_t *states = arena_alloc(&session->word_arena, 2 * (count + 1) * sizeof(size_t));
+    size_t *next = &states[count + 1];
+    for (size_t k = 0; k <= count; k++) states[k] = NO_STATE;
+    state_add(states, items, count, 0, 0);
+    size_t found = PATTERN_NO_MATCH;
+    for (size_t i = 0; ; i++) {
+        if (states[count] != NO_STATE) {
+            found = i;
+            if (!longest) break;
+        }
+        if (i == n) break;
+        unsigned char c = (unsigned char)(backward ? s[n - 1 - i] : s[i]);
+        if (!state_step(states, next, items, count, c)) break;
+        size_t *swap = states;
+        states = next;
+        next = swap;
+    }
+    return found;
+}
+
+/**
+ * @brief Whether a pattern matches all of a string
+ */
+int pattern_match(const struct pattern *p, const char *s, size_t n) {
+    if (p->literal != NULL) return n == p->literal_length && memcmp(s, p->literal, n) == 0;
+    return anchored(p, s, n, 0, 1) == n;
+}
+
+/**
+ * @brief Length of the shortest or longest start of a string the pattern matches
+ * @return The length, PATTERN_NO_MATCH when no start matches
+ */
+size_t pattern_prefix(const struct pattern *p, const char *s, size_t n, int longest) {
+    if (p->literal != NULL) {
+        size_t length = p->literal_length;
+        return length <= n && memcmp(s, p->literal, length) == 0 ? length : PATTERN_NO_MATCH;
+    }
+    return anchored(p, s, n, 0, longest);
+}
+
+/**
+ * @brief Length of the shortest or longest end of a string the pattern matches
+ * @return The length, PATTERN_NO_MATCH when no end matches
+ */
+size_t pattern_suffix(const struct pattern *p, const char *s, size_t n, int longest) {
+    if (p->literal != NULL) {
+        size_t length = p->literal_length;
+        return length <= n && memcmp(s + n - length, p->literal, length) == 0 ? length : PATTERN_NO_MATCH;
+    }
+    return anchored(p, s, n, 1, longest);
+}
+
+/**
+ * @brief Finds the leftmost, then longest, non-empty match of a pattern in a string
+ * A match is started at every offset until one is found; after that only
+ * matches that started no later go on, until they all end.
+ * @param start Set to the offset the match starts at
+ * @param end Set to the offset just past it
+ * @return 1 when there is a match, 0 otherwise
+ */
+int pattern_find(const struct pattern *p, const char *s, size_t n, size_t *start, size_t *end) {
+    if (p->literal != NULL) {
+        if (p->literal_length == 0) return 0;
+        const char *at = memmem(s, n, p->literal, p->literal_length);
+        if (at == NULL) return 0;
+        *start = (size_t)(at - s);
+        *end = *start + p->literal_length;
+        return 1;
+    }
+    size_t count = p->count;
+    size_t *states = arena_alloc(&session->word_arena, 2 * (count + 1) * sizeof(size_t));
+    size_t *next = &states[count + 1];
+    for (size_t k = 0; k <= count; k++) states[k] = NO_STATE;
+    size_t best = NO_STATE;
+    for (size_t i = 0; ; i++) {
+        if (best == NO_STATE) state_add(states, p->items, count, 0, i);
+        size_t accepted = states[count];
+        if (accepted != NO_STATE && accepted < i && accepted <= best) { // non-empty, and leftmost
+            best = accepted;
+            *start = accepted;
+            *end = i;
+        }
+        if (best != NO_STATE) {
+            for (size_t k = 0; k < count; k++) {
+                if (states[k] > best) states[k] = NO_STATE; // started later, can no longer win
+            }
+        }
+        if (i == n) break;
+        int any = state_step(states, next, p->items, count, (unsigned char)s[i]);
+        size_t *swap = states;
+        states = next;
+        next = swap;
+        if (!any && best != NO_STATE) break;
+    }
+    return best != NO_STATE;
+}
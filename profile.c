@@ -0,0 +1,162 @@
+/*******************************************************************************
+  @file         profile.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file profile.c
+ * @brief Script profiler producing folded stacks for flamegraphs
+ *
+ * With JBASH_PROFILE=FILE set, every script line (and anything that pushes a
+ * frame on top of it) is timed exactly. On exit two files are written in the
+ * folded stack format understood by flamegraph.pl and speedscope:
+ *   FILE      wall time in microseconds
+ *   FILE.cpu  CPU time of the commands run (children via wait4, builtins via getrusage)
+ * A line such as "build.jb;build.jb:12 5300" means line 12 of build.jb spent
+ * 5.3ms of its own time. Time spent in deeper frames is not counted twice.
+ *
+ * When the variable is unset the only cost is one branch per script line.
+ */
+#include "JBash.h"
+
+/**
+ * Accumulated self time of one distinct stack.
+ */
+struct profile_entry {
+    char *stack;                  // frames joined by ';'
+    long long wall_us;
+    long long cpu_us;
+    struct profile_entry *next;   // hash chain
+};
+
+/**
+ * An open frame on the profiler stack.
+ */
+struct profile_frame {
+    size_t path_length;      // length of profile_path before this frame was appended
+    long long wall_start;    // monotonic_us() when pushed
+    long long cpu_start;     // profile_cpu_us when pushed
+    long long child_wall;    // inclusive time of frames pushed on top of this one
+    long long child_cpu;
+};
+
+int profiling = 0;
+static char *profile_output = NULL;
+static struct profile_entry *profile_table[PROFILE_BUCKETS];
+static struct profile_frame profile_stack[PROFILE_DEPTH];
+static size_t profile_depth = 0;  // frames pushed, may exceed PROFILE_DEPTH (extra frames are not timed)
+static char profile_path[PROFILE_PATH]; // current stack as "frame;frame;frame"
+static long long profile_cpu_us = 0;    // CPU time of every command so far
+
+/**
+ * @brief Adds self time to the entry for the current stack
+ */
+static void profile_account(long long wall_us, long long cpu_us) {
+    unsigned long hash = 5381;
+    for (const char *p = profile_path; *p; p++) hash = hash * 33 + (unsigned char)*p;
+    struct profile_entry **bucket = &profile_table[hash % PROFILE_BUCKETS];
+    struct profile_entry *entry = *bucket;
+    while (entry != NULL && strcmp(entry->stack, profile_path) != 0) entry = entry->next;
+    if (entry == NULL) {
+        entry = safe_malloc(sizeof(struct profile_entry));
+        entry->stack = strdup(profile_path);
+        entry->wall_us = 0;
+        entry->cpu_us = 0;
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    entry->wall_us += wall_us;
+    entry->cpu_us += cpu_us;
+}
+
+/**
+ * @brief Opens a frame (a script, a script line, a function call)
+ * @param frame Frame name; ';' and spaces are replaced since they delimit folded stacks
+ */
+void profile_push(const char *frame) {
+    size_t depth = profile_depth++;
+    if (depth >= PROFILE_DEPTH) return;
+
+    struct profile_frame *f = &profile_stack[depth];
+    f->path_length = strlen(profile_path);
+    size_t at = f->path_length;
+    if (at > 0 && at + 1 < PROFILE_PATH) profile_path[at++] = ';';
+    for (const char *p = frame; *p && at + 1 < PROFILE_PATH; p++) {
+        profile_path[at++] = (*p == ';' || *p == ' ') ? '_' : *p;
+    }
+    profile_path[at] = NULLCHAR;
+
+    f->child_wall = 0;
+    f->child_cpu = 0;
+    f->cpu_start = profile_cpu_us;
+    f->wall_start = monotonic_us(); // last, so the bookkeeping above is not billed to the frame
+}
+
+/**
+ * @brief Closes the innermost frame and books its self time
+ */
+void profile_pop(void) {
+    if (profile_depth == 0) return;
+    size_t depth = --profile_depth;
+    if (depth >= PROFILE_DEPTH) return;
+
+    struct profile_frame *f = &profile_stack[depth];
+    long long wall = monotonic_us() - f->wall_start;
+    long long cpu = profile_cpu_us - f->cpu_start;
+    profile_account(wall - f->child_wall, cpu - f->child_cpu);
+    if (depth > 0) {
+        profile_stack[depth - 1].child_wall += wall;
+        profile_stack[depth - 1].child_cpu += cpu;
+    }
+    profile_path[f->path_length] = NULLCHAR;
+}
+
+/**
+ * @brief Adds the CPU time of a finished command to the running total
+ */
+void profile_add_cpu(long long us) {
+    profile_cpu_us += us;
+}
+
+/**
+ * @brief Writes one folded stack file
+ * @param path Output file
+ * @param cpu Non-zero to write CPU time, otherwise wall time
+ */
+static void profile_write(const char *path, int cpu) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        perror("profile");
+        return;
+    }
+    for (size_t i = 0; i < PROFILE_BUCKETS; i++) {
+        for (struct profile_entry *e = profile_table[i]; e != NULL; e = e->next) {
+            long long value = cpu ? e->cpu_us : e->wall_us;
+            if (value > 0) fprintf(out, "%s %lld\n", e->stack, value);
+        }
+    }
+    fclose(out);
+}
+
+/**
+ * @brief Writes the profile when the shell exits
+ */
+static void profile_write_at_exit(void) {
+    while (profile_depth > 0) profile_pop(); // an exit in the middle of a script still counts
+    size_t length = strlen(profile_output);
+    char cpu_path[length + 5];
+    snprintf(cpu_path, sizeof(cpu_path), "%s.cpu", profile_output);
+    profile_write(profile_output, 0);
+    profile_write(cpu_path, 1);
+}
+
+/**
+ * @brief Turns the profiler on when JBASH_PROFILE names an output file
+ */
+void profile_init(void) {
+    const char *path = getenv("JBASH_PROFILE");
+    if (path == NULL || path[0] == NULLCHAR) return;
+    profile_output = strdup(path);
+    profiling = 1;
+    atexit(profile_write_at_exit);
+}
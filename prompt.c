@@ -0,0 +1,335 @@
+/*******************************************************************************
+  @file         prompt.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file prompt.c
+ * @brief Prompt drawing and asynchronous prompt segments
+ *
+ * A segment is a small piece of the prompt (by default the current git branch)
+ * produced by running a command through /bin/sh. Running it inline would block
+ * the prompt, so the prompt is drawn straight away with the cached value (or a
+ * placeholder) while a worker process computes the fresh value. When the worker
+ * finishes, only the segment is redrawn on the line the user is typing on.
+ * Results are cached per directory and trusted for SEGMENT_TTL seconds.
+ */
+#include "JBash.h"
+
+/**
+ * One cached segment value, keyed by the directory it was computed in.
+ */
+struct segment_entry {
+    char *dir;                // directory the value belongs to, NULL if slot unused
+    char value[SEGMENT_MAX];  // first line of the segment command output
+    time_t stamp;             // monotonic time (seconds) the value was computed
+};
+
+static struct segment_entry segment_cache[SEGMENT_CACHE_SIZE];
+static size_t segment_next_slot = 0; // round robin replacement when cache is full
+
+// State of the single in-flight worker
+static pid_t worker_pid = -1;
+static int worker_fd = -1;
+static char *worker_dir = NULL;
+static char worker_buffer[SEGMENT_MAX];
+static size_t worker_length = 0;
+static const char *pending_command = NULL; // worker to start once the prompt is on screen
+
+// What the current prompt line shows, so it can be redrawn in place
+static char shown_segment[SEGMENT_MAX];
+static int continuation_shown = 0; // the current line has CONTINUATION_PROMPT, no segment to redraw
+
+/**
+ * @brief Seconds on the monotonic clock, unaffected by wall clock changes
+ */
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * @brief Returns the segment command, or NULL when segments are disabled
+ * Set JBASH_SEGMENT to the command to run, or to an empty string to disable.
+ */
+static const char *segment_command(void) {
+    const char *cmd = getenv("JBASH_SEGMENT");
+    if (cmd == NULL) return SEGMENT_DEFAULT_CMD;
+    return cmd[0] != NULLCHAR ? cmd : NULL;
+}
+
+/**
+ * @brief Returns how many seconds a cached value stays fresh (JBASH_SEGMENT_TTL)
+ */
+static time_t segment_ttl(void) {
+    const char *ttl = getenv("JBASH_SEGMENT_TTL");
+    return ttl != NULL ? (time_t)atol(ttl) : SEGMENT_TTL;
+}
+
+/**
+ * @brief Finds the cache entry for a directory
+ * @param dir Directory to look up
+ * @return The matching entry or NULL
+ */
+static struct segment_entry *segment_lookup(const char *dir) {
+    for (size_t i = 0; i < SEGMENT_CACHE_SIZE; i++) {
+        if (segment_cache[i].dir != NULL && strcmp(segment_cache[i].dir, dir) == 0) {
+            return &segment_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Stores a freshly computed value in the cache, replacing the oldest slot if needed
+ * @param dir Directory the value was computed in (copied)
+ * @param value Segment text
+ */
+static void segment_store(const char *dir, const char *value) {
+    struct segment_entry *entry = segment_lookup(dir);
+    if (entry == NULL) {
+        entry = &segment_cache[segment_next_slot];
+        segment_next_slot = (segment_next_slot + 1) % SEGMENT_CACHE_SIZE;
+        free(entry->dir);
+        entry->dir = strdup(dir);
+    }
+    snprintf(entry->value, sizeof(entry->value), "%s", value);
+    entry->stamp = monotonic_seconds();
+}
+
+/**
+ * @brief Adds the segment cache, and the snapshot's directories it does not have, to the snapshot being saved
+ */
+void segment_snapshot(void) {
+    size_t added = 0;
+    for (size_t i = 0; i < SEGMENT_CACHE_SIZE; i++) {
+        if (segment_cache[i].dir == NULL) continue;
+        snapshot_add_segment(segment_cache[i].dir, segment_cache[i].value);
+        added++;
+    }
+    size_t count = snapshot_segment_count();
+    for (size_t i = 0; i < count && added < SEGMENT_CACHE_SIZE; i++) {
+        const char *dir, *value;
+        snapshot_segment_at(i, &dir, &value);
+        if (segment_lookup(dir) != NULL) continue;
+        snapshot_add_segment(dir, value);
+        added++;
+    }
+}
+
+/**
+ * @brief Forks a worker that runs the segment command for the current directory
+ * The worker's stdout is a pipe that read_input() (editor.c) polls alongside the keyboard.
+ */
+static void segment_spawn(const char *cmd) {
+    int fds[2];
+    if (pipe(fds) == -1) return; // no worker, the prompt keeps its cached value
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        // worker: stdout goes to the pipe, it must never touch the terminal
+        int devnull = open("/dev/null", O_RDWR);
+        dup2(devnull, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        close(devnull);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC); // commands run later must not inherit it
+    worker_pid = pid;
+    worker_fd = fds[0];
+    worker_dir = strdup(session_cwd(session));
+    worker_length = 0;
+}
+
+/**
+ * @brief Stops an in-flight worker whose result is no longer wanted
+ */
+static void segment_cancel(void) {
+    if (worker_pid == -1) return;
+    kill(worker_pid, SIGTERM);
+    waitpid(worker_pid, NULL, 0);
+    close(worker_fd);
+    free(worker_dir);
+    worker_pid = -1;
+    worker_fd = -1;
+    worker_dir = NULL;
+}
+
+/**
+ * @brief Picks the value to show for the current directory and asks for a worker if it is stale
+ * Called before each prompt is drawn; never blocks on the segment command. The worker is
+ * forked by segment_start(), after the prompt is drawn, so it never delays the prompt.
+ */
+void segment_refresh(void) {
+    shown_segment[0] = NULLCHAR;
+    const char *cmd = segment_command();
+    if (cmd == NULL) return;
+
+    struct segment_entry *entry = segment_lookup(session_cwd(session));
+    if (entry != NULL) {
+        snprintf(shown_segment, sizeof(shown_segment), "%s", entry->value);
+        if (monotonic_seconds() - entry->stamp < segment_ttl()) return; // still fresh
+    } else {
+        const char *saved = snapshot_segment(session_cwd(session)); // an earlier shell's value beats "..."
+        snprintf(shown_segment, sizeof(shown_segment), "%s", saved != NULL ? saved : SEGMENT_PLACEHOLDER);
+    }
+
+    if (worker_pid != -1) {
+        if (strcmp(worker_dir, session_cwd(session)) == 0) return; // already computing this directory
+        segment_cancel(); // user moved on, the old directory's result is not needed
+    }
+    pending_command = cmd;
+}
+
+/**
+ * @brief Forks the worker segment_refresh() asked for, if any
+ * Called by the line editor right before it waits for input.
+ */
+void segment_start(void) {
+    if (pending_command == NULL) return;
+    const char *cmd = pending_command;
+    pending_command = NULL;
+    segment_spawn(cmd);
+}
+
+/**
+ * @brief Reads whatever the worker has produced so far
+ * @return 1 if the worker finished and the shown segment changed, 0 otherwise
+ */
+static int segment_collect(void) {
+    if (worker_pid == -1) return 0;
+
+    ssize_t n;
+    char chunk[64];
+    while ((n = read(worker_fd, chunk, sizeof(chunk))) > 0) {
+        // keep only what fits, the rest is drained and dropped
+        size_t room = sizeof(worker_buffer) - 1 - worker_length;
+        size_t keep = (size_t)n < room ? (size_t)n : room;
+        memcpy(&worker_buffer[worker_length], chunk, keep);
+        worker_length += keep;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) return 0; // not done yet
+
+    // EOF: the worker is done, keep the first line as the value
+    worker_buffer[worker_length] = NULLCHAR;
+    worker_buffer[strcspn(worker_buffer, "\r\n")] = NULLCHAR;
+    waitpid(worker_pid, NULL, 0);
+    close(worker_fd);
+    segment_store(worker_dir, worker_buffer);
+
+    int changed = 0;
+    if (strcmp(worker_dir, session_cwd(session)) == 0 && strcmp(shown_segment, worker_buffer) != 0) {
+        snprintf(shown_segment, sizeof(shown_segment), "%s", worker_buffer);
+        changed = 1;
+    }
+    free(worker_dir);
+    worker_pid = -1;
+    worker_fd = -1;
+    worker_dir = NULL;
+    return changed;
+}
+
+/**
+ * @brief Visible width of the segment as drawn by print_segment()
+ */
+static size_t segment_width(const char *segment) {
+    return segment[0] != NULLCHAR ? strlen(segment) + 3 : 0; // " (" + value + ")"
+}
+
+/**
+ * @brief Prints a segment with its decoration, nothing for an empty value
+ */
+static void print_segment(const char *segment) {
+    if (segment[0] != NULLCHAR) {
+        printf(" \033[0;33m(%s)\033[0m", segment); // Color mode: Yellow;
+    }
+}
+
+/**
+ * @brief Prints what follows the segment: the last command's status and duration, then the shell name
+ * A failed status is shown in red, and the duration only for commands slower than PROMPT_SLOW_MS.
+ */
+static void print_prompt_tail(void) {
+    if (session->last_usage.status != 0) {
+        printf(" \033[0;31m[%d]\033[0m", session->last_usage.status); // Color mode: Red;
+    }
+    if (session->last_usage.wall_us >= PROMPT_SLOW_MS * 1000LL) {
+        printf(" \033[0;35m%.1fs\033[0m", session->last_usage.wall_us / 1000000.0); // Color mode: Magenta;
+    }
+    printf("%s", SHELL_NAME);
+}
+
+void print_prompt() {
+    continuation_shown = 0;
+    segment_refresh();
+    printf("\033[1;32m%s:\033[0m", session_cwd(session));
+    print_segment(shown_segment);
+    print_prompt_tail();
+}
+
+/**
+ * @brief Prompt for the next line of an unfinished compound command
+ */
+void print_continuation_prompt(void) {
+    continuation_shown = 1;
+    printf("%s", CONTINUATION_PROMPT);
+}
+
+/**
+ * @brief Redraws the segment on the current input line after its worker finished
+ * If the new value is as wide as the old one only the segment is rewritten,
+ * otherwise everything after it shifts so the rest of the line is redrawn too.
+ *
+ * @param line The text typed so far
+ * @param length Length of the typed text
+ * @param cursor Cursor position within the typed text
+ * @param old_width Visible width of the segment currently on screen
+ */
+static void segment_redraw_from(const char *line, size_t length, size_t cursor, size_t old_width) {
+    size_t column = strlen(session_cwd(session)) + 1; // segment starts right after "cwd:"
+    if (segment_width(shown_segment) == old_width) {
+        // "\0337" and "\0338" save and restore the cursor around the rewrite
+        printf("\0337\r\033[%zuC", column);
+        print_segment(shown_segment);
+        printf("\0338");
+    } else {
+        printf("\r\033[%zuC", column);
+        print_segment(shown_segment);
+        print_prompt_tail();
+        printf("%.*s\033[K", (int)length, line);
+        if (length > cursor) printf("\033[%zuD", length - cursor); // back to the editing position
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Descriptor that becomes readable when the segment worker has output, -1 when none runs
+ */
+int segment_fd(void) {
+    return worker_fd;
+}
+
+/**
+ * @brief Collects the worker's output and redraws the segment if it finished with a new value
+ * @param line The text typed so far, used to redraw after a segment update
+ * @param length Length of the typed text
+ * @param cursor Cursor position within the typed text
+ */
+void segment_update(const char *line, size_t length, size_t cursor) {
+    size_t old_width = segment_width(shown_segment);
+    // on a continuation line the new value waits for the next full prompt
+    if (segment_collect() && !continuation_shown) segment_redraw_from(line, length, cursor, old_width);
+}
@@ -0,0 +1,382 @@
+/*******************************************************************************
+  @file         rc.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file rc.c
+ * @brief The rc file, the source builtin and the parse cache
+ *
+ * Interactive shells and servers source ~/.jbashrc (JBASH_RC) before the
+ * first prompt; "source FILE" (or ". FILE") runs a file in the current shell.
+ *
+ * A sourced file is parsed once into an image: every command line split into
+ * words (split_words), stored as offsets into a string pool. The image is
+ * written to the cache directory (JBASH_CACHE_DIR, default ~/.cache/jbash),
+ * keyed by the file's path, mtime and size and the build ID of the shell.
+ * While those match, sourcing the file again is one mmap: the parser reads
+ * the words from the image in place, nothing is read or split. Only parsing
+ * into nodes and expansion, which depends on variables, run every time.
+ *
+ * Image layout: header, lines, words, then the string pool (NUL terminated).
+ */
+#include "JBash.h"
+
+#define PARSE_CACHE_MAGIC 0x4a425043u // "JBPC"
+#ifndef JBASH_BUILD_ID
+#define JBASH_BUILD_ID 0 // the Makefile passes a checksum of the library sources
+#endif
+
+/**
+ * Start of an image.
+ */
+struct parse_header {
+    uint32_t magic;        // PARSE_CACHE_MAGIC
+    uint32_t line_count;
+    uint64_t build_id;     // shell that wrote it; another build may split words differently
+    uint64_t size;         // image size
+    int64_t mtime_sec;     // the source file when it was parsed
+    int64_t mtime_nsec;
+    uint64_t source_size;
+    uint32_t source;       // string offset of the source path, guards against hash collisions
+    uint32_t word_count;
+};
+
+/**
+ * One command line: a run of words.
+ */
+struct parse_line {
+    uint32_t number;       // line number in the source file, for the profiler
+    uint32_t first_word;
+    uint32_t word_count;
+};
+
+/**
+ * One word as split_words() produced it.
+ */
+struct parse_word {
+    uint32_t text;         // string offset
+    uint32_t quote;        // quote character it was enclosed in, or 0
+};
+
+/**
+ * An image being built from a source file.
+ */
+struct image_builder {
+    struct parse_line *lines;
+    size_t line_count, line_capacity;
+    struct parse_word *words;
+    size_t word_count, word_capacity;
+    char *pool;
+    size_t pool_length, pool_capacity;
+};
+
+/**
+ * @brief The build ID cached images and indexes are keyed by
+ */
+uint64_t cache_build_id(void) {
+    if (JBASH_BUILD_ID != 0) return (uint64_t)JBASH_BUILD_ID;
+    uint64_t hash = 14695981039346656037ull; // built without the Makefile: the compile time will do
+    for (const char *p = __DATE__ " " __TIME__; *p; p++) hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+    return hash;
+}
+
+/**
+ * @brief A file in the cache directory, JBASH_CACHE_DIR or ~/.cache/jbash
+ * @param key Absolute path of what is cached, hashed into the file name
+ * @param suffix File name extension, "jbc" for parse images
+ * @param path Filled in with the cache file's path
+ * @param make_dirs Create the cache directory if it is missing
+ * @return 0, or -1 when caching is disabled (JBASH_CACHE_DIR is empty, or no HOME)
+ */
+int cache_path(const char *key, const char *suffix, char *path, size_t size, int make_dirs) {
+    char dir[PATH_MAX];
+    const char *set = getenv("JBASH_CACHE_DIR");
+    if (set != NULL) {
+        if (set[0] == NULLCHAR) return -1;
+        snprintf(dir, sizeof(dir), "%s", set);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL) return -1;
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        if (make_dirs) mkdir(dir, 0700);
+        snprintf(dir, sizeof(dir), "%s/.cache/jbash", home);
+    }
+    if (make_dirs) mkdir(dir, 0700);
+    uint64_t hash = 14695981039346656037ull;
+    for (const char *p = key; *p; p++) hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+    snprintf(path, size, "%s/%016llx.%s", dir, (unsigned long long)hash, suffix);
+    return 0;
+}
+
+/**
+ * @brief Checks an image against its source file, bounds included
+ */
+static int image_valid(const char *image, size_t size, const char *source, const struct stat *st) {
+    const struct parse_header *header = (const struct parse_header *)image;
+    if (size < sizeof(struct parse_header) || header->magic != PARSE_CACHE_MAGIC || header->size != size ||
+        header->build_id != cache_build_id() || header->mtime_sec != st->st_mtim.tv_sec ||
+        header->mtime_nsec != st->st_mtim.tv_nsec || header->source_size != (uint64_t)st->st_size ||
+        image[size - 1] != NULLCHAR) {
+        return 0;
+    }
+    size_t words_at = sizeof(struct parse_header) + header->line_count * sizeof(struct parse_line);
+    if (header->line_count > size / sizeof(struct parse_line) || header->word_count > size / sizeof(struct parse_word) ||
+        words_at + header->word_count * sizeof(struct parse_word) > size || header->source >= size ||
+        strcmp(&image[header->source], source) != 0) {
+        return 0;
+    }
+    const struct parse_line *lines = (const struct parse_line *)&image[sizeof(struct parse_header)];
+    const struct parse_word *words = (const struct parse_word *)&image[words_at];
+    for (uint32_t i = 0; i < header->line_count; i++) {
+        if (lines[i].first_word > header->word_count || lines[i].word_count > header->word_count - lines[i].first_word) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->word_count; i++) {
+        if (words[i].text >= size) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Appends a string to the image's pool
+ * @return Its offset within the pool
+ */
+static uint32_t builder_string(struct image_builder *b, const char *s) {
+    size_t length = strlen(s) + 1;
+    while (b->pool_length + length > b->pool_capacity) b->pool = realloc_buffer(b->pool, &b->pool_capacity, sizeof(char));
+    memcpy(&b->pool[b->pool_length], s, length);
+    b->pool_length += length;
+    return (uint32_t)(b->pool_length - length);
+}
+
+/**
+ * @brief split_words() callback while building an image: records the word
+ */
+static void builder_word(char *word, char quote, void *context) {
+    struct image_builder *b = context;
+    if (b->word_count == b->word_capacity) b->words = realloc_buffer(b->words, &b->word_capacity, sizeof(struct parse_word));
+    b->words[b->word_count].text = builder_string(b, word);
+    b->words[b->word_count].quote = (unsigned char)quote;
+    b->word_count++;
+}
+
+/**
+ * @brief Parses a source file into an image
+ * @param in The file, read from the start
+ * @param source Its absolute path
+ * @param st Its stat, for the key
+ * @param size Set to the image size
+ * @return The image, to be freed by the caller
+ */
+static char *image_build(FILE *in, const char *source, const struct stat *st, size_t *size) {
+    struct image_builder b = { NULL, 0, CMD_LINE_BUFFER, NULL, 0, CMD_LINE_BUFFER, NULL, 0, STR_BUFFER };
+    b.lines = safe_malloc(b.line_capacity * sizeof(struct parse_line));
+    b.words = safe_malloc(b.word_capacity * sizeof(struct parse_word));
+    b.pool = safe_malloc(b.pool_capacity);
+    uint32_t source_offset = builder_string(&b, source);
+
+    char *line = NULL;
+    size_t capacity = 0, number = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, in)) != -1) {
+        number++;
+        if (length > 0 && line[length - 1] == NEWLINE) line[--length] = NULLCHAR;
+        size_t indent = strspn(line, " \t");
+        if (line[indent] == NULLCHAR || line[indent] == '#') continue; // blank line or comment, like run_script()
+        if (b.line_count == b.line_capacity) b.lines = realloc_buffer(b.lines, &b.line_capacity, sizeof(struct parse_line));
+        struct parse_line *parsed = &b.lines[b.line_count++];
+        parsed->number = (uint32_t)number;
+        parsed->first_word = (uint32_t)b.word_count;
+        split_words(&line[indent], (size_t)length - indent, builder_word, &b);
+        parsed->word_count = (uint32_t)(b.word_count - parsed->first_word);
+    }
+    free(line);
+
+    size_t lines_at = sizeof(struct parse_header);
+    size_t words_at = lines_at + b.line_count * sizeof(struct parse_line);
+    size_t strings = words_at + b.word_count * sizeof(struct parse_word);
+    *size = strings + b.pool_length + 1;
+    char *image = safe_malloc(*size);
+    struct parse_header header = { PARSE_CACHE_MAGIC, (uint32_t)b.line_count, cache_build_id(), *size,
+                                   st->st_mtim.tv_sec, st->st_mtim.tv_nsec, (uint64_t)st->st_size,
+                                   (uint32_t)(source_offset + strings), (uint32_t)b.word_count };
+    for (size_t i = 0; i < b.word_count; i++) b.words[i].text += (uint32_t)strings;
+    memcpy(image, &header, sizeof(header));
+    memcpy(&image[lines_at], b.lines, b.line_count * sizeof(struct parse_line));
+    memcpy(&image[words_at], b.words, b.word_count * sizeof(struct parse_word));
+    memcpy(&image[strings], b.pool, b.pool_length);
+    image[*size - 1] = NULLCHAR;
+    free(b.lines);
+    free(b.words);
+    free(b.pool);
+    return image;
+}
+
+/**
+ * @brief Writes a file of the cache, replacing the old one atomically
+ * @param path The file, as cache_path() named it
+ */
+void cache_store(const char *path, const char *data, size_t size) {
+    char temporary[PATH_MAX + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return; // no cache, the file is simply parsed again next time
+    int ok = 1;
+    for (size_t written = 0; ok && written < size; ) {
+        ssize_t n = write(fd, &data[written], size - written);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) ok = 0;
+        else written += (size_t)n;
+    }
+    if (close(fd) == -1) ok = 0;
+    if (!ok || rename(temporary, path) == -1) unlink(temporary);
+}
+
+/**
+ * An image being read by the parser.
+ */
+struct image_reader {
+    const char *image;
+    const struct parse_line *lines;
+    const struct parse_word *words;
+    uint32_t next;   // next line to hand out
+    uint32_t count;
+};
+
+/**
+ * @brief line_source callback for an image: hands out the next line's words, still in the image
+ */
+static int image_read(struct line_source *source) {
+    struct image_reader *reader = source->context;
+    if (reader->next == reader->count) return 0;
+    const struct parse_line *line = &reader->lines[reader->next++];
+    source->number = line->number;
+    for (uint32_t w = 0; w < line->word_count; w++) {
+        const struct parse_word *word = &reader->words[line->first_word + w];
+        line_source_add(source, (char *)&reader->image[word->text], (char)word->quote);
+    }
+    return 1;
+}
+
+/**
+ * @brief Runs the commands of an image in the current session
+ * The parser reads the split words from the image, nothing is lexed again.
+ * @param name Source name, for profiler frames and syntax errors
+ * @param status Set to the status of the last command
+ * @return returns 1, to continue execution and 0 after exit.
+ */
+static int image_run(const char *image, const char *name, int *status) {
+    const struct parse_header *header = (const struct parse_header *)image;
+    const struct parse_line *lines = (const struct parse_line *)&image[sizeof(struct parse_header)];
+    struct image_reader reader = { image, lines, (const struct parse_word *)&lines[header->line_count], 0,
+                                   header->line_count };
+    struct line_source source;
+    line_source_init(&source, image_read, &reader, name);
+    if (profiling) profile_push(name);
+    int rv = session_run_source(session, &source);
+    if (profiling) profile_pop();
+    line_source_free(&source);
+    *status = session->last_usage.status;
+    return rv;
+}
+
+/**
+ * @brief Runs a file's commands in the current session, from its cached image when it is up to date
+ * The session's current command (its words, buffer and expanded words) is set
+ * aside while the file runs, so "source FILE ; more commands" keeps working.
+ * @param path File to run
+ * @param status Set to the status of the last command, or 1 when the file cannot be read
+ * @return returns 1, to continue execution and 0 after exit.
+ */
+int source_file(const char *path, int *status) {
+    uint64_t begun = startup_begin();
+    char *source = realpath(path, NULL);
+    FILE *in = source != NULL ? fopen(source, "r") : NULL;
+    struct stat st;
+    if (in == NULL || fstat(fileno(in), &st) == -1) {
+        fprintf(stderr, "source: %s: %s\n", path, strerror(errno));
+        if (in != NULL) fclose(in);
+        free(source);
+        *status = 1;
+        return 1;
+    }
+
+    // one mmap when the cached image still matches the file
+    char cached[PATH_MAX];
+    char *image = NULL, *built = NULL;
+    size_t size = 0;
+    if (cache_path(source, "jbc", cached, sizeof(cached), 0) == 0) {
+        int fd = open(cached, O_RDONLY | O_CLOEXEC);
+        struct stat cst;
+        if (fd != -1 && fstat(fd, &cst) == 0 && cst.st_size > 0) {
+            size = (size_t)cst.st_size;
+            void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED && image_valid(mapped, size, source, &st)) image = mapped;
+            else if (mapped != MAP_FAILED) munmap(mapped, size);
+        }
+        if (fd != -1) close(fd);
+    }
+    if (image == NULL) {
+        TRACE_BEGIN("parse_file");
+        image = built = image_build(in, source, &st, &size);
+        TRACE_END("parse_file");
+        if (cache_path(source, "jbc", cached, sizeof(cached), 1) == 0) cache_store(cached, image, size);
+    }
+    fclose(in);
+
+    // set the source command's own state aside, the file's commands get their own
+    char **outer_args = session->args;
+    char *outer_input = session->input;
+    struct arena outer_arena = session->word_arena;
+    session->args = NULL;
+    session->input = NULL;
+    session->word_arena.head = NULL;
+    int rv = image_run(image, path, status);
+    arena_free(&session->word_arena);
+    session->args = outer_args;
+    session->input = outer_input;
+    session->word_arena = outer_arena;
+
+    if (built != NULL) free(built);
+    else munmap(image, size);
+    startup_end(source, begun);
+    free(source);
+    return rv;
+}
+
+/**
+ * @brief Sources the rc file, ~/.jbashrc or JBASH_RC, if there is one
+ * Called by interactive shells and servers before the first command.
+ * @return returns 1, to continue execution and 0 if the rc file ran exit.
+ */
+int rc_load(void) {
+    char path[PATH_MAX];
+    const char *set = getenv("JBASH_RC");
+    if (set != NULL) {
+        if (set[0] == NULLCHAR) return 1; // disabled
+        snprintf(path, sizeof(path), "%s", set);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL) return 1;
+        snprintf(path, sizeof(path), "%s/.jbashrc", home);
+    }
+    if (access(path, R_OK) != 0) return 1;
+    int status;
+    return source_file(path, &status);
+}
+
+/**
+ * @brief The source builtin: "source FILE" or ". FILE"
+ * @param status Set to the status of the file's last command
+ * @return returns 1, to continue execution and 0 if the file ran exit.
+ */
+int source_builtin(char **args, int *status) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "usage: source FILE\n");
+        *status = 2;
+        return 1;
+    }
+    return source_file(args[1], status);
+}
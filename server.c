@@ -0,0 +1,332 @@
+/*******************************************************************************
+  @file         server.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file server.c
+ * @brief Server mode: a warm shell serving commands over a Unix socket
+ *
+ * "JBash --server" listens on JBASH_SOCKET and keeps one session alive, so
+ * its variables and the command hash table stay warm between requests.
+ * "JBash --client COMMANDS" sends a request and exits with the commands'
+ * status.
+ *
+ * The client hands its terminal and working directory to whoever listens, so
+ * both ends check the other one's uid (SO_PEERCRED): a client only talks to a
+ * server of its own user and runs the commands itself otherwise, and a server
+ * drops connections from other users. The default socket is jbash.sock in
+ * $XDG_RUNTIME_DIR, or else in /tmp/jbash-UID, a directory the server
+ * creates with mode 0700; a directory that another user could have made or
+ * can write to is not used.
+ *
+ * A request is a struct server_request followed by the commands. It carries
+ * SERVER_FDS descriptors as SCM_RIGHTS: the client's stdin, stdout, stderr and
+ * working directory. The server runs the commands with those as its own stdio
+ * and working directory, then answers with the 4-byte exit status. Requests
+ * are served one at a time, in the order they connect.
+ */
+#define _GNU_SOURCE // accept4, MSG_CMSG_CLOEXEC
+#include "JBash.h"
+
+static char *listening_path = NULL; // socket file to remove on exit
+
+/**
+ * @brief Makes sure a directory for the default socket is this user's alone
+ * @param create Non-zero to create it, with mode 0700, when it is missing
+ * @return 0, or -1 when it is missing, not a directory, another user's, or open to others
+ */
+static int private_directory(const char *directory, int create) {
+    struct stat st;
+    if (lstat(directory, &st) == -1) {
+        if (!create) return -1; // no server has made it: nobody is listening
+        if ((errno != ENOENT || mkdir(directory, 0700) == -1) && errno != EEXIST) {
+            perror(directory);
+            return -1;
+        }
+        if (lstat(directory, &st) == -1) return -1;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        fprintf(stderr, "JBash: %s is not a private directory of this user, not using it\n", directory);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief The socket path: JBASH_SOCKET, or jbash.sock in $XDG_RUNTIME_DIR or in /tmp/jbash-UID
+ * @param address Filled in with the path
+ * @param create Non-zero for the server, which creates /tmp/jbash-UID when it is missing
+ * @return 0, or -1 when the path does not fit in a sockaddr_un or its directory is not private
+ */
+static int server_address(struct sockaddr_un *address, int create) {
+    char fallback[PATH_MAX];
+    const char *path = getenv("JBASH_SOCKET");
+    if (path == NULL || path[0] == NULLCHAR) {
+        const char *runtime = getenv("XDG_RUNTIME_DIR");
+        if (runtime != NULL && runtime[0] == '/') {
+            snprintf(fallback, sizeof(fallback), "%s", runtime);
+        } else {
+            snprintf(fallback, sizeof(fallback), "/tmp/jbash-%u", (unsigned)getuid());
+        }
+        if (private_directory(fallback, create) == -1) return -1;
+        size_t length = strlen(fallback);
+        snprintf(&fallback[length], sizeof(fallback) - length, "/jbash.sock");
+        path = fallback;
+    }
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "JBash: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+/**
+ * @brief Whether the process at the other end of a connection runs as this user
+ */
+static int peer_is_user(int connection) {
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0 && length == sizeof(peer) &&
+           peer.uid == getuid();
+}
+
+/**
+ * @brief Removes the socket file when the server exits
+ */
+static void server_cleanup(void) {
+    if (listening_path != NULL) unlink(listening_path);
+}
+
+/**
+ * @brief SIGTERM handler: exit normally so the socket file is removed
+ */
+static void server_stop(int sig) {
+    (void)sig;
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Reads exactly length bytes
+ * @return 0, or -1 on error or end of file
+ */
+static int read_full(int fd, void *buffer, size_t length) {
+    char *p = buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs one request in the server's session
+ * @param connection Accepted client connection
+ */
+static void serve_request(int connection) {
+    struct server_request request;
+    struct iovec iov = { &request, sizeof(request) };
+    union { // aligned buffer for the descriptors
+        char buffer[CMSG_SPACE(sizeof(int) * SERVER_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message = { 0 };
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t n;
+    do n = recvmsg(connection, &message, MSG_CMSG_CLOEXEC); while (n == -1 && errno == EINTR);
+    int fds[SERVER_FDS];
+    size_t received = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (received < SERVER_FDS) fds[received++] = fd;
+            else close(fd);
+        }
+    }
+
+    char *commands = NULL;
+    int32_t status = 2;
+    if (n != (ssize_t)sizeof(request) || request.magic != SERVER_MAGIC || received != SERVER_FDS ||
+        request.length > SERVER_MAX_REQUEST) {
+        if (n != 0) fprintf(stderr, "JBash: bad request\n"); // nothing at all is another server checking the socket
+        goto done;
+    }
+    commands = safe_malloc(request.length + 1);
+    if (request.length > 0 && read_full(connection, commands, request.length) == -1) {
+        fprintf(stderr, "JBash: short request\n");
+        goto done;
+    }
+
+    // the client's descriptors become the shell's stdio for the length of the request
+    int saved[3];
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+        dup2(fds[i], i);
+    }
+    session_enter(session);
+    if (fchdir(fds[3]) == 0) session_update_cwd(session);
+    else perror("JBash: client directory");
+
+    status = jb_eval(session, commands, request.length);
+    session->exited = 0; // "exit" ends the request, not the server
+    if (xtrace_enabled) xtrace_flush();
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] != -1) {
+            dup2(saved[i], i);
+            close(saved[i]);
+        }
+    }
+
+done:
+    free(commands);
+    for (size_t i = 0; i < received; i++) close(fds[i]);
+    // MSG_NOSIGNAL: a client that went away must not kill the server, and SIGPIPE
+    // stays at its default for the commands the server runs
+    send(connection, &status, sizeof(status), MSG_NOSIGNAL);
+}
+
+/**
+ * @brief "JBash --server": accepts requests until killed
+ * @return Exit status, only on failure to start
+ */
+int server_main(void) {
+    struct sockaddr_un address;
+    if (server_address(&address, 1) == -1) return 2;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        perror("JBash: socket");
+        return 1;
+    }
+    // a socket file nobody accepts on is left over from a server that was killed
+    if (connect(listener, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "JBash: a server is already listening on %s\n", address.sun_path);
+        return 1;
+    }
+    close(listener);
+    unlink(address.sun_path);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    mode_t mask = umask(077); // only this user may send commands
+    int rc = bind(listener, (struct sockaddr *)&address, sizeof(address));
+    umask(mask);
+    if (rc == -1 || listen(listener, SOMAXCONN) == -1) {
+        perror(address.sun_path);
+        return 1;
+    }
+    snapshot_init(); // the warm state survives a restart of the server too
+    if (rc_load() == 0) return session->last_usage.status; // ~/.jbashrc ran exit
+    session->exited = 0;
+    listening_path = strdup(address.sun_path);
+    atexit(server_cleanup);
+    signal(SIGTERM, server_stop);
+
+    while (1) {
+        int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (connection == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("JBash: accept");
+            return 1;
+        }
+        if (!peer_is_user(connection)) { // the socket's mode should keep them out, this does for sure
+            fprintf(stderr, "JBash: refused a connection from another user\n");
+            close(connection);
+            continue;
+        }
+        serve_request(connection);
+        close(connection);
+        snapshot_tick();
+    }
+}
+
+/**
+ * @brief "JBash --client COMMANDS": runs the commands in the server
+ * @param commands Commands, lines separated by newlines
+ * @return The commands' exit status, or -1 when no server of this user is listening
+ */
+int client_main(const char *commands) {
+    struct sockaddr_un address;
+    if (server_address(&address, 0) == -1) return -1;
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection == -1) return -1;
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(connection);
+        return -1;
+    }
+    if (!peer_is_user(connection)) { // nothing is sent to another user's process
+        fprintf(stderr, "JBash: %s is served by another user, running the commands here\n", address.sun_path);
+        close(connection);
+        return -1;
+    }
+
+    size_t length = strlen(commands);
+    if (length > SERVER_MAX_REQUEST) {
+        fprintf(stderr, "JBash: commands too long for the server\n");
+        close(connection);
+        return 2;
+    }
+    struct server_request request = { SERVER_MAGIC, (uint32_t)length };
+    int fds[SERVER_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO,
+                            open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+    if (fds[3] == -1) {
+        perror("JBash: working directory");
+        close(connection);
+        return 2;
+    }
+
+    struct iovec iov = { &request, sizeof(request) };
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message = { 0 };
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&message);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    int32_t status = 2;
+    const char *p = commands;
+    size_t left = length;
+    int ok = sendmsg(connection, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(request);
+    while (ok && left > 0) {
+        ssize_t n = send(connection, p, left, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) ok = 0;
+        else {
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+    if (!ok || read_full(connection, &status, sizeof(status)) == -1) {
+        fprintf(stderr, "JBash: the server closed the connection\n");
+        status = 2;
+    }
+    close(fds[3]);
+    close(connection);
+    return status;
+}
@@ -0,0 +1,257 @@
+/*******************************************************************************
+  @file         session.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file session.c
+ * @brief Shell sessions and the libjbash API
+ *
+ * Everything one shell instance owns (the words and buffer of the command
+ * being run, the working directory, the variables, the functions and the
+ * last command's usage) lives in a struct jb_session, so several sessions
+ * can live in one process. Sessions run one at a time: entering a session makes it the
+ * current one and moves the process into its working directory, which it
+ * keeps as an open descriptor (fchdir is cheaper and safer than a path).
+ *
+ * Instrumentation (history, stats, tracing, profiling, set -x) stays shared
+ * by the whole process.
+ *
+ * Every way of running commands (jb_eval, scripts, sourced files and the
+ * terminal) is a line source that session_run_command() parses one complete
+ * command at a time (parser.c), compiles (compile.c) and runs (vm.c).
+ */
+#include "JBash.h"
+
+struct jb_session *session = NULL;
+uint64_t command_serial = 0; // counts the complete commands session_run_command() has parsed
+
+/**
+  @brief Creates a session in the process's current working directory
+  The first session created becomes the current one.
+  @return The new session, free it with jb_session_free()
+ */
+struct jb_session *jb_session_new(void)
+{
+    struct jb_session *s = safe_malloc(sizeof(struct jb_session));
+    memset(s, 0, sizeof(struct jb_session));
+    s->cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (session == NULL) session = s;
+    return s;
+}
+
+/**
+  @brief Releases a session and everything it owns
+ */
+void jb_session_free(struct jb_session *s)
+{
+    if (s == NULL) return;
+    if (s->args != NULL || s->input != NULL) {
+        struct jb_session *previous = session;
+        session = s;
+        free_args(s->args);
+        session = previous;
+    }
+    arena_free(&s->word_arena);
+    vars_free(s->vars);
+    functions_free(s->functions);
+    patterns_free(s->patterns);
+    if (s->cwd_fd != -1) close(s->cwd_fd);
+    free(s->cwd);
+    if (session == s) session = NULL;
+    free(s);
+}
+
+/**
+  @brief Makes a session the current one and moves the process into its working directory
+ */
+void session_enter(struct jb_session *s)
+{
+    if (session != s) { // call sites may have resolved the other session's functions, expressions its variables
+        commands_changed();
+        var_generation++;
+    }
+    session = s;
+    if (s->cwd_fd != -1 && fchdir(s->cwd_fd) == -1) perror("session");
+}
+
+/**
+  @brief Records a successful chdir in the session: its descriptor, and the path is looked up again when needed
+ */
+void session_update_cwd(struct jb_session *s)
+{
+    int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s->cwd_fd != -1) close(s->cwd_fd);
+    s->cwd_fd = fd;
+    free(s->cwd);
+    s->cwd = NULL;
+}
+
+/**
+  @brief The session's working directory as a path, looked up on first use (the prompt)
+  @param s Session, already entered
+  @return The path, or "?" when it cannot be determined
+ */
+const char *session_cwd(struct jb_session *s)
+{
+    if (s->cwd == NULL) {
+        uint64_t begun = startup_begin();
+        s->cwd = getcwd(NULL, 0);
+        startup_end("cwd (first prompt)", begun);
+    }
+    return s->cwd != NULL ? s->cwd : "?";
+}
+
+/**
+  @brief Parses and runs the next complete command of a line source in the current session
+  The command is compiled to bytecode and run by vm_run(), or with JBASH_INTERP=tree
+  run by the tree walker. A syntax error sets the status to 2 and skips the command.
+  @param s Session, already entered
+  @param source Where the command's lines come from
+  @return 1 to continue, 0 after exit, -1 at the end of the source
+ */
+int session_run_command(struct jb_session *s, struct line_source *source)
+{
+    struct node *command = parse_command(source);
+    command_serial++;
+    if (source->error) {
+        s->last_usage = (struct cmd_usage){ .status = 2 };
+        usage_publish(&s->last_usage);
+        return 1;
+    }
+    if (command == NULL) return -1;
+    if (tree_walker == -1) {
+        const char *engine = getenv("JBASH_INTERP");
+        tree_walker = engine != NULL && strcmp(engine, "tree") == 0;
+    }
+    int rv;
+    if (tree_walker) {
+        rv = run_node(command);
+    } else {
+        if (source->chunk == NULL) source->chunk = chunk_new();
+        compile(source->chunk, command, source->name, 0);
+        rv = vm_run(source->chunk);
+    }
+    node_free(command);
+    s->breaking = s->continuing = s->returning = 0; // a break with no loop left to leave
+    if (rv == 0) s->exited = 1;
+    return rv;
+}
+
+/**
+  @brief Runs every command of a line source in the current session, until it ends or exit runs
+  @return returns 1, to continue execution and 0 after exit.
+ */
+int session_run_source(struct jb_session *s, struct line_source *source)
+{
+    int rv;
+    while ((rv = session_run_command(s, source)) == 1) continue;
+    return rv != 0;
+}
+
+/**
+ * A command buffer being read by jb_eval().
+ */
+struct buffer_reader {
+    const char *buffer;
+    size_t length;
+    size_t start;  // where the next line starts
+};
+
+/**
+  @brief line_source callback of jb_eval(): copies the next line out of the buffer
+ */
+static int buffer_read(struct line_source *source)
+{
+    struct buffer_reader *reader = source->context;
+    if (reader->start >= reader->length) return 0;
+    const char *newline = memchr(&reader->buffer[reader->start], NEWLINE, reader->length - reader->start);
+    size_t end = newline != NULL ? (size_t)(newline - reader->buffer) : reader->length;
+    size_t line_length = end - reader->start;
+    char *line = safe_malloc(line_length + 1);
+    memcpy(line, &reader->buffer[reader->start], line_length);
+    line[line_length] = NULLCHAR;
+    reader->start = end + 1;
+    source->number++;
+    line_source_split(source, line, line_length);
+    return 1;
+}
+
+/**
+  @brief Evaluates a buffer of commands in a session
+  Blank lines and '#' comments are skipped like in scripts, and compound
+  commands may span lines. After "exit" the session runs nothing more and
+  every call returns the exit status.
+  @param s Session
+  @param buffer Commands, lines separated by newlines; need not be null terminated
+  @param length Length of buffer
+  @return Exit status of the last command
+ */
+int jb_eval(struct jb_session *s, const char *buffer, size_t length)
+{
+    if (s->exited) return s->last_usage.status;
+    session_enter(s);
+    struct buffer_reader reader = { buffer, length, 0 };
+    struct line_source source;
+    line_source_init(&source, buffer_read, &reader, NULL);
+    session_run_source(s, &source);
+    line_source_free(&source);
+    return s->last_usage.status;
+}
+
+/**
+  @brief Exit status of the last command the session ran
+ */
+int jb_last_status(const struct jb_session *s)
+{
+    return s->last_usage.status;
+}
+
+/**
+  @brief line_source callback of run_script(): reads the next line of the stream
+ */
+static int file_read(struct line_source *source)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length = getline(&line, &capacity, source->context);
+    if (length == -1) {
+        free(line);
+        return 0;
+    }
+    if (length > 0 && line[length - 1] == NEWLINE) line[--length] = NULLCHAR;
+    source->number++;
+    line_source_split(source, line, (size_t)length);
+    return 1;
+}
+
+/**
+  @brief Sets up a line source reading the lines of a stream
+  @param in Stream, left open when the source is freed
+  @param name Script or file name, NULL for none
+ */
+void line_source_stream(struct line_source *source, FILE *in, const char *name)
+{
+    line_source_init(source, file_read, in, name);
+}
+
+/**
+  @brief Runs commands read from a script or a non-terminal stdin in the current session
+  Blank lines and lines starting with '#' (including a "#!" line) are skipped.
+  Each command is parsed when it is complete and run before the next one is read.
+  With the profiler on, the script and each command's line are profiler frames.
+  @param in Stream to read commands from
+  @param name Script name, used for profiler frames and syntax errors
+  @return Exit status of the last command, like sh
+ */
+int run_script(FILE *in, const char *name)
+{
+    session_enter(session);
+    struct line_source source;
+    line_source_stream(&source, in, name);
+    if (profiling) profile_push(name);
+    session_run_source(session, &source);
+    if (profiling) profile_pop();
+    line_source_free(&source);
+    return session->last_usage.status;
+}
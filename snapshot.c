@@ -0,0 +1,547 @@
+/*******************************************************************************
+  @file         snapshot.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file snapshot.c
+ * @brief Snapshot of the shell's caches for a warm restart
+ *
+ * The command hash table, the history and the prompt segment cache are saved
+ * to one file (JBASH_SNAPSHOT, default ~/.jbash_snapshot) when an interactive
+ * shell or a server exits, and every SNAPSHOT_INTERVAL seconds while it runs,
+ * so a crash loses little. The next shell maps the file and reads from it in
+ * place; nothing is parsed or rebuilt:
+ *   - a command hash miss looks the name up in the file's own hash index,
+ *   - "history" lists the file's entries before the session's own,
+ *   - the prompt shows the file's segment for a directory while its worker runs.
+ *
+ * The file holds no pointers, only offsets from its start, so it works at any
+ * address. Every section is bounds checked when the file is mapped. The
+ * command section is only trusted when PATH hashes to the same value and
+ * every PATH directory still has the mtime it had when the file was written
+ * (a command added or removed changes its directory's mtime).
+ *
+ * Layout: header, PATH directories, commands, command index, history,
+ * segments, then the string pool. All strings are NUL terminated, and so is
+ * the file.
+ */
+#include "JBash.h"
+
+#define SNAPSHOT_MAGIC 0x4a42534eu // "JBSN"
+#define SNAPSHOT_VERSION 1         // bump when any struct below changes
+#define SNAPSHOT_POOL 4096         // first size of the string pool being written
+
+/**
+ * Where a section starts and how many entries it has.
+ */
+struct snapshot_section {
+    uint64_t offset;
+    uint64_t count;
+};
+
+/**
+ * Start of the file.
+ */
+struct snapshot_header {
+    uint32_t magic;                    // SNAPSHOT_MAGIC
+    uint32_t version;                  // SNAPSHOT_VERSION
+    uint64_t size;                     // file size, a truncated file is rejected
+    uint64_t path_hash;                // PATH the commands were found with
+    struct snapshot_section dirs;      // struct snapshot_dir
+    struct snapshot_section commands;  // struct snapshot_command
+    struct snapshot_section index;     // uint32_t slots, power of two: command number + 1, 0 if empty
+    struct snapshot_section history;   // struct snapshot_history, oldest first
+    struct snapshot_section segments;  // struct snapshot_segment
+};
+
+/**
+ * A PATH directory and its mtime when the snapshot was written.
+ */
+struct snapshot_dir {
+    uint64_t path;  // string offset
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+/**
+ * A command hash table entry.
+ */
+struct snapshot_command {
+    uint32_t name;  // string offsets
+    uint32_t path;
+    uint64_t hits;
+};
+
+/**
+ * A history entry, struct cmd_usage spelled out in fixed width fields.
+ */
+struct snapshot_history {
+    uint32_t line;      // string offset
+    int32_t finished;
+    int64_t started;
+    int64_t status;
+    int64_t wall_us;
+    int64_t user_us;
+    int64_t sys_us;
+    int64_t maxrss_kb;
+    int64_t nvcsw;
+    int64_t nivcsw;
+};
+
+/**
+ * A prompt segment cache entry.
+ */
+struct snapshot_segment {
+    uint32_t dir;  // string offsets
+    uint32_t value;
+};
+
+int snapshot_enabled = 0;
+void (*snapshot_front_end)(void) = NULL;
+
+static const char *map = NULL;       // the mapped snapshot, NULL if there is none
+static size_t map_size = 0;
+static int map_tried = 0;            // mapping is attempted once, on first use
+static int commands_valid = -1;      // -1 not checked yet for commands_path_hash
+static uint64_t commands_path_hash;  // PATH hash commands_valid was computed for
+static time_t last_save = 0;
+
+// what snapshot_save() collects before writing
+static struct snapshot_command *new_commands;
+static struct snapshot_history *new_history;
+static struct snapshot_segment *new_segments;
+static size_t command_count, command_capacity, history_count, history_capacity, segment_count, segment_capacity;
+static char *pool;
+static size_t pool_length, pool_capacity;
+
+/**
+ * @brief 64-bit FNV-1a, for PATH and the command index
+ */
+static uint64_t snapshot_hash(const char *s) {
+    uint64_t hash = 14695981039346656037ull;
+    while (*s) hash = (hash ^ (unsigned char)*s++) * 1099511628211ull;
+    return hash;
+}
+
+/**
+ * @brief The snapshot file: JBASH_SNAPSHOT, or ~/.jbash_snapshot
+ * @return The path, or NULL when snapshots are disabled (JBASH_SNAPSHOT is empty or there is no HOME)
+ */
+static const char *snapshot_path(void) {
+    static char path[4096];
+    const char *set = getenv("JBASH_SNAPSHOT");
+    if (set != NULL) return set[0] != NULLCHAR ? set : NULL;
+    const char *home = getenv("HOME");
+    if (home == NULL) return NULL;
+    snprintf(path, sizeof(path), "%s/.jbash_snapshot", home);
+    return path;
+}
+
+/**
+ * @brief Checks that a section lies inside the file
+ */
+static int section_ok(const struct snapshot_section *section, size_t entry_size) {
+    return section->offset % 8 == 0 && section->offset <= map_size &&
+           section->count <= (map_size - section->offset) / entry_size;
+}
+
+/**
+ * @brief A string of the snapshot, "" for an offset outside the file
+ */
+static const char *snapshot_string(uint64_t offset) {
+    return offset < map_size ? &map[offset] : "";
+}
+
+/**
+ * @brief Maps the snapshot the first time it is needed
+ * @return The header, or NULL when there is no usable snapshot
+ */
+static const struct snapshot_header *snapshot_map(void) {
+    if (map_tried || !snapshot_enabled) return (const struct snapshot_header *)map;
+    map_tried = 1;
+    const char *path = snapshot_path();
+    if (path == NULL) return NULL;
+
+    uint64_t begun = startup_begin();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size <= sizeof(struct snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return NULL;
+    map = mapped;
+    map_size = (size_t)st.st_size;
+
+    const struct snapshot_header *header = (const struct snapshot_header *)map;
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->size != map_size ||
+        map[map_size - 1] != NULLCHAR || !section_ok(&header->dirs, sizeof(struct snapshot_dir)) ||
+        !section_ok(&header->commands, sizeof(struct snapshot_command)) ||
+        !section_ok(&header->index, sizeof(uint32_t)) || (header->index.count & (header->index.count - 1)) != 0 ||
+        !section_ok(&header->history, sizeof(struct snapshot_history)) ||
+        !section_ok(&header->segments, sizeof(struct snapshot_segment))) {
+        munmap(mapped, map_size); // another version or a damaged file, it is replaced on the next save
+        map = NULL;
+        map_size = 0;
+        return NULL;
+    }
+    startup_end("snapshot", begun);
+    return header;
+}
+
+/**
+ * @brief Whether the snapshot's commands can be used with this PATH
+ * Cheap checks only: the PATH hash and one stat per PATH directory, done once per PATH value.
+ */
+static int commands_usable(const struct snapshot_header *header, const char *path_var) {
+    uint64_t hash = snapshot_hash(path_var);
+    if (commands_valid != -1 && commands_path_hash == hash) return commands_valid;
+    commands_path_hash = hash;
+    commands_valid = header->path_hash == hash;
+    const struct snapshot_dir *dirs = (const struct snapshot_dir *)&map[header->dirs.offset];
+    for (uint64_t i = 0; commands_valid && i < header->dirs.count; i++) {
+        struct stat st;
+        if (stat(snapshot_string(dirs[i].path), &st) == -1 || st.st_mtim.tv_sec != dirs[i].mtime_sec ||
+            st.st_mtim.tv_nsec != dirs[i].mtime_nsec) {
+            commands_valid = 0;
+        }
+    }
+    return commands_valid;
+}
+
+/**
+ * @brief Looks a command up in the snapshot's hash index
+ * @param name Command name
+ * @param path_var Current value of PATH
+ * @return Where it was found when the snapshot was written, or NULL
+ */
+const char *snapshot_command(const char *name, const char *path_var) {
+    const struct snapshot_header *header = snapshot_map();
+    if (header == NULL || header->index.count == 0 || !commands_usable(header, path_var)) return NULL;
+    const uint32_t *index = (const uint32_t *)&map[header->index.offset];
+    const struct snapshot_command *commands = (const struct snapshot_command *)&map[header->commands.offset];
+    uint64_t mask = header->index.count - 1;
+    for (uint64_t slot = snapshot_hash(name) & mask, probes = 0; probes <= mask; slot = (slot + 1) & mask, probes++) {
+        if (index[slot] == 0 || index[slot] > header->commands.count) return NULL;
+        const struct snapshot_command *c = &commands[index[slot] - 1];
+        if (strcmp(snapshot_string(c->name), name) == 0) return snapshot_string(c->path);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Number of commands in a usable command section
+ */
+size_t snapshot_command_count(const char *path_var) {
+    const struct snapshot_header *header = snapshot_map();
+    return header != NULL && commands_usable(header, path_var) ? header->commands.count : 0;
+}
+
+/**
+ * @brief A command of the snapshot, by position
+ */
+void snapshot_command_at(size_t i, const char **name, const char **path, uint64_t *hits) {
+    const struct snapshot_header *header = (const struct snapshot_header *)map;
+    const struct snapshot_command *c = &((const struct snapshot_command *)&map[header->commands.offset])[i];
+    *name = snapshot_string(c->name);
+    *path = snapshot_string(c->path);
+    *hits = c->hits;
+}
+
+/**
+ * @brief Number of history entries in the snapshot
+ */
+size_t snapshot_history_count(void) {
+    const struct snapshot_header *header = snapshot_map();
+    return header != NULL ? header->history.count : 0;
+}
+
+/**
+ * @brief A history entry of the snapshot, oldest first
+ * @return The command line
+ */
+const char *snapshot_history_at(size_t i, time_t *started, struct cmd_usage *usage, int *finished) {
+    const struct snapshot_header *header = (const struct snapshot_header *)map;
+    const struct snapshot_history *h = &((const struct snapshot_history *)&map[header->history.offset])[i];
+    *started = (time_t)h->started;
+    *finished = h->finished;
+    usage->status = (int)h->status;
+    usage->wall_us = h->wall_us;
+    usage->user_us = h->user_us;
+    usage->sys_us = h->sys_us;
+    usage->maxrss_kb = h->maxrss_kb;
+    usage->nvcsw = h->nvcsw;
+    usage->nivcsw = h->nivcsw;
+    return snapshot_string(h->line);
+}
+
+/**
+ * @brief Number of prompt segments in the snapshot
+ */
+size_t snapshot_segment_count(void) {
+    const struct snapshot_header *header = snapshot_map();
+    return header != NULL ? header->segments.count : 0;
+}
+
+/**
+ * @brief A prompt segment of the snapshot, by position
+ */
+void snapshot_segment_at(size_t i, const char **dir, const char **value) {
+    const struct snapshot_header *header = (const struct snapshot_header *)map;
+    const struct snapshot_segment *s = &((const struct snapshot_segment *)&map[header->segments.offset])[i];
+    *dir = snapshot_string(s->dir);
+    *value = snapshot_string(s->value);
+}
+
+/**
+ * @brief The snapshot's prompt segment for a directory
+ * @return The value, or NULL
+ */
+const char *snapshot_segment(const char *dir) {
+    size_t count = snapshot_segment_count();
+    for (size_t i = 0; i < count; i++) {
+        const char *d, *value;
+        snapshot_segment_at(i, &d, &value);
+        if (strcmp(d, dir) == 0) return value;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Copies a string into the pool being written
+ * @return Its offset within the pool
+ */
+static uint32_t pool_add(const char *s) {
+    size_t length = strlen(s) + 1;
+    while (pool_length + length > pool_capacity) {
+        if (pool_capacity == 0) pool_capacity = SNAPSHOT_POOL / 2; // realloc_buffer doubles it
+        pool = realloc_buffer(pool, &pool_capacity, sizeof(char));
+    }
+    memcpy(&pool[pool_length], s, length);
+    pool_length += length;
+    return (uint32_t)(pool_length - length);
+}
+
+/**
+ * @brief Adds a command hash table entry to the snapshot being saved
+ */
+void snapshot_add_command(const char *name, const char *path, uint64_t hits) {
+    if (command_count == command_capacity) {
+        if (command_capacity == 0) command_capacity = CMD_LINE_BUFFER / 2;
+        new_commands = realloc_buffer(new_commands, &command_capacity, sizeof(struct snapshot_command));
+    }
+    struct snapshot_command *c = &new_commands[command_count++];
+    c->name = pool_add(name);
+    c->path = pool_add(path);
+    c->hits = hits;
+}
+
+/**
+ * @brief Adds a history entry to the snapshot being saved, oldest first
+ */
+void snapshot_add_history(const char *line, time_t started, const struct cmd_usage *usage, int finished) {
+    if (history_count == history_capacity) {
+        if (history_capacity == 0) history_capacity = CMD_LINE_BUFFER / 2;
+        new_history = realloc_buffer(new_history, &history_capacity, sizeof(struct snapshot_history));
+    }
+    struct snapshot_history *h = &new_history[history_count++];
+    memset(h, 0, sizeof(struct snapshot_history));
+    h->line = pool_add(line);
+    h->started = started;
+    h->finished = finished;
+    if (finished) {
+        h->status = usage->status;
+        h->wall_us = usage->wall_us;
+        h->user_us = usage->user_us;
+        h->sys_us = usage->sys_us;
+        h->maxrss_kb = usage->maxrss_kb;
+        h->nvcsw = usage->nvcsw;
+        h->nivcsw = usage->nivcsw;
+    }
+}
+
+/**
+ * @brief Adds a prompt segment to the snapshot being saved
+ */
+void snapshot_add_segment(const char *dir, const char *value) {
+    if (segment_count == segment_capacity) {
+        if (segment_capacity == 0) segment_capacity = CMD_LINE_BUFFER / 2;
+        new_segments = realloc_buffer(new_segments, &segment_capacity, sizeof(struct snapshot_segment));
+    }
+    struct snapshot_segment *s = &new_segments[segment_count++];
+    s->dir = pool_add(dir);
+    s->value = pool_add(value);
+}
+
+/**
+ * @brief Places a section after the previous one, 8-byte aligned
+ */
+static size_t place(struct snapshot_section *section, size_t at, size_t count, size_t entry_size) {
+    at = (at + 7) & ~(size_t)7;
+    section->offset = at;
+    section->count = count;
+    return at + count * entry_size;
+}
+
+/**
+ * @brief Writes the snapshot: collects the caches, lays the file out and replaces the old one atomically
+ * @return 0 on success, 1 when it could not be written (or snapshots are disabled)
+ */
+int snapshot_save(void) {
+    const char *path = snapshot_path();
+    if (path == NULL || !snapshot_enabled) return 1; // scripts must not replace it with their little state
+    snapshot_map(); // the entries of the old file are carried over
+
+    command_count = history_count = segment_count = pool_length = 0;
+    const char *path_var = getenv("PATH");
+    if (path_var == NULL) path_var = "/bin:/usr/bin";
+    hash_snapshot(path_var);
+    history_snapshot();
+    if (snapshot_front_end != NULL) snapshot_front_end();
+
+    // the PATH directories, for the mtime check
+    struct snapshot_dir dirs[256];
+    size_t dir_count = 0;
+    char *path_copy = strdup(path_var);
+    for (char *dir = path_copy != NULL ? strtok(path_copy, ":") : NULL; dir != NULL && dir_count < 256;
+         dir = strtok(NULL, ":")) {
+        struct stat st;
+        if (dir[0] != '/' || stat(dir, &st) == -1) continue; // relative entries are never hashed
+        dirs[dir_count].path = pool_add(dir);
+        dirs[dir_count].mtime_sec = st.st_mtim.tv_sec;
+        dirs[dir_count].mtime_nsec = st.st_mtim.tv_nsec;
+        dir_count++;
+    }
+    free(path_copy);
+
+    size_t slots = 2;
+    while (slots < command_count * 2) slots *= 2; // at most half full
+    struct snapshot_header header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, snapshot_hash(path_var),
+                                      { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+    size_t at = sizeof(header);
+    at = place(&header.dirs, at, dir_count, sizeof(struct snapshot_dir));
+    at = place(&header.commands, at, command_count, sizeof(struct snapshot_command));
+    at = place(&header.index, at, slots, sizeof(uint32_t));
+    at = place(&header.history, at, history_count, sizeof(struct snapshot_history));
+    at = place(&header.segments, at, segment_count, sizeof(struct snapshot_segment));
+    size_t strings = (at + 7) & ~(size_t)7;
+    header.size = strings + pool_length + 1; // the final NUL ends every string
+
+    char *file = safe_malloc(header.size);
+    memset(file, 0, header.size);
+    // string offsets were relative to the pool, make them relative to the file
+    for (size_t i = 0; i < dir_count; i++) dirs[i].path += strings;
+    for (size_t i = 0; i < command_count; i++) {
+        new_commands[i].name += (uint32_t)strings;
+        new_commands[i].path += (uint32_t)strings;
+    }
+    for (size_t i = 0; i < history_count; i++) new_history[i].line += (uint32_t)strings;
+    for (size_t i = 0; i < segment_count; i++) {
+        new_segments[i].dir += (uint32_t)strings;
+        new_segments[i].value += (uint32_t)strings;
+    }
+    memcpy(file, &header, sizeof(header));
+    if (dir_count > 0) memcpy(&file[header.dirs.offset], dirs, dir_count * sizeof(struct snapshot_dir));
+    if (command_count > 0) {
+        memcpy(&file[header.commands.offset], new_commands, command_count * sizeof(struct snapshot_command));
+    }
+    uint32_t *index = (uint32_t *)&file[header.index.offset];
+    for (size_t i = 0; i < command_count; i++) {
+        size_t slot = snapshot_hash(&pool[new_commands[i].name - strings]) & (slots - 1);
+        while (index[slot] != 0) slot = (slot + 1) & (slots - 1);
+        index[slot] = (uint32_t)(i + 1);
+    }
+    if (history_count > 0) {
+        memcpy(&file[header.history.offset], new_history, history_count * sizeof(struct snapshot_history));
+    }
+    if (segment_count > 0) {
+        memcpy(&file[header.segments.offset], new_segments, segment_count * sizeof(struct snapshot_segment));
+    }
+    if (pool_length > 0) memcpy(&file[strings], pool, pool_length);
+
+    // write next to it and rename, so a crash never leaves half a file behind
+    char temporary[strlen(path) + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int ok = fd != -1;
+    for (size_t written = 0; ok && written < header.size; ) {
+        ssize_t n = write(fd, &file[written], header.size - written);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) ok = 0;
+        else written += (size_t)n;
+    }
+    if (fd != -1 && close(fd) == -1) ok = 0;
+    if (ok && rename(temporary, path) == -1) ok = 0;
+    if (!ok) unlink(temporary);
+    free(file);
+    last_save = time(NULL);
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Saves the snapshot when the last save is more than SNAPSHOT_INTERVAL seconds old
+ * Called after every command of an interactive shell or server.
+ */
+void snapshot_tick(void) {
+    if (!snapshot_enabled) return;
+    time_t now = time(NULL);
+    if (last_save == 0) last_save = now; // the first save is due one interval after startup
+    else if (now - last_save >= SNAPSHOT_INTERVAL) snapshot_save();
+}
+
+/**
+ * @brief atexit handler of shells that keep a snapshot
+ */
+static void snapshot_save_at_exit(void) {
+    snapshot_save();
+}
+
+/**
+ * @brief Turns snapshots on for an interactive shell or a server: saved at exit and periodically
+ * Nothing is read until a cache needs it.
+ */
+void snapshot_init(void) {
+    if (snapshot_path() == NULL) return;
+    snapshot_enabled = 1;
+    atexit(snapshot_save_at_exit);
+}
+
+/**
+ * @brief The snapshot builtin
+ *   snapshot        shows the file and what it holds
+ *   snapshot save   writes it now
+ * @return 0 on success, 1 when it could not be written or read, 2 on bad usage
+ */
+int snapshot_builtin(char **args) {
+    if (!snapshot_enabled) {
+        fprintf(stderr, "snapshot: only interactive shells and servers keep a snapshot\n");
+        return 1;
+    }
+    if (args[1] != NULL && strcmp(args[1], "save") == 0) {
+        if (snapshot_save() != 0) {
+            fprintf(stderr, "snapshot: could not write %s\n", snapshot_path());
+            return 1;
+        }
+        return 0;
+    }
+    if (args[1] != NULL) {
+        fprintf(stderr, "usage: snapshot [save]\n");
+        return 2;
+    }
+    const struct snapshot_header *header = snapshot_map();
+    if (header == NULL) {
+        printf("snapshot: none loaded from %s\n", snapshot_path());
+        return 1;
+    }
+    const char *path_var = getenv("PATH");
+    printf("file      %s (%zu bytes)\n", snapshot_path(), map_size);
+    printf("commands  %llu (%s)\n", (unsigned long long)header->commands.count,
+           commands_usable(header, path_var != NULL ? path_var : "/bin:/usr/bin") ? "valid" : "stale, PATH or one of its directories changed");
+    printf("history   %llu\n", (unsigned long long)header->history.count);
+    printf("segments  %llu\n", (unsigned long long)header->segments.count);
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+  @file         startup.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file startup.c
+ * @brief Startup timeline for --startup-trace
+ *
+ * Subsystems initialize themselves on first use (the spawn latency page on the
+ * first fork, the working directory string on the first prompt, the command
+ * hash table on the first PATH lookup, and so on), so startup only does what
+ * the first command needs. With "JBash --startup-trace" every init step
+ * prints one line to stderr as it finishes:
+ *   startup <TAB> ms since main() <TAB> ms the step took <TAB> step
+ * Lazy steps show up where they really happen, after the first prompt or
+ * the first command.
+ */
+#include "JBash.h"
+
+int startup_tracing = 0;
+static uint64_t startup_ns; // when main() started
+
+/**
+ * @brief Turns the timeline on, called first thing in main()
+ */
+void startup_trace_init(void) {
+    startup_ns = monotonic_ns();
+    startup_tracing = 1;
+}
+
+/**
+ * @brief Starts timing an init step
+ * @return Token for startup_end(), 0 when the timeline is off
+ */
+uint64_t startup_begin(void) {
+    return startup_tracing ? monotonic_ns() : 0;
+}
+
+/**
+ * @brief Prints a finished init step
+ * @param step What was initialized
+ * @param begun What startup_begin() returned
+ */
+void startup_end(const char *step, uint64_t begun) {
+    if (!startup_tracing) return;
+    uint64_t now = monotonic_ns();
+    fprintf(stderr, "startup\t%8.3f\t%8.3f\t%s\n", (now - startup_ns) / 1e6,
+            begun != 0 ? (now - begun) / 1e6 : 0.0, step);
+}
+
+/**
+ * @brief Prints a point on the timeline, such as the first prompt
+ */
+void startup_mark(const char *step) {
+    if (startup_tracing) startup_end(step, startup_ns);
+}
@@ -0,0 +1,236 @@
+/*******************************************************************************
+  @file         stats.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file stats.c
+ * @brief Latency histograms and the stats builtin
+ *
+ * Histograms are HDR style: values (nanoseconds) land in log-linear buckets,
+ * HIST_SUB_BUCKETS per power of two, so every recorded value is known to
+ * within about 6% whatever its magnitude. Recording is an index computation
+ * and an increment, cheap enough to leave on permanently.
+ *
+ * Spawn latency is the time from fork() in the shell to the child calling
+ * execvp. The child stores its timestamp in a shared page before exec, and the
+ * shell reads it back when it reaps the child, so measuring it costs no
+ * system calls.
+ */
+#include "JBash.h"
+
+struct histogram spawn_histogram = { .name = "spawn" };
+struct histogram keystroke_histogram = { .name = "keystroke" };
+struct editor_totals editor_totals; // filled in by the line editor (editor.c)
+
+/**
+ * Command wall time histograms, one per command name, in an open addressing table.
+ */
+static struct histogram *command_histograms[STATS_COMMANDS];
+static struct histogram other_commands = { .name = "(other)" }; // used once the table is full
+static size_t command_count = 0;
+
+static uint64_t *spawn_stamps = MAP_FAILED; // shared with children, one slot per pipeline stage
+
+/**
+ * @brief Nanoseconds on the monotonic clock, comparable between the shell and its children
+ */
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Bucket index for a value
+ * Values below 2 * HIST_SUB_BUCKETS get a bucket each; above that the top
+ * HIST_SUB_BITS + 1 bits select the bucket and the rest are dropped.
+ */
+static size_t hist_index(uint64_t value) {
+    if (value < 2 * HIST_SUB_BUCKETS) return (size_t)value;
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (size_t)shift * HIST_SUB_BUCKETS + (size_t)(value >> shift);
+}
+
+/**
+ * @brief Highest value that lands in a bucket
+ */
+static uint64_t hist_bucket_top(size_t index) {
+    if (index < 2 * HIST_SUB_BUCKETS) return index;
+    size_t shift = index / HIST_SUB_BUCKETS - 1;
+    uint64_t mantissa = index - shift * HIST_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * @brief Records one value
+ * @param h Histogram to record into
+ * @param value Value in nanoseconds
+ */
+void hist_record(struct histogram *h, uint64_t value) {
+    h->counts[hist_index(value)]++;
+    if (h->count == 0 || value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+    h->count++;
+    h->sum += value;
+}
+
+/**
+ * @brief Value below which the given fraction of recorded values fall
+ * @param h Histogram to query
+ * @param fraction Between 0 and 1, e.g. 0.99 for p99
+ * @return The bucket's highest value, clamped to the largest value recorded
+ */
+static uint64_t hist_percentile(const struct histogram *h, double fraction) {
+    if (h->count == 0) return 0;
+    uint64_t wanted = (uint64_t)(fraction * (double)h->count + 0.5);
+    if (wanted == 0) wanted = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= wanted) {
+            uint64_t top = hist_bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Clears a histogram, keeping its name
+ */
+static void hist_reset(struct histogram *h) {
+    const char *name = h->name;
+    memset(h, 0, sizeof(*h));
+    h->name = name;
+}
+
+/**
+ * @brief Records the wall time of a command under its name
+ * @param name Command name as typed (directories are stripped)
+ * @param ns Wall time in nanoseconds
+ */
+void stats_record_command(const char *name, uint64_t ns) {
+    const char *slash = strrchr(name, '/');
+    if (slash != NULL && slash[1] != NULLCHAR) name = slash + 1;
+
+    unsigned long hash = 5381;
+    for (const char *p = name; *p; p++) hash = hash * 33 + (unsigned char)*p;
+    for (size_t probe = 0; probe < STATS_COMMANDS; probe++) {
+        struct histogram **slot = &command_histograms[(hash + probe) % STATS_COMMANDS];
+        if (*slot == NULL) {
+            if (command_count >= STATS_COMMANDS * 3 / 4) break; // keep probes short
+            *slot = calloc(1, sizeof(struct histogram));
+            if (*slot == NULL) break;
+            (*slot)->name = strdup(name);
+            command_count++;
+        }
+        if (strcmp((*slot)->name, name) == 0) {
+            hist_record(*slot, ns);
+            return;
+        }
+    }
+    hist_record(&other_commands, ns);
+}
+
+/**
+ * @brief Maps the page children write their exec timestamps to
+ * Called on the first fork; without it spawn latency is simply not recorded.
+ */
+void stats_init(void) {
+    if (spawn_stamps != MAP_FAILED) return; // already mapped
+    uint64_t begun = startup_begin();
+    spawn_stamps = mmap(NULL, STATS_SPAWN_SLOTS * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    startup_end("stats (first fork)", begun);
+}
+
+/**
+ * @brief Clears a stage's slot before forking it, mapping the shared page the first time
+ */
+void stats_spawn_begin(size_t stage) {
+    if (spawn_stamps == MAP_FAILED) stats_init();
+    if (spawn_stamps != MAP_FAILED) spawn_stamps[stage % STATS_SPAWN_SLOTS] = 0;
+}
+
+/**
+ * @brief Called in the child right before execvp, stores the exec start time
+ */
+void stats_spawn_exec(size_t stage) {
+    if (spawn_stamps != MAP_FAILED) spawn_stamps[stage % STATS_SPAWN_SLOTS] = monotonic_ns();
+}
+
+/**
+ * @brief Called by the shell after reaping a stage, records fork to exec latency
+ * @param stage Stage index used for stats_spawn_begin()
+ * @param forked_ns monotonic_ns() taken just before fork()
+ * @return When the child reached exec, or 0 if it never did
+ */
+uint64_t stats_spawn_end(size_t stage, uint64_t forked_ns) {
+    if (spawn_stamps == MAP_FAILED) return 0;
+    uint64_t exec_ns = spawn_stamps[stage % STATS_SPAWN_SLOTS];
+    if (exec_ns < forked_ns) return 0; // never reached exec
+    hist_record(&spawn_histogram, exec_ns - forked_ns);
+    return exec_ns;
+}
+
+/**
+ * @brief Prints one histogram as a table row, times in microseconds
+ */
+static void print_histogram(const struct histogram *h) {
+    if (h->count == 0) return;
+    printf("%-16s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", h->name,
+           (unsigned long long)h->count, h->min / 1e3, (double)h->sum / (double)h->count / 1e3,
+           hist_percentile(h, 0.50) / 1e3, hist_percentile(h, 0.90) / 1e3,
+           hist_percentile(h, 0.99) / 1e3, hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+/**
+ * @brief Prints the line editor's totals, when it has read anything
+ */
+static void editor_totals_print(void) {
+    const struct editor_totals *t = &editor_totals;
+    if (t->batches == 0 || t->keys == 0) return;
+    printf("editor: batches %llu, bytes read %llu, bytes rendered %llu (%.1f/key), writes %llu (%.2f/key)\n",
+           (unsigned long long)t->batches, (unsigned long long)t->keys,
+           (unsigned long long)t->render_bytes, (double)t->render_bytes / (double)t->keys,
+           (unsigned long long)t->writes, (double)t->writes / (double)t->keys);
+}
+
+/**
+ * @brief The stats builtin
+ * "stats" prints count, min, mean, p50, p90, p99, p99.9 and max (microseconds) of
+ * spawn latency, keystroke-to-render latency (per input batch) and each command's
+ * wall time, followed by the line editor's byte and write counts.
+ * "stats reset" clears every histogram.
+ *
+ * @param args Null terminated list of arguments, args[0] is "stats"
+ * @return 0 on success, 1 on bad usage
+ */
+int stats_builtin(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "reset") == 0) {
+        hist_reset(&spawn_histogram);
+        hist_reset(&keystroke_histogram);
+        hist_reset(&other_commands);
+        memset(&editor_totals, 0, sizeof(editor_totals));
+        for (size_t i = 0; i < STATS_COMMANDS; i++) {
+            if (command_histograms[i] != NULL) hist_reset(command_histograms[i]);
+        }
+        return 0;
+    }
+    if (args[1] != NULL) {
+        fprintf(stderr, "stats: usage: stats [reset]\n");
+        return 1;
+    }
+
+    printf("%-16s %8s %10s %10s %10s %10s %10s %10s %10s\n",
+           "histogram (us)", "count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+    print_histogram(&spawn_histogram);
+    print_histogram(&keystroke_histogram);
+    for (size_t i = 0; i < STATS_COMMANDS; i++) {
+        if (command_histograms[i] != NULL) print_histogram(command_histograms[i]);
+    }
+    print_histogram(&other_commands);
+    editor_totals_print();
+    return 0;
+}
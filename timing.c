@@ -0,0 +1,119 @@
+/*******************************************************************************
+  @file         timing.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file timing.c
+ * @brief Report of the time keyword
+ *
+ * "time list" runs the command list and then prints its wall time (measured
+ * with CLOCK_MONOTONIC) together with the usage of every pipeline stage as
+ * returned by wait4. "time -j list" prints the same report as JSON.
+ */
+#include "JBash.h"
+
+/**
+ * @brief Appends the usage of one stage to the report
+ * @param report Report being collected
+ * @param argv Null terminated words of the stage, joined into the report's command text
+ * @param pipeline 1-based index of the pipeline within the command list
+ * @param stage 1-based position within the pipeline
+ * @param usage What the stage cost
+ */
+void time_report_add(struct time_report *report, char **argv, int pipeline, int stage, const struct cmd_usage *usage) {
+    if (report->count == report->capacity) {
+        // arena memory cannot be resized, so move to a fresh, larger array
+        size_t capacity = report->capacity ? report->capacity * 2 : 8;
+        struct stage_usage *stages = arena_alloc(&session->word_arena, capacity * sizeof(struct stage_usage));
+        if (report->count > 0) memcpy(stages, report->stages, report->count * sizeof(struct stage_usage));
+        report->stages = stages;
+        report->capacity = capacity;
+    }
+
+    size_t length = 0;
+    for (size_t i = 0; argv[i] != NULL; i++) length += strlen(argv[i]) + 1;
+    char *command = arena_alloc(&session->word_arena, length + 1);
+    command[0] = NULLCHAR;
+    for (size_t i = 0, at = 0; argv[i] != NULL; i++) {
+        at += (size_t)sprintf(&command[at], i ? " %s" : "%s", argv[i]);
+    }
+
+    struct stage_usage *entry = &report->stages[report->count++];
+    entry->command = command;
+    entry->pipeline = pipeline;
+    entry->stage = stage;
+    entry->usage = *usage;
+}
+
+/**
+ * @brief Prints a string as a JSON string literal
+ */
+static void print_json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Prints the usage fields shared by the totals and each stage as JSON members
+ */
+static void print_json_usage(FILE *out, const struct cmd_usage *usage) {
+    fprintf(out, "\"status\":%d,\"wall_us\":%lld,\"user_us\":%lld,\"sys_us\":%lld,"
+                 "\"maxrss_kb\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld",
+            usage->status, usage->wall_us, usage->user_us, usage->sys_us,
+            usage->maxrss_kb, usage->nvcsw, usage->nivcsw);
+}
+
+/**
+ * @brief qsort comparator putting stages in command list order (they are added as they finish)
+ */
+static int compare_stages(const void *a, const void *b) {
+    const struct stage_usage *x = a, *y = b;
+    if (x->pipeline != y->pipeline) return x->pipeline - y->pipeline;
+    return x->stage - y->stage;
+}
+
+/**
+ * @brief Prints the report to stderr, so it never mixes into a pipeline's output
+ * @param report Per stage usage collected while the list ran
+ * @param total Usage of the whole list
+ * @param json Non-zero for JSON, otherwise a human readable table
+ */
+void time_report_print(const struct time_report *report, const struct cmd_usage *total, int json) {
+    if (report->count > 1) qsort(report->stages, report->count, sizeof(struct stage_usage), compare_stages);
+    if (json) {
+        fprintf(stderr, "{");
+        print_json_usage(stderr, total);
+        fprintf(stderr, ",\"stages\":[");
+        for (size_t i = 0; i < report->count; i++) {
+            const struct stage_usage *s = &report->stages[i];
+            fprintf(stderr, "%s{\"pipeline\":%d,\"stage\":%d,\"command\":", i ? "," : "", s->pipeline, s->stage);
+            print_json_string(stderr, s->command);
+            fprintf(stderr, ",");
+            print_json_usage(stderr, &s->usage);
+            fprintf(stderr, "}");
+        }
+        fprintf(stderr, "]}\n");
+        return;
+    }
+
+    fprintf(stderr, "\nreal %.6fs  user %.6fs  sys %.6fs  maxrss %ldkB  csw %ld/%ld\n",
+            total->wall_us / 1e6, total->user_us / 1e6, total->sys_us / 1e6,
+            total->maxrss_kb, total->nvcsw, total->nivcsw);
+    if (report->count == 0) return;
+    fprintf(stderr, "%7s %6s %10s %10s %10s %10s %7s %7s  %s\n",
+            "stage", "status", "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "command");
+    for (size_t i = 0; i < report->count; i++) {
+        const struct stage_usage *s = &report->stages[i];
+        char label[16];
+        snprintf(label, sizeof(label), "%d.%d", s->pipeline, s->stage);
+        fprintf(stderr, "%7s %6d %9.6fs %9.6fs %9.6fs %8ldkB %7ld %7ld  %s\n",
+                label, s->usage.status, s->usage.wall_us / 1e6, s->usage.user_us / 1e6,
+                s->usage.sys_us / 1e6, s->usage.maxrss_kb, s->usage.nvcsw, s->usage.nivcsw, s->command);
+    }
+}
@@ -0,0 +1,349 @@
+/*******************************************************************************
+  @file         tokenize.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file tokenize.c
+ * @brief Splitting a command line into words, and the buffer helpers it uses
+ *
+ * Words are separated by blanks; single and double quotes keep blanks inside
+ * a word, and so do the parentheses of "(( ))" and "$(( ))". Unquoted operators become the OP_* words so a quoted "|" stays an
+ * ordinary argument, everything else goes through expand_word(). Splitting
+ * (split_words) and making arguments (make_word) are separate steps so the
+ * parse cache (rc.c) can store split words and skip the first one.
+ */
+#include "JBash.h"
+
+// Operator words; tokenize() hands out these exact pointers so a quoted "|" stays an ordinary word
+char OP_PIPE[] = "|";
+char OP_SEMI[] = ";";
+char OP_AND[] = "&&";
+char OP_OR[] = "||";
+
+/**
+  @brief Checks whether a word is one of the operator words handed out by make_word()
+ */
+int is_operator(const char *word)
+{
+    return word == OP_PIPE || word == OP_SEMI || word == OP_AND || word == OP_OR;
+}
+
+/**
+  @brief The operator a split word stands for
+  @param word Null terminated word
+  @param quote The quote character the word was enclosed in, or 0
+  @return OP_PIPE, OP_SEMI, OP_AND or OP_OR for an unquoted operator, NULL for any other word
+ */
+char *word_operator(const char *word, char quote)
+{
+    if (quote != 0) return NULL;
+    if (strcmp(word, "|") == 0) return OP_PIPE;
+    if (strcmp(word, ";") == 0) return OP_SEMI;
+    if (strcmp(word, "&&") == 0) return OP_AND;
+    if (strcmp(word, "||") == 0) return OP_OR;
+    return NULL;
+}
+
+/**
+  @brief Turns a split word into an argument
+  Unquoted operators become the OP_* words, everything else goes through expansion.
+  @param word The word, with its quote character and compiled arithmetic
+  @return The word to store in args, NULL after an expansion error
+ */
+char *make_word(const struct word *word)
+{
+    char *op = word_operator(word->text, word->quote);
+    return op != NULL ? op : expand_word(word->text, word->quote, word->arith);
+}
+
+/**
+  @brief Turns the words of a command into its arguments
+  A word that is "${NAME[@]}" alone becomes one argument per element, and
+  those arguments point at the elements themselves (see argv_owned()).
+  NAME=(...) words in front of a command or pipeline stage are assigned
+  here and leave no argument behind.
+  @param words Words as parsed, not expanded
+  @param count Number of words
+  @param assignments Non-zero for a command, zero for other word lists (for loop values)
+  @param argc Set to the number of arguments, or NULL
+  @return Null terminated arguments, in word_arena; NULL after an expansion error, which is reported
+ */
+char **make_argv(const struct word *words, size_t count, int assignments, size_t *argc)
+{
+    size_t capacity = count + 1, n = 0;
+    char **argv = arena_alloc(&session->word_arena, capacity * sizeof(char *));
+    int prefix = assignments; // still in front of the command's name
+    session->argv_borrows = 0;
+    for (size_t k = 0; k < count; k++) {
+        const struct word *w = &words[k];
+        if (prefix && is_array_list(w)) {
+            if (xtrace_enabled) {
+                char *trace[] = { w->text, NULL };
+                xtrace_command(trace);
+            }
+            array_assign_word(w);
+            continue;
+        }
+        size_t fields = array_fields(w->text, w->quote, NULL);
+        if (fields == ARRAY_NOT_FIELDS) {
+            argv[n] = make_word(w);
+            if (argv[n] == NULL) return NULL; // the command does not run
+            if (argv[n] == OP_PIPE) prefix = assignments;
+            else if (var_assignment(argv[n]) == 0) prefix = 0;
+            n++;
+            continue;
+        }
+        if (n + fields + (count - k) > capacity) { // the rest of the words still need a slot each
+            capacity = n + fields + (count - k);
+            char **grown = arena_alloc(&session->word_arena, capacity * sizeof(char *));
+            memcpy(grown, argv, n * sizeof(char *));
+            argv = grown;
+        }
+        array_fields(w->text, w->quote, &argv[n]);
+        n += fields;
+        if (fields > 0) session->argv_borrows = 1;
+        prefix = 0;
+    }
+    argv[n] = NULL;
+    if (argc != NULL) *argc = n;
+    return argv;
+}
+
+/**
+  @brief Copies arguments that make_argv() pointed at array elements into word_arena
+  For functions and builtins that may assign an array while its elements are their arguments.
+  @return argv itself when none of them points into an array
+ */
+char **argv_owned(char **argv)
+{
+    if (!session->argv_borrows) return argv;
+    session->argv_borrows = 0;
+    size_t count = 0;
+    while (argv[count] != NULL) count++;
+    char **owned = arena_alloc(&session->word_arena, (count + 1) * sizeof(char *));
+    for (size_t k = 0; k < count; k++) {
+        size_t length = strlen(argv[k]) + 1;
+        owned[k] = memcpy(arena_alloc(&session->word_arena, length), argv[k], length);
+    }
+    owned[count] = NULL;
+    return owned;
+}
+
+/**
+  @brief Whether a '(' opens the list of a NAME=(...) or NAME+=(...) word
+  @param word_start Start of the word the '(' is in
+  @param paren The '('
+ */
+static int is_list_start(const char *word_start, const char *paren)
+{
+    size_t length = var_name_length(word_start);
+    if (length == 0) return 0;
+    const char *equals = &word_start[length] + (word_start[length] == '+');
+    return *equals == '=' && equals + 1 == paren;
+}
+
+/**
+  @brief Splits a command line into words in place, without expanding them
+  Leading whitespace must already be removed (see realloc_leftover_string).
+  @param inputString The command line, words are null terminated inside it
+  @param string_length Length of the command line
+  @param emit Called with every word and the quote character it was enclosed in (or 0), in order
+  @param context Passed on to emit
+ */
+void split_words(char *inputString, size_t string_length, void (*emit)(char *word, char quote, void *context),
+                 void *context)
+{
+    int extra_whitespace = 0; // keep track of extra whitespace
+    int unbalanced = 0; // an unclosed "$((" or "NAME=(" ran to the end of the line, later ones are not looked at again
+    char *word_start = inputString;  // Track start of current word
+    for (size_t i = 0; i < string_length; i++) { // go through the entire buffer
+        if (i != 0 && (inputString[i] == '"' || inputString[i] == '\'')) { // Check for quotes to include whitespaces
+            char quote = inputString[i];                                   // Note which delimiter we track
+            i++;
+            word_start = &inputString[i];                                  // Ignore beginning quote
+            while (i < string_length && inputString[i] != quote) i++;      // Keep adding until closing quote
+            inputString[i] = NULLCHAR;                                     // Null terminate word excluding end quote
+            emit(word_start, quote, context);                              // Add to args, expanding unless single quoted
+            if (i == string_length) {                                      // Unbalanced quote ran to the end of the line
+                word_start = &inputString[i];                              // Nothing left, don't step past the terminator
+                break;
+            }
+            while (i + 1 < string_length && IS_BLANK(inputString[i + 1])) i++; // Blanks after the quote end no word
+            word_start = &inputString[i + 1];                              // Start of next word
+            extra_whitespace = 0;
+
+        } else if (!unbalanced && inputString[i] == '(' && i + 1 < string_length && inputString[i + 1] == '(' &&
+                   (&inputString[i] == word_start || inputString[i - 1] == '$')) { // "(( ))" and "$(( ))" keep their blanks
+            int depth = 0;
+            size_t j = i;
+            for (; j < string_length; j++) {
+                if (inputString[j] == '(') depth++;
+                else if (inputString[j] == ')' && --depth == 0) break;
+            }
+            if (j == string_length) unbalanced = 1; // scanning again from every later "$((" would be quadratic
+            else if (inputString[j - 1] == ')') i = j; // the loop goes on after the closing "))"
+
+        } else if (!unbalanced && inputString[i] == '(' && is_list_start(word_start, &inputString[i])) { // NAME=(...) keeps its blanks
+            char quote = 0;
+            int depth = 0;
+            size_t j = i;
+            for (; j < string_length; j++) {
+                if (quote != 0) {
+                    if (inputString[j] == quote) quote = 0;
+                } else if (inputString[j] == '"' || inputString[j] == '\'') {
+                    quote = inputString[j];
+                } else if (inputString[j] == '(') {
+                    depth++;
+                } else if (inputString[j] == ')' && --depth == 0) {
+                    break;
+                }
+            }
+            if (j == string_length) unbalanced = 1;
+            else i = j;
+
+        } else if (IS_BLANK(inputString[i]) && !IS_BLANK(inputString[i + 1])) { // End of word
+            inputString[i - extra_whitespace] = NULLCHAR;                  // Null terminate word accounting for multiple whitespace
+            emit(word_start, 0, context);                                  // Add token to args
+            word_start = &inputString[i + 1];                              // Start of next word
+            extra_whitespace = 0;                                          // Reset whitespace count
+
+        } else if (IS_BLANK(inputString[i]) && IS_BLANK(inputString[i + 1])) { // Extra whitespace check
+            extra_whitespace++;
+        }
+    }
+
+    // Add final word if exists
+    if (word_start[0] != NULLCHAR) {
+        emit(word_start, 0, context);
+    }
+}
+
+/**
+ * The args array tokenize() is filling.
+ */
+struct word_list {
+    char **args;
+    size_t length;    // words so far
+    size_t capacity;  // slots allocated, one is kept for the terminating NULL
+};
+
+/**
+  @brief split_words() callback of tokenize(): expands the word and appends it
+ */
+static void append_word(char *word, char quote, void *context)
+{
+    struct word_list *list = context;
+    // buffer check, check if array length is close to buffer size
+    if (list->length + 1 >= list->capacity) {
+        list->args = realloc_buffer(list->args, &list->capacity, sizeof(char *));
+    }
+    struct word split = { word, quote, NULL };
+    char *arg = make_word(&split);
+    list->args[list->length++] = arg != NULL ? arg : ""; // the error is reported, the word is left empty
+}
+
+/**
+  @brief Splits the session's command line into tokens in place. Prepares the arguments for execvp
+  Leading whitespace must already be removed (see realloc_leftover_string).
+  @param string_length Length of the command line
+  @return returns char** args to be used by execvp
+ */
+char** tokenize(size_t string_length)
+{
+    TRACE_BEGIN("tokenize");
+    // Starting buffer size
+    struct word_list list = { NULL, 0, CMD_LINE_BUFFER };
+    // allocate array of tokens to heap, zeroed like parse() does for the string
+    list.args = safe_malloc(sizeof(char *) * list.capacity);
+    memset(list.args, 0, sizeof(char *) * list.capacity);
+    split_words(session->input, string_length, append_word, &list); // the command line, split in place
+    list.args[list.length] = NULL;  // Null terminate args array
+    TRACE_END("tokenize");
+
+    return list.args;
+}
+
+/**
+ * Frees memory allocated for command line arguments.
+ * 
+ * @param args Double pointer to array of command line argument strings to be freed
+ *             The strings point into inputString or the word arena, both are released
+ *             Array must be NULL terminated
+ *             
+ * @note Assumes args is a valid pointer to a NULL-terminated array of strings
+ */
+void free_args(char **args)
+{
+    // Free the original Command Line buffer, args[0] may now be an expanded word
+    if (session->input != NULL) free(session->input);
+    session->input = NULL;
+    // Expanded words live in the arena
+    arena_reset(&session->word_arena);
+    // Free the cmd array
+    if (args != NULL) free(args);
+}
+
+
+/**
+ * Reallocates the current buffer memory with error checking.
+ * 
+ * @param ptr The pointer buffer to resize
+ * @param current_buffer The current size of the buffer, in elements
+ * @param element_size Size of one element (sizeof(char) for strings, sizeof(char *) for args)
+ * @note Exits with status 1 if memory reallocation fails
+ */
+void* realloc_buffer(void *ptr, size_t *current_buffer, size_t element_size) {
+    *current_buffer *= 2;
+    char *new_ptr = realloc(ptr, element_size * *current_buffer); // increase
+    if (new_ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed for size %zu\n", *current_buffer);
+        free(ptr); // Free original buffer if realloc fails
+        exit(EXIT_FAILURE);
+    }
+    return new_ptr;
+}
+
+/**
+ * Reallocates the string with with error checking.
+ * 
+ * @param inputString The inputString buffer to resize
+ * @param string_length The length of the current string
+ * @note Exits with status 1 if memory reallocation fails
+ */
+void* realloc_leftover_string(char *inputString, size_t *string_length) {
+    size_t i = 0;
+    while (IS_BLANK(inputString[i])) { // count preceding whitespaces
+        i++;
+    }
+    // shift left by the amount of whitespaces, removing them.
+    if (i != 0) {
+        memmove(inputString, inputString + i, *string_length - i + 1); // + 1 to account for null char
+        *string_length -= i;
+    }
+
+    // realloc and reduce size to length of string
+    char *resized_string = realloc(inputString, sizeof(char) * (*string_length + 1)); // manage unused memory
+    if (resized_string == NULL) {
+        fprintf(stderr, "Memory allocation failed for size %zu\n", *string_length + 1);
+        free(inputString); // Free original buffer if realloc fails
+        exit(EXIT_FAILURE);
+    }
+    return resized_string;
+}
+
+/**
+ * Allocate SIZE bytes of memory with error checking.
+ * 
+ * @param size The number of bytes to allocate
+ * @return A generic pointer to the allocated memory if successful
+ * @note Exits with status 1 if memory allocation fails
+ */
+void* safe_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed for size %zu\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
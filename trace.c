@@ -0,0 +1,186 @@
+/*******************************************************************************
+  @file         trace.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file trace.c
+ * @brief Event tracing of shell internals in Chrome trace format
+ *
+ * When tracing is on, TRACE_BEGIN/TRACE_END record timestamped events for
+ * parsing, tokenizing, expansion, PATH lookup, fork, exec, wait and rendering.
+ * Each thread writes to its own ring buffer, so recording takes no locks; the
+ * rings are linked into a list (with an atomic push) so a dump sees them all.
+ * "trace dump FILE" writes the events as Chrome trace JSON, which loads in
+ * chrome://tracing and Perfetto.
+ *
+ * Tracing is opt-in at runtime (JBASH_TRACE=FILE or the trace builtin) and can
+ * be removed at compile time with -DTRACING=0, just like DEBUG.
+ */
+#include "JBash.h"
+
+#if TRACING
+
+#include <sys/syscall.h> // SYS_gettid
+
+/**
+ * One recorded event.
+ */
+struct trace_record {
+    uint64_t ts_ns;     // monotonic_ns() when it happened (or started, for 'X')
+    uint64_t dur_ns;    // duration of complete ('X') events
+    const char *name;   // static string
+    char phase;         // 'B' begin, 'E' end, 'X' complete
+};
+
+/**
+ * Ring buffer owned by one thread; only that thread writes to it.
+ */
+struct trace_ring {
+    struct trace_ring *next;  // all rings, newest first
+    long tid;
+    uint64_t head;            // total events written, the ring keeps the last TRACE_EVENTS
+    struct trace_record records[TRACE_EVENTS];
+};
+
+int trace_enabled = 0;
+static struct trace_ring *trace_rings = NULL;
+static _Thread_local struct trace_ring *my_ring = NULL;
+static char *trace_exit_path = NULL; // JBASH_TRACE, dumped when the shell exits
+
+/**
+ * @brief Returns this thread's ring, creating and registering it on first use
+ */
+static struct trace_ring *trace_ring(void) {
+    if (my_ring == NULL) {
+        struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+        if (ring == NULL) return NULL;
+        ring->tid = (long)syscall(SYS_gettid);
+        ring->next = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {}
+        my_ring = ring;
+    }
+    return my_ring;
+}
+
+/**
+ * @brief Appends one event to this thread's ring, overwriting the oldest when full
+ */
+static void trace_push(const char *name, char phase, uint64_t ts_ns, uint64_t dur_ns) {
+    struct trace_ring *ring = trace_ring();
+    if (ring == NULL) return;
+    struct trace_record *record = &ring->records[ring->head % TRACE_EVENTS];
+    record->ts_ns = ts_ns;
+    record->dur_ns = dur_ns;
+    record->name = name;
+    record->phase = phase;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE); // publish after the record is written
+}
+
+/**
+ * @brief Records a begin ('B') or end ('E') event now
+ */
+void trace_event(const char *name, char phase) {
+    trace_push(name, phase, monotonic_ns(), 0);
+}
+
+/**
+ * @brief Records an event whose start and end were measured elsewhere (e.g. fork to exec)
+ */
+void trace_complete(const char *name, uint64_t start_ns, uint64_t end_ns) {
+    trace_push(name, 'X', start_ns, end_ns - start_ns);
+}
+
+/**
+ * @brief Forgets every recorded event
+ */
+static void trace_clear(void) {
+    for (struct trace_ring *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Writes every ring as Chrome trace JSON
+ * @param path File to write
+ * @return 0 on success, 1 if the file could not be written
+ */
+int trace_dump(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        perror("trace");
+        return 1;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    int first = 1;
+    long pid = (long)getpid();
+    for (struct trace_ring *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t start = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+        for (uint64_t i = start; i < head; i++) {
+            const struct trace_record *r = &ring->records[i % TRACE_EVENTS];
+            fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld",
+                    first ? "" : ",", r->name, r->phase, r->ts_ns / 1e3, pid, ring->tid);
+            if (r->phase == 'X') fprintf(out, ",\"dur\":%.3f", r->dur_ns / 1e3);
+            fprintf(out, "}");
+            first = 0;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Dumps to JBASH_TRACE when the shell exits
+ */
+static void trace_dump_at_exit(void) {
+    if (trace_exit_path != NULL) trace_dump(trace_exit_path);
+}
+
+/**
+ * @brief Turns tracing on at startup when JBASH_TRACE names an output file
+ */
+void trace_init(void) {
+    const char *path = getenv("JBASH_TRACE");
+    if (path == NULL || path[0] == NULLCHAR) return;
+    trace_exit_path = strdup(path);
+    trace_enabled = 1;
+    atexit(trace_dump_at_exit);
+}
+
+/**
+ * @brief The trace builtin
+ * "trace on" and "trace off" start and stop recording, "trace dump FILE" writes
+ * Chrome trace JSON and "trace clear" drops what was recorded so far.
+ *
+ * @param args Null terminated list of arguments, args[0] is "trace"
+ * @return 0 on success, 1 on bad usage or write failure
+ */
+int trace_builtin(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "on") == 0) {
+        trace_enabled = 1;
+    } else if (args[1] != NULL && strcmp(args[1], "off") == 0) {
+        trace_enabled = 0;
+    } else if (args[1] != NULL && strcmp(args[1], "clear") == 0) {
+        trace_clear();
+    } else if (args[1] != NULL && strcmp(args[1], "dump") == 0 && args[2] != NULL) {
+        return trace_dump(args[2]);
+    } else {
+        fprintf(stderr, "trace: usage: trace on|off|clear|dump FILE\n");
+        return 1;
+    }
+    return 0;
+}
+
+#else
+
+void trace_init(void) {}
+
+int trace_builtin(char **args) {
+    (void)args;
+    fprintf(stderr, "trace: tracing was compiled out (TRACING=0)\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,244 @@
+/*******************************************************************************
+  @file         vars.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file vars.c
+ * @brief Shell variables
+ *
+ * Variables set by the shell itself (such as the last command's status and
+ * resource usage) live in a small chained hash table per session. They are
+ * not exported to child processes; lookups that miss fall back to the environment.
+ * PATH is the exception: assigning it changes the environment, so command
+ * lookups and children see the new value.
+ *
+ * A value's buffer is reused when the new value fits, so a counter that
+ * is assigned again and again stops allocating. A variable may hold an
+ * array instead (arrays.c); as a scalar it is the array's element 0. Compiled arithmetic
+ * (arith.c) keeps pointers to variables as slots; var_generation moves on
+ * when a table is freed or another session's becomes current.
+ */
+#include "JBash.h"
+
+/**
+ * One variable in a hash bucket chain.
+ */
+struct var {
+    char *name;
+    char *value;
+    size_t capacity;   // bytes allocated for value
+    struct array *array; // its elements when it is an array, value is then unused
+    struct var *next;
+};
+
+uint64_t var_generation = 1; // slots found in an older generation may have been freed
+
+/**
+ * @brief djb2 string hash, good enough for short variable names
+ */
+static unsigned long var_hash(const char *name) {
+    unsigned long hash = 5381;
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash % VAR_BUCKETS;
+}
+
+/**
+ * @brief Adds a variable without a value to the current session's table
+ */
+static struct var *var_new(const char *name, unsigned long bucket) {
+    struct var *v = safe_malloc(sizeof(struct var));
+    v->name = strdup(name);
+    v->value = NULL;
+    v->capacity = 0;
+    v->array = NULL;
+    v->next = session->vars[bucket];
+    session->vars[bucket] = v;
+    return v;
+}
+
+/**
+ * @brief Sets (or creates) a shell variable
+ * @param name Variable name (copied)
+ * @param value New value (copied)
+ */
+void var_set(const char *name, const char *value) {
+    if (name[0] == 'P' && strcmp(name, "PATH") == 0) { // lookups and children use the environment's PATH
+        setenv(name, value, 1);
+        commands_changed();
+        return;
+    }
+    if (name[0] == 'J' && strcmp(name, "JBASH_AUTOLOAD") == 0) commands_changed(); // names may autoload elsewhere
+    unsigned long bucket = var_hash(name);
+    for (struct var *v = session->vars[bucket]; v != NULL; v = v->next) {
+        if (strcmp(v->name, name) == 0) {
+            var_assign(v, value);
+            return;
+        }
+    }
+    struct var *v = var_new(name, bucket);
+    var_assign(v, value);
+}
+
+/**
+ * @brief Makes a variable an array, replacing its value or its previous array
+ * @param a The array, owned by the variable from now on
+ */
+void var_set_array(const char *name, struct array *a) {
+    struct var *v = var_find(name);
+    if (v == NULL) v = var_new(name, var_hash(name));
+    array_free(v->array);
+    free(v->value);
+    v->value = NULL;
+    v->capacity = 0;
+    v->array = a;
+}
+
+/**
+ * @brief The array a variable holds, NULL for a scalar
+ */
+struct array *var_array(const struct var *v) {
+    return v->array;
+}
+
+/**
+ * @brief Finds a shell variable of the current session, for callers that keep it as a slot
+ * @return The variable, or NULL when it is not a shell variable
+ */
+struct var *var_find(const char *name) {
+    for (struct var *v = session->vars[var_hash(name)]; v != NULL; v = v->next) {
+        if (strcmp(v->name, name) == 0) return v;
+    }
+    return NULL;
+}
+
+/**
+ * @brief The value of a variable var_find() returned
+ */
+const char *var_value(const struct var *v) {
+    return v->array != NULL ? array_scalar(v->array) : v->value;
+}
+
+/**
+ * @brief Sets a variable var_find() returned, in its own buffer when the value fits
+ * @param value New value (copied); it may point into the old one
+ */
+void var_assign(struct var *v, const char *value) {
+    if (v->array != NULL) {
+        array_assign_scalar(v->array, value);
+        return;
+    }
+    size_t length = strlen(value) + 1;
+    if (length <= v->capacity) {
+        memmove(v->value, value, length);
+        return;
+    }
+    size_t capacity = length < STR_BUFFER ? STR_BUFFER : length; // room for a counter to grow
+    char *copy = malloc(capacity);
+    if (copy == NULL) return; // keep the old value rather than losing it
+    memcpy(copy, value, length);
+    free(v->value);
+    v->value = copy;
+    v->capacity = capacity;
+}
+
+/**
+ * @brief Sets a shell variable to a decimal integer
+ */
+void var_set_number(const char *name, long long value) {
+    char number[24];
+    snprintf(number, sizeof(number), "%lld", value);
+    var_set(name, number);
+}
+
+/**
+ * @brief Length of the variable name a word starts with: a letter or '_', then letters, digits and '_'
+ * @return 0 when the word does not start with a name
+ */
+size_t var_name_length(const char *text) {
+    size_t length = 0;
+    if (!(text[0] == '_' || (text[0] >= 'A' && text[0] <= 'Z') || (text[0] >= 'a' && text[0] <= 'z'))) return 0;
+    while (text[length] == '_' || (text[length] >= 'A' && text[length] <= 'Z') ||
+           (text[length] >= 'a' && text[length] <= 'z') || (text[length] >= '0' && text[length] <= '9')) {
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Whether a word is an assignment: NAME=, NAME+=, NAME[SUBSCRIPT]= or NAME[SUBSCRIPT]+= and the value
+ * @return Offset of its '=', 0 when it is not one
+ */
+size_t var_assignment(const char *word) {
+    size_t length = var_name_length(word);
+    if (length == 0) return 0;
+    if (word[length] == '[') {
+        const char *close = strchr(&word[length], ']');
+        if (close == NULL) return 0;
+        length = (size_t)(close - word) + 1;
+    }
+    if (word[length] == '+') length++;
+    return word[length] == '=' ? length : 0;
+}
+
+/**
+ * @brief Runs an assignment word var_assignment() accepts
+ * NAME+=value adds to the value; the subscripted forms set an array element.
+ * @param word The expanded word, split in place and put back: it may be the chunk's own
+ * @return 0, or -1 after reporting a bad subscript
+ */
+int var_set_word(char *word) {
+    int rv = 0;
+    size_t equals = var_assignment(word), name_length = var_name_length(word);
+    int append = word[equals - 1] == '+';
+    const char *value = &word[equals + 1];
+    char after = word[name_length];
+    word[name_length] = NULLCHAR;
+    if (after == '[') {
+        char *close = strchr(&word[name_length + 1], ']');
+        *close = NULLCHAR;
+        rv = array_set_element(word, &word[name_length + 1], value, append);
+        *close = ']';
+    } else if (append && var_get(word) != NULL) {
+        const char *old = var_get(word);
+        size_t old_length = strlen(old), length = strlen(value);
+        char *joined = arena_alloc(&session->word_arena, old_length + length + 1);
+        memcpy(joined, old, old_length);
+        memcpy(&joined[old_length], value, length + 1);
+        var_set(word, joined);
+    } else {
+        var_set(word, value);
+    }
+    word[name_length] = after;
+    return rv;
+}
+
+/**
+ * @brief Looks up a variable, shell variables first, then the environment
+ * @param name Variable name
+ * @return The value, or NULL if unset
+ */
+const char *var_get(const char *name) {
+    struct var *v = var_find(name);
+    return v != NULL ? var_value(v) : getenv(name);
+}
+
+/**
+ * @brief Frees every variable of a session's table
+ * @param table The session's VAR_BUCKETS buckets
+ */
+void vars_free(struct var **table) {
+    for (size_t i = 0; i < VAR_BUCKETS; i++) {
+        struct var *v = table[i];
+        while (v != NULL) {
+            struct var *next = v->next;
+            free(v->name);
+            free(v->value);
+            array_free(v->array);
+            free(v);
+            v = next;
+        }
+        table[i] = NULL;
+    }
+    var_generation++;
+}
@@ -0,0 +1,228 @@
+/*******************************************************************************
+  @file         vm.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file vm.c
+ * @brief The bytecode interpreter
+ *
+ * vm_run() runs a chunk built by compile() with threaded dispatch: every
+ * instruction ends by jumping straight to the code of the next one through
+ * a table of label addresses (GCC's labels as values), instead of going
+ * back to one switch. Each instruction then has its own indirect branch,
+ * which the branch predictor learns separately.
+ *
+ * Loops keep a frame each, in an array sized by the chunk's loop depth.
+ * After every command the interpreter checks for exit and for a break or
+ * continue, which it unwinds by jumping to the frame's break or continue
+ * target; nothing is unwound through the C stack. A return leaves the chunk.
+ */
+#include "JBash.h"
+
+int tree_walker = -1;
+
+/**
+ * A loop being run.
+ */
+struct loop_frame {
+    uint32_t break_pc;     // its LOOP_END
+    uint32_t continue_pc;  // its condition, or its FOR_NEXT
+    int status;            // status of the last body, the loop's status when it ends
+    char **values;         // for loops: the expanded words, one heap block
+    size_t count;
+    size_t next;           // the value FOR_NEXT assigns next
+};
+
+/**
+ * @brief Pushes a profiler frame for the line a command was parsed on
+ */
+static void line_push(const struct chunk *c, uint32_t line) {
+    char frame[strlen(c->file) + 24];
+    snprintf(frame, sizeof(frame), "%s:%u", c->file, line);
+    profile_push(frame);
+}
+
+/**
+ * @brief Runs a command of only assignment words: expands each and sets the variable
+ * NAME=(...) lists are expanded element by element when they are assigned.
+ * @return 1, assignments never end the shell
+ */
+static int assign(const struct word *words, size_t count) {
+    long long started = monotonic_us();
+    int status = 0;
+    char **argv = arena_alloc(&session->word_arena, (count + 1) * sizeof(char *));
+    int failed = 0; // an expansion error, reported; nothing is assigned
+    for (size_t k = 0; !failed && k < count; k++) {
+        argv[k] = is_array_list(&words[k]) ? words[k].text : make_word(&words[k]);
+        failed = argv[k] == NULL;
+    }
+    argv[count] = NULL;
+    if (failed) status = 1;
+    else if (xtrace_enabled) xtrace_command(argv);
+    for (size_t k = 0; !failed && k < count; k++) {
+        if (is_array_list(&words[k])) array_assign_word(&words[k]);
+        else if (var_set_word(argv[k]) == -1) status = 1;
+    }
+    session->last_usage = (struct cmd_usage){ .status = status, .wall_us = monotonic_us() - started };
+    usage_publish(&session->last_usage);
+    return 1;
+}
+
+/**
+ * @brief Runs a (( )) command: its status is 0 when the expression is not 0
+ */
+static void arith(const struct word *word) {
+    long long started = monotonic_us();
+    int status = arith_command(word);
+    session->last_usage = (struct cmd_usage){ .status = status, .wall_us = monotonic_us() - started };
+    usage_publish(&session->last_usage);
+}
+
+/**
+ * @brief Runs a compiled command in the current session
+ * @param c Chunk built by compile()
+ * @return returns 1, to continue execution and 0 after exit.
+ */
+int vm_run(const struct chunk *c) {
+    static void *const dispatch[BC_COUNT] = {
+        [BC_EXEC] = &&op_exec,
+        [BC_CALL] = &&op_call,
+        [BC_ASSIGN] = &&op_assign,
+        [BC_JUMP] = &&op_jump,
+        [BC_JUMP_IF_FAIL] = &&op_jump_if_fail,
+        [BC_JUMP_IF_OK] = &&op_jump_if_ok,
+        [BC_SET_STATUS] = &&op_set_status,
+        [BC_ARITH] = &&op_arith,
+        [BC_DEFINE] = &&op_define,
+        [BC_LOOP_BEGIN] = &&op_loop_begin,
+        [BC_FOR_BEGIN] = &&op_for_begin,
+        [BC_FOR_NEXT] = &&op_for_next,
+        [BC_LOOP_STATUS] = &&op_loop_status,
+        [BC_LOOP_END] = &&op_loop_end,
+        [BC_CASE] = &&op_case,
+        [BC_HALT] = &&op_halt,
+    };
+    #define NEXT(operands) do { ip += 1 + (operands); goto *dispatch[*ip]; } while (0)
+    #define JUMP_TO(target) do { ip = &code[target]; goto *dispatch[*ip]; } while (0)
+    // a command ended the shell, or a break, continue or return has to unwind loops
+    #define AFTER_COMMAND(operands) do { \
+            arena_reset(&session->word_arena); \
+            if (profile_line) profile_pop(); \
+            if (!rv) goto halt; \
+            if (loop_jumping()) goto unwind; \
+            NEXT(operands); \
+        } while (0)
+
+    const uint32_t *code = c->code, *ip = code;
+    const struct word *words = c->words;
+    struct loop_frame frames[c->loop_depth + 1];
+    int top = 0; // frames in use
+    int rv = 1;
+    int profile_line = profiling && c->file != NULL;
+    struct loop_frame *frame;
+    size_t arm;
+
+    goto *dispatch[*ip];
+
+op_exec: // first count line
+    if (profile_line) line_push(c, ip[3]);
+    rv = execute(&words[ip[1]], ip[2]);
+    AFTER_COMMAND(3);
+
+op_call: // site first count line
+    if (profile_line) line_push(c, ip[4]);
+    rv = execute_call(&c->sites[ip[1]], &words[ip[2]], ip[3]);
+    AFTER_COMMAND(4);
+
+op_assign: // first count line
+    if (profile_line) line_push(c, ip[3]);
+    rv = assign(&words[ip[1]], ip[2]);
+    AFTER_COMMAND(3);
+
+op_jump:
+    JUMP_TO(ip[1]);
+
+op_jump_if_fail:
+    if (session->last_usage.status != 0) JUMP_TO(ip[1]);
+    NEXT(1);
+
+op_jump_if_ok:
+    if (session->last_usage.status == 0) JUMP_TO(ip[1]);
+    NEXT(1);
+
+op_set_status:
+    set_status((int)ip[1]);
+    NEXT(1);
+
+op_arith: // word line
+    if (profile_line) line_push(c, ip[2]);
+    arith(&words[ip[1]]);
+    AFTER_COMMAND(2);
+
+op_define: // definition
+    function_define(c->definitions[ip[1]]);
+    set_status(0);
+    NEXT(1);
+
+op_loop_begin: // break continue
+    frame = &frames[top++];
+    *frame = (struct loop_frame){ .break_pc = ip[1], .continue_pc = ip[2] };
+    session->loop_depth++;
+    NEXT(2);
+
+op_for_begin: // first count break continue
+    frame = &frames[top++];
+    *frame = (struct loop_frame){ .break_pc = ip[3], .continue_pc = ip[4], .count = ip[2] };
+    frame->values = loop_values(ip[1] != FOR_POSITIONAL ? &words[ip[1]] : NULL, &frame->count);
+    if (frame->values == NULL) frame->status = 1; // the words had an error, the body never runs
+    session->loop_depth++;
+    NEXT(4);
+
+op_for_next: // name end
+    frame = &frames[top - 1];
+    if (frame->next == frame->count) JUMP_TO(ip[2]);
+    var_set(words[ip[1]].text, frame->values[frame->next++]);
+    NEXT(2);
+
+op_loop_status:
+    frames[top - 1].status = session->last_usage.status;
+    NEXT(0);
+
+op_loop_end:
+    frame = &frames[--top];
+    free(frame->values);
+    session->loop_depth--;
+    set_status(frame->status);
+    if (loop_jumping()) goto unwind; // "break 2" or "continue 2" goes on to the enclosing loop
+    NEXT(0);
+
+unwind: // the innermost loop takes one level off the break or continue
+    if (top == 0 || session->returning) goto halt; // nothing to leave, or return leaves every loop
+    frame = &frames[top - 1];
+    frame->status = session->last_usage.status;
+    JUMP_TO(loop_stops() ? frame->break_pc : frame->continue_pc);
+
+op_case: // case line target...
+    if (profile_line) line_push(c, ip[2]);
+    arm = case_select((struct node *)c->cases[ip[1]]); // the node keeps its matcher between runs
+    arena_reset(&session->word_arena);
+    if (profile_line) profile_pop();
+    if (arm == CASE_FAILED) { // the word had an error: status 1, past the no-match target's SET_STATUS 0
+        set_status(1);
+        JUMP_TO(ip[3 + ((const struct node *)c->cases[ip[1]])->arm_count] + 2);
+    }
+    JUMP_TO(ip[3 + arm]);
+
+op_halt:
+halt:
+    while (top > 0) { // exit or return inside loops
+        free(frames[--top].values);
+        session->loop_depth--;
+    }
+    return rv;
+
+    #undef NEXT
+    #undef JUMP_TO
+    #undef AFTER_COMMAND
+}
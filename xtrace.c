@@ -0,0 +1,160 @@
+/*******************************************************************************
+  @file         xtrace.c
+  @author       Jeremiah Brenio
+*******************************************************************************/
+
+/**
+ * @file xtrace.c
+ * @brief The set builtin and buffered execution tracing (set -x)
+ *
+ * Other shells write every trace line to stderr unbuffered, one system call
+ * per command, which distorts timing badly. Here trace lines are formatted
+ * into a per session buffer and written in batches: when the buffer is full,
+ * when a line is added and the oldest buffered line is older than
+ * XTRACE_FLUSH_MS, before the prompt is drawn, on "set +x" and at exit. The
+ * lines before a long running command therefore stay buffered until it ends.
+ *
+ * JBASH_XTRACEFD=N sends the trace to file descriptor N instead of stderr,
+ * and JBASH_XTRACE_TIME=1 prefixes each line with the seconds since tracing
+ * started. Both are read when "set -x" runs.
+ */
+#include "JBash.h"
+
+int xtrace_enabled = 0;
+static int xtrace_fd = STDERR_FILENO;
+static int xtrace_timestamps = 0;
+static uint64_t xtrace_started_ns = 0; // timestamps are relative to set -x
+static uint64_t xtrace_oldest_ns = 0;  // when the first line still in the buffer was added
+static char xtrace_buffer[XTRACE_BUFFER];
+static size_t xtrace_length = 0;
+static int xtrace_registered = 0;      // flush at exit is registered once
+
+/**
+ * @brief Writes out everything buffered so far
+ */
+void xtrace_flush(void) {
+    size_t written = 0;
+    while (written < xtrace_length) {
+        ssize_t n = write(xtrace_fd, &xtrace_buffer[written], xtrace_length - written);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break; // trace output is best effort, never fail the command over it
+        }
+        written += (size_t)n;
+    }
+    xtrace_length = 0;
+}
+
+/**
+ * @brief Appends text to the buffer, flushing first when it would not fit
+ */
+static void xtrace_append(const char *text, size_t length) {
+    if (xtrace_length + length > XTRACE_BUFFER) xtrace_flush();
+    if (length > XTRACE_BUFFER) { // longer than the whole buffer, write it straight through
+        write(xtrace_fd, text, length);
+        return;
+    }
+    memcpy(&xtrace_buffer[xtrace_length], text, length);
+    xtrace_length += length;
+}
+
+/**
+ * @brief Appends a word, single quoted when it would otherwise read as several words
+ */
+static void xtrace_word(const char *word) {
+    if (is_operator(word) || (word[0] != NULLCHAR && strpbrk(word, " \t\n'\"$|;&") == NULL)) {
+        xtrace_append(word, strlen(word));
+        return;
+    }
+    xtrace_append("'", 1);
+    for (const char *p = word; *p; p++) {
+        if (*p == '\'') xtrace_append("'\\''", 4);
+        else xtrace_append(p, 1);
+    }
+    xtrace_append("'", 1);
+}
+
+/**
+ * @brief Traces one pipeline about to run, after expansion
+ * @param argv Null terminated words of the pipeline, operators included
+ */
+void xtrace_command(char **argv) {
+    uint64_t now = monotonic_ns();
+    if (xtrace_length == 0) xtrace_oldest_ns = now;
+
+    if (xtrace_timestamps) {
+        char stamp[32];
+        int n = snprintf(stamp, sizeof(stamp), "[%.6f] ", (now - xtrace_started_ns) / 1e9);
+        xtrace_append(stamp, (size_t)n);
+    }
+    xtrace_append("+ ", 2);
+    for (size_t i = 0; argv[i] != NULL; i++) {
+        if (i > 0) xtrace_append(" ", 1);
+        xtrace_word(argv[i]);
+    }
+    xtrace_append("\n", 1);
+
+    if (now - xtrace_oldest_ns >= XTRACE_FLUSH_MS * 1000000ull) xtrace_flush();
+}
+
+/**
+ * @brief Turns tracing on, picking up JBASH_XTRACEFD and JBASH_XTRACE_TIME
+ * @return 0 on success, 1 if JBASH_XTRACEFD is not an open descriptor
+ */
+static int xtrace_start(void) {
+    const char *fd = var_get("JBASH_XTRACEFD");
+    int target = STDERR_FILENO;
+    if (fd != NULL && fd[0] != NULLCHAR) {
+        target = atoi(fd);
+        if (fcntl(target, F_GETFD) == -1) {
+            fprintf(stderr, "set: JBASH_XTRACEFD: %s: invalid file descriptor\n", fd);
+            return 1;
+        }
+    }
+    if (xtrace_enabled) xtrace_flush(); // lines already buffered go to the old descriptor
+    xtrace_fd = target;
+    const char *timestamps = var_get("JBASH_XTRACE_TIME");
+    xtrace_timestamps = timestamps != NULL && strcmp(timestamps, "1") == 0;
+    xtrace_started_ns = monotonic_ns();
+    xtrace_enabled = 1;
+    if (!xtrace_registered) {
+        atexit(xtrace_flush);
+        xtrace_registered = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief The set builtin
+ * "set -x" (or "set -o xtrace") traces every command before it runs,
+ * "set +x" (or "set +o xtrace") stops tracing. Without arguments it prints the options.
+ *
+ * @param args Null terminated list of arguments, args[0] is "set"
+ * @return 0 on success, 1 on bad usage
+ */
+int set_builtin(char **args) {
+    if (args[1] == NULL) {
+        printf("xtrace\t%s\n", xtrace_enabled ? "on" : "off");
+        return 0;
+    }
+    for (size_t i = 1; args[i] != NULL; i++) {
+        const char *arg = args[i];
+        int on = arg[0] == '-';
+        if (strcmp(arg, "-x") == 0 || strcmp(arg, "+x") == 0) {
+            // short form
+        } else if ((strcmp(arg, "-o") == 0 || strcmp(arg, "+o") == 0) &&
+                   args[i + 1] != NULL && strcmp(args[i + 1], "xtrace") == 0) {
+            i++; // long form takes the option name as the next word
+        } else {
+            fprintf(stderr, "set: %s: invalid option\nset: usage: set [-x|+x] [-o xtrace|+o xtrace]\n", arg);
+            return 1;
+        }
+        if (on) {
+            if (xtrace_start() != 0) return 1;
+        } else {
+            xtrace_flush();
+            xtrace_enabled = 0;
+        }
+    }
+    return 0;
+}